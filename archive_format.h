@@ -0,0 +1,96 @@
+// On-disk layout of the interaction archive, shared by the firmware and
+// tools/archive_stats.
+//
+//   <dir>/index.bin      IndexHeader, then SLOTS fixed-size Records. The
+//                        record for seq lives in slot seq % SLOTS, so a
+//                        lookup is one seek.
+//   <dir>/seg<N>.bin     Append-only payloads: IMA ADPCM audio as WAV
+//                        0x11 blocks (ima_adpcm.h), then the transcript,
+//                        then the response text.
+//
+// Segments are deleted oldest first to stay under the size budget; a
+// record whose segment is older than firstSegment is gone. Payloads are
+// written before their record, and the record before the header, so a
+// power cut loses at most the interaction being written. All fields are
+// little-endian and naturally aligned. Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace archive {
+
+static const uint32_t MAGIC = 0x58494156;  // "VAIX"
+static const uint16_t VERSION = 2;
+static const uint32_t SLOTS = 256;
+static const uint16_t NO_TIMING = 0xffff;
+
+// Stage durations kept per interaction, in ms
+enum Timing {
+  TIMING_RECORD,    // Button to end of recording
+  TIMING_STT,       // End of recording to transcript
+  TIMING_LLM,       // Transcript to answer
+  TIMING_TTS,       // Answer to speech ready
+  TIMING_PLAY,      // Speech ready to end of playback
+  TIMING_FEEDBACK,  // End of recording to first audible cue
+  TIMING_TOTAL,     // Button to the last stage reached
+  TIMING_RESERVED,
+  TIMING_COUNT
+};
+
+static const char* const timingNames[TIMING_COUNT] = {
+  "record", "stt", "llm", "tts", "play", "feedback", "total", "reserved",
+};
+
+struct IndexHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t slots;
+  uint32_t nextSeq;           // Sequence numbers start at 1; 0 marks an empty slot
+  uint32_t firstSegment;      // Oldest segment still on disk
+  uint32_t lastSegment;       // Segment being appended to
+  uint32_t lastSegmentBytes;
+  uint32_t rotations;         // Segments deleted for the budget
+  uint8_t reserved[32];
+};
+
+struct Record {
+  uint32_t seq;
+  uint32_t segment;
+  uint32_t offset;            // Of the audio within the segment
+  uint32_t audioBytes;        // IMA ADPCM blocks; prefix ImaAdpcm::wavHeader to play
+  uint32_t sampleCount;
+  uint32_t sampleRate;
+  uint16_t transcriptBytes;   // Follow the audio
+  uint16_t responseBytes;     // Follow the transcript
+  uint32_t uptimeSec;         // When the interaction started
+  uint16_t timingsMs[TIMING_COUNT];
+  uint16_t blockAlign;
+  uint8_t reserved[10];
+  uint32_t crc;               // CRC-32 of everything above
+};
+
+static_assert(sizeof(IndexHeader) == 64, "index header layout");
+static_assert(sizeof(Record) == 64, "record layout");
+
+inline uint32_t recordOffset(uint32_t seq) {
+  return sizeof(IndexHeader) + (seq % SLOTS) * sizeof(Record);
+}
+
+// CRC-32 (IEEE, reflected), bitwise: records are small
+inline uint32_t crc32(const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+inline uint32_t recordCrc(const Record& r) {
+  return crc32(&r, offsetof(Record, crc));
+}
+
+}  // namespace archive
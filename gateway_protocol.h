@@ -0,0 +1,125 @@
+// Wire format between the device and the voice gateway, shared by the
+// firmware (gateway_session.h), tools/voice_gateway and tools/gateway_load.
+// One plain TCP connection per device carries every turn: the device sends
+// the microphone as it is captured, and the gateway answers with the
+// transcript, the answer text and the spoken answer, after running speech
+// recognition, the LLM and TTS itself.
+//
+//   Frame     type (1 byte), payload length (2 bytes), payload
+//
+//   Device to gateway
+//     HELLO          Hello; first frame on the connection
+//     TURN_START     The user started speaking
+//     AUDIO_UP       Hello.uplinkCodec audio at Hello.sampleRate: PCM16
+//                    samples, or whole IMA ADPCM blocks (the last block of
+//                    a turn may be short)
+//     TURN_END       The user stopped speaking
+//     CANCEL         Barge-in: drop the rest of the answer; ignored once
+//                    the turn is done
+//   Gateway to device
+//     READY          Ready; answers HELLO
+//     TRANSCRIPT     UTF-8 text
+//     ANSWER_TEXT    UTF-8 text, as it will be spoken
+//     ANSWER_START   AnswerStart; AUDIO_DOWN frames follow
+//     AUDIO_DOWN     Answer audio in Hello.downlinkCodec, as AUDIO_UP
+//     TURN_DONE      TurnDone; the last frame of every turn
+//     ERROR          UTF-8 text; the gateway closes the connection
+//
+// Turns are strictly sequential: TURN_START after TURN_DONE, or after
+// CANCEL, which the gateway also ends with TURN_DONE. A turn that fails
+// while the user is speaking gets its TURN_DONE before TURN_END; the
+// device stops streaming, and a TURN_END already sent is ignored. All fields are
+// little-endian and naturally aligned. Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gateway {
+
+static const uint8_t VERSION = 1;
+static const uint16_t DEFAULT_PORT = 7700;
+static const size_t HEADER_BYTES = 3;
+static const size_t PAYLOAD_MAX = 4096;  // Larger frames are a protocol error
+static const uint16_t ADPCM_BLOCK_ALIGN = 256;  // 505 samples per block
+
+enum Type : uint8_t {
+  FRAME_HELLO = 0x01,
+  FRAME_TURN_START = 0x02,
+  FRAME_AUDIO_UP = 0x03,
+  FRAME_TURN_END = 0x04,
+  FRAME_CANCEL = 0x05,
+  FRAME_READY = 0x81,
+  FRAME_TRANSCRIPT = 0x82,
+  FRAME_ANSWER_TEXT = 0x83,
+  FRAME_ANSWER_START = 0x84,
+  FRAME_AUDIO_DOWN = 0x85,
+  FRAME_TURN_DONE = 0x86,
+  FRAME_ERROR = 0x87,
+};
+
+enum Codec : uint8_t {
+  CODEC_PCM16 = 0,
+  CODEC_IMA_ADPCM = 1,  // ADPCM_BLOCK_ALIGN blocks (ima_adpcm.h)
+};
+
+enum Status : uint8_t {
+  STATUS_OK,
+  STATUS_NO_SPEECH,    // Recognition found nothing to answer
+  STATUS_STT_FAILED,
+  STATUS_LLM_FAILED,
+  STATUS_TTS_FAILED,
+  STATUS_CANCELLED,
+};
+
+static const char* const statusNames[] = {
+  "ok", "no speech", "stt failed", "llm failed", "tts failed", "cancelled",
+};
+
+struct Hello {
+  uint8_t version;
+  uint8_t uplinkCodec;
+  uint8_t downlinkCodec;
+  uint8_t reserved;
+  uint32_t sampleRate;  // Of the uplink audio
+  char deviceId[24];    // Terminated; for the gateway's logs
+};
+
+struct Ready {
+  uint8_t version;
+  uint8_t reserved[3];
+  uint32_t sessionId;
+};
+
+struct AnswerStart {
+  uint32_t sampleRate;
+  uint8_t codec;
+  uint8_t reserved[3];
+};
+
+// Stage times of the turn at the gateway, in ms
+struct TurnDone {
+  uint8_t status;
+  uint8_t reserved;
+  uint16_t sttMs;   // TURN_END to the final transcript
+  uint16_t llmMs;   // Transcript to the answer text
+  uint16_t ttsMs;   // Answer text to the first answer audio
+  uint32_t audioMs; // Answer audio sent
+};
+
+static_assert(sizeof(Hello) == 32, "hello layout");
+static_assert(sizeof(Ready) == 8, "ready layout");
+static_assert(sizeof(AnswerStart) == 8, "answer start layout");
+static_assert(sizeof(TurnDone) == 12, "turn done layout");
+
+inline void putHeader(uint8_t* out, uint8_t type, uint16_t len) {
+  out[0] = type;
+  out[1] = len;
+  out[2] = len >> 8;
+}
+
+inline uint16_t payloadLength(const uint8_t* header) {
+  return header[1] | header[2] << 8;
+}
+
+}  // namespace gateway
@@ -0,0 +1,282 @@
+// Device end of a voice gateway connection (gateway_protocol.h): the
+// microphone goes up as PCM or IMA ADPCM frames, and the transcript, the
+// answer text and the answer audio come back, so the device makes no TLS,
+// JSON or base64 requests of its own. The caller marks each turn with
+// turnStart() and turnEnd() (hold to talk), as with RealtimeSession.
+//
+// The transport (a plain TCP socket to the gateway on the LAN) is reached
+// through ReadFn and WriteFn, as in h2_client.h. Frame payloads are read
+// into the caller's buffer apart from their headers, so PCM in it stays
+// aligned. poll() is non-blocking and delivers every event. Single-
+// threaded: one task owns the session. Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gateway_protocol.h"
+#include "ima_adpcm.h"
+
+class GatewaySession {
+ public:
+  // Writes all of data; returns len, or < 0 on error
+  typedef int32_t (*WriteFn)(void* io, const uint8_t* data, uint32_t len);
+  // Reads what is available, up to len; 0 if nothing yet, < 0 once closed
+  typedef int32_t (*ReadFn)(void* io, uint8_t* buf, uint32_t len);
+
+  enum Event : uint8_t {
+    EVENT_READY,
+    EVENT_TRANSCRIPT,   // text() holds it
+    EVENT_ANSWER_TEXT,  // text() holds it
+    EVENT_TURN_DONE,    // turnDone() holds the status and stage times
+    EVENT_ERROR,        // text() holds it; the gateway closes the connection
+    EVENT_CLOSED,       // The connection is gone
+  };
+
+  struct Handler {
+    void (*audio)(void* ctx, const int16_t* samples, size_t count, uint32_t sampleRate);
+    void (*event)(void* ctx, Event event);
+    void* ctx;
+  };
+
+  static const uint32_t RX_BUFFER_BYTES = gateway::PAYLOAD_MAX;
+  static const size_t UPLINK_FRAME_BYTES = 4 * gateway::ADPCM_BLOCK_ALIGN;  // 126 ms of ADPCM, 32 ms of PCM at 16 kHz
+
+  // rxBuffer holds RX_BUFFER_BYTES, is 2-byte aligned and must outlive the session
+  GatewaySession(uint8_t* rxBuffer, ReadFn read, WriteFn write, void* io, const Handler& handler)
+    : rx_(rxBuffer), read_(read), write_(write), io_(io), handler_(handler) {}
+
+  // First frame on the connection; wait for EVENT_READY
+  bool hello(const char* deviceId, uint32_t sampleRate, uint8_t uplinkCodec, uint8_t downlinkCodec) {
+    gateway::Hello h = {};
+    h.version = gateway::VERSION;
+    h.uplinkCodec = uplinkCodec;
+    h.downlinkCodec = downlinkCodec;
+    h.sampleRate = sampleRate;
+    snprintf(h.deviceId, sizeof(h.deviceId), "%s", deviceId);
+    uplinkCodec_ = uplinkCodec;
+    return writeFrame(gateway::FRAME_HELLO, (const uint8_t*)&h, sizeof(h));
+  }
+
+  bool turnStart() {
+    encoder_.reset();
+    pendingSamples_ = 0;
+    frameLen_ = 0;
+    return writeFrame(gateway::FRAME_TURN_START, nullptr, 0);
+  }
+
+  // Microphone samples of the current turn, at the hello's sample rate.
+  // ADPCM goes out in whole blocks; a partial block waits for more audio
+  // or for turnEnd().
+  bool audio(const int16_t* samples, size_t count) {
+    if (uplinkCodec_ == gateway::CODEC_PCM16) {
+      while (count > 0) {
+        size_t n = count < UPLINK_FRAME_BYTES / 2 ? count : UPLINK_FRAME_BYTES / 2;
+        if (!writeFrame(gateway::FRAME_AUDIO_UP, (const uint8_t*)samples, n * 2)) return false;
+        samples += n;
+        count -= n;
+      }
+      return true;
+    }
+    while (count > 0) {
+      size_t n = PER_BLOCK - pendingSamples_ < count ? PER_BLOCK - pendingSamples_ : count;
+      memcpy(pending_ + pendingSamples_, samples, n * 2);
+      pendingSamples_ += n;
+      samples += n;
+      count -= n;
+      if (pendingSamples_ == PER_BLOCK && !encodePending()) return false;
+    }
+    return flushFrame();
+  }
+
+  // Sends what is left of the turn's audio, then TURN_END
+  bool turnEnd() {
+    if (pendingSamples_ > 0 && !encodePending()) return false;
+    return flushFrame() && writeFrame(gateway::FRAME_TURN_END, nullptr, 0);
+  }
+
+  // Barge-in: the gateway drops the rest of the answer and ends the turn
+  bool cancel() { return writeFrame(gateway::FRAME_CANCEL, nullptr, 0); }
+
+  // Reads and handles whatever has arrived. False once the connection is
+  // closed or broke the protocol; EVENT_CLOSED has been delivered by then.
+  bool poll() {
+    while (open_) {
+      size_t need = headerLen_ < gateway::HEADER_BYTES ? gateway::HEADER_BYTES : gateway::payloadLength(header_);
+      if (headerLen_ == gateway::HEADER_BYTES && need > RX_BUFFER_BYTES) return close();
+      int32_t n;
+      if (headerLen_ < gateway::HEADER_BYTES) {
+        n = read_(io_, header_ + headerLen_, gateway::HEADER_BYTES - headerLen_);
+        if (n > 0) headerLen_ += n;
+      } else if (rxLen_ < need) {
+        n = read_(io_, rx_ + rxLen_, need - rxLen_);
+        if (n > 0) rxLen_ += n;
+      } else {
+        handleFrame(header_[0], rx_, rxLen_);
+        headerLen_ = 0;
+        rxLen_ = 0;
+        continue;
+      }
+      if (n < 0) return close();
+      if (n == 0) return true;
+      bytesReceived_ += n;
+    }
+    return false;
+  }
+
+  bool isOpen() const { return open_; }
+  bool ready() const { return ready_; }
+  uint32_t sessionId() const { return sessionId_; }
+  // Valid inside the event only; not terminated
+  const char* text() const { return (const char*)rx_; }
+  size_t textLength() const { return rxLen_; }
+  const gateway::TurnDone& turnDone() const { return turnDone_; }
+  uint32_t bytesSent() const { return bytesSent_; }
+  uint32_t bytesReceived() const { return bytesReceived_; }
+  uint32_t audioSamplesSent() const { return audioSamplesSent_; }
+  uint32_t audioSamplesReceived() const { return audioSamplesReceived_; }
+
+ private:
+  static const size_t PER_BLOCK = ImaAdpcm::samplesPerBlock(gateway::ADPCM_BLOCK_ALIGN);
+
+  uint8_t* rx_;
+  ReadFn read_;
+  WriteFn write_;
+  void* io_;
+  Handler handler_;
+  bool open_ = true;
+  bool ready_ = false;
+  uint32_t sessionId_ = 0;
+  uint8_t uplinkCodec_ = gateway::CODEC_PCM16;
+
+  uint8_t header_[gateway::HEADER_BYTES];
+  size_t headerLen_ = 0;
+  size_t rxLen_ = 0;
+
+  // ADPCM uplink: samples waiting for a whole block, blocks waiting for a frame
+  ImaAdpcmEncoder encoder_;
+  int16_t pending_[PER_BLOCK];
+  size_t pendingSamples_ = 0;
+  uint8_t frame_[gateway::HEADER_BYTES + UPLINK_FRAME_BYTES];
+  size_t frameLen_ = 0;
+
+  // Answer audio
+  uint32_t answerRate_ = 24000;
+  uint8_t answerCodec_ = gateway::CODEC_PCM16;
+  ImaAdpcmDecoder decoder_;
+  int16_t decoded_[2 * gateway::ADPCM_BLOCK_ALIGN];
+
+  gateway::TurnDone turnDone_ = {};
+  uint32_t bytesSent_ = 0;
+  uint32_t bytesReceived_ = 0;
+  uint32_t audioSamplesSent_ = 0;
+  uint32_t audioSamplesReceived_ = 0;
+
+  bool writeFrame(uint8_t type, const uint8_t* payload, size_t len) {
+    if (!open_) return false;
+    // Control frames go out in one write, so one TCP segment
+    uint8_t small[gateway::HEADER_BYTES + sizeof(gateway::Hello)];
+    gateway::putHeader(small, type, len);
+    bool ok;
+    if (len <= sizeof(small) - gateway::HEADER_BYTES) {
+      if (len) memcpy(small + gateway::HEADER_BYTES, payload, len);
+      ok = write_(io_, small, gateway::HEADER_BYTES + len) >= 0;
+    } else {
+      ok = write_(io_, small, gateway::HEADER_BYTES) >= 0 && write_(io_, payload, len) >= 0;
+    }
+    if (!ok) return close();
+    bytesSent_ += gateway::HEADER_BYTES + len;
+    if (type == gateway::FRAME_AUDIO_UP && uplinkCodec_ == gateway::CODEC_PCM16) audioSamplesSent_ += len / 2;
+    return true;
+  }
+
+  // Encodes the pending samples as one block into the frame, sending the
+  // frame first if it is full
+  bool encodePending() {
+    if (frameLen_ + gateway::ADPCM_BLOCK_ALIGN > UPLINK_FRAME_BYTES && !flushFrame()) return false;
+    frameLen_ += encoder_.encodeBlock(pending_, pendingSamples_, frame_ + gateway::HEADER_BYTES + frameLen_);
+    audioSamplesSent_ += pendingSamples_;
+    pendingSamples_ = 0;
+    return true;
+  }
+
+  bool flushFrame() {
+    if (frameLen_ == 0) return true;
+    gateway::putHeader(frame_, gateway::FRAME_AUDIO_UP, frameLen_);
+    bool ok = write_(io_, frame_, gateway::HEADER_BYTES + frameLen_) >= 0;
+    bytesSent_ += gateway::HEADER_BYTES + frameLen_;
+    frameLen_ = 0;
+    return ok || close();
+  }
+
+  bool close() {
+    if (open_) {
+      open_ = false;
+      emit(EVENT_CLOSED);
+    }
+    return false;
+  }
+
+  void emit(Event event) {
+    if (handler_.event) handler_.event(handler_.ctx, event);
+  }
+
+  void handleFrame(uint8_t type, const uint8_t* p, size_t len) {
+    switch (type) {
+      case gateway::FRAME_READY:
+        if (len >= sizeof(gateway::Ready)) {
+          gateway::Ready r;
+          memcpy(&r, p, sizeof(r));
+          sessionId_ = r.sessionId;
+          ready_ = true;
+          emit(EVENT_READY);
+        }
+        break;
+      case gateway::FRAME_TRANSCRIPT:
+        emit(EVENT_TRANSCRIPT);
+        break;
+      case gateway::FRAME_ANSWER_TEXT:
+        emit(EVENT_ANSWER_TEXT);
+        break;
+      case gateway::FRAME_ANSWER_START:
+        if (len >= sizeof(gateway::AnswerStart)) {
+          gateway::AnswerStart a;
+          memcpy(&a, p, sizeof(a));
+          answerRate_ = a.sampleRate;
+          answerCodec_ = a.codec;
+          decoder_.begin(gateway::ADPCM_BLOCK_ALIGN);
+        }
+        break;
+      case gateway::FRAME_AUDIO_DOWN:
+        deliverAudio(p, len);
+        break;
+      case gateway::FRAME_TURN_DONE:
+        if (len >= sizeof(gateway::TurnDone)) memcpy(&turnDone_, p, sizeof(turnDone_));
+        emit(EVENT_TURN_DONE);
+        break;
+      case gateway::FRAME_ERROR:
+        emit(EVENT_ERROR);
+        break;
+      default:
+        break;  // Unknown frames from a newer gateway are skipped
+    }
+  }
+
+  void deliverAudio(const uint8_t* p, size_t len) {
+    if (answerCodec_ == gateway::CODEC_PCM16) {
+      audioSamplesReceived_ += len / 2;
+      if (handler_.audio) handler_.audio(handler_.ctx, (const int16_t*)p, len / 2, answerRate_);
+      return;
+    }
+    while (len > 0) {
+      size_t n = len < gateway::ADPCM_BLOCK_ALIGN ? len : gateway::ADPCM_BLOCK_ALIGN;
+      size_t count = decoder_.decode(p, n, decoded_);
+      audioSamplesReceived_ += count;
+      if (handler_.audio) handler_.audio(handler_.ctx, decoded_, count, answerRate_);
+      p += n;
+      len -= n;
+    }
+  }
+};
@@ -0,0 +1,724 @@
+// Compact HTTP/2 client (RFC 9113) for a few long-lived request streams,
+// such as gRPC calls that upload while the response arrives. One
+// connection, up to MAX_STREAMS streams multiplexed on it, flow control in
+// both directions, and HPACK (RFC 7541) with the static table and Huffman
+// decoding. The dynamic table is switched off through SETTINGS, so header
+// decoding needs no table memory. No server push, no priorities.
+// H2Client has 4 stream slots; a host program multiplexing many callers
+// on one connection picks its own count with BasicH2Client.
+//
+// The transport (TLS negotiated with ALPN "h2", or plain TCP to a local
+// test server) is reached through ReadFn and WriteFn. poll() is non-
+// blocking: call it whenever the caller would otherwise wait. Events are
+// delivered from inside poll(). Single-threaded: one task owns the client.
+// Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+template <int MaxStreams>
+class BasicH2Client {
+ public:
+  // Writes all of data; returns len, or < 0 on error
+  typedef int32_t (*WriteFn)(void* io, const uint8_t* data, uint32_t len);
+  // Reads what is available, up to len; 0 if nothing yet, < 0 once closed
+  typedef int32_t (*ReadFn)(void* io, uint8_t* buf, uint32_t len);
+
+  struct Header {
+    const char* name;  // Lowercase
+    const char* value;
+  };
+
+  // Stream events. header() sees the response headers and the trailers;
+  // closed() comes last, with 0 after a clean end of stream.
+  struct Handler {
+    void (*header)(void* ctx, const char* name, size_t nameLen, const char* value, size_t valueLen);
+    void (*data)(void* ctx, const uint8_t* data, size_t len);
+    void (*closed)(void* ctx, uint32_t errorCode);
+    void* ctx;
+  };
+
+  static const int MAX_STREAMS = MaxStreams;
+  static const uint32_t FRAME_MAX = 16384;  // Largest frame accepted; the protocol minimum
+  static const uint32_t RX_BUFFER_BYTES = 9 + FRAME_MAX;
+  static const uint32_t HEADER_BLOCK_MAX = 2048;
+  static const uint32_t ERROR_TRANSPORT = 0x100;  // Not an HTTP/2 code: the connection dropped
+
+  enum ErrorCode : uint32_t {
+    NO_ERROR = 0x0,
+    PROTOCOL_ERROR = 0x1,
+    INTERNAL_ERROR = 0x2,
+    FLOW_CONTROL_ERROR = 0x3,
+    STREAM_CLOSED = 0x5,
+    FRAME_SIZE_ERROR = 0x6,
+    REFUSED_STREAM = 0x7,
+    CANCEL = 0x8,
+    COMPRESSION_ERROR = 0x9,
+  };
+
+  // rxBuffer holds RX_BUFFER_BYTES and must outlive the client
+  BasicH2Client(uint8_t* rxBuffer, ReadFn read, WriteFn write, void* io)
+    : rx_(rxBuffer), read_(read), write_(write), io_(io) {}
+
+  // Sends the connection preface and our SETTINGS. The receive windows
+  // bound how much response data may be in flight per stream and on the
+  // connection; the protocol's 64 KB suits a device, while a host program
+  // downloading on many streams at once raises them.
+  bool start(uint32_t streamWindow = DEFAULT_WINDOW, uint32_t connectionWindow = DEFAULT_WINDOW) {
+    static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    uint8_t settings[24];
+    putSetting(settings, SETTINGS_HEADER_TABLE_SIZE, 0);
+    putSetting(settings + 6, SETTINGS_ENABLE_PUSH, 0);
+    putSetting(settings + 12, SETTINGS_MAX_FRAME_SIZE, FRAME_MAX);
+    putSetting(settings + 18, SETTINGS_INITIAL_WINDOW_SIZE, streamWindow);
+    open_ = write_(io_, (const uint8_t*)preface, sizeof(preface) - 1) >= 0
+            && writeFrame(FRAME_SETTINGS, 0, 0, settings, streamWindow == DEFAULT_WINDOW ? 18 : 24);
+    if (open_ && connectionWindow > (uint32_t)DEFAULT_WINDOW) windowUpdate(0, connectionWindow - DEFAULT_WINDOW);
+    return open_;
+  }
+
+  // Opens a stream with the request headers. Returns its id, or 0 if the
+  // connection is closed, going away, or out of stream slots.
+  uint32_t request(const Header* headers, int count, bool endStream, const Handler& handler) {
+    if (!open_ || goingAway_ || activeStreams() >= peerMaxStreams_) return 0;
+    Stream* s = freeSlot();
+    if (!s) return 0;
+
+    uint8_t block[HEADER_BLOCK_MAX];
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+      if (!encodeHeader(headers[i], block, len)) return 0;
+    }
+    if (len > peerMaxFrame_) return 0;  // Would need CONTINUATION; requests here are small
+
+    memset(s, 0, sizeof(*s));
+    s->id = nextStreamId_;
+    nextStreamId_ += 2;
+    s->handler = handler;
+    s->sendWindow = peerInitialWindow_;
+    s->localClosed = endStream;
+    if (!writeFrame(FRAME_HEADERS, FLAG_END_HEADERS | (endStream ? FLAG_END_STREAM : 0), s->id, block, len)) return 0;
+    return s->id;
+  }
+
+  // Sends up to len bytes of request body, as far as the flow-control
+  // windows allow, and returns how many went out (0 means wait and poll).
+  // endStream closes our side once the last byte is sent. -1 if the
+  // stream is gone.
+  int32_t send(uint32_t id, const uint8_t* data, uint32_t len, bool endStream) {
+    Stream* s = find(id);
+    if (!open_ || !s || s->localClosed) return -1;
+    uint32_t n = len;
+    if (n > peerMaxFrame_) n = peerMaxFrame_;
+    if (connSendWindow_ < (int32_t)n) n = connSendWindow_ > 0 ? connSendWindow_ : 0;
+    if (s->sendWindow < (int32_t)n) n = s->sendWindow > 0 ? s->sendWindow : 0;
+    bool end = endStream && n == len;
+    if (n == 0 && !end) {
+      if (len) windowStalls_++;
+      return 0;
+    }
+    if (!writeFrame(FRAME_DATA, end ? FLAG_END_STREAM : 0, id, data, n)) return -1;
+    connSendWindow_ -= n;
+    s->sendWindow -= n;
+    s->localClosed = end;
+    bytesSent_ += n;
+    return n;
+  }
+
+  // Abandons a stream; its handler is not called again
+  void cancel(uint32_t id) {
+    Stream* s = find(id);
+    if (!s) return;
+    uint8_t code[4];
+    put32(code, CANCEL);
+    writeFrame(FRAME_RST_STREAM, 0, id, code, 4);
+    s->id = 0;
+  }
+
+  // Reads and handles whatever has arrived. False once the connection is
+  // unusable; open streams have been closed with an error by then.
+  bool poll() {
+    while (open_) {
+      uint32_t need = rxLen_ < 9 ? 9 : 9 + get24(rx_);
+      if (need > RX_BUFFER_BYTES) return fail(FRAME_SIZE_ERROR);
+      if (rxLen_ < need) {
+        int32_t n = read_(io_, rx_ + rxLen_, need - rxLen_);
+        if (n < 0) return fail(ERROR_TRANSPORT);
+        if (n == 0) return true;
+        rxLen_ += n;
+        bytesReceived_ += n;
+        continue;
+      }
+      rxLen_ = 0;
+      uint32_t code = handleFrame(rx_[3], rx_[4], get32(rx_ + 5) & 0x7fffffff, rx_ + 9, need - 9);
+      if (code != NO_ERROR) return fail(code);
+    }
+    return false;
+  }
+
+  // Says goodbye to the server; open streams are closed with CANCEL
+  void close() {
+    if (!open_) return;
+    uint8_t goaway[8];
+    put32(goaway, lastPeerStream_);
+    put32(goaway + 4, NO_ERROR);
+    writeFrame(FRAME_GOAWAY, 0, 0, goaway, sizeof(goaway));
+    closeAll(CANCEL);
+    open_ = false;
+  }
+
+  bool isOpen() const { return open_; }
+  bool goingAway() const { return goingAway_; }
+  uint32_t lastError() const { return lastError_; }
+  uint32_t bytesSent() const { return bytesSent_; }
+  uint32_t bytesReceived() const { return bytesReceived_; }
+  uint32_t windowStalls() const { return windowStalls_; }
+  // Streams open now; request() fails at the peer's limit or MAX_STREAMS
+  int openStreams() const { return activeStreams(); }
+  int streamLimit() const { return peerMaxStreams_; }
+
+  // Room for body bytes on this stream right now
+  uint32_t sendable(uint32_t id) const {
+    const Stream* s = const_cast<BasicH2Client*>(this)->find(id);
+    if (!s || s->localClosed) return 0;
+    int32_t w = s->sendWindow < connSendWindow_ ? s->sendWindow : connSendWindow_;
+    return w > 0 ? w : 0;
+  }
+
+ private:
+  enum : uint8_t {
+    FRAME_DATA = 0x0,
+    FRAME_HEADERS = 0x1,
+    FRAME_PRIORITY = 0x2,
+    FRAME_RST_STREAM = 0x3,
+    FRAME_SETTINGS = 0x4,
+    FRAME_PUSH_PROMISE = 0x5,
+    FRAME_PING = 0x6,
+    FRAME_GOAWAY = 0x7,
+    FRAME_WINDOW_UPDATE = 0x8,
+    FRAME_CONTINUATION = 0x9,
+  };
+  enum : uint8_t {
+    FLAG_ACK = 0x1,
+    FLAG_END_STREAM = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20,
+  };
+  enum : uint16_t {
+    SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    SETTINGS_ENABLE_PUSH = 0x2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    SETTINGS_MAX_FRAME_SIZE = 0x5,
+  };
+  static const int32_t DEFAULT_WINDOW = 65535;
+  static const uint32_t WINDOW_UPDATE_AT = 16384;  // Received bytes returned to the peer in batches
+
+  struct Stream {
+    uint32_t id;  // 0: free slot
+    Handler handler;
+    int32_t sendWindow;
+    uint32_t unacked;  // Received, not yet returned with WINDOW_UPDATE
+    bool localClosed;
+  };
+
+  uint8_t* rx_;
+  ReadFn read_;
+  WriteFn write_;
+  void* io_;
+  uint32_t rxLen_ = 0;
+  bool open_ = false;
+  bool goingAway_ = false;
+  uint32_t lastError_ = NO_ERROR;
+  Stream streams_[MAX_STREAMS] = {};
+  uint32_t nextStreamId_ = 1;
+  uint32_t lastPeerStream_ = 0;
+  int32_t connSendWindow_ = DEFAULT_WINDOW;
+  uint32_t connUnacked_ = 0;
+  int32_t peerInitialWindow_ = DEFAULT_WINDOW;
+  uint32_t peerMaxFrame_ = FRAME_MAX;
+  int peerMaxStreams_ = MAX_STREAMS;
+
+  // A header block can span HEADERS and CONTINUATION frames
+  uint8_t headerBlock_[HEADER_BLOCK_MAX];
+  uint32_t headerLen_ = 0;
+  uint32_t headerStream_ = 0;  // Stream whose block is open, 0 if none
+  bool headerEndStream_ = false;
+
+  uint32_t bytesSent_ = 0;
+  uint32_t bytesReceived_ = 0;
+  uint32_t windowStalls_ = 0;
+
+  static uint32_t get24(const uint8_t* p) { return (uint32_t)p[0] << 16 | p[1] << 8 | p[2]; }
+  static uint32_t get32(const uint8_t* p) { return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | p[2] << 8 | p[3]; }
+  static void put32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+  }
+  static void putSetting(uint8_t* p, uint16_t id, uint32_t value) {
+    p[0] = id >> 8;
+    p[1] = id;
+    put32(p + 2, value);
+  }
+
+  Stream* find(uint32_t id) {
+    if (id == 0) return nullptr;
+    for (Stream& s : streams_) {
+      if (s.id == id) return &s;
+    }
+    return nullptr;
+  }
+
+  Stream* freeSlot() {
+    for (Stream& s : streams_) {
+      if (s.id == 0) return &s;
+    }
+    return nullptr;
+  }
+
+  int activeStreams() const {
+    int n = 0;
+    for (const Stream& s : streams_) n += s.id != 0;
+    return n;
+  }
+
+  bool writeFrame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* payload, uint32_t len) {
+    // Small frames go out in one write, so one TLS record
+    uint8_t frame[9 + 64];
+    frame[0] = len >> 16;
+    frame[1] = len >> 8;
+    frame[2] = len;
+    frame[3] = type;
+    frame[4] = flags;
+    put32(frame + 5, id);
+    bool ok;
+    if (len <= 64) {
+      if (len) memcpy(frame + 9, payload, len);
+      ok = write_(io_, frame, 9 + len) >= 0;
+    } else {
+      ok = write_(io_, frame, 9) >= 0 && write_(io_, payload, len) >= 0;
+    }
+    if (!ok) {
+      lastError_ = ERROR_TRANSPORT;
+      open_ = false;
+    }
+    return ok;
+  }
+
+  bool fail(uint32_t code) {
+    if (open_ && code != ERROR_TRANSPORT) {
+      uint8_t goaway[8];
+      put32(goaway, lastPeerStream_);
+      put32(goaway + 4, code);
+      writeFrame(FRAME_GOAWAY, 0, 0, goaway, sizeof(goaway));
+    }
+    lastError_ = code;
+    open_ = false;
+    closeAll(code);
+    return false;
+  }
+
+  void closeStream(Stream* s, uint32_t code) {
+    Handler h = s->handler;
+    s->id = 0;
+    if (h.closed) h.closed(h.ctx, code);
+  }
+
+  void closeAll(uint32_t code) {
+    for (Stream& s : streams_) {
+      if (s.id) closeStream(&s, code);
+    }
+  }
+
+  void windowUpdate(uint32_t id, uint32_t increment) {
+    uint8_t p[4];
+    put32(p, increment);
+    writeFrame(FRAME_WINDOW_UPDATE, 0, id, p, 4);
+  }
+
+  // Returns an HTTP/2 error code for the connection, NO_ERROR to go on
+  uint32_t handleFrame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len) {
+    if (headerStream_ && (type != FRAME_CONTINUATION || id != headerStream_)) return PROTOCOL_ERROR;
+    if (id > lastPeerStream_ && (id & 1) == 0) lastPeerStream_ = id;
+
+    switch (type) {
+      case FRAME_DATA:
+        {
+          if (id == 0) return PROTOCOL_ERROR;
+          connUnacked_ += len;
+          if (connUnacked_ >= WINDOW_UPDATE_AT) {
+            windowUpdate(0, connUnacked_);
+            connUnacked_ = 0;
+          }
+          Stream* s = find(id);
+          if (!s) return NO_ERROR;  // Cancelled by us; the data is dropped
+          s->unacked += len;
+          uint32_t pad = 0;
+          if (flags & FLAG_PADDED) {
+            if (len < 1 || p[0] >= len) return PROTOCOL_ERROR;
+            pad = p[0];
+            p++;
+            len--;
+          }
+          if (len > pad && s->handler.data) s->handler.data(s->handler.ctx, p, len - pad);
+          if (!find(id)) return NO_ERROR;  // The handler cancelled it
+          if (flags & FLAG_END_STREAM) {
+            closeStream(s, NO_ERROR);
+          } else if (s->unacked >= WINDOW_UPDATE_AT) {
+            windowUpdate(id, s->unacked);
+            s->unacked = 0;
+          }
+          return NO_ERROR;
+        }
+      case FRAME_HEADERS:
+        {
+          if (id == 0) return PROTOCOL_ERROR;
+          uint32_t pad = 0;
+          if (flags & FLAG_PADDED) {
+            if (len < 1) return PROTOCOL_ERROR;
+            pad = p[0];
+            p++;
+            len--;
+          }
+          if (flags & FLAG_PRIORITY) {
+            if (len < 5) return PROTOCOL_ERROR;
+            p += 5;
+            len -= 5;
+          }
+          if (pad > len) return PROTOCOL_ERROR;
+          headerLen_ = 0;
+          headerEndStream_ = flags & FLAG_END_STREAM;
+          return appendHeaderBlock(id, flags, p, len - pad);
+        }
+      case FRAME_CONTINUATION:
+        if (!headerStream_) return PROTOCOL_ERROR;
+        return appendHeaderBlock(id, flags, p, len);
+      case FRAME_RST_STREAM:
+        {
+          if (id == 0 || len != 4) return PROTOCOL_ERROR;
+          Stream* s = find(id);
+          if (s) closeStream(s, get32(p));
+          return NO_ERROR;
+        }
+      case FRAME_SETTINGS:
+        if (id != 0 || len % 6) return PROTOCOL_ERROR;
+        if (flags & FLAG_ACK) return NO_ERROR;
+        for (uint32_t i = 0; i < len; i += 6) {
+          uint16_t key = p[i] << 8 | p[i + 1];
+          uint32_t value = get32(p + i + 2);
+          if (key == SETTINGS_INITIAL_WINDOW_SIZE) {
+            if (value > 0x7fffffff) return FLOW_CONTROL_ERROR;
+            int32_t delta = (int32_t)value - peerInitialWindow_;
+            for (Stream& s : streams_) {
+              if (s.id) s.sendWindow += delta;
+            }
+            peerInitialWindow_ = value;
+          } else if (key == SETTINGS_MAX_FRAME_SIZE) {
+            if (value < 16384 || value > 0xffffff) return PROTOCOL_ERROR;
+            peerMaxFrame_ = value < FRAME_MAX ? value : FRAME_MAX;
+          } else if (key == SETTINGS_MAX_CONCURRENT_STREAMS) {
+            peerMaxStreams_ = value < (uint32_t)MAX_STREAMS ? value : MAX_STREAMS;
+          }
+        }
+        return writeFrame(FRAME_SETTINGS, FLAG_ACK, 0, nullptr, 0) ? NO_ERROR : ERROR_TRANSPORT;
+      case FRAME_PING:
+        if (id != 0 || len != 8) return PROTOCOL_ERROR;
+        if (flags & FLAG_ACK) return NO_ERROR;
+        return writeFrame(FRAME_PING, FLAG_ACK, 0, p, 8) ? NO_ERROR : ERROR_TRANSPORT;
+      case FRAME_GOAWAY:
+        {
+          if (id != 0 || len < 8) return PROTOCOL_ERROR;
+          uint32_t last = get32(p) & 0x7fffffff;
+          goingAway_ = true;
+          lastError_ = get32(p + 4);
+          for (Stream& s : streams_) {
+            if (s.id > last) closeStream(&s, REFUSED_STREAM);
+          }
+          return NO_ERROR;
+        }
+      case FRAME_WINDOW_UPDATE:
+        {
+          if (len != 4) return PROTOCOL_ERROR;
+          int32_t increment = get32(p) & 0x7fffffff;
+          if (id == 0) {
+            connSendWindow_ += increment;
+          } else {
+            Stream* s = find(id);
+            if (s) s->sendWindow += increment;
+          }
+          return NO_ERROR;
+        }
+      case FRAME_PUSH_PROMISE:
+        return PROTOCOL_ERROR;  // Disabled in our SETTINGS
+      default:
+        return NO_ERROR;  // PRIORITY and unknown types are ignored
+    }
+  }
+
+  uint32_t appendHeaderBlock(uint32_t id, uint8_t flags, const uint8_t* p, uint32_t len) {
+    if (headerLen_ + len > HEADER_BLOCK_MAX) return INTERNAL_ERROR;  // Larger than any response here
+    memcpy(headerBlock_ + headerLen_, p, len);
+    headerLen_ += len;
+    if (!(flags & FLAG_END_HEADERS)) {
+      headerStream_ = id;
+      return NO_ERROR;
+    }
+    headerStream_ = 0;
+    Stream* s = find(id);
+    if (!decodeHeaders(s)) return COMPRESSION_ERROR;
+    if (s && headerEndStream_ && find(id)) closeStream(s, NO_ERROR);
+    return NO_ERROR;
+  }
+
+  //----------------------------------------
+  // HPACK
+  //----------------------------------------
+
+  struct StaticEntry {
+    const char* name;
+    const char* value;
+  };
+
+  static const StaticEntry& staticEntry(uint32_t index) {
+    static const StaticEntry table[61] = {
+      { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+      { ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+      { ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+      { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+      { "accept-encoding", "gzip, deflate" }, { "accept-language", "" }, { "accept-ranges", "" },
+      { "accept", "" }, { "access-control-allow-origin", "" }, { "age", "" }, { "allow", "" },
+      { "authorization", "" }, { "cache-control", "" }, { "content-disposition", "" },
+      { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+      { "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+      { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" }, { "from", "" }, { "host", "" },
+      { "if-match", "" }, { "if-modified-since", "" }, { "if-none-match", "" }, { "if-range", "" },
+      { "if-unmodified-since", "" }, { "last-modified", "" }, { "link", "" }, { "location", "" },
+      { "max-forwards", "" }, { "proxy-authenticate", "" }, { "proxy-authorization", "" },
+      { "range", "" }, { "referer", "" }, { "refresh", "" }, { "retry-after", "" }, { "server", "" },
+      { "set-cookie", "" }, { "strict-transport-security", "" }, { "transfer-encoding", "" },
+      { "user-agent", "" }, { "vary", "" }, { "via", "" }, { "www-authenticate", "" },
+    };
+    return table[index - 1];
+  }
+
+  static void encodeInt(uint32_t value, uint8_t prefixBits, uint8_t first, uint8_t* out, size_t& len) {
+    uint32_t max = (1u << prefixBits) - 1;
+    if (value < max) {
+      out[len++] = first | value;
+      return;
+    }
+    out[len++] = first | max;
+    value -= max;
+    while (value >= 128) {
+      out[len++] = (value & 127) | 128;
+      value >>= 7;
+    }
+    out[len++] = value;
+  }
+
+  // Literal without indexing (RFC 7541 6.2.2), name from the static table
+  // when it has one; a full match is sent as an index
+  static bool encodeHeader(const Header& h, uint8_t* out, size_t& len) {
+    size_t nameLen = strlen(h.name);
+    size_t valueLen = strlen(h.value);
+    if (len + nameLen + valueLen + 12 > HEADER_BLOCK_MAX) return false;
+    uint32_t nameIndex = 0;
+    for (uint32_t i = 1; i <= 61; i++) {
+      const StaticEntry& e = staticEntry(i);
+      if (strcmp(e.name, h.name) != 0) continue;
+      if (strcmp(e.value, h.value) == 0) {
+        encodeInt(i, 7, 0x80, out, len);
+        return true;
+      }
+      if (!nameIndex) nameIndex = i;
+    }
+    encodeInt(nameIndex, 4, 0x00, out, len);
+    if (!nameIndex) {
+      encodeInt(nameLen, 7, 0x00, out, len);
+      memcpy(out + len, h.name, nameLen);
+      len += nameLen;
+    }
+    encodeInt(valueLen, 7, 0x00, out, len);
+    memcpy(out + len, h.value, valueLen);
+    len += valueLen;
+    return true;
+  }
+
+  static bool decodeInt(const uint8_t*& p, const uint8_t* end, uint8_t prefixBits, uint32_t& value) {
+    uint32_t max = (1u << prefixBits) - 1;
+    value = *p++ & max;
+    if (value < max) return true;
+    for (int shift = 0; shift <= 21; shift += 7) {
+      if (p == end) return false;
+      uint8_t b = *p++;
+      value += (uint32_t)(b & 127) << shift;
+      if (!(b & 128)) return true;
+    }
+    return false;
+  }
+
+  // Decodes a string literal into out (truncated to cap) and sets len
+  static bool decodeString(const uint8_t*& p, const uint8_t* end, char* out, size_t cap, size_t& len) {
+    if (p == end) return false;
+    bool huffman = *p & 0x80;
+    uint32_t n;
+    if (!decodeInt(p, end, 7, n) || n > (uint32_t)(end - p)) return false;
+    len = huffman ? huffmanDecode(p, n, out, cap) : (n < cap ? n : cap);
+    if (!huffman) memcpy(out, p, len);
+    p += n;
+    return len != (size_t)-1;
+  }
+
+  bool decodeHeaders(Stream* s) {
+    char name[64];
+    char value[256];  // Longer values (a long grpc-message) are cut short
+    const uint8_t* p = headerBlock_;
+    const uint8_t* end = headerBlock_ + headerLen_;
+    while (p < end) {
+      uint8_t b = *p;
+      uint32_t index;
+      size_t nameLen = 0;
+      size_t valueLen = 0;
+      if (b & 0x80) {
+        // Indexed field; only the static table exists here
+        if (!decodeInt(p, end, 7, index) || index == 0 || index > 61) return false;
+        const StaticEntry& e = staticEntry(index);
+        nameLen = strlen(e.name);
+        valueLen = strlen(e.value);
+        memcpy(name, e.name, nameLen);
+        memcpy(value, e.value, valueLen);
+      } else if ((b & 0xe0) == 0x20) {
+        // Table size update; anything but 0 breaks our SETTINGS
+        if (!decodeInt(p, end, 5, index) || index != 0) return false;
+        continue;
+      } else {
+        // Literal, with incremental indexing (into a table of size 0) or not
+        if (!decodeInt(p, end, (b & 0x40) ? 6 : 4, index) || index > 61) return false;
+        if (index) {
+          nameLen = strlen(staticEntry(index).name);
+          memcpy(name, staticEntry(index).name, nameLen);
+        } else if (!decodeString(p, end, name, sizeof(name), nameLen)) {
+          return false;
+        }
+        if (!decodeString(p, end, value, sizeof(value), valueLen)) return false;
+      }
+      if (s && s->handler.header) s->handler.header(s->handler.ctx, name, nameLen, value, valueLen);
+    }
+    return true;
+  }
+
+  // Canonical Huffman decode (RFC 7541 Appendix B). Returns the length
+  // written, cut at cap, or -1 on an invalid code or padding.
+  static size_t huffmanDecode(const uint8_t* in, uint32_t len, char* out, size_t cap) {
+    const HuffmanIndex& h = huffmanIndex();
+    size_t n = 0;
+    uint32_t code = 0;
+    int bits = 0;
+    for (uint32_t i = 0; i < len; i++) {
+      for (int k = 7; k >= 0; k--) {
+        code = code << 1 | ((in[i] >> k) & 1);
+        bits++;
+        if (bits < 5) continue;
+        if (bits > 30) return (size_t)-1;
+        uint32_t offset = code - h.first[bits];
+        if (code < h.first[bits] || offset >= h.count[bits]) continue;
+        uint16_t symbol = h.symbols[h.start[bits] + offset];
+        if (symbol == 256) return (size_t)-1;  // EOS must not appear
+        if (n < cap) out[n++] = (char)symbol;
+        code = 0;
+        bits = 0;
+      }
+    }
+    // Padding is the most significant bits of EOS: up to 7 one bits
+    if (bits > 7 || code != (1u << bits) - 1) return (size_t)-1;
+    return n;
+  }
+
+  struct HuffmanIndex {
+    uint32_t first[31];   // First code of each length
+    uint16_t count[31];   // Codes of each length
+    uint16_t start[31];   // Their first position in symbols
+    uint16_t symbols[257];  // By code length, then symbol value
+  };
+
+  static const HuffmanIndex& huffmanIndex() {
+    static HuffmanIndex index;
+    static bool built = false;
+    if (built) return index;
+    static const struct {
+      uint32_t code;
+      uint8_t bits;
+    } codes[257] = {
+      { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 },
+      { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 }, { 0xfffffe8, 28 }, { 0xffffea, 24 },
+      { 0x3ffffffc, 30 }, { 0xfffffe9, 28 }, { 0xfffffea, 28 }, { 0x3ffffffd, 30 },
+      { 0xfffffeb, 28 }, { 0xfffffec, 28 }, { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 },
+      { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+      { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 },
+      { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 }, { 0x14, 6 }, { 0x3f8, 10 },
+      { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+      { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 },
+      { 0x17, 6 }, { 0x18, 6 }, { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 },
+      { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+      { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 }, { 0x1ffa, 13 }, { 0x21, 6 },
+      { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 }, { 0x63, 7 },
+      { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+      { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 },
+      { 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 },
+      { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 }, { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 },
+      { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 },
+      { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 },
+      { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+      { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+      { 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 },
+      { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+      { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 },
+      { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 }, { 0xffffec, 24 }, { 0xffffed, 24 },
+      { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 },
+      { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+      { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 }, { 0x3fffda, 22 },
+      { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 },
+      { 0x7fffe9, 23 }, { 0x1fffde, 21 }, { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 },
+      { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+      { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 }, { 0x7fffed, 23 },
+      { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+      { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 },
+      { 0x7ffff1, 23 }, { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+      { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 },
+      { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 },
+      { 0xfffff1, 24 }, { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 },
+      { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+      { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 },
+      { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 },
+      { 0xfffed, 20 }, { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 },
+      { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+      { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 }, { 0x3ffffeb, 26 },
+      { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+      { 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 },
+      { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+      { 0x3fffffff, 30 },
+    };
+    memset(&index, 0, sizeof(index));
+    for (int s = 0; s < 257; s++) index.count[codes[s].bits]++;
+    uint16_t pos = 0;
+    for (int b = 1; b <= 30; b++) {
+      index.start[b] = pos;
+      uint16_t k = pos;
+      for (int s = 0; s < 257; s++) {
+        if (codes[s].bits != b) continue;
+        if (k == pos) index.first[b] = codes[s].code;
+        index.symbols[k++] = s;
+      }
+      pos = k;
+    }
+    built = true;
+    return index;
+  }
+};
+
+typedef BasicH2Client<4> H2Client;
@@ -0,0 +1,179 @@
+// IMA ADPCM for 16-bit mono PCM, 4 bits per sample. Audio is stored in
+// WAV format 0x11 (IMA/DVI ADPCM) blocks: a 4-byte header holding the
+// block's first sample and step index, then blockAlign - 4 bytes of codes,
+// two samples per byte with the first in the low nibble. A block holds
+// (blockAlign - 4) * 2 + 1 samples, and the last block of a stream may be
+// shorter. Every block restarts the predictor, so a damaged block does not
+// spoil the rest of the stream. Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class ImaAdpcm {
+ public:
+  static const uint16_t FORMAT_TAG = 0x11;
+  static const size_t WAV_HEADER_BYTES = 60;
+
+  static constexpr uint32_t samplesPerBlock(uint16_t blockAlign) { return (blockAlign - 4) * 2 + 1; }
+
+  // Writes a WAV header: fmt with the samples-per-block extension, fact
+  // with the sample count, and the data chunk header
+  static size_t wavHeader(uint8_t* out, uint32_t sampleRate, uint16_t blockAlign, uint32_t dataBytes, uint32_t samples) {
+    uint32_t perBlock = samplesPerBlock(blockAlign);
+    uint8_t* p = out;
+    p = tag(p, "RIFF");
+    p = le32(p, WAV_HEADER_BYTES - 8 + dataBytes);
+    p = tag(p, "WAVE");
+    p = tag(p, "fmt ");
+    p = le32(p, 20);
+    p = le16(p, FORMAT_TAG);
+    p = le16(p, 1);  // Mono
+    p = le32(p, sampleRate);
+    p = le32(p, (uint32_t)((uint64_t)sampleRate * blockAlign / perBlock));
+    p = le16(p, blockAlign);
+    p = le16(p, 4);  // Bits per sample
+    p = le16(p, 2);  // Extension size
+    p = le16(p, perBlock);
+    p = tag(p, "fact");
+    p = le32(p, 4);
+    p = le32(p, samples);
+    p = tag(p, "data");
+    p = le32(p, dataBytes);
+    return p - out;
+  }
+
+  static int16_t stepSize(int index) {
+    static const int16_t steps[89] = {
+      7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+      50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+      253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+      1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+      3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+      11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+      32767,
+    };
+    return steps[index];
+  }
+
+  // Applies one code to the coder state; shared by both directions so the
+  // encoder's prediction never drifts from what a decoder reconstructs
+  static int16_t step(int32_t& predictor, uint8_t& index, uint8_t code) {
+    static const int8_t adjust[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+    int32_t s = stepSize(index);
+    int32_t delta = s >> 3;
+    if (code & 4) delta += s;
+    if (code & 2) delta += s >> 1;
+    if (code & 1) delta += s >> 2;
+    predictor += code & 8 ? -delta : delta;
+    if (predictor > 32767) predictor = 32767;
+    if (predictor < -32768) predictor = -32768;
+    int next = index + adjust[code & 7];
+    index = next < 0 ? 0 : next > 88 ? 88 : next;
+    return (int16_t)predictor;
+  }
+
+ private:
+  static uint8_t* tag(uint8_t* p, const char* t) {
+    memcpy(p, t, 4);
+    return p + 4;
+  }
+  static uint8_t* le16(uint8_t* p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+  }
+  static uint8_t* le32(uint8_t* p, uint32_t v) {
+    return le16(le16(p, v), v >> 16);
+  }
+};
+
+class ImaAdpcmEncoder {
+ public:
+  // Encodes one block of count samples, at most samplesPerBlock(blockAlign),
+  // and returns its size: blockAlign for a full block. The step index
+  // carries over from the previous block.
+  size_t encodeBlock(const int16_t* in, size_t count, uint8_t* out) {
+    if (count == 0) return 0;
+    predictor_ = in[0];
+    out[0] = (uint16_t)in[0];
+    out[1] = (uint16_t)in[0] >> 8;
+    out[2] = index_;
+    out[3] = 0;
+    size_t bytes = 4;
+    for (size_t i = 1; i < count; i += 2) {
+      uint8_t lo = encodeSample(in[i]);
+      uint8_t hi = i + 1 < count ? encodeSample(in[i + 1]) : 0;
+      out[bytes++] = lo | (hi << 4);
+    }
+    return bytes;
+  }
+
+  void reset() {
+    predictor_ = 0;
+    index_ = 0;
+  }
+
+ private:
+  int32_t predictor_ = 0;
+  uint8_t index_ = 0;
+
+  // Quantizes the difference to the prediction in step/4 units
+  uint8_t encodeSample(int16_t sample) {
+    int32_t s = ImaAdpcm::stepSize(index_);
+    int32_t diff = sample - predictor_;
+    uint8_t code = 0;
+    if (diff < 0) {
+      code = 8;
+      diff = -diff;
+    }
+    if (diff >= s) {
+      code |= 4;
+      diff -= s;
+    }
+    if (diff >= s >> 1) {
+      code |= 2;
+      diff -= s >> 1;
+    }
+    if (diff >= s >> 2) code |= 1;
+    ImaAdpcm::step(predictor_, index_, code);
+    return code;
+  }
+};
+
+// Decodes a stream of blocks fed in pieces of any size, as they come off
+// storage: len bytes yield at most 2 * len samples
+class ImaAdpcmDecoder {
+ public:
+  void begin(uint16_t blockAlign) {
+    blockAlign_ = blockAlign;
+    pos_ = 0;
+  }
+
+  size_t decode(const uint8_t* in, size_t len, int16_t* out) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+      uint8_t b = in[i];
+      if (pos_ >= 4) {
+        out[n++] = ImaAdpcm::step(predictor_, index_, b & 15);
+        out[n++] = ImaAdpcm::step(predictor_, index_, b >> 4);
+      } else if (pos_ == 0) {
+        predictor_ = b;
+      } else if (pos_ == 1) {
+        predictor_ = (int16_t)(predictor_ | b << 8);
+        out[n++] = (int16_t)predictor_;
+      } else if (pos_ == 2) {
+        index_ = b > 88 ? 88 : b;
+      }
+      if (++pos_ == blockAlign_) pos_ = 0;
+    }
+    return n;
+  }
+
+ private:
+  uint16_t blockAlign_ = 256;
+  uint16_t pos_ = 0;  // Byte within the current block
+  int32_t predictor_ = 0;
+  uint8_t index_ = 0;
+};
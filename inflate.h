@@ -0,0 +1,418 @@
+// Streaming DEFLATE decoder (RFC 1951) with gzip (RFC 1952) and zlib
+// (RFC 1950) framing. Input is pulled one byte at a time from a callback,
+// output is produced on demand into the caller's buffer, and the history
+// lives in a fixed 32 KB window supplied by the caller. No other allocation.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class Inflater {
+ public:
+  // Returns the next compressed byte, or -1 once the input is exhausted.
+  typedef int (*ReadByteFn)(void* ctx);
+
+  enum Format {
+    FORMAT_RAW,
+    FORMAT_ZLIB,
+    FORMAT_GZIP
+  };
+
+  static const size_t WINDOW_SIZE = 32768;
+
+  Inflater(uint8_t* window, ReadByteFn readByte, void* ctx)
+    : window_(window), readByte_(readByte), ctx_(ctx) {
+    reset(FORMAT_GZIP);
+  }
+
+  void reset(Format format) {
+    format_ = format;
+    state_ = STATE_HEADER;
+    bitBuf_ = 0;
+    bitCount_ = 0;
+    windowPos_ = 0;
+    copyLength_ = 0;
+    copyDistance_ = 0;
+    storedRemaining_ = 0;
+    lastBlock_ = false;
+    crc_ = 0xffffffff;
+    adlerA_ = 1;
+    adlerB_ = 0;
+    totalOut_ = 0;
+  }
+
+  // Decompresses up to len bytes into out. Returns 0 at the end of the
+  // stream or on error; check failed() to tell them apart.
+  size_t read(uint8_t* out, size_t len) {
+    size_t produced = 0;
+    while (produced < len) {
+      switch (state_) {
+        case STATE_HEADER:
+          if (!readHeader()) return fail(produced);
+          state_ = STATE_BLOCK_HEADER;
+          break;
+        case STATE_BLOCK_HEADER:
+          if (lastBlock_) {
+            state_ = STATE_TRAILER;
+            break;
+          }
+          if (!readBlockHeader()) return fail(produced);
+          break;
+        case STATE_STORED:
+          while (produced < len && storedRemaining_ > 0) {
+            int b = readByte_(ctx_);
+            if (b < 0) return fail(produced);
+            out[produced++] = emit((uint8_t)b);
+            storedRemaining_--;
+          }
+          if (storedRemaining_ == 0) state_ = STATE_BLOCK_HEADER;
+          break;
+        case STATE_HUFFMAN:
+          while (produced < len && copyLength_ > 0) {
+            out[produced++] = emit(window_[(windowPos_ - copyDistance_) & (WINDOW_SIZE - 1)]);
+            copyLength_--;
+          }
+          if (produced < len && !decodeSymbol(out, produced)) return fail(produced);
+          break;
+        case STATE_TRAILER:
+          if (!readTrailer()) return fail(produced);
+          state_ = STATE_DONE;
+          return produced;
+        case STATE_DONE:
+        case STATE_ERROR:
+          return produced;
+      }
+    }
+    return produced;
+  }
+
+  bool finished() const { return state_ == STATE_DONE; }
+  bool failed() const { return state_ == STATE_ERROR; }
+  uint32_t totalOut() const { return totalOut_; }
+
+ private:
+  enum State {
+    STATE_HEADER,
+    STATE_BLOCK_HEADER,
+    STATE_STORED,
+    STATE_HUFFMAN,
+    STATE_TRAILER,
+    STATE_DONE,
+    STATE_ERROR
+  };
+
+  static const int MAX_BITS = 15;
+  static const int MAX_LITLEN_CODES = 288;
+  static const int MAX_DIST_CODES = 30;
+
+  struct Huffman {
+    uint16_t count[MAX_BITS + 1];
+    uint16_t symbol[MAX_LITLEN_CODES];
+  };
+
+  uint8_t* window_;
+  ReadByteFn readByte_;
+  void* ctx_;
+
+  Format format_;
+  State state_;
+  uint32_t bitBuf_;
+  int bitCount_;
+  uint32_t windowPos_;
+  uint16_t copyLength_;
+  uint16_t copyDistance_;
+  uint16_t storedRemaining_;
+  bool lastBlock_;
+  uint32_t crc_;
+  uint32_t adlerA_;
+  uint32_t adlerB_;
+  uint32_t totalOut_;
+  Huffman lencode_;
+  Huffman distcode_;
+
+  size_t fail(size_t produced) {
+    state_ = STATE_ERROR;
+    return produced;
+  }
+
+  uint8_t emit(uint8_t b) {
+    window_[windowPos_ & (WINDOW_SIZE - 1)] = b;
+    windowPos_++;
+    totalOut_++;
+    if (format_ == FORMAT_GZIP) {
+      crc_ ^= b;
+      crc_ = (crc_ >> 4) ^ crcNibble(crc_ & 0x0f);
+      crc_ = (crc_ >> 4) ^ crcNibble(crc_ & 0x0f);
+    } else if (format_ == FORMAT_ZLIB) {
+      adlerA_ = (adlerA_ + b) % 65521;
+      adlerB_ = (adlerB_ + adlerA_) % 65521;
+    }
+    return b;
+  }
+
+  static uint32_t crcNibble(uint32_t index) {
+    static const uint32_t table[16] = {
+      0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+      0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    return table[index];
+  }
+
+  // Ensures at least n (<= 24) bits are buffered.
+  bool needBits(int n) {
+    while (bitCount_ < n) {
+      int b = readByte_(ctx_);
+      if (b < 0) return false;
+      bitBuf_ |= (uint32_t)b << bitCount_;
+      bitCount_ += 8;
+    }
+    return true;
+  }
+
+  bool getBits(int n, uint32_t& value) {
+    if (!needBits(n)) return false;
+    value = bitBuf_ & ((1u << n) - 1);
+    bitBuf_ >>= n;
+    bitCount_ -= n;
+    return true;
+  }
+
+  bool getByte(uint8_t& value) {
+    uint32_t v;
+    if (!getBits(8, v)) return false;
+    value = (uint8_t)v;
+    return true;
+  }
+
+  void alignToByte() {
+    bitBuf_ >>= bitCount_ & 7;
+    bitCount_ -= bitCount_ & 7;
+  }
+
+  bool skipZeroTerminated() {
+    uint8_t c;
+    do {
+      if (!getByte(c)) return false;
+    } while (c != 0);
+    return true;
+  }
+
+  bool readHeader() {
+    uint8_t b[10];
+    if (format_ == FORMAT_ZLIB) {
+      if (!getByte(b[0]) || !getByte(b[1])) return false;
+      // CM must be deflate, no preset dictionary, and the check bits must hold
+      return (b[0] & 0x0f) == 8 && (b[1] & 0x20) == 0 && ((b[0] << 8) | b[1]) % 31 == 0;
+    }
+    if (format_ != FORMAT_GZIP) return true;
+
+    for (int i = 0; i < 10; i++) {
+      if (!getByte(b[i])) return false;
+    }
+    if (b[0] != 0x1f || b[1] != 0x8b || b[2] != 8) return false;
+    uint8_t flags = b[3];
+    if (flags & 0x04) {  // FEXTRA
+      uint8_t lo, hi;
+      if (!getByte(lo) || !getByte(hi)) return false;
+      for (uint16_t n = lo | (hi << 8); n > 0; n--) {
+        if (!getByte(lo)) return false;
+      }
+    }
+    if ((flags & 0x08) && !skipZeroTerminated()) return false;  // FNAME
+    if ((flags & 0x10) && !skipZeroTerminated()) return false;  // FCOMMENT
+    if (flags & 0x02) {                                         // FHCRC
+      uint8_t skip;
+      if (!getByte(skip) || !getByte(skip)) return false;
+    }
+    return true;
+  }
+
+  bool readTrailer() {
+    alignToByte();
+    uint8_t b[8];
+    if (format_ == FORMAT_GZIP) {
+      for (int i = 0; i < 8; i++) {
+        if (!getByte(b[i])) return false;
+      }
+      uint32_t crc = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+      uint32_t size = b[4] | (b[5] << 8) | (b[6] << 16) | ((uint32_t)b[7] << 24);
+      return crc == (crc_ ^ 0xffffffff) && size == totalOut_;
+    }
+    if (format_ == FORMAT_ZLIB) {
+      for (int i = 0; i < 4; i++) {
+        if (!getByte(b[i])) return false;
+      }
+      uint32_t adler = ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+      return adler == ((adlerB_ << 16) | adlerA_);
+    }
+    return true;
+  }
+
+  bool readBlockHeader() {
+    uint32_t header;
+    if (!getBits(3, header)) return false;
+    lastBlock_ = header & 1;
+
+    switch (header >> 1) {
+      case 0:
+        {
+          alignToByte();
+          uint32_t len, nlen;
+          if (!getBits(16, len) || !getBits(16, nlen)) return false;
+          if ((len ^ 0xffff) != nlen) return false;
+          storedRemaining_ = len;
+          state_ = STATE_STORED;
+          return true;
+        }
+      case 1:
+        buildFixedTables();
+        state_ = STATE_HUFFMAN;
+        return true;
+      case 2:
+        if (!readDynamicTables()) return false;
+        state_ = STATE_HUFFMAN;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Builds canonical decoding tables from code lengths. Returns false for
+  // over-subscribed codes; incomplete codes are allowed (single-symbol
+  // distance trees are legal).
+  static bool buildHuffman(Huffman& h, const uint8_t* lengths, int n) {
+    memset(h.count, 0, sizeof(h.count));
+    for (int i = 0; i < n; i++) h.count[lengths[i]]++;
+    if (h.count[0] == n) return true;
+
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; len++) {
+      left <<= 1;
+      left -= h.count[len];
+      if (left < 0) return false;
+    }
+
+    uint16_t offsets[MAX_BITS + 1];
+    offsets[1] = 0;
+    for (int len = 1; len < MAX_BITS; len++) offsets[len + 1] = offsets[len] + h.count[len];
+    for (int i = 0; i < n; i++) {
+      if (lengths[i] != 0) h.symbol[offsets[lengths[i]]++] = i;
+    }
+    return true;
+  }
+
+  // Canonical decode, one bit at a time. Returns -1 on bad code or EOF.
+  int decode(const Huffman& h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAX_BITS; len++) {
+      uint32_t bit;
+      if (!getBits(1, bit)) return -1;
+      code |= bit;
+      int count = h.count[len];
+      if (code - count < first) return h.symbol[index + (code - first)];
+      index += count;
+      first += count;
+      first <<= 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+
+  void buildFixedTables() {
+    uint8_t lengths[MAX_LITLEN_CODES];
+    int i = 0;
+    for (; i < 144; i++) lengths[i] = 8;
+    for (; i < 256; i++) lengths[i] = 9;
+    for (; i < 280; i++) lengths[i] = 7;
+    for (; i < 288; i++) lengths[i] = 8;
+    buildHuffman(lencode_, lengths, MAX_LITLEN_CODES);
+    for (i = 0; i < MAX_DIST_CODES; i++) lengths[i] = 5;
+    buildHuffman(distcode_, lengths, MAX_DIST_CODES);
+  }
+
+  bool readDynamicTables() {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    uint32_t nlen, ndist, ncode;
+    if (!getBits(5, nlen) || !getBits(5, ndist) || !getBits(4, ncode)) return false;
+    nlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if (nlen > 286 || ndist > MAX_DIST_CODES) return false;
+
+    uint8_t lengths[MAX_LITLEN_CODES + MAX_DIST_CODES];
+    memset(lengths, 0, 19);
+    for (uint32_t i = 0; i < ncode; i++) {
+      uint32_t len;
+      if (!getBits(3, len)) return false;
+      lengths[order[i]] = len;
+    }
+    // Code-length code tree lives in lencode_ until the real one is built
+    if (!buildHuffman(lencode_, lengths, 19)) return false;
+
+    uint32_t index = 0;
+    while (index < nlen + ndist) {
+      int symbol = decode(lencode_);
+      if (symbol < 0) return false;
+      if (symbol < 16) {
+        lengths[index++] = symbol;
+        continue;
+      }
+      uint8_t repeatValue = 0;
+      uint32_t repeat;
+      if (symbol == 16) {
+        if (index == 0 || !getBits(2, repeat)) return false;
+        repeatValue = lengths[index - 1];
+        repeat += 3;
+      } else if (symbol == 17) {
+        if (!getBits(3, repeat)) return false;
+        repeat += 3;
+      } else {
+        if (!getBits(7, repeat)) return false;
+        repeat += 11;
+      }
+      if (index + repeat > nlen + ndist) return false;
+      while (repeat--) lengths[index++] = repeatValue;
+    }
+    if (lengths[256] == 0) return false;  // No end-of-block code
+
+    return buildHuffman(lencode_, lengths, nlen) && buildHuffman(distcode_, lengths + nlen, ndist);
+  }
+
+  // Decodes one literal/length symbol: literals go straight to out, matches
+  // become a pending copy drained by read().
+  bool decodeSymbol(uint8_t* out, size_t& produced) {
+    static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                             35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                             3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                           257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                           8193, 12289, 16385, 24577 };
+    static const uint8_t distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                           7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    int symbol = decode(lencode_);
+    if (symbol < 0) return false;
+    if (symbol < 256) {
+      out[produced++] = emit((uint8_t)symbol);
+      return true;
+    }
+    if (symbol == 256) {
+      state_ = STATE_BLOCK_HEADER;
+      return true;
+    }
+
+    symbol -= 257;
+    if (symbol >= 29) return false;
+    uint32_t extra;
+    if (!getBits(lengthExtra[symbol], extra)) return false;
+    copyLength_ = lengthBase[symbol] + extra;
+
+    symbol = decode(distcode_);
+    if (symbol < 0 || symbol >= 30) return false;
+    if (!getBits(distExtra[symbol], extra)) return false;
+    copyDistance_ = distBase[symbol] + extra;
+    return copyDistance_ <= totalOut_;
+  }
+};
@@ -0,0 +1,193 @@
+// Playback jitter buffer for audio that arrives over the network while it
+// plays. A single producer pushes PCM as it is received and a single
+// consumer (the playback task) reads it. Playback starts once a prefill
+// target is buffered. The target is learned across streams from the
+// worst lag each stream showed against real time, and is set so the
+// chance of an underrun stays below a configured probability. When the
+// level runs low the consumer is asked to play slightly slower, which is
+// cheaper to hear than a gap. Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+class JitterBuffer {
+ public:
+  static const uint32_t MIN_PREFILL_MS = 60;
+  static const uint32_t STRETCH_RATE_Q16 = 62259;  // Play at 95% speed while low
+  static constexpr float ALPHA = 0.25f;             // Weight of the newest stream
+
+  // storage holds capacity samples and must outlive the buffer
+  JitterBuffer(int16_t* storage, uint32_t capacity, float underrunProbability)
+    : data_(storage), capacity_(capacity), z_(zScore(underrunProbability)) {}
+
+  // Producer: starts a stream at the rate given by its header
+  void begin(uint32_t sampleRate) {
+    sampleRate_ = sampleRate;
+    head_.store(0);
+    tail_.store(0);
+    ended_.store(false);
+    pushed_ = 0;
+    firstArrival_ = 0;
+    hasArrival_ = false;
+    peakLagMs_ = 0;
+    buffering_ = true;
+    stretching_ = false;
+
+    float ms = lagMeanMs_ + z_ * 1.25f * lagDevMs_;  // 1.25: mean absolute deviation to sigma
+    float maxMs = capacity_ * 750.0f / sampleRate_;   // Leave a quarter for arrivals during prefill
+    if (ms < MIN_PREFILL_MS) ms = MIN_PREFILL_MS;
+    if (ms > maxMs) ms = maxMs;
+    targetMs_ = (uint32_t)ms;
+    targetSamples_ = (uint32_t)(ms * sampleRate_ / 1000);
+  }
+
+  // Producer: copies as many samples as fit and returns how many. Call
+  // once per network read so each call is one arrival.
+  uint32_t push(const int16_t* samples, uint32_t count, uint32_t nowMs) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t space = capacity_ - (head - tail_.load(std::memory_order_acquire));
+    if (count > space) count = space;
+    if (count == 0) return 0;
+
+    observeArrival(nowMs);
+    uint32_t start = head % capacity_;
+    uint32_t first = count < capacity_ - start ? count : capacity_ - start;
+    memcpy(data_ + start, samples, first * sizeof(int16_t));
+    memcpy(data_, samples + first, (count - first) * sizeof(int16_t));
+    head_.store(head + count, std::memory_order_release);
+    pushed_ += count;
+    return count;
+  }
+
+  // Producer: true once the prefill target has been pushed; start the
+  // consumer then so it does not sit on silence.
+  bool prefilled() const { return pushed_ >= targetSamples_; }
+
+  // Producer: no more samples. Folds this stream's worst lag into the
+  // prefill estimate for the next one.
+  void end() {
+    ended_.store(true, std::memory_order_release);
+    if (!hasArrival_) return;
+    if (!hasLag_) {
+      lagMeanMs_ = peakLagMs_;
+      lagDevMs_ = peakLagMs_ / 2;
+      hasLag_ = true;
+    } else {
+      float deviation = peakLagMs_ > lagMeanMs_ ? peakLagMs_ - lagMeanMs_ : lagMeanMs_ - peakLagMs_;
+      lagDevMs_ += ALPHA * (deviation - lagDevMs_);
+      lagMeanMs_ += ALPHA * (peakLagMs_ - lagMeanMs_);
+    }
+  }
+
+  // Consumer: copies up to count samples. Returns how many, 0 while
+  // (re)buffering, or -1 once the stream has ended and drained.
+  int read(int16_t* out, int count) {
+    uint32_t tail = tail_.load(std::memory_order_relaxed);
+    uint32_t level = head_.load(std::memory_order_acquire) - tail;
+    bool ended = ended_.load(std::memory_order_acquire);
+
+    if (buffering_) {
+      if (!ended && level < targetSamples_) return 0;
+      buffering_ = false;
+    }
+    if (level == 0) {
+      if (ended) return -1;
+      underruns_++;
+      buffering_ = true;
+      stretching_ = false;
+      return 0;
+    }
+
+    uint32_t n = (uint32_t)count < level ? (uint32_t)count : level;
+    uint32_t start = tail % capacity_;
+    uint32_t first = n < capacity_ - start ? n : capacity_ - start;
+    memcpy(out, data_ + start, first * sizeof(int16_t));
+    memcpy(out + first, data_, (n - first) * sizeof(int16_t));
+    tail_.store(tail + n, std::memory_order_release);
+
+    level -= n;
+    if (!stretching_ && !ended && level < targetSamples_ / 4) {
+      stretching_ = true;
+      stretches_++;
+    } else if (stretching_ && (ended || level > targetSamples_ / 2)) {
+      stretching_ = false;
+    }
+    return (int)n;
+  }
+
+  // Consumer: playback speed multiplier to apply to this stream, Q16
+  uint32_t rateQ16() const { return stretching_ ? STRETCH_RATE_Q16 : 1u << 16; }
+
+  uint32_t sampleRate() const { return sampleRate_; }
+  uint32_t targetMs() const { return targetMs_; }
+  float jitterMs() const { return jitterMs_; }
+  float peakLagMs() const { return peakLagMs_; }
+  uint32_t underruns() const { return underruns_; }
+  uint32_t stretches() const { return stretches_; }
+
+ private:
+  int16_t* data_;
+  uint32_t capacity_;
+  float z_;
+  uint32_t sampleRate_ = 16000;
+  std::atomic<uint32_t> head_{ 0 };  // Total samples pushed
+  std::atomic<uint32_t> tail_{ 0 };  // Total samples read
+  std::atomic<bool> ended_{ false };
+
+  // Producer side
+  uint64_t pushed_ = 0;
+  uint32_t firstArrival_ = 0;
+  bool hasArrival_ = false;
+  float lastTransitMs_ = 0;
+  float jitterMs_ = 0;   // RFC 3550 interarrival jitter
+  float peakLagMs_ = 0;  // This stream's worst lateness against real time
+  float lagMeanMs_ = 200.0f;
+  float lagDevMs_ = 100.0f;
+  bool hasLag_ = false;
+  uint32_t targetMs_ = 0;
+  uint32_t targetSamples_ = 0;
+
+  // Consumer side
+  bool buffering_ = true;
+  bool stretching_ = false;
+  uint32_t underruns_ = 0;
+  uint32_t stretches_ = 0;
+
+  void observeArrival(uint32_t nowMs) {
+    float mediaMs = pushed_ * 1000.0f / sampleRate_;
+    if (!hasArrival_) {
+      firstArrival_ = nowMs;
+      hasArrival_ = true;
+      lastTransitMs_ = 0;
+      return;
+    }
+    // Transit relative to the first arrival: how far behind real time the
+    // sample that starts this arrival is. Its maximum is the prefill that
+    // would have avoided every underrun in this stream.
+    float transit = (float)(nowMs - firstArrival_) - mediaMs;
+    if (transit > peakLagMs_) peakLagMs_ = transit;
+    float d = transit - lastTransitMs_;
+    if (d < 0) d = -d;
+    jitterMs_ += (d - jitterMs_) / 16.0f;
+    lastTransitMs_ = transit;
+  }
+
+  // One-sided normal quantile for the allowed underrun probability, rounded
+  // to the next stricter table entry
+  static float zScore(float p) {
+    static const float table[][2] = {
+      { 0.5f, 0.0f }, { 0.2f, 0.84f }, { 0.1f, 1.28f }, { 0.05f, 1.64f },
+      { 0.02f, 2.05f }, { 0.01f, 2.33f }, { 0.005f, 2.58f }, { 0.001f, 3.09f },
+    };
+    float z = 3.09f;
+    for (unsigned i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+      if (table[i][0] <= p) {
+        z = table[i][1];
+        break;
+      }
+    }
+    return z;
+  }
+};
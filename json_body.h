@@ -0,0 +1,159 @@
+// JSON request body assembled from pieces: literal JSON, string values and
+// integers. String values are quoted and escaped as the body is read, so
+// user text goes onto the wire without being copied into a payload String,
+// and a quote or newline in it cannot break the request. size() is the
+// exact byte count of the escaped body, for Content-Length. The pieces are
+// referenced, not copied, and must outlive the reads. Plain C++, no Arduino
+// dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+class JsonBody {
+ public:
+  static const int MAX_PARTS = 12;
+
+  // Literal JSON, sent as is
+  JsonBody& raw(const char* json) { return raw(json, strlen(json)); }
+  JsonBody& raw(const char* json, size_t len) { return add(json, len, false); }
+
+  // A string value, quoted and escaped
+  JsonBody& string(const char* text) { return string(text, strlen(text)); }
+  JsonBody& string(const char* text, size_t len) { return add(text, len, true); }
+
+  JsonBody& number(int32_t value) {
+    if (count_ == MAX_PARTS) return fail();
+    Part& p = parts_[count_];
+    int len = snprintf(p.digits, sizeof(p.digits), "%ld", (long)value);
+    return add(p.digits, len, false);
+  }
+
+  // False if a piece did not fit in MAX_PARTS; the body is then incomplete
+  bool ok() const { return ok_; }
+  size_t size() const { return size_; }
+  size_t remaining() const { return size_ - sent_; }
+
+  // Copies up to len bytes of the body and returns the count, 0 at the end
+  size_t read(uint8_t* out, size_t len) {
+    size_t n = 0;
+    while (n < len) {
+      if (pendingPos_ < pendingLen_) {
+        out[n++] = pending_[pendingPos_++];
+        continue;
+      }
+      if (part_ == count_) break;
+      const Part& p = parts_[part_];
+      if (!p.escaped) {
+        size_t k = p.len - pos_ < len - n ? p.len - pos_ : len - n;
+        memcpy(out + n, p.data + pos_, k);
+        n += k;
+        pos_ += k;
+        if (pos_ == p.len) nextPart();
+        continue;
+      }
+      if (!opened_) {
+        opened_ = true;
+        out[n++] = '"';
+        continue;
+      }
+      // Copy the run of characters that need no escape in one go
+      size_t run = pos_;
+      while (run < p.len && run - pos_ < len - n && escapeOf((uint8_t)p.data[run]) == 0) run++;
+      memcpy(out + n, p.data + pos_, run - pos_);
+      n += run - pos_;
+      pos_ = run;
+      if (n == len) break;
+      if (pos_ == p.len) {
+        out[n++] = '"';
+        nextPart();
+      } else {
+        pendingLen_ = escapeTo((uint8_t)p.data[pos_++], pending_);
+        pendingPos_ = 0;
+      }
+    }
+    sent_ += n;
+    return n;
+  }
+
+  // Bytes text takes once escaped, without the quotes
+  static size_t escapedLength(const char* text, size_t len) {
+    size_t n = len;
+    for (size_t i = 0; i < len; i++) {
+      char e = escapeOf((uint8_t)text[i]);
+      if (e) n += e == 'u' ? 5 : 1;
+    }
+    return n;
+  }
+
+ private:
+  struct Part {
+    const char* data;
+    size_t len;
+    bool escaped;
+    char digits[12];
+  };
+
+  Part parts_[MAX_PARTS];
+  int count_ = 0;
+  size_t size_ = 0;
+  bool ok_ = true;
+
+  // Read position
+  int part_ = 0;
+  size_t pos_ = 0;
+  bool opened_ = false;
+  char pending_[6];  // Rest of an escape sequence split across reads
+  uint8_t pendingLen_ = 0;
+  uint8_t pendingPos_ = 0;
+  size_t sent_ = 0;
+
+  JsonBody& add(const char* data, size_t len, bool escaped) {
+    if (count_ == MAX_PARTS) return fail();
+    Part& p = parts_[count_++];
+    p.data = data;
+    p.len = len;
+    p.escaped = escaped;
+    size_ += escaped ? escapedLength(data, len) + 2 : len;
+    return *this;
+  }
+
+  JsonBody& fail() {
+    ok_ = false;
+    return *this;
+  }
+
+  void nextPart() {
+    part_++;
+    pos_ = 0;
+    opened_ = false;
+  }
+
+  // The character after the backslash, 'u' for \u00XX, or 0 if c is sent
+  // as is. UTF-8 sequences pass through unchanged.
+  static char escapeOf(uint8_t c) {
+    if (c >= 0x20) return c == '"' || c == '\\' ? c : 0;
+    switch (c) {
+      case '\n': return 'n';
+      case '\r': return 'r';
+      case '\t': return 't';
+      case '\b': return 'b';
+      case '\f': return 'f';
+      default: return 'u';
+    }
+  }
+
+  static uint8_t escapeTo(uint8_t c, char* out) {
+    static const char hex[] = "0123456789abcdef";
+    char e = escapeOf(c);
+    out[0] = '\\';
+    out[1] = e;
+    if (e != 'u') return 2;
+    out[2] = '0';
+    out[3] = '0';
+    out[4] = hex[c >> 4];
+    out[5] = hex[c & 15];
+    return 6;
+  }
+};
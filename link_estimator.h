@@ -0,0 +1,140 @@
+// Uplink estimator and upload profile selection. Keeps EWMAs of measured
+// upload throughput and round-trip time, and picks the audio encoding that
+// minimizes the expected end-of-speech-to-transcript latency. Throughput
+// samples pass through a median of three before the EWMA, so a single
+// outlier (a body that fit in the send buffer, a stalled write) is dropped
+// rather than averaged in. Switching needs a clear, repeated win
+// (hysteresis) so noise cannot make the profile flap. Plain C++, no
+// Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+
+enum UploadProfileId {
+  UPLOAD_LINEAR16_16K,
+  UPLOAD_FLAC_16K,
+  UPLOAD_MULAW_8K,
+  UPLOAD_PROFILE_COUNT
+};
+
+struct UploadProfile {
+  const char* name;
+  const char* encoding;     // RecognitionConfig.encoding
+  uint32_t sampleRate;
+  float bytesPerSecond;     // Encoded bytes per second of audio (initial guess)
+  float encodeMsPerSecond;  // On-device encode cost per second of audio (initial guess)
+  float qualityPenaltyMs;   // Latency we would rather pay than lose recognition accuracy
+};
+
+static const UploadProfile uploadProfiles[UPLOAD_PROFILE_COUNT] = {
+  { "LINEAR16_16K", "LINEAR16", 16000, 32000.0f, 0.0f, 0.0f },
+  { "FLAC_16K", "FLAC", 16000, 20000.0f, 25.0f, 0.0f },
+  { "MULAW_8K", "MULAW", 8000, 8000.0f, 1.0f, 400.0f },
+};
+
+class LinkEstimator {
+ public:
+  static constexpr float ALPHA = 0.3f;              // EWMA weight of a new sample
+  static constexpr float SWITCH_MARGIN = 0.15f;     // Required relative improvement
+  static const int SWITCH_CONFIRMATIONS = 2;        // Consecutive wins before switching
+  static const uint32_t MIN_UPLOAD_BYTES = 8192;    // Smaller bodies just fill the TCP send buffer
+
+  LinkEstimator() {
+    for (int i = 0; i < UPLOAD_PROFILE_COUNT; i++) {
+      bytesPerSecond_[i] = uploadProfiles[i].bytesPerSecond;
+      encodeMsPerSecond_[i] = uploadProfiles[i].encodeMsPerSecond;
+    }
+  }
+
+  // Body bytes and the time spent writing them to the socket.
+  void observeUpload(uint32_t bytes, uint32_t micros) {
+    if (bytes < MIN_UPLOAD_BYTES || micros == 0) return;
+    float sample = bytes * 1000.0f / micros;  // bytes per ms
+    if (!hasThroughput_) {
+      recent_[0] = recent_[1] = throughput_ = sample;
+      hasThroughput_ = true;
+      return;
+    }
+    float median = median3(sample, recent_[0], recent_[1]);
+    recent_[1] = recent_[0];
+    recent_[0] = sample;
+    throughput_ += ALPHA * (median - throughput_);
+  }
+
+  void observeRtt(float ms) {
+    if (ms <= 0) return;
+    rtt_ = hasRtt_ ? rtt_ + ALPHA * (ms - rtt_) : ms;
+    hasRtt_ = true;
+  }
+
+  // Refines the size and cost model of a profile from an actual encode.
+  void observeEncoding(UploadProfileId id, float audioSeconds, uint32_t encodedBytes, float encodeMs) {
+    if (audioSeconds < 0.5f) return;
+    bytesPerSecond_[id] += ALPHA * (encodedBytes / audioSeconds - bytesPerSecond_[id]);
+    encodeMsPerSecond_[id] += ALPHA * (encodeMs / audioSeconds - encodeMsPerSecond_[id]);
+  }
+
+  // Upload bytes per encoded byte (4/3 for base64 inside JSON).
+  void setPayloadInflation(float factor) { inflation_ = factor; }
+
+  float expectedLatencyMs(UploadProfileId id, float audioSeconds) const {
+    float bytes = bytesPerSecond_[id] * audioSeconds * inflation_;
+    return rtt_ + bytes / throughput_ + encodeMsPerSecond_[id] * audioSeconds + uploadProfiles[id].qualityPenaltyMs;
+  }
+
+  // Returns the profile to use for a clip of the given length. Stays on the
+  // current profile until another one wins by SWITCH_MARGIN on
+  // SWITCH_CONFIRMATIONS consecutive calls.
+  UploadProfileId choose(float audioSeconds) {
+    if (!hasThroughput_) return current_;
+
+    UploadProfileId best = current_;
+    float bestMs = expectedLatencyMs(current_, audioSeconds);
+    for (int i = 0; i < UPLOAD_PROFILE_COUNT; i++) {
+      float ms = expectedLatencyMs((UploadProfileId)i, audioSeconds);
+      if (ms < bestMs) {
+        best = (UploadProfileId)i;
+        bestMs = ms;
+      }
+    }
+
+    if (best == current_ || bestMs > expectedLatencyMs(current_, audioSeconds) * (1.0f - SWITCH_MARGIN)) {
+      candidateWins_ = 0;
+      return current_;
+    }
+    candidateWins_ = best == candidate_ ? candidateWins_ + 1 : 1;
+    candidate_ = best;
+    if (candidateWins_ >= SWITCH_CONFIRMATIONS) {
+      current_ = best;
+      candidateWins_ = 0;
+    }
+    return current_;
+  }
+
+  UploadProfileId current() const { return current_; }
+  bool hasThroughput() const { return hasThroughput_; }
+  float throughputBytesPerMs() const { return throughput_; }
+  float rttMs() const { return rtt_; }
+
+ private:
+  static float median3(float a, float b, float c) {
+    if (a > b) {
+      float t = a;
+      a = b;
+      b = t;
+    }
+    return c < a ? a : (c > b ? b : c);
+  }
+
+  float throughput_ = 0;  // bytes per ms
+  float recent_[2] = {};  // Last two raw samples, newest first
+  float rtt_ = 100.0f;
+  bool hasThroughput_ = false;
+  bool hasRtt_ = false;
+  float inflation_ = 4.0f / 3.0f;
+  float bytesPerSecond_[UPLOAD_PROFILE_COUNT];
+  float encodeMsPerSecond_[UPLOAD_PROFILE_COUNT];
+  UploadProfileId current_ = UPLOAD_LINEAR16_16K;
+  UploadProfileId candidate_ = UPLOAD_LINEAR16_16K;
+  int candidateWins_ = 0;
+};
@@ -4,9 +4,12 @@
 #include <WiFiMulti.h>
 #include <WebServer.h>
 #include <HTTPClient.h>
+#include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
 #include <EEPROM.h>
 #include <driver/i2s.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
 #include <Adafruit_SSD1306.h>
 #include <Adafruit_GFX.h>
 #include <Arduino_GFX_Library.h>
@@ -14,6 +17,26 @@
 #include <SD.h>
 #include <SPI.h>
 #include <FS.h>
+#include "rom/crc.h"
+#include "inflate.h"
+#include "flac_encoder.h"
+#include "link_estimator.h"
+#include "speculation.h"
+#include "mixer.h"
+#include "volume_limiter.h"
+#include "jitter_buffer.h"
+#include "read_ahead.h"
+#include "ima_adpcm.h"
+#include "archive_format.h"
+#include "json_body.h"
+#include "speech_text.h"
+#include "h2_client.h"
+#include "speech_grpc.h"
+#include "ws_client.h"
+#include "realtime_session.h"
+#include "gateway_session.h"
+#include "upload_body.h"
+#include "queue_journal.h"
 //#include "Audio.h"
 #define BACKGROUND BLACK
 
@@ -58,9 +81,142 @@ int cs = 5;
 #define SPI_MISO_PIN 19
 #define SPI_SCK_PIN 18
 
+// Offline utterance queue (store-and-forward while WiFi is down)
+#define QUEUE_DIR "/queue"
+#define QUEUE_JOURNAL_PATH "/queue/journal.bin"
+#define QUEUE_JOURNAL_TMP_PATH "/queue/journal.tmp"  // Compaction output until it replaces the journal
+#define QUEUE_INDEX_PATH "/queue/index.bin"
+#define QUEUE_INDEX_MAGIC 0x5149
+#define QUEUE_MAX_PENDING 32
+#define QUEUE_DRAIN_WORKERS 1        // Utterances processed concurrently while draining
+#define QUEUE_MAX_ATTEMPTS 3
+#define QUEUE_RETRY_DELAY_MS 30000
+
+// Ask the cloud APIs for gzip/deflate responses and inflate them on the fly
+#define ACCEPT_GZIP_RESPONSES
+#define HTTP_BODY_TIMEOUT_MS 10000
+
+// Answers are rewritten from markdown into plain sentences before TTS
+#define TTS_MAX_BYTES 5000  // Google TTS input limit; longer answers stop at a sentence
+
+// Connection pre-warming: sockets for the next pipeline stages are opened
+// in the background while the user is still speaking
+#define DNS_CACHE_SIZE 4
+#define DNS_CACHE_TTL_MS 60000      // Below the 300 s TTL Google publishes for its API hosts
+#define PREWARM_MAX_IDLE_MS 60000   // Drop warm sockets the server is likely to have closed
+#define PREWARM_WAIT_MS 3000        // How long a stage waits for an in-progress pre-warm
+//#define PREWARM_DURING_PLAYBACK   // Warm the speech socket while the answer plays
+
+// Speculative LLM queries on stable interim transcripts
+#define SPECULATION_ENABLED
+#define SPECULATION_MIN_STABILITY 0.8f  // Recognizer stability that counts as stable
+#define SPECULATION_STABLE_MS 400       // Or: interim text unchanged for this long
+
+// Streaming recognition: while the user speaks, audio goes to Speech-to-Text
+// StreamingRecognize (gRPC over HTTP/2), so interim results can start
+// speculation and the final transcript follows the release closely. The
+// REST request remains the fallback.
+#define STREAMING_STT_ENABLED
+#define STT_STREAM_CHUNK_MS 100            // Audio per request message
+#define STT_STREAM_FINAL_WAIT_MS 3000      // Release to final transcript before falling back
+#define STT_STREAM_LANGUAGE "en-US"
+
+// Realtime voice: one WebSocket session to the Gemini Live API carries the
+// microphone up and the spoken answer down, in place of the speech, LLM
+// and TTS requests. Turns follow the button (hold to talk), and a press
+// while the answer plays cuts it short. The request pipeline remains the
+// fallback when the session cannot be set up.
+//#define REALTIME_MODE
+#define REALTIME_PATH "/ws/google.ai.generativelanguage.v1beta.GenerativeService.BidiGenerateContent"
+#define REALTIME_MODEL "models/gemini-2.0-flash-live-001"
+#define REALTIME_CHUNK_MS 100           // Audio per realtimeInput message
+#define REALTIME_SETUP_WAIT_MS 5000     // Connect to setupComplete
+#define REALTIME_ANSWER_WAIT_MS 10000   // End of speech to the first answer audio
+#define REALTIME_IDLE_CLOSE_MS 300000   // Idle session kept open for the next turn
+
+// Voice gateway: a host on the LAN (tools/voice_gateway) makes the speech,
+// LLM and TTS requests for every device of the site over pooled HTTP/2
+// connections, and the device keeps one plain TCP connection to it for
+// the microphone up and the spoken answer down (gateway_protocol.h), with
+// no TLS or JSON of its own. Turns, barge-in and the fallback to the
+// request pipeline work as in REALTIME_MODE; set one or the other.
+//#define GATEWAY_MODE
+#define GATEWAY_HOST "192.168.1.20"
+#define GATEWAY_PORT 7700
+#define GATEWAY_UPLINK_CODEC gateway::CODEC_IMA_ADPCM  // A quarter of PCM16 on the WLAN
+#define GATEWAY_DOWNLINK_CODEC gateway::CODEC_PCM16
+#define GATEWAY_CONNECT_WAIT_MS 3000   // Connect to READY
+#if defined(GATEWAY_MODE) && defined(REALTIME_MODE)
+#error "GATEWAY_MODE and REALTIME_MODE both answer turns; set one"
+#endif
+
+// Caching proxy for the LLM and TTS requests (tools/api_cache_proxy): a
+// host on the LAN that answers questions the fleet has asked before from
+// its store, and makes one upstream call for identical requests that
+// arrive together. Requests go to it over plain HTTP, so these hosts get
+// no TLS socket of their own; speech recognition still goes to Google.
+#define API_PROXY_URL ""  // e.g. "http://192.168.1.20:8088"; empty calls Google directly
+
+// Speech backend for the recognize request (sttBackends). Google
+// Speech-to-Text takes the audio base64-encoded in JSON. A Whisper-style
+// server (OpenAI /v1/audio/transcriptions, whisper.cpp) takes a multipart
+// upload of the WAV, and STT_BACKEND_WAV_POST sends the WAV as the whole
+// body; both answer {"text": ...} and skip the base64 overhead.
+#define STT_BACKEND STT_BACKEND_GOOGLE
+#define STT_SERVER_URL "http://192.168.1.20:8080/v1/audio/transcriptions"
+#define STT_SERVER_MODEL "whisper-1"
+#define STT_SERVER_TOKEN ""  // Bearer token, if the server wants one
+
+// IMA ADPCM storage: 505 samples per 256-byte block
+#define ADPCM_BLOCK_ALIGN 256
+
+// Interaction archive (layout in archive_format.h; read it with tools/archive_stats)
+#define ARCHIVE_ENABLED
+#define ARCHIVE_DIR "/archive"
+#define ARCHIVE_INDEX_PATH "/archive/index.bin"
+#define ARCHIVE_SEGMENT_BYTES (256 * 1024)
+#define ARCHIVE_BUDGET_BYTES (8 * 1024 * 1024)
+#define ARCHIVE_TEXT_MAX 2048  // Per field
+
+// Playback task and local audio bank (start.wav, stop.wav, filler1.wav .. fillerN.wav)
+#define BANK_DIR "/bank"
+#define BANK_MAX_FILLERS 4
+#define FILLER_DELAY_MS 1200        // Silence tolerated after the stop chime before "one moment"
+#define CROSSFADE_MS 150            // Filler fade-out under the answer fade-in
+#define PLAYBACK_BLOCK_SAMPLES 256
+#define PLAYBACK_QUEUE_LENGTH 8
+#define VOLUME_DEFAULT 16           // VolumeLimiter step: 2 dB each, 20 is 0 dB
+#define VOLUME_INTENT_STEP 2        // "louder" / "quieter"
+#define JITTER_BUFFER_SAMPLES 16384        // 0.68 s at the 24 kHz TTS rate
+#define JITTER_UNDERRUN_PROBABILITY 0.01f  // Allowed chance of a gap per streamed answer
+#define READAHEAD_BLOCK_BYTES 8192  // SD read size for answer and filler files
+#define READAHEAD_BLOCKS 2          // Lead kept ahead of playback: 2 x 8 KB is ~370 ms at 24 kHz
+#define I2S_DMA_BUF_COUNT 16
+#define I2S_DMA_BUF_LEN 60          // Samples; 960 in flight is 22 ms of output, 60 ms of capture
+#define CAPTURE_READ_BYTES 512
+
+// Hold to talk: recording runs while BUTTON_PIN is held. A press released
+// within RECORD_TAP_MS is a tap and records RECORD_DURATION as before.
+#define RECORD_MAX_MS 15000
+#define RECORD_TAP_MS 400
+#define RECORD_RELEASE_DEBOUNCE_MS 30
+#define CAPTURE_STAGING_PSRAM_MS 10000    // Clips up to ~9 s never touch SD
+#define CAPTURE_STAGING_INTERNAL 16384    // Without PSRAM every clip spills
+#define CAPTURE_SPILL_BYTES 8192          // SD write size once a clip spills
+#define CAPTURE_SPILL_HEADROOM 32768      // Start spilling this far before the staging is full
+
+// Boot sequencer
+#define WIFI_FAST_CONNECT_MS 5000  // Direct association to the first network before WiFiMulti scans
+
+// Idle power: light sleep with GPIO wake and WiFi modem sleep in STATE_READY
+#define IDLE_AFTER_MS 5000   // Quiet time in READY before the device idles
+#define IDLE_POLL_MS 250     // Loop period while idle (web server, config pin)
+#define IDLE_MIN_FREQ_MHZ 80  // Floor for power management; APB (and the UART baud) stays at 80 MHz
+
 // EEPROM Settings
 #define EEPROM_SIZE 2048
-#define WIFI_CONFIG_MAGIC 0x55AA
+#define WIFI_CONFIG_MAGIC 0x55AB
+#define WIFI_CONFIG_MAGIC_NO_VOLUME 0x55AA  // Saved before DeviceConfig::volume existed
 #define WIFI_MAX_NETWORKS 3
 #define WIFI_CRED_MAX_LEN 32
 #define API_KEY_LEN 64
@@ -72,6 +228,7 @@ typedef struct {
   char googleSpeechApiKey[API_KEY_LEN] = "xxxxx";
   char googleTtsApiKey[API_KEY_LEN];
   char geminiApiKey[API_KEY_LEN];
+  uint8_t volume;  // Appended, so images saved before it keep their layout; see loadConfig()
 } DeviceConfig;
 
 // Function declarations
@@ -91,20 +248,87 @@ void startRecording();
 void stopRecording();
 void processSpeech();
 void queryGemini(const String& query);
-void textToSpeech(const String& text);
+void textToSpeech(const String& answer);
+bool transcribeFile(const char* path, String& transcript, String& error, int& httpCode);
+class RecordingReader;
+bool transcribeRecording(RecordingReader& reader, String& transcript, String& error, int& httpCode);
+bool fetchGeminiAnswer(const String& query, String& answer, String& error, int& httpCode);
+bool synthesizeToFile(const String& text, const char* path, String& error, int& httpCode);
+bool streamSpeech(const String& text, String& error, int& httpCode);
 void playAudio(const char* filename);
+void waitForPlayback();
+String readyMessage();
+
+void initUtteranceQueue();
+bool enqueueUtterance(const char* path);
+void serviceUtteranceQueue();
+bool playQueuedAnswer();
+
+void initNetwork();
+void prewarmTask(void* param);
+void requestPrewarm(uint32_t hostMask);
+void traceBegin();
+void traceReport();
+void initArchive();
+void archiveInteraction();
+
+void onInterimTranscript(const String& text, float stability);
+void resetSpeculation();
+void startSttStream();
+void cancelSttStream();
+void pollStreamInterim();
+bool takeStreamTranscript(String& transcript, bool& transcribed, String& error);
+void startRealtimeTurn();
+bool finishRealtimeTurn();
+void interruptRealtimeAnswer();
+void startStatusServer();
+void registerMetricsRoute();
+String renderMetrics();
+int countQueueEntries(uint8_t status);
+
+void initDisplay();
+void bootPhaseBegin(int phase);
+void bootPhaseEnd(int phase);
+void bootSdTask(void* param);
+void bootAudioTask(void* param);
+void bootReport();
+
+void initPower();
+void initPerf();
+void powerIdleCheck();
+void powerSleep();
+void powerWake();
+
+void initPlayback();
+void captureTask(void* param);
+void spillCapture(bool all);
+bool saveRecordingFile();
+void appendTaskMetrics(String& out);
+void playbackTask(void* param);
+void readAheadTask(void* param);
+void playCue(uint8_t cue);
+void playSpeechStream();
+void playTestTone(uint16_t hz, uint16_t ms);
+void scheduleFiller(uint32_t delayMs);
+void stopCues();
+void armFeedbackTimer();
+void setVolume(int step, bool persist);
+bool handleLocalIntent(const String& transcript);
 
 // Web Server
 WebServer server(80);
 WiFiMulti wifiMulti;
+unsigned long wifiConnectStartMs = 0;  // connectToWiFi() started associating
+bool wifiScanFallback = false;         // The direct association gave up; WiFiMulti scans
 DeviceConfig deviceConfig;
 
 // Audio Settings
 const int SAMPLE_RATE = 44100;
+const int RECORD_SAMPLE_RATE = 16000;  // Every upload profile derives from 16 kHz capture
 const int RECORD_DURATION = 5000;  // 5 seconds
 uint8_t* audioBuffer = nullptr;
 size_t audioBufferSize = 0;
-bool isPlayingAudio = false;
+volatile bool isPlayingAudio = false;
 
 // SD file for recording and playback
 File audioFile;
@@ -126,97 +350,726 @@ enum State {
 State currentState = STATE_INIT;
 String errorMessage = "";
 
+// Offline utterance queue. The journal is the source of truth (append-only,
+// CRC per record); the index is a compact snapshot that is rebuilt from the
+// journal whenever it is missing or does not cover the whole journal.
+enum QueueStatus : uint8_t {
+  QUEUE_FREE = 0,
+  QUEUE_PENDING = 1,   // Recorded offline, waiting for connectivity
+  QUEUE_ANSWERED = 2,  // Answer synthesized, waiting to be played
+  QUEUE_DONE = 3,      // Answer played, files removed
+  QUEUE_FAILED = 4     // Dropped after QUEUE_MAX_ATTEMPTS or a permanent error
+};
+
+typedef struct {
+  uint32_t seq;
+  uint8_t status;
+  uint8_t attempts;
+  uint16_t reserved;
+} QueueEntry;
+
+typedef struct {
+  uint16_t magic;
+  uint16_t count;
+  uint32_t nextSeq;
+  uint32_t journalSize;  // Journal bytes reflected by this index
+  uint32_t crc;          // CRC32 of the header fields above and the entries
+} QueueIndexHeader;
+
+QueueEntry queueEntries[QUEUE_MAX_PENDING];
+bool queueInFlight[QUEUE_MAX_PENDING];
+unsigned long queueLastAttempt[QUEUE_MAX_PENDING];
+uint16_t queueCount = 0;
+uint32_t queueNextSeq = 1;
+uint32_t queueJournalSize = 0;
+volatile int queueActiveWorkers = 0;
+SemaphoreHandle_t queueMutex = nullptr;
+
 bool isConfigModeActive = false;
 
-void setup() {
-  Serial.begin(115200);
+// Cloud API hosts, indexed by ApiHost
+enum ApiHost {
+  API_SPEECH,
+  API_GEMINI,
+  API_TTS,
+  API_HOST_COUNT
+};
+const char* const apiHostNames[API_HOST_COUNT] = {
+  "speech.googleapis.com",
+  "generativelanguage.googleapis.com",
+  "texttospeech.googleapis.com"
+};
+// Hosts whose requests go through API_PROXY_URL when it is set
+const bool apiHostProxied[API_HOST_COUNT] = { false, true, true };
+
+// Speech backends, and how each wants the audio
+enum SttBackendId {
+  STT_BACKEND_GOOGLE,
+  STT_BACKEND_WHISPER,
+  STT_BACKEND_WAV_POST,
+  STT_BACKEND_COUNT
+};
 
-  // Reset TFT display pin manually
-  pinMode(1, OUTPUT);
-  digitalWrite(1, LOW);
-  delay(50);
-  digitalWrite(1, HIGH);
-  delay(50);
+enum UploadBodyKind : uint8_t {
+  BODY_JSON_BASE64,  // Audio base64-encoded inside the JSON request
+  BODY_MULTIPART,    // multipart/form-data with the audio as a file part
+  BODY_FILE          // The audio file is the whole body
+};
 
-  //init tft
-  gfx->begin();
-  gfx->fillScreen(BACKGROUND);
+typedef struct {
+  const char* name;
+  UploadBodyKind body;
+  float inflation;  // Upload bytes per encoded audio byte, for the link estimator
+} SttBackend;
+
+const SttBackend sttBackends[STT_BACKEND_COUNT] = {
+  { "google", BODY_JSON_BASE64, 4.0f / 3.0f },
+  { "whisper", BODY_MULTIPART, 1.0f },
+  { "wav-post", BODY_FILE, 1.0f },
+};
 
-#ifdef TFT_BL
-  pinMode(TFT_BL, OUTPUT);
-  digitalWrite(TFT_BL, HIGH);
-#endif
+typedef struct {
+  const char* host;
+  IPAddress ip;
+  unsigned long resolvedAt;
+} DnsCacheEntry;
+
+enum SocketState : uint8_t {
+  SOCKET_IDLE,
+  SOCKET_CONNECTING,
+  SOCKET_READY,
+  SOCKET_IN_USE
+};
 
+// TLS client that measures how long writes take, which is how upload
+// throughput is sampled for the link estimator.
+class MeteredClient : public WiFiClientSecure {
+public:
+  uint32_t bytesWritten = 0;
+  uint32_t writeMicros = 0;
+  int64_t lastWriteUs = 0;  // esp_timer time the last write returned
+
+  void resetMeter() {
+    bytesWritten = 0;
+    writeMicros = 0;
+  }
 
-  // Initialize OLED
-  //if(!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
-  //  Serial.println(F("SSD1306 allocation failed"));
-  //  while(1);
-  //}
-  displayStatus("Booting...Next Sd Init");
+  size_t write(const uint8_t* buf, size_t size) override {
+    unsigned long start = micros();
+    size_t written = WiFiClientSecure::write(buf, size);
+    writeMicros += micros() - start;
+    lastWriteUs = esp_timer_get_time();
+    bytesWritten += written;
+    return written;
+  }
+  using WiFiClientSecure::write;
+};
 
-  // Initialize EEPROM
-  EEPROM.begin(EEPROM_SIZE);
-  loadConfig();
+// One TLS socket per API host, owned by the foreground pipeline. The
+// pre-warm task connects it ahead of time; beginApiRequest() hands it to
+// HTTPClient, which reuses the open connection.
+typedef struct {
+  MeteredClient client;
+  volatile SocketState state;
+  unsigned long readyAt;
+  uint32_t connectMs;  // DNS + TCP + TLS time paid by the pre-warm task
+} ApiSocket;
+
+DnsCacheEntry dnsCache[DNS_CACHE_SIZE];
+ApiSocket apiSockets[API_HOST_COUNT];
+SemaphoreHandle_t netMutex = nullptr;
+LinkEstimator linkEstimator;
+EventGroupHandle_t prewarmEvents = nullptr;
+TaskHandle_t foregroundTask = nullptr;
+
+// Per-interaction timeline, printed when the device returns to ready
+enum TraceMark {
+  TRACE_BUTTON,
+  TRACE_RECORD_END,
+  TRACE_STT_DONE,
+  TRACE_LLM_DONE,
+  TRACE_TTS_DONE,
+  TRACE_PLAYBACK_END,
+  TRACE_MARK_COUNT
+};
 
-  // Initialize SPI with custom pins
-  SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN, SD_CS_PIN);
+typedef struct {
+  bool active;
+  unsigned long marks[TRACE_MARK_COUNT];
+  uint8_t prewarmHits;
+  uint8_t prewarmMisses;
+  uint32_t prewarmSavedMs;
+  uint32_t feedbackMs;  // End of speech to first audible cue; 0 if none played
+} InteractionTrace;
+InteractionTrace trace = {};
+
+// Archive state; the header mirrors index.bin
+typedef struct {
+  bool ready;
+  archive::IndexHeader header;
+  String transcript;  // Of the interaction in progress
+  String response;
+  uint32_t lastWriteMs;
+  uint64_t bytesWritten;
+} ArchiveState;
+ArchiveState archiveState = {};
+
+// Markdown-to-speech rewriting of the answers sent to TTS
+typedef struct {
+  uint32_t answers;
+  uint64_t bytesIn;
+  uint64_t bytesOut;
+  uint32_t sentences;
+  uint32_t truncated;  // Answers cut at a sentence to fit TTS_MAX_BYTES
+  uint32_t lastMicros;
+} SpeechTextStats;
+SpeechTextStats speechTextStats = {};
+void traceMark(TraceMark mark);
+
+// Playback requests handled by the playback task, which owns I2S_NUM_1
+enum PlaybackKind : uint8_t {
+  PLAYBACK_ANSWER,  // Main voice; isPlayingAudio tracks it
+  PLAYBACK_STREAM,  // Main voice fed from speechStream
+  PLAYBACK_CUE,     // Chime, replaces any cue still sounding
+  PLAYBACK_FILLER,  // Delayed "one moment" phrase, dropped if the answer comes first
+  PLAYBACK_TEST_TONE,
+  PLAYBACK_STOP_CUES,
+  PLAYBACK_STOP_ANSWER,  // Fades the main voice out (barge-in)
+  PLAYBACK_SET_VOLUME
+};
+
+enum CueId : uint8_t {
+  CUE_START,
+  CUE_STOP,
+  CUE_CONFIRM,
+  CUE_COUNT
+};
+
+// Bank file for each cue, and the tone synthesized when it is missing
+typedef struct {
+  const char* path;
+  uint16_t toneHz;
+} CueSound;
+static const CueSound cueSounds[CUE_COUNT] = {
+  { BANK_DIR "/start.wav", 880 },
+  { BANK_DIR "/stop.wav", 660 },
+  { BANK_DIR "/confirm.wav", 1320 },
+};
+
+typedef struct {
+  PlaybackKind kind;
+  uint8_t volume;
+  uint32_t delayMs;
+  uint16_t toneHz;  // Cue synthesized in place of a missing bank file
+  uint16_t toneMs;
+  char path[48];
+} PlaybackRequest;
+
+// One sounding voice: a WAV (PCM or IMA ADPCM; headerless PCM at
+// SAMPLE_RATE) file on SD, the network speech stream, or a synthesized tone. Sources at other rates are linearly resampled.
+// Each voice owns the mixer slot of the same index.
+enum VoiceSlot {
+  VOICE_FILLER,
+  VOICE_ANSWER,
+  VOICE_CUE,
+  VOICE_TONE,
+  VOICE_COUNT
+};
+
+// Higher priorities duck the lower ones while they play
+static const uint8_t voicePriority[VOICE_COUNT] = { 0, 1, 2, 3 };
+
+typedef struct {
+  bool active;
+  File file;             // Until handed to the read-ahead task
+  ReadAhead* readAhead;  // Answer and filler only; cues are short enough to read inline
+  JitterBuffer* stream;
+  uint32_t remaining;  // Bytes left in the data chunk
+  bool coded;          // IMA ADPCM: file bytes are decoded into buf
+  ImaAdpcmDecoder adpcm;
+  uint8_t codedBuf[PLAYBACK_BLOCK_SAMPLES / 2];  // Decodes to at most a full buf
+  uint16_t toneHz;
+  uint32_t toneLength;  // Samples
+  uint32_t tonePos;
+  uint32_t step;   // Source samples per output sample, Q16
+  uint32_t phase;  // Position between prev and next, Q16
+  int16_t prev;
+  int16_t next;
+  int16_t buf[PLAYBACK_BLOCK_SAMPLES];
+  uint16_t bufLen;
+  uint16_t bufPos;
+} Voice;
+Voice voices[VOICE_COUNT];
+
+// Audio formats a WAV may carry here: 16-bit PCM or 4-bit IMA ADPCM, mono
+typedef struct {
+  uint16_t format;  // 1 or ImaAdpcm::FORMAT_TAG
+  uint32_t sampleRate;
+  uint16_t blockAlign;
+  uint32_t dataBytes;
+} WavInfo;
+Mixer mixer(SAMPLE_RATE);
+VolumeLimiter volumeLimiter(SAMPLE_RATE);
+JitterBuffer* speechStream = nullptr;  // TTS audio on its way from the network
+
+// Files being read ahead, owned by the read-ahead task once handed over
+File readAheadFiles[VOICE_COUNT];
+TaskHandle_t readAheadTaskHandle = nullptr;
+uint32_t readAheadMaxMicros = 0;  // Slowest single SD block read
+
+typedef struct {
+  bool hasCue[CUE_COUNT];
+  int fillers;
+  int nextFiller;
+} AudioBank;
+AudioBank bank = {};
+QueueHandle_t playbackQueue = nullptr;
+
+typedef struct {
+  volatile unsigned long feedbackArmedAt;  // End of speech, 0 once measured
+  uint32_t lastFeedbackMs;
+  uint64_t feedbackMsTotal;
+  uint32_t feedbackCount;
+  uint32_t cuesPlayed;
+  uint32_t fillersPlayed;
+  uint32_t crossfades;
+} PlaybackStats;
+PlaybackStats playbackStats = {};
+
+// Speculative Gemini request started from an interim transcript. The
+// background task owns query/answer while state is SPEC_RUNNING.
+enum SpeculationState : uint8_t {
+  SPEC_IDLE,
+  SPEC_RUNNING,
+  SPEC_DONE
+};
+
+typedef struct {
+  volatile SpeculationState state;
+  volatile bool cancelled;
+  String query;  // Normalized interim transcript
+  String answer;
+  String error;
+  bool ok;
+  unsigned long startedAt;
+  unsigned long durationMs;
+} Speculation;
+Speculation speculation;
+speculative::StableInterim speculationInterim(SPECULATION_MIN_STABILITY, SPECULATION_STABLE_MS);
+
+typedef struct {
+  uint32_t attempts;
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t savedMs;
+} SpeculationStats;
+SpeculationStats speculationStats = {};
+
+// Streaming recognition of the current recording. The stream task owns the
+// connection; the loop reads the newest interim under lock and the result
+// once done is given.
+typedef struct {
+  volatile bool running;    // Task alive; a new recording does not stream until it exits
+  volatile bool active;     // Streaming the current recording
+  volatile bool audioEnded; // Capture has stopped; head is final
+  volatile bool cancelled;
+  SemaphoreHandle_t done;
+  SemaphoreHandle_t lock;   // Guards the interim fields
+  String interim;
+  float interimStability;
+  volatile bool interimFresh;
+  unsigned long interimPolledAt;
+  bool ok;                  // Result: the stream settled the transcript
+  bool noSpeech;            // Ended cleanly without a final result
+  String transcript;
+  String error;
+  int64_t audioEndUs;       // END_STREAM sent
+} SttStream;
+SttStream sttStream;
+
+typedef struct {
+  uint32_t streams;
+  uint32_t transcripts;     // Streams that produced the transcript
+  uint32_t fallbacks;       // Recordings sent through the REST request instead
+  uint32_t busy;            // Not streamed: the previous stream had not exited
+  uint32_t interims;
+  uint32_t windowStalls;    // Sends held back by HTTP/2 flow control
+  uint32_t lastConnectMs;
+  uint32_t lastFinalMs;     // End of audio to final transcript
+  uint64_t finalMsTotal;
+} SttStreamStats;
+SttStreamStats sttStreamStats = {};
+
+// Realtime voice session. The realtime task owns the WebSocket and keeps
+// it open between turns; the loop starts and ends turns through the flags
+// and learns how the answer went from the others. In GATEWAY_MODE the
+// gateway task plays the same part over its TCP connection.
+typedef struct {
+  volatile bool active;      // The current recording is a realtime turn
+  volatile uint32_t turn;    // Bumped for each recording
+  volatile bool audioEnded;  // Capture has stopped; head is final
+  volatile bool ready;       // setupComplete received
+  volatile bool answering;   // Answer audio is arriving
+  volatile bool playing;     // The answer voice has been started
+  volatile bool answered;    // The turn is complete
+  volatile bool failed;      // The session dropped before the answer
+  volatile bool discarding;  // Barge-in or fallback: drop the rest of the answer
+  bool interrupted;          // Loop: the answer voice is fading out
+  volatile bool goAway;
+  int64_t audioEndUs;        // activityEnd sent
+} RealtimeState;
+RealtimeState realtime = {};
+TaskHandle_t realtimeTaskHandle = nullptr;
+
+typedef struct {
+  uint32_t sessions;
+  uint32_t setupFailures;
+  uint32_t turns;
+  uint32_t answers;
+  uint32_t interruptions;   // Answers cut short by a press
+  uint32_t fallbacks;       // Turns answered through the request pipeline instead
+  uint32_t lastConnectMs;   // Connect to setupComplete
+  uint32_t lastTurnMs;      // End of speech to the first answer audio
+  uint64_t turnMsTotal;
+  uint64_t audioBytesSent;
+  uint64_t audioSamplesReceived;
+} RealtimeStats;
+RealtimeStats realtimeStats = {};
+
+// Gateway turns are also counted in realtimeStats; these are the gateway's
+// own stage times from TURN_DONE
+typedef struct {
+  uint32_t failures;        // TURN_DONE with a failed stage
+  uint32_t cancels;
+  uint32_t lastSttMs;       // End of speech to the final transcript
+  uint32_t lastLlmMs;       // Transcript to the answer text
+  uint32_t lastTtsMs;       // Answer text to the first answer audio
+  uint64_t bytesSent;
+  uint64_t bytesReceived;
+} GatewayStats;
+GatewayStats gatewayStats = {};
+
+// Responses from API_PROXY_URL, by its X-Cache header
+typedef struct {
+  uint32_t requests;
+  uint32_t hits;    // Answered from the proxy's store
+  uint32_t shared;  // Answered by an upstream call another device started
+} ProxyStats;
+ProxyStats proxyStats = {};
+
+// Downlink accounting for cloud responses (wire bytes vs decoded bytes)
+typedef struct {
+  uint32_t responses;
+  uint32_t compressedResponses;
+  uint64_t wireBytes;
+  uint64_t decodedBytes;
+  uint64_t inflateMicros;
+} DownlinkStats;
+DownlinkStats downlinkStats = {};
+
+// Boot phases. SD and audio come up in tasks while the display is
+// initialized, after WiFi association has been started.
+enum BootPhase {
+  BOOT_CONFIG,
+  BOOT_WIFI_START,
+  BOOT_DISPLAY,
+  BOOT_SD,
+  BOOT_QUEUE,
+  BOOT_ARCHIVE,
+  BOOT_AUDIO,
+  BOOT_PLAYBACK,
+  BOOT_PHASE_COUNT
+};
+const char* const bootPhaseNames[BOOT_PHASE_COUNT] = { "config", "wifi_start", "display", "sd", "queue", "archive", "audio", "playback" };
+#define BOOT_SD_DONE (1 << 0)
+#define BOOT_AUDIO_DONE (1 << 1)
+
+typedef struct {
+  uint32_t startMs[BOOT_PHASE_COUNT];
+  uint32_t durationMs[BOOT_PHASE_COUNT];
+  uint32_t setupMs;  // setup() returned
+  uint32_t wifiMs;   // First association
+  uint32_t readyMs;  // First STATE_READY
+  volatile bool sdOk;
+} BootTimings;
+BootTimings bootTimings = {};
+EventGroupHandle_t bootEvents = nullptr;
+bool displayReady = false;
+
+// Idle power state. The loop task holds the no-light-sleep lock except
+// while idle; the I2S drivers hold their own PM locks while running, so
+// they are stopped for the idle period. The CPU clock is left to the
+// performance policy below.
+typedef struct {
+  volatile bool idle;
+  bool lightSleep;               // esp_pm_configure accepted light sleep
+  unsigned long quietSince;
+  unsigned long idleSince;
+  volatile int64_t wakeEdgeUs;   // Set by the button interrupt while idle
+  int64_t wakeFromUs;
+  bool measurePending;           // Woken by the button; startRecording() closes the measurement
+  uint32_t entries;
+  uint64_t idleMsTotal;
+  uint32_t lastWakeToRecordMs;
+  uint64_t wakeToRecordMsTotal;
+  uint32_t wakeToRecordCount;
+} IdlePower;
+IdlePower idlePower = {};
+esp_pm_lock_handle_t noSleepLock = nullptr;
+SemaphoreHandle_t powerMutex = nullptr;
+TaskHandle_t loopTaskHandle = nullptr;
+
+// Performance policy: each pipeline stage either pins the CPU at its top
+// clock or leaves power management free to drop it to IDLE_MIN_FREQ_MHZ.
+// The loop task holds the stage of the current state; heavier work inside
+// a state, and the playback task while it mixes, hold their own stage.
+enum PerfStage : uint8_t {
+  PERF_IDLE,
+  PERF_NETWORK,
+  PERF_CAPTURE,
+  PERF_ENCODE,
+  PERF_DECODE,
+  PERF_MIX,
+  PERF_STAGE_COUNT
+};
+
+typedef struct {
+  const char* name;
+  bool maxClock;
+} PerfPolicy;
+
+constexpr PerfPolicy perfPolicy[PERF_STAGE_COUNT] = {
+  { "idle", false },
+  { "network", false },  // Waiting on sockets: the radio, not the CPU, sets the pace
+  { "capture", true },   // I2S reads and SD writes while recording
+  { "encode", true },    // FLAC / mu-law upload encoding
+  { "decode", true },    // JSON parse and base64 decode of responses
+  { "mix", true },       // Mixer, resampler and limiter
+};
+
+constexpr PerfStage stateStage[] = {
+  PERF_IDLE,     // STATE_INIT
+  PERF_NETWORK,  // STATE_WIFI_CONFIG
+  PERF_NETWORK,  // STATE_WIFI_CONNECTING
+  PERF_NETWORK,  // STATE_WIFI_CONNECTED
+  PERF_IDLE,     // STATE_READY
+  PERF_IDLE,     // STATE_RECORDING: the capture task holds PERF_CAPTURE
+  PERF_NETWORK,  // STATE_PROCESSING_SPEECH
+  PERF_NETWORK,  // STATE_QUERYING_AI
+  PERF_NETWORK,  // STATE_PROCESSING_TTS
+  PERF_IDLE,     // STATE_PLAYING: the playback task holds PERF_MIX
+  PERF_IDLE,     // STATE_ERROR
+};
+static_assert(sizeof(stateStage) / sizeof(stateStage[0]) == STATE_ERROR + 1, "one stage per State");
+
+typedef struct {
+  esp_pm_lock_handle_t locks[PERF_STAGE_COUNT];  // CPU_FREQ_MAX, for maxClock stages
+  uint32_t maxMhz;
+  uint32_t maxHolders;
+  int64_t sinceUs;
+  uint64_t minUs;  // Time with no stage pinning the clock (includes light sleep)
+  uint64_t maxUs;
+  uint32_t entries[PERF_STAGE_COUNT];
+  uint64_t stageUs[PERF_STAGE_COUNT];
+} PerfStats;
+PerfStats perf = {};
+portMUX_TYPE perfMux = portMUX_INITIALIZER_UNLOCKED;
+
+bool perfBegin(PerfStage stage);
+void perfEnd(PerfStage stage, int64_t startUs);
+void perfSetState(State state);
+
+// Holds a stage for the enclosing scope
+struct PerfScope {
+  PerfStage stage;
+  int64_t startUs;
+  bool held;
+  explicit PerfScope(PerfStage s) : stage(s), startUs(esp_timer_get_time()), held(perfBegin(s)) {}
+  ~PerfScope() {
+    if (held) perfEnd(stage, startUs);
+  }
+};
+
+// Scheduling plan. Core 1 (APP) runs the audio tasks above everything
+// else on it, including the Arduino loop (state machine, display,
+// foreground requests) at priority 1. Core 0 (PRO) runs the WiFi and
+// lwIP tasks, so background network and TLS work goes there too, below
+// them. Every task is started from this table through startTask().
+enum TaskRole : uint8_t {
+  TASK_PLAYBACK,
+  TASK_CAPTURE,
+  TASK_READ_AHEAD,
+  TASK_PREWARM,
+  TASK_SPECULATE,
+  TASK_STT_STREAM,
+  TASK_REALTIME,
+  TASK_QUEUE_DRAIN,
+  TASK_BOOT_SD,
+  TASK_BOOT_AUDIO,
+  TASK_ROLE_COUNT
+};
+
+typedef struct {
+  const char* name;
+  uint32_t stack;
+  UBaseType_t priority;
+  BaseType_t core;
+} TaskPlan;
+
+constexpr TaskPlan taskPlan[TASK_ROLE_COUNT] = {
+  { "playback", 6144, 10, APP_CPU_NUM },
+  { "capture", 4096, 10, APP_CPU_NUM },
+  { "readAhead", 4096, 8, APP_CPU_NUM },  // Feeds playback; below it, above the loop
+  { "prewarm", 8192, 3, PRO_CPU_NUM },
+  { "speculate", 12288, 2, PRO_CPU_NUM },
+  { "sttStream", 12288, 4, PRO_CPU_NUM },  // Real-time upload; above the other background work
+  { "realtime", 12288, 4, PRO_CPU_NUM },   // Same, both ways
+  { "queueDrain", 16384, 1, PRO_CPU_NUM },
+  { "bootSd", 8192, 2, tskNO_AFFINITY },  // Boot only
+  { "bootAudio", 4096, 2, tskNO_AFFINITY },
+};
+
+// Audio deadlines. A playback block has to reach i2s_write before the
+// DMA ring drains, and a capture read has to come back before the RX ring
+// overflows; a gap longer than the ring is a missed deadline.
+typedef struct {
+  uint32_t playbackBlocks;
+  uint32_t playbackMisses;
+  uint32_t playbackMaxBlockUs;  // Mix + limiter time for one block
+  uint32_t playbackMaxGapUs;
+  uint32_t captureReads;
+  uint32_t captureMisses;
+  uint32_t captureMaxGapUs;
+} AudioDeadlines;
+AudioDeadlines audioDeadlines = {};
+TaskHandle_t captureTaskHandle = nullptr;
+SemaphoreHandle_t captureStopped = nullptr;
+volatile bool captureActive = false;
+
+// Capture staging, the first tier of the recording store. The capture
+// task appends PCM; a clip that fits stays here and is read in place by
+// RecordingReader. Once the fill passes spillAt, or with archival on, the
+// loop spills it to /recording.wav in blocks and keeps doing so until the
+// release, after which the file holds the clip.
+typedef struct {
+  uint8_t* data;
+  uint32_t size;
+  uint32_t spillAt;
+  volatile uint32_t head;  // Bytes captured since startRecording()
+  volatile uint32_t tail;  // Bytes written to the file
+  bool spilled;            // The clip lives in /recording.wav
+  bool saved;              // An in-memory clip has also been written out
+  uint32_t peak;           // Highest fill seen
+  uint32_t overflows;      // Reads dropped because the staging was full
+  uint32_t spills;
+} CaptureStaging;
+CaptureStaging captureStaging = {};
+bool recordingArchival = false;  // Write every clip through to SD
+
+typedef struct {
+  uint32_t inMemory;         // Clips that never touched SD
+  uint32_t spilled;
+  uint64_t writeBytesAvoided;
+  uint64_t readBytesAvoided;
+  uint32_t lastBytesAvoided;  // Last interaction, write + reread
+} RecordingStoreStats;
+RecordingStoreStats recordingStoreStats = {};
+
+// Recognize request bodies, by how the audio travelled
+typedef struct {
+  uint32_t jsonUploads;
+  uint32_t binaryUploads;
+  uint64_t bodyBytes;
+  uint64_t base64BytesAvoided;  // What base64 would have added to the binary uploads
+  uint32_t lastEncodeMicros;    // Encoder and base64 time of the last upload
+  uint64_t encodeMicrosTotal;
+} UploadStats;
+UploadStats uploadStats = {};
+
+// Hold-to-talk timings for the last recording
+typedef struct {
+  int64_t releaseUs;  // Release edge; 0 once the upload has been measured
+  uint32_t recordingMs;
+  uint32_t releaseToFinalizeMs;
+  uint32_t releaseToUploadMs;
+  uint64_t releaseToUploadMsTotal;
+  uint32_t releaseToUploadCount;
+  uint32_t holds;
+  uint32_t taps;
+} RecordingStats;
+RecordingStats recordingStats = {};
+
+BaseType_t startTask(TaskRole role, TaskFunction_t fn, void* param, TaskHandle_t* handle = nullptr);
+
+void setup() {
+  Serial.begin(115200);
+  initNetwork();
+  bootEvents = xEventGroupCreate();
 
-// Initialize SD card
-#ifdef REASSIGN_PINS
-  //SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN, SPI_CS_PIN);
-  if (!SD.begin(SD_CS_PIN)) {
+  // Configuration first: WiFi association needs the credentials, and the
+  // config pin decides what else is brought up
+  bootPhaseBegin(BOOT_CONFIG);
+  EEPROM.begin(EEPROM_SIZE);
+  loadConfig();
+  pinMode(BUTTON_PIN, INPUT_PULLUP);
+  pinMode(CONFIG_PIN, INPUT_PULLUP);
+  pinMode(I2S_SD, OUTPUT);
+#ifdef DISABLE_AUDIO_OUTPUT_ON_BOOT
+  digitalWrite(I2S_SD, LOW);  // Disable amplifier on boot
 #else
-  if (!SD.begin(SD_CS_PIN)) {
+  digitalWrite(I2S_SD, HIGH);  // Enable amplifier
 #endif
+  bool configMode = digitalRead(CONFIG_PIN) == LOW && !isConfigModeActive;
+  bootPhaseEnd(BOOT_CONFIG);
 
+  // Association is the longest step, so it starts before anything else
+  if (!configMode) {
+    bootPhaseBegin(BOOT_WIFI_START);
+    connectToWiFi();
+    bootPhaseEnd(BOOT_WIFI_START);
+  }
+
+  // SD (then the offline queue) and the I2S drivers come up in parallel
+  // with the display. The SD card and the TFT are on separate SPI buses.
+  // Config mode needs the audio too, for its mic and speaker tests.
+  EventBits_t wanted = BOOT_SD_DONE | BOOT_AUDIO_DONE;
+  startTask(TASK_BOOT_SD, bootSdTask, NULL);
+  startTask(TASK_BOOT_AUDIO, bootAudioTask, NULL);
+
+  bootPhaseBegin(BOOT_DISPLAY);
+  initDisplay();
+  bootPhaseEnd(BOOT_DISPLAY);
+  displayStatus("Booting...");
+
+  xEventGroupWaitBits(bootEvents, wanted, pdFALSE, pdTRUE, portMAX_DELAY);
+  if (!bootTimings.sdOk) {
     Serial.println("Card Mount Failed");
     setError("SD Card Init Failed");
-    // Reset TFT display pin manually
-    gfx->displayOn();
-    pinMode(1, OUTPUT);
-    digitalWrite(1, LOW);
-    delay(50);
-    digitalWrite(1, HIGH);
-    delay(50);
-
-    //init tft
-    gfx->begin();
-    digitalWrite(TFT_BL, LOW);
-    gfx->fillScreen(BACKGROUND);
-    gfx->displayOn();
-    digitalWrite(TFT_BL, HIGH);
     displayStatus("SD Card Fail ");
-    gfx->displayOn();
 
     // Halt further operation since SD card is critical for recording/playback
     while (true) {
       delay(1000);
     }
-  } else {
-    Serial.println("SD Card Initialized");
-    Serial.println("SD Card Initialized successfully");
-    displayStatus("SD Card Ready");
   }
-  // Initialize hardware
-  pinMode(BUTTON_PIN, INPUT_PULLUP);
-  pinMode(CONFIG_PIN, INPUT_PULLUP);
-  pinMode(I2S_SD, OUTPUT);
-#ifdef DISABLE_AUDIO_OUTPUT_ON_BOOT
-  digitalWrite(I2S_SD, LOW);  // Disable amplifier on boot
-#else
-  digitalWrite(I2S_SD, HIGH);  // Enable amplifier
-#endif
+  Serial.println("SD Card Initialized successfully");
 
-  // Check for config mode
-  if (digitalRead(CONFIG_PIN) == LOW && !isConfigModeActive) {
+  // Needs the SD card (audio bank) and the config (volume)
+  bootPhaseBegin(BOOT_PLAYBACK);
+  initPlayback();
+  bootPhaseEnd(BOOT_PLAYBACK);
+
+  if (configMode) {
+    bootReport();
     enterConfigMode();
     return;
   }
+  initPower();
+  initPerf();
 
-  setupAudioHardware();
-  // Removed automatic WiFi connect on boot to wait for WiFi selection via WiFi manager
-  connectToWiFi();
+  bootTimings.setupMs = millis();
+  bootReport();
+  displayStatus("Connecting WiFi...");
 }
 
 void loop() {
@@ -226,6 +1079,8 @@ void loop() {
   }
 
   static unsigned long recordStartTime = 0;
+  static bool recordTap = false;
+  static unsigned long recordReleasedAt = 0;
   static unsigned long stateEnterTime = 0;
 
   // State machine
@@ -248,19 +1103,40 @@ void loop() {
     configButtonWasPressed = false;
   }
 
+  // A press while idle restores clocks and WiFi before it is handled
+  if (idlePower.idle && digitalRead(BUTTON_PIN) == LOW) powerWake();
+  perfSetState(currentState);
+
+  serviceUtteranceQueue();
+  server.handleClient();
+
   switch (currentState) {
     case STATE_INIT:
       break;
     case STATE_WIFI_CONNECTING:
       {
         static int currentNetworkIndex = 0;
-        if (wifiMulti.run() == WL_CONNECTED) {
+        // connectToWiFi() started associating with the first network;
+        // WiFiMulti takes over (scanning all of them) as soon as the
+        // driver reports that network missing or refusing us, or if it is
+        // slow
+        wl_status_t status = WiFi.status();
+        bool connected = status == WL_CONNECTED;
+        if (!connected && (status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED
+                           || millis() - wifiConnectStartMs > WIFI_FAST_CONNECT_MS)) {
+          wifiScanFallback = true;
+        }
+        if (!connected && wifiScanFallback) {
+          connected = wifiMulti.run() == WL_CONNECTED;
+        }
+        if (connected) {
+          if (!bootTimings.wifiMs) bootTimings.wifiMs = millis();
           displayStatus("WiFi Connected to network #" + String(currentNetworkIndex + 1));
           Serial.print("Connected to: ");
           Serial.println(WiFi.SSID());
           currentState = STATE_WIFI_CONNECTED;
           stateEnterTime = millis();
-        } else if (millis() > stateEnterTime + 30000) {  // 30s timeout
+        } else if (millis() - wifiConnectStartMs > 30000) {  // 30s timeout
           enterConfigMode();
         } else {
           // Update currentNetworkIndex based on which network is currently connected or being tried
@@ -270,9 +1146,12 @@ void loop() {
         break;
       }
     case STATE_WIFI_CONNECTED:
-      if (millis() > stateEnterTime + 2000) {  // Brief display of connection status
-        displayStatus("Ready\nPress to record");
-        currentState = STATE_READY;
+      startStatusServer();
+      displayStatus(readyMessage());
+      currentState = STATE_READY;
+      if (!bootTimings.readyMs) {
+        bootTimings.readyMs = millis();
+        bootReport();
       }
       break;
     case STATE_READY:
@@ -283,30 +1162,67 @@ void loop() {
           if (now - lastButtonPress > 200) {  // 200ms debounce
             displayStatus("Recording...");
             currentState = STATE_RECORDING;
+            traceBegin();
+            resetSpeculation();
+            requestPrewarm((1 << API_SPEECH) | (1 << API_GEMINI));
+            playCue(CUE_START);
             recordStartTime = now;
+            recordTap = false;
+            recordReleasedAt = 0;
             startRecording();
             lastButtonPress = now;
           }
+        } else {
+          playQueuedAnswer();
         }
         break;
       }
     case STATE_RECORDING:
-      if (millis() - recordStartTime >= RECORD_DURATION) {
+      {
+        unsigned long now = millis();
+        unsigned long elapsed = now - recordStartTime;
+        if (digitalRead(BUTTON_PIN) == LOW) {
+          recordReleasedAt = 0;
+        } else if (!recordReleasedAt) {
+          recordReleasedAt = now;
+          recordingStats.releaseUs = esp_timer_get_time();
+          if (elapsed < RECORD_TAP_MS) recordTap = true;
+        }
+        bool released = !recordTap && recordReleasedAt && now - recordReleasedAt >= RECORD_RELEASE_DEBOUNCE_MS;
+        if (!released && elapsed < (recordTap ? RECORD_DURATION : RECORD_MAX_MS)) {
+          spillCapture(false);  // The capture task stages the audio meanwhile
+          pollStreamInterim();
+          break;
+        }
+        if (!released) recordingStats.releaseUs = esp_timer_get_time();  // Timed out: measure from now
+        if (recordTap) {
+          recordingStats.taps++;
+        } else {
+          recordingStats.holds++;
+        }
+        recordingStats.recordingMs = elapsed;
+
         stopRecording();
+        recordingStats.releaseToFinalizeMs = (esp_timer_get_time() - recordingStats.releaseUs) / 1000;
+        traceMark(TRACE_RECORD_END);
+        armFeedbackTimer();
+        playCue(CUE_STOP);
+        if (WiFi.status() != WL_CONNECTED) {
+          // No point waiting for a connect timeout; store and forward later
+          cancelSttStream();
+          if (saveRecordingFile() && enqueueUtterance("/recording.wav")) {
+            displayStatus("Offline: saved for later\nPress to record");
+            currentState = STATE_READY;
+          } else {
+            setError("Offline queue full");
+          }
+          break;
+        }
         displayStatus("Processing speech...");
         currentState = STATE_PROCESSING_SPEECH;
+        scheduleFiller(FILLER_DELAY_MS);
+        if (finishRealtimeTurn()) break;
         processSpeech();
-      } else {
-        // During recording, read audio data and write to SD file
-        size_t bytes_read = 0;
-        uint8_t buffer[512];
-        if (audioFile) {
-          esp_err_t result = i2s_read(I2S_NUM_0, buffer, sizeof(buffer), &bytes_read, portMAX_DELAY);
-          if (result == ESP_OK && bytes_read > 0) {
-            audioFile.write(buffer, bytes_read);
-            audioFile.flush();
-          }
-        }
       }
       break;
     case STATE_PROCESSING_SPEECH:
@@ -316,19 +1232,33 @@ void loop() {
     case STATE_PROCESSING_TTS:
       break;
     case STATE_PLAYING:
+#ifdef PREWARM_DURING_PLAYBACK
+      requestPrewarm(1 << API_SPEECH);  // The pre-warm task skips sockets that are already warm
+#endif
+      if (realtime.active && digitalRead(BUTTON_PIN) == LOW) interruptRealtimeAnswer();
       if (!isPlayingAudio) {
+        traceMark(TRACE_PLAYBACK_END);
+        traceReport();
         currentState = STATE_READY;
-        displayStatus("Ready\nPress to record");
+        displayStatus(readyMessage());
       }
       break;
     case STATE_ERROR:
       if (millis() > stateEnterTime + 5000) {  // Show error for 5 seconds
+        traceReport();
         currentState = STATE_READY;
-        displayStatus("Ready\nPress to record");
+        displayStatus(readyMessage());
       }
       break;
   }
-  delay(10);
+
+  perfSetState(currentState);
+  powerIdleCheck();
+  if (idlePower.idle) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_POLL_MS));  // The button interrupt ends this early
+  } else {
+    delay(10);
+  }
 }
 
 //========================================
@@ -337,12 +1267,19 @@ void loop() {
 
 void loadConfig() {
   EEPROM.get(0, deviceConfig);
-  if (deviceConfig.magic != WIFI_CONFIG_MAGIC) {
+  if (deviceConfig.magic == WIFI_CONFIG_MAGIC_NO_VOLUME) {
+    // Same layout up to the volume byte, which such images never wrote
+    deviceConfig.magic = WIFI_CONFIG_MAGIC;
+    deviceConfig.volume = VOLUME_DEFAULT;
+    saveConfig();
+  } else if (deviceConfig.magic != WIFI_CONFIG_MAGIC) {
     // Initialize with defaults
     memset(&deviceConfig, 0, sizeof(deviceConfig));
     deviceConfig.magic = WIFI_CONFIG_MAGIC;
+    deviceConfig.volume = VOLUME_DEFAULT;
     saveConfig();
   }
+  if (deviceConfig.volume > VolumeLimiter::STEPS) deviceConfig.volume = VOLUME_DEFAULT;
 }
 
 void saveConfig() {
@@ -406,6 +1343,11 @@ void enterConfigMode() {
     <input type='text' name='gemini' placeholder='Gemini API Key' value=')=====";
     html += String(deviceConfig.geminiApiKey);
     html += R"=====('><br>
+    <h3>Audio</h3>
+    <label>Volume (0-20, 2 dB steps)</label>
+    <input type='number' name='volume' min='0' max='20' value=')=====";
+    html += String(deviceConfig.volume);
+    html += R"=====('><br>
     <input type='submit' value='Save & Reboot'>
     </form>
     <h3>Test Functions</h3>
@@ -433,6 +1375,7 @@ void enterConfigMode() {
     if (server.hasArg("speech")) strncpy(deviceConfig.googleSpeechApiKey, server.arg("speech").c_str(), API_KEY_LEN);
     if (server.hasArg("tts")) strncpy(deviceConfig.googleTtsApiKey, server.arg("tts").c_str(), API_KEY_LEN);
     if (server.hasArg("gemini")) strncpy(deviceConfig.geminiApiKey, server.arg("gemini").c_str(), API_KEY_LEN);
+    if (server.hasArg("volume")) setVolume(server.arg("volume").toInt(), false);
 
     saveConfig();
     server.send(200, "text/plain", "Configuration saved. Connecting to WiFi...");
@@ -442,12 +1385,21 @@ void enterConfigMode() {
 
   // Test microphone endpoint
   server.on("/test/mic", HTTP_GET, []() {
-    displayStatus("Testing mic... Please wait: recording 2 seconds");
+    if (!captureTaskHandle) {
+      server.send(503, "text/plain", "Audio is not initialized.");
+      return;
+    }
+    displayStatus("Testing mic... Please wait: recording 5 seconds");
     startRecording();
-    delay(5000);  // Record 2 seconds
+    for (unsigned long start = millis(); millis() - start < 5000;) {
+      spillCapture(false);
+      delay(10);
+    }
     stopRecording();
+    saveRecordingFile();
     displayStatus("Playing back test recording... Please wait");
-    playAudio("/recording.wav");
+    playAudio("/recording.wav");  // Resampled from RECORD_SAMPLE_RATE by the playback task
+    waitForPlayback();
     server.send(200, "text/plain", "Microphone test completed.");
   });
 
@@ -456,17 +1408,193 @@ void enterConfigMode() {
     displayStatus("Testing audio output... Please wait");
     // Play a predefined test tone or audio file
     // For simplicity, play the last recorded audio if exists
-    if (SD.exists("recording.wav")) {
+    if (saveRecordingFile()) {
       playAudio("/recording.wav");
+      waitForPlayback();
       server.send(200, "text/plain", "Audio output test completed.");
     } else {
-      server.send(200, "text/plain", "No test audio available.");
+      playTestTone(1000, 1000);
+      delay(1000);
+      server.send(200, "text/plain", "No test recording; played a 1 kHz test tone.");
     }
   });
 
+  registerMetricsRoute();
+  server.begin();
+}
+
+// Serves /metrics while the device is in normal (station) operation
+void startStatusServer() {
+  registerMetricsRoute();
   server.begin();
 }
 
+void registerMetricsRoute() {
+  static bool registered = false;
+  if (registered) return;
+  registered = true;
+  server.on("/metrics", HTTP_GET, []() {
+    server.send(200, "text/plain; version=0.0.4", renderMetrics());
+  });
+}
+
+void appendMetric(String& out, const char* name, double value) {
+  out += name;
+  out += ' ';
+  out += String(value, 3);
+  out += '\n';
+}
+
+// Prometheus text exposition of the device counters
+String renderMetrics() {
+  String out;
+  appendMetric(out, "voiceai_uptime_seconds", millis() / 1000.0);
+  appendMetric(out, "voiceai_free_heap_bytes", esp_get_free_heap_size());
+  appendMetric(out, "voiceai_queue_pending", countQueueEntries(QUEUE_PENDING));
+  appendMetric(out, "voiceai_queue_answered", countQueueEntries(QUEUE_ANSWERED));
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    appendMetric(out, (String("voiceai_boot_phase_ms{phase=\"") + bootPhaseNames[i] + "\"}").c_str(), bootTimings.durationMs[i]);
+  }
+  appendMetric(out, "voiceai_boot_setup_ms", bootTimings.setupMs);
+  appendMetric(out, "voiceai_boot_wifi_ms", bootTimings.wifiMs);
+  appendMetric(out, "voiceai_boot_ready_ms", bootTimings.readyMs);
+  appendMetric(out, "voiceai_light_sleep_enabled", idlePower.lightSleep ? 1 : 0);
+  appendMetric(out, "voiceai_idle_entries_total", idlePower.entries);
+  appendMetric(out, "voiceai_idle_ms_total", idlePower.idleMsTotal + (idlePower.idle ? millis() - idlePower.idleSince : 0));
+  appendMetric(out, "voiceai_wake_to_record_ms", idlePower.lastWakeToRecordMs);
+  appendMetric(out, "voiceai_wake_to_record_ms_sum", idlePower.wakeToRecordMsTotal);
+  appendMetric(out, "voiceai_wake_to_record_ms_count", idlePower.wakeToRecordCount);
+  uint64_t cpuMinUs = perf.minUs;
+  uint64_t cpuMaxUs = perf.maxUs;
+  uint64_t openUs = perf.sinceUs ? esp_timer_get_time() - perf.sinceUs : 0;
+  if (perf.maxHolders > 0) {
+    cpuMaxUs += openUs;
+  } else {
+    cpuMinUs += openUs;
+  }
+  appendMetric(out, (String("voiceai_cpu_time_ms{mhz=\"") + IDLE_MIN_FREQ_MHZ + "\"}").c_str(), cpuMinUs / 1000);
+  appendMetric(out, (String("voiceai_cpu_time_ms{mhz=\"") + perf.maxMhz + "\"}").c_str(), cpuMaxUs / 1000);
+  for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+    String label = String("{stage=\"") + perfPolicy[i].name + "\"}";
+    appendMetric(out, ("voiceai_perf_stage_entries_total" + label).c_str(), perf.entries[i]);
+    appendMetric(out, ("voiceai_perf_stage_ms_total" + label).c_str(), perf.stageUs[i] / 1000);
+  }
+  appendMetric(out, "voiceai_audio_playback_blocks_total", audioDeadlines.playbackBlocks);
+  appendMetric(out, "voiceai_audio_playback_deadline_misses_total", audioDeadlines.playbackMisses);
+  appendMetric(out, "voiceai_audio_playback_block_budget_us", PLAYBACK_BLOCK_SAMPLES * 1000000.0 / SAMPLE_RATE);
+  appendMetric(out, "voiceai_audio_playback_block_max_us", audioDeadlines.playbackMaxBlockUs);
+  appendMetric(out, "voiceai_audio_playback_gap_max_us", audioDeadlines.playbackMaxGapUs);
+  appendMetric(out, "voiceai_audio_capture_reads_total", audioDeadlines.captureReads);
+  appendMetric(out, "voiceai_audio_capture_deadline_misses_total", audioDeadlines.captureMisses);
+  appendMetric(out, "voiceai_audio_capture_gap_max_us", audioDeadlines.captureMaxGapUs);
+  appendTaskMetrics(out);
+  appendMetric(out, "voiceai_recording_ms", recordingStats.recordingMs);
+  appendMetric(out, "voiceai_recordings_held_total", recordingStats.holds);
+  appendMetric(out, "voiceai_recordings_tapped_total", recordingStats.taps);
+  appendMetric(out, "voiceai_release_to_finalize_ms", recordingStats.releaseToFinalizeMs);
+  appendMetric(out, "voiceai_release_to_upload_ms", recordingStats.releaseToUploadMs);
+  appendMetric(out, "voiceai_release_to_upload_ms_sum", recordingStats.releaseToUploadMsTotal);
+  appendMetric(out, "voiceai_release_to_upload_ms_count", recordingStats.releaseToUploadCount);
+  appendMetric(out, "voiceai_capture_staging_bytes", captureStaging.size);
+  appendMetric(out, "voiceai_capture_staging_peak_bytes", captureStaging.peak);
+  appendMetric(out, "voiceai_capture_overflows_total", captureStaging.overflows);
+  appendMetric(out, "voiceai_capture_spills_total", captureStaging.spills);
+  appendMetric(out, "voiceai_recordings_in_memory_total", recordingStoreStats.inMemory);
+  appendMetric(out, "voiceai_recordings_spilled_total", recordingStoreStats.spilled);
+  appendMetric(out, "voiceai_sd_write_bytes_avoided_total", recordingStoreStats.writeBytesAvoided);
+  appendMetric(out, "voiceai_sd_read_bytes_avoided_total", recordingStoreStats.readBytesAvoided);
+  appendMetric(out, "voiceai_upload_json_total", uploadStats.jsonUploads);
+  appendMetric(out, "voiceai_upload_binary_total", uploadStats.binaryUploads);
+  appendMetric(out, "voiceai_upload_body_bytes_total", uploadStats.bodyBytes);
+  appendMetric(out, "voiceai_upload_base64_bytes_avoided_total", uploadStats.base64BytesAvoided);
+  appendMetric(out, "voiceai_upload_encode_us", uploadStats.lastEncodeMicros);
+  appendMetric(out, "voiceai_upload_encode_us_sum", uploadStats.encodeMicrosTotal);
+  appendMetric(out, "voiceai_upload_encode_us_count", uploadStats.jsonUploads + uploadStats.binaryUploads);
+  appendMetric(out, "voiceai_sd_bytes_avoided_last", recordingStoreStats.lastBytesAvoided);
+  appendMetric(out, "voiceai_tts_answers_total", speechTextStats.answers);
+  appendMetric(out, "voiceai_tts_answer_bytes_total", speechTextStats.bytesIn);
+  appendMetric(out, "voiceai_tts_spoken_bytes_total", speechTextStats.bytesOut);
+  appendMetric(out, "voiceai_tts_sentences_total", speechTextStats.sentences);
+  appendMetric(out, "voiceai_tts_truncated_total", speechTextStats.truncated);
+  appendMetric(out, "voiceai_tts_normalize_us", speechTextStats.lastMicros);
+  appendMetric(out, "voiceai_archive_interactions", archiveState.header.nextSeq ? archiveState.header.nextSeq - 1 : 0);
+  appendMetric(out, "voiceai_archive_segments", archiveState.ready ? archiveState.header.lastSegment - archiveState.header.firstSegment + 1 : 0);
+  appendMetric(out, "voiceai_archive_rotations_total", archiveState.header.rotations);
+  appendMetric(out, "voiceai_archive_bytes_written_total", archiveState.bytesWritten);
+  appendMetric(out, "voiceai_archive_write_ms", archiveState.lastWriteMs);
+  appendMetric(out, "voiceai_downlink_responses_total", downlinkStats.responses);
+  appendMetric(out, "voiceai_downlink_compressed_responses_total", downlinkStats.compressedResponses);
+  appendMetric(out, "voiceai_downlink_wire_bytes_total", downlinkStats.wireBytes);
+  appendMetric(out, "voiceai_downlink_decoded_bytes_total", downlinkStats.decodedBytes);
+  appendMetric(out, "voiceai_inflate_microseconds_total", downlinkStats.inflateMicros);
+  appendMetric(out, "voiceai_uplink_throughput_bytes_per_ms", linkEstimator.throughputBytesPerMs());
+  appendMetric(out, "voiceai_uplink_rtt_ms", linkEstimator.rttMs());
+  appendMetric(out, "voiceai_uplink_profile", linkEstimator.current());
+  appendMetric(out, "voiceai_speculation_attempts_total", speculationStats.attempts);
+  appendMetric(out, "voiceai_speculation_hits_total", speculationStats.hits);
+  appendMetric(out, "voiceai_speculation_misses_total", speculationStats.misses);
+  appendMetric(out, "voiceai_speculation_saved_ms_total", speculationStats.savedMs);
+  appendMetric(out, "voiceai_stt_streams_total", sttStreamStats.streams);
+  appendMetric(out, "voiceai_stt_stream_transcripts_total", sttStreamStats.transcripts);
+  appendMetric(out, "voiceai_stt_stream_fallbacks_total", sttStreamStats.fallbacks);
+  appendMetric(out, "voiceai_stt_stream_busy_total", sttStreamStats.busy);
+  appendMetric(out, "voiceai_stt_stream_interims_total", sttStreamStats.interims);
+  appendMetric(out, "voiceai_stt_stream_window_stalls_total", sttStreamStats.windowStalls);
+  appendMetric(out, "voiceai_stt_stream_connect_ms", sttStreamStats.lastConnectMs);
+  appendMetric(out, "voiceai_stt_stream_final_ms", sttStreamStats.lastFinalMs);
+  appendMetric(out, "voiceai_stt_stream_final_ms_sum", sttStreamStats.finalMsTotal);
+  appendMetric(out, "voiceai_stt_stream_final_ms_count", sttStreamStats.transcripts);
+  appendMetric(out, "voiceai_realtime_sessions_total", realtimeStats.sessions);
+  appendMetric(out, "voiceai_realtime_setup_failures_total", realtimeStats.setupFailures);
+  appendMetric(out, "voiceai_realtime_turns_total", realtimeStats.turns);
+  appendMetric(out, "voiceai_realtime_answers_total", realtimeStats.answers);
+  appendMetric(out, "voiceai_realtime_interruptions_total", realtimeStats.interruptions);
+  appendMetric(out, "voiceai_realtime_fallbacks_total", realtimeStats.fallbacks);
+  appendMetric(out, "voiceai_realtime_connect_ms", realtimeStats.lastConnectMs);
+  appendMetric(out, "voiceai_realtime_turn_ms", realtimeStats.lastTurnMs);
+  appendMetric(out, "voiceai_realtime_turn_ms_sum", realtimeStats.turnMsTotal);
+  appendMetric(out, "voiceai_realtime_turn_ms_count", realtimeStats.answers);
+  appendMetric(out, "voiceai_realtime_audio_bytes_sent_total", realtimeStats.audioBytesSent);
+  appendMetric(out, "voiceai_realtime_audio_samples_received_total", realtimeStats.audioSamplesReceived);
+  appendMetric(out, "voiceai_gateway_failures_total", gatewayStats.failures);
+  appendMetric(out, "voiceai_gateway_cancels_total", gatewayStats.cancels);
+  appendMetric(out, "voiceai_gateway_stt_ms", gatewayStats.lastSttMs);
+  appendMetric(out, "voiceai_gateway_llm_ms", gatewayStats.lastLlmMs);
+  appendMetric(out, "voiceai_gateway_tts_ms", gatewayStats.lastTtsMs);
+  appendMetric(out, "voiceai_gateway_bytes_sent_total", gatewayStats.bytesSent);
+  appendMetric(out, "voiceai_gateway_bytes_received_total", gatewayStats.bytesReceived);
+  appendMetric(out, "voiceai_proxy_requests_total", proxyStats.requests);
+  appendMetric(out, "voiceai_proxy_hits_total", proxyStats.hits);
+  appendMetric(out, "voiceai_proxy_shared_total", proxyStats.shared);
+  appendMetric(out, "voiceai_feedback_latency_ms", playbackStats.lastFeedbackMs);
+  appendMetric(out, "voiceai_feedback_latency_ms_sum", playbackStats.feedbackMsTotal);
+  appendMetric(out, "voiceai_feedback_latency_ms_count", playbackStats.feedbackCount);
+  appendMetric(out, "voiceai_cues_played_total", playbackStats.cuesPlayed);
+  appendMetric(out, "voiceai_fillers_played_total", playbackStats.fillersPlayed);
+  appendMetric(out, "voiceai_crossfades_total", playbackStats.crossfades);
+  appendMetric(out, "voiceai_volume_step", deviceConfig.volume);
+  appendMetric(out, "voiceai_limiter_active_samples_total", volumeLimiter.limitedSamples());
+  appendMetric(out, "voiceai_output_clipped_samples_total", volumeLimiter.clippedSamples());
+  uint32_t readAheadUnderruns = 0;
+  uint32_t readAheadFills = 0;
+  for (int i = 0; i < VOICE_COUNT; i++) {
+    if (!voices[i].readAhead) continue;
+    readAheadUnderruns += voices[i].readAhead->underruns();
+    readAheadFills += voices[i].readAhead->fills();
+  }
+  appendMetric(out, "voiceai_sd_readahead_underruns_total", readAheadUnderruns);
+  appendMetric(out, "voiceai_sd_readahead_blocks_total", readAheadFills);
+  appendMetric(out, "voiceai_sd_read_max_us", readAheadMaxMicros);
+  if (speechStream) {
+    appendMetric(out, "voiceai_stream_jitter_ms", speechStream->jitterMs());
+    appendMetric(out, "voiceai_stream_prefill_target_ms", speechStream->targetMs());
+    appendMetric(out, "voiceai_stream_peak_lag_ms", speechStream->peakLagMs());
+    appendMetric(out, "voiceai_stream_underruns_total", speechStream->underruns());
+    appendMetric(out, "voiceai_stream_stretches_total", speechStream->stretches());
+  }
+  return out;
+}
+
 void connectToWiFi() {
   WiFi.mode(WIFI_STA);
   displayStatus("Connecting WiFi...");
@@ -481,80 +1609,359 @@ void connectToWiFi() {
       Serial.printf("Added WiFi: %s\n", deviceConfig.ssids[i]);
     }
   }
+
+  // Start associating with the first configured network right away;
+  // WiFiMulti's scan is only needed if that one is not in range
+  for (int i = 0; i < WIFI_MAX_NETWORKS; i++) {
+    if (strlen(deviceConfig.ssids[i]) > 0) {
+      WiFi.begin(deviceConfig.ssids[i], deviceConfig.passwords[i]);
+      break;
+    }
+  }
+  wifiConnectStartMs = millis();
+  wifiScanFallback = false;
 }
 
 //========================================
-// Audio Functions
+// Boot Sequencer
 //========================================
 
-#include "driver/i2s.h"
+void bootPhaseBegin(int phase) {
+  bootTimings.startMs[phase] = millis();
+}
 
-void setupAudioHardware() {
-  Serial.println("Starting audio hardware setup");
+void bootPhaseEnd(int phase) {
+  bootTimings.durationMs[phase] = millis() - bootTimings.startMs[phase];
+}
 
-  // I2S configuration for microphone (RX)
-  i2s_config_t i2s_mic_config = {
-    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
-    .sample_rate = SAMPLE_RATE,
-    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
-    .communication_format = I2S_COMM_FORMAT_STAND_MSB,
-    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-    .dma_buf_count = 16,
-    .dma_buf_len = 60,
-    .use_apll = true,
-    .tx_desc_auto_clear = false,
-    .fixed_mclk = 0
-  };
+void initDisplay() {
+  // Reset TFT display pin manually
+  pinMode(1, OUTPUT);
+  digitalWrite(1, LOW);
+  delay(50);
+  digitalWrite(1, HIGH);
+  delay(50);
 
-  i2s_pin_config_t mic_pins = {
-    .bck_io_num = I2S_SCK,              // bck_io_num
-    .ws_io_num = I2S_WS,                // ws_io_num
-    .data_out_num = I2S_PIN_NO_CHANGE,  // data_out_num
-    .data_in_num = I2S_DIN,             // data_in_num
-  };
+  gfx->begin();
+  gfx->fillScreen(BACKGROUND);
+#ifdef TFT_BL
+  pinMode(TFT_BL, OUTPUT);
+  digitalWrite(TFT_BL, HIGH);
+#endif
+  displayReady = true;
+}
 
-  // Install and start I2S driver for microphone
-  // Remove uninstall call to avoid error if driver not installed
-  // i2s_driver_uninstall(I2S_NUM_0);
-  i2s_driver_install(I2S_NUM_0, &i2s_mic_config, 0, NULL);
-  i2s_set_pin(I2S_NUM_0, &mic_pins);
+void bootSdTask(void* param) {
+  bootPhaseBegin(BOOT_SD);
+  SPI.begin(SPI_SCK_PIN, SPI_MISO_PIN, SPI_MOSI_PIN, SD_CS_PIN);
+  bootTimings.sdOk = SD.begin(SD_CS_PIN);
+  bootPhaseEnd(BOOT_SD);
+
+  if (bootTimings.sdOk) {
+    bootPhaseBegin(BOOT_QUEUE);
+    initUtteranceQueue();
+    bootPhaseEnd(BOOT_QUEUE);
+    bootPhaseBegin(BOOT_ARCHIVE);
+    initArchive();
+    bootPhaseEnd(BOOT_ARCHIVE);
+  }
+  xEventGroupSetBits(bootEvents, BOOT_SD_DONE);
+  vTaskDelete(NULL);
+}
 
-  // I2S configuration for amplifier (TX)
-  i2s_config_t i2s_amp_config = {
-    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-    .sample_rate = SAMPLE_RATE,
-    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
-    .communication_format = I2S_COMM_FORMAT_STAND_MSB,
-    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-    .dma_buf_count = 16,
-    .dma_buf_len = 60,
-    .use_apll = true,
-    .tx_desc_auto_clear = false,
-    .fixed_mclk = 0
-  };
+void bootAudioTask(void* param) {
+  bootPhaseBegin(BOOT_AUDIO);
+  setupAudioHardware();
+  bootPhaseEnd(BOOT_AUDIO);
+  xEventGroupSetBits(bootEvents, BOOT_AUDIO_DONE);
+  vTaskDelete(NULL);
+}
 
-  i2s_pin_config_t amp_pins = {
-    .bck_io_num = I2S_BCK,             // bck_io_num
-    .ws_io_num = I2S_WS,               // ws_io_num
-    .data_out_num = I2S_DOUT,          // data_out_num
-    .data_in_num = I2S_PIN_NO_CHANGE,  // data_in_num
-  };
+// One line per report: phase durations, then milestones since power-on
+void bootReport() {
+  String line = "[boot]";
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+    line += String(" ") + bootPhaseNames[i] + "=" + String(bootTimings.durationMs[i]);
+  }
+  line += " | setup@" + String(bootTimings.setupMs);
+  line += " wifi@" + String(bootTimings.wifiMs);
+  line += " ready@" + String(bootTimings.readyMs);
+  Serial.println(line);
+}
 
-  // Install and start I2S driver for amplifier
-  // Remove uninstall call to avoid error if driver not installed
-  // i2s_driver_uninstall(I2S_NUM_1);
-  i2s_driver_install(I2S_NUM_1, &i2s_amp_config, 0, NULL);
-  i2s_set_pin(I2S_NUM_1, &amp_pins);
+//========================================
+// Idle Power
+//========================================
 
-  Serial.println("Audio hardware initialized");
+void initPower() {
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  powerMutex = xSemaphoreCreateMutex();
+  esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "busy", &noSleepLock);
+  esp_pm_lock_acquire(noSleepLock);
+
+  esp_pm_config_esp32_t pm = {};
+  perf.maxMhz = getCpuFrequencyMhz();
+  pm.max_freq_mhz = perf.maxMhz;
+  pm.min_freq_mhz = IDLE_MIN_FREQ_MHZ;
+  pm.light_sleep_enable = true;
+  esp_err_t err = esp_pm_configure(&pm);
+  if (err != ESP_OK) {
+    // Light sleep needs tickless idle in the core's sdkconfig; keep the
+    // clock scaling and modem sleep without it
+    pm.light_sleep_enable = false;
+    err = esp_pm_configure(&pm);
+  }
+  idlePower.lightSleep = err == ESP_OK && pm.light_sleep_enable;
+  esp_sleep_enable_gpio_wakeup();
+  idlePower.quietSince = millis();
+  Serial.printf("[power] pm=%s light_sleep=%d\n", esp_err_to_name(err), idlePower.lightSleep);
 }
 
-void writeWavHeader(File& file, uint32_t dataLength) {
-  // WAV header is 44 bytes
-  uint8_t header[44];
+// Level interrupt armed only while idle; it also wakes the chip from light
+// sleep, so it disables itself after the first hit
+void ARDUINO_ISR_ATTR onButtonWake() {
+  gpio_set_intr_type((gpio_num_t)BUTTON_PIN, GPIO_INTR_DISABLE);
+  idlePower.wakeEdgeUs = esp_timer_get_time();
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(loopTaskHandle, &woken);
+  if (woken) portYIELD_FROM_ISR();
+}
+
+// Called once per loop: idles after IDLE_AFTER_MS of quiet READY time and
+// wakes as soon as anything else is going on
+void powerIdleCheck() {
+  if (!powerMutex) return;
+  bool quiet = currentState == STATE_READY && !isPlayingAudio && !mixer.anyActive()
+               && digitalRead(BUTTON_PIN) == HIGH && digitalRead(CONFIG_PIN) == HIGH;
+  if (!quiet) {
+    idlePower.quietSince = millis();
+    powerWake();
+  } else if (!idlePower.idle && millis() - idlePower.quietSince >= IDLE_AFTER_MS) {
+    powerSleep();
+  }
+}
+
+void powerSleep() {
+  xSemaphoreTake(powerMutex, portMAX_DELAY);
+  if (!idlePower.idle) {
+    i2s_stop(I2S_NUM_0);
+    i2s_stop(I2S_NUM_1);
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);  // Radio wakes for each DTIM beacon
+    idlePower.wakeEdgeUs = 0;
+    attachInterrupt(BUTTON_PIN, onButtonWake, ONLOW_WE);
+    idlePower.idle = true;
+    idlePower.idleSince = millis();
+    idlePower.entries++;
+    esp_pm_lock_release(noSleepLock);
+  }
+  xSemaphoreGive(powerMutex);
+}
+
+// Safe to call from any task; a no-op unless idle
+void powerWake() {
+  if (!idlePower.idle || !powerMutex) return;
+  xSemaphoreTake(powerMutex, portMAX_DELAY);
+  if (idlePower.idle) {
+    esp_pm_lock_acquire(noSleepLock);
+    detachInterrupt(BUTTON_PIN);
+    WiFi.setSleep(WIFI_PS_NONE);
+    i2s_start(I2S_NUM_0);
+    i2s_start(I2S_NUM_1);
+    idlePower.idleMsTotal += millis() - idlePower.idleSince;
+    idlePower.quietSince = millis();
+    idlePower.idle = false;
+
+    if (digitalRead(BUTTON_PIN) == LOW) {
+      // Measured from the interrupt when it fired, else from now
+      int64_t edge = idlePower.wakeEdgeUs;
+      idlePower.wakeFromUs = edge ? edge : esp_timer_get_time();
+      idlePower.measurePending = true;
+      requestPrewarm((1 << API_SPEECH) | (1 << API_GEMINI));
+    }
+  }
+  xSemaphoreGive(powerMutex);
+}
+
+//========================================
+// Performance Policy
+//========================================
+
+void initPerf() {
+  for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+    if (perfPolicy[i].maxClock) esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, perfPolicy[i].name, &perf.locks[i]);
+  }
+  perf.sinceUs = esp_timer_get_time();
+  perfSetState(currentState);
+}
+
+// Moves the time since the last change into the bucket of the clock that
+// was in effect, then applies delta to the number of pinning holders
+void perfAccount(int delta) {
+  portENTER_CRITICAL(&perfMux);
+  int64_t now = esp_timer_get_time();
+  if (perf.maxHolders > 0) {
+    perf.maxUs += now - perf.sinceUs;
+  } else {
+    perf.minUs += now - perf.sinceUs;
+  }
+  perf.sinceUs = now;
+  perf.maxHolders += delta;
+  portEXIT_CRITICAL(&perfMux);
+}
+
+// Returns true if the stage was taken; only then call perfEnd()
+bool perfBegin(PerfStage stage) {
+  if (!perf.sinceUs) return false;  // Before initPerf()
+  perf.entries[stage]++;
+  if (perf.locks[stage]) {
+    esp_pm_lock_acquire(perf.locks[stage]);
+    perfAccount(1);
+  }
+  return true;
+}
+
+void perfEnd(PerfStage stage, int64_t startUs) {
+  perf.stageUs[stage] += esp_timer_get_time() - startUs;
+  if (perf.locks[stage]) {
+    perfAccount(-1);
+    esp_pm_lock_release(perf.locks[stage]);
+  }
+}
+
+// Loop task: swaps the held stage when the state has changed
+void perfSetState(State state) {
+  static bool held = false;
+  static State heldState = STATE_INIT;
+  static int64_t heldSince = 0;
+  if (held && state == heldState) return;
+  if (held) perfEnd(stateStage[heldState], heldSince);
+  heldState = state;
+  heldSince = esp_timer_get_time();
+  held = perfBegin(stateStage[state]);
+}
+
+//========================================
+// Scheduling
+//========================================
+
+BaseType_t startTask(TaskRole role, TaskFunction_t fn, void* param, TaskHandle_t* handle) {
+  const TaskPlan& plan = taskPlan[role];
+  return xTaskCreatePinnedToCore(fn, plan.name, plan.stack, param, plan.priority, handle, plan.core);
+}
+
+// Per-task CPU share since the previous scrape, and stack headroom. This
+// is the data vTaskGetRunTimeStats() formats, read as structs instead.
+void appendTaskMetrics(String& out) {
+#if configGENERATE_RUN_TIME_STATS && configUSE_TRACE_FACILITY
+  const int MAX_TASKS = 32;
+  static TaskStatus_t tasks[MAX_TASKS];
+  static TaskHandle_t lastHandle[MAX_TASKS];
+  static uint32_t lastCounter[MAX_TASKS];
+  static uint32_t lastTotal = 0;
+
+  uint32_t total = 0;
+  int count = uxTaskGetSystemState(tasks, MAX_TASKS, &total);
+  uint32_t elapsed = total - lastTotal;
+  for (int i = 0; i < count; i++) {
+    const TaskStatus_t& t = tasks[i];
+    uint32_t previous = 0;
+    for (int k = 0; k < MAX_TASKS; k++) {
+      if (lastHandle[k] == t.xHandle) previous = lastCounter[k];
+    }
+    int core = t.xCoreID == tskNO_AFFINITY ? -1 : t.xCoreID;
+    String label = String("{task=\"") + t.pcTaskName + "\",core=\"" + core + "\"}";
+    // Percent of one core; a pinned task tops out at 100
+    float percent = elapsed ? (t.ulRunTimeCounter - previous) * 100.0f / elapsed : 0;
+    appendMetric(out, ("voiceai_task_cpu_percent" + label).c_str(), percent);
+    appendMetric(out, ("voiceai_task_stack_free_bytes" + label).c_str(), t.usStackHighWaterMark);
+  }
+  for (int i = 0; i < MAX_TASKS; i++) {
+    lastHandle[i] = i < count ? tasks[i].xHandle : nullptr;
+    lastCounter[i] = i < count ? tasks[i].ulRunTimeCounter : 0;
+  }
+  lastTotal = total;
+#else
+  // The core was built without FreeRTOS run-time stats; only the plan is known
+  for (int i = 0; i < TASK_ROLE_COUNT; i++) {
+    appendMetric(out, (String("voiceai_task_priority{task=\"") + taskPlan[i].name + "\"}").c_str(), taskPlan[i].priority);
+  }
+#endif
+}
+
+//========================================
+// Audio Functions
+//========================================
+
+#include "driver/i2s.h"
+
+void setupAudioHardware() {
+  Serial.println("Starting audio hardware setup");
+
+  // I2S configuration for microphone (RX)
+  i2s_config_t i2s_mic_config = {
+    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
+    .sample_rate = RECORD_SAMPLE_RATE,
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+    .communication_format = I2S_COMM_FORMAT_STAND_MSB,
+    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+    .dma_buf_count = I2S_DMA_BUF_COUNT,
+    .dma_buf_len = I2S_DMA_BUF_LEN,
+    .use_apll = true,
+    .tx_desc_auto_clear = false,
+    .fixed_mclk = 0
+  };
+
+  i2s_pin_config_t mic_pins = {
+    .bck_io_num = I2S_SCK,              // bck_io_num
+    .ws_io_num = I2S_WS,                // ws_io_num
+    .data_out_num = I2S_PIN_NO_CHANGE,  // data_out_num
+    .data_in_num = I2S_DIN,             // data_in_num
+  };
+
+  // Install and start I2S driver for microphone
+  // Remove uninstall call to avoid error if driver not installed
+  // i2s_driver_uninstall(I2S_NUM_0);
+  i2s_driver_install(I2S_NUM_0, &i2s_mic_config, 0, NULL);
+  i2s_set_pin(I2S_NUM_0, &mic_pins);
+
+  // I2S configuration for amplifier (TX)
+  i2s_config_t i2s_amp_config = {
+    .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
+    .sample_rate = SAMPLE_RATE,
+    .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+    .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
+    .communication_format = I2S_COMM_FORMAT_STAND_MSB,
+    .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
+    .dma_buf_count = I2S_DMA_BUF_COUNT,
+    .dma_buf_len = I2S_DMA_BUF_LEN,
+    .use_apll = true,
+    .tx_desc_auto_clear = false,
+    .fixed_mclk = 0
+  };
+
+  // Own WS line: the mic is clocked at RECORD_SAMPLE_RATE and must not
+  // see the amplifier's LRCLK
+  i2s_pin_config_t amp_pins = {
+    .bck_io_num = I2S_BCK,             // bck_io_num
+    .ws_io_num = I2S_LRC,              // ws_io_num
+    .data_out_num = I2S_DOUT,          // data_out_num
+    .data_in_num = I2S_PIN_NO_CHANGE,  // data_in_num
+  };
+
+  // Install and start I2S driver for amplifier
+  // Remove uninstall call to avoid error if driver not installed
+  // i2s_driver_uninstall(I2S_NUM_1);
+  i2s_driver_install(I2S_NUM_1, &i2s_amp_config, 0, NULL);
+  i2s_set_pin(I2S_NUM_1, &amp_pins);
+
+  Serial.println("Audio hardware initialized");
+}
 
+// Canonical 44-byte header of a mono WAV: 16-bit PCM by default, or
+// 8-bit mu-law (format 7)
+void buildWavHeader(uint8_t* header, uint32_t dataLength, uint32_t sampleRate, uint16_t format = 1,
+                    uint16_t bitsPerSample = 16) {
   // RIFF chunk descriptor
   memcpy(header, "RIFF", 4);
   uint32_t chunkSize = 36 + dataLength;
@@ -564,73 +1971,2530 @@ void writeWavHeader(File& file, uint32_t dataLength) {
   header[7] = ((chunkSize >> 24) & 0xff);
   memcpy(header + 8, "WAVE", 4);
 
-  // fmt subchunk
-  memcpy(header + 12, "fmt ", 4);
-  header[16] = 16;  // Subchunk1Size for PCM
-  header[17] = 0;
-  header[18] = 0;
-  header[19] = 0;
-  header[20] = 1;  // AudioFormat PCM = 1
-  header[21] = 0;
-  header[22] = 1;  // NumChannels = 1 (mono)
-  header[23] = 0;
-  header[24] = (SAMPLE_RATE & 0xff);
-  header[25] = ((SAMPLE_RATE >> 8) & 0xff);
-  header[26] = ((SAMPLE_RATE >> 16) & 0xff);
-  header[27] = ((SAMPLE_RATE >> 24) & 0xff);
-  uint32_t byteRate = SAMPLE_RATE * 2;  // SampleRate * NumChannels * BitsPerSample/8
-  header[28] = (byteRate & 0xff);
-  header[29] = ((byteRate >> 8) & 0xff);
-  header[30] = ((byteRate >> 16) & 0xff);
-  header[31] = ((byteRate >> 24) & 0xff);
-  uint16_t blockAlign = 2;  // NumChannels * BitsPerSample/8
-  header[32] = (blockAlign & 0xff);
-  header[33] = ((blockAlign >> 8) & 0xff);
-  uint16_t bitsPerSample = 16;
-  header[34] = (bitsPerSample & 0xff);
-  header[35] = ((bitsPerSample >> 8) & 0xff);
+  // fmt subchunk
+  memcpy(header + 12, "fmt ", 4);
+  header[16] = 16;  // Subchunk1Size for PCM
+  header[17] = 0;
+  header[18] = 0;
+  header[19] = 0;
+  header[20] = format;  // AudioFormat: PCM = 1, mu-law = 7
+  header[21] = 0;
+  header[22] = 1;  // NumChannels = 1 (mono)
+  header[23] = 0;
+  header[24] = (sampleRate & 0xff);
+  header[25] = ((sampleRate >> 8) & 0xff);
+  header[26] = ((sampleRate >> 16) & 0xff);
+  header[27] = ((sampleRate >> 24) & 0xff);
+  uint32_t byteRate = sampleRate * bitsPerSample / 8;  // SampleRate * NumChannels * BitsPerSample/8
+  header[28] = (byteRate & 0xff);
+  header[29] = ((byteRate >> 8) & 0xff);
+  header[30] = ((byteRate >> 16) & 0xff);
+  header[31] = ((byteRate >> 24) & 0xff);
+  uint16_t blockAlign = bitsPerSample / 8;  // NumChannels * BitsPerSample/8
+  header[32] = (blockAlign & 0xff);
+  header[33] = ((blockAlign >> 8) & 0xff);
+  header[34] = (bitsPerSample & 0xff);
+  header[35] = ((bitsPerSample >> 8) & 0xff);
+
+  // data subchunk
+  memcpy(header + 36, "data", 4);
+  header[40] = (dataLength & 0xff);
+  header[41] = ((dataLength >> 8) & 0xff);
+  header[42] = ((dataLength >> 16) & 0xff);
+  header[43] = ((dataLength >> 24) & 0xff);
+}
+
+void writeWavHeader(File& file, uint32_t dataLength, uint32_t sampleRate) {
+  uint8_t header[44];
+  buildWavHeader(header, dataLength, sampleRate);
+  file.seek(0);
+  file.write(header, 44);
+}
+
+void startRecording() {
+  powerWake();
+
+  // Close any previously open file
+  if (audioFile) {
+    audioFile.close();
+  }
+  // The clip starts in memory; spillCapture() opens the file if it has to
+  captureStaging.head = 0;
+  captureStaging.tail = 0;
+  captureStaging.spilled = false;
+  captureStaging.saved = false;
+  captureActive = true;
+  xTaskNotifyGive(captureTaskHandle);
+  startSttStream();
+  startRealtimeTurn();
+
+  if (idlePower.measurePending) {
+    idlePower.measurePending = false;
+    idlePower.lastWakeToRecordMs = (esp_timer_get_time() - idlePower.wakeFromUs) / 1000;
+    idlePower.wakeToRecordMsTotal += idlePower.lastWakeToRecordMs;
+    idlePower.wakeToRecordCount++;
+    Serial.printf("[power] wake to record %u ms\n", (unsigned)idlePower.lastWakeToRecordMs);
+  }
+  Serial.println("Recording started");
+}
+
+void stopRecording() {
+  if (captureActive) {
+    captureActive = false;
+    xSemaphoreTake(captureStopped, pdMS_TO_TICKS(500));  // One read is at most 100 ms
+  }
+  sttStream.audioEnded = true;
+  realtime.audioEnded = true;
+  spillCapture(true);
+
+  CaptureStaging& st = captureStaging;
+  if (st.spilled && audioFile) {
+    audioFile.flush();
+    uint32_t fileSize = audioFile.size();
+    uint32_t dataLength = fileSize - 44;
+    writeWavHeader(audioFile, dataLength, RECORD_SAMPLE_RATE);
+    audioFile.close();
+    recordingStoreStats.spilled++;
+    recordingStoreStats.lastBytesAvoided = 0;
+    Serial.println("Recording stopped");
+  } else if (!st.spilled) {
+    recordingStoreStats.inMemory++;
+    recordingStoreStats.writeBytesAvoided += 44 + st.head;
+    recordingStoreStats.lastBytesAvoided = 44 + st.head;
+    Serial.printf("Recording stopped (%u bytes in memory)\n", (unsigned)st.head);
+  } else {
+    Serial.println("No recording file open");
+  }
+}
+
+// Copies microphone DMA into the recording file between startRecording()
+// and stopRecording(), at audio priority so SD or network stalls in the
+// loop cannot overflow the RX ring
+void captureTask(void* param) {
+  static uint8_t buffer[CAPTURE_READ_BYTES];
+  const uint32_t ringUs = (uint64_t)I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN * 1000000 / RECORD_SAMPLE_RATE;
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    PerfScope perfScope(PERF_CAPTURE);
+    int64_t lastReadUs = 0;
+    while (captureActive) {
+      size_t bytesRead = 0;
+      i2s_read(I2S_NUM_0, buffer, sizeof(buffer), &bytesRead, pdMS_TO_TICKS(100));
+      int64_t now = esp_timer_get_time();
+      if (lastReadUs) {
+        uint32_t gap = now - lastReadUs;
+        if (gap > audioDeadlines.captureMaxGapUs) audioDeadlines.captureMaxGapUs = gap;
+        if (gap > ringUs) audioDeadlines.captureMisses++;
+      }
+      lastReadUs = now;
+      audioDeadlines.captureReads++;
+      if (bytesRead == 0 || !captureActive) continue;
+
+      CaptureStaging& st = captureStaging;
+      uint32_t head = st.head;
+      uint32_t fill = head - st.tail;
+      if (fill + bytesRead > st.size) {
+        st.overflows++;
+        continue;
+      }
+      uint32_t start = head % st.size;
+      uint32_t first = min((uint32_t)bytesRead, st.size - start);
+      memcpy(st.data + start, buffer, first);
+      memcpy(st.data, buffer + first, bytesRead - first);
+      st.head = head + bytesRead;
+      if (fill + bytesRead > st.peak) st.peak = fill + bytesRead;
+    }
+    xSemaphoreGive(captureStopped);
+  }
+}
+
+// Loop task: writes staged audio to the recording file, in whole
+// CAPTURE_SPILL_BYTES blocks while recording and everything when all is set
+void spillCapture(bool all) {
+  CaptureStaging& st = captureStaging;
+  if (!st.spilled) {
+    // Stay in memory unless the staging is filling up or archival is on
+    if (!recordingArchival && st.head < st.spillAt) return;
+    audioFile = SD.open("/recording.wav", FILE_WRITE);
+    if (!audioFile) {
+      Serial.println("[record] cannot open /recording.wav, keeping the clip in memory");
+      return;
+    }
+    uint8_t emptyHeader[44] = { 0 };  // Placeholder until stopRecording()
+    audioFile.write(emptyHeader, 44);
+    st.spilled = true;
+  }
+
+  for (;;) {
+    uint32_t tail = st.tail;
+    uint32_t staged = st.head - tail;
+    uint32_t n = staged >= CAPTURE_SPILL_BYTES ? CAPTURE_SPILL_BYTES : all ? staged : 0;
+    if (n == 0) return;
+    uint32_t start = tail % st.size;
+    uint32_t first = min(n, st.size - start);
+    audioFile.write(st.data + start, first);
+    if (n > first) audioFile.write(st.data, n - first);
+    st.tail = tail + n;
+    st.spills++;
+  }
+}
+
+// Makes sure /recording.wav holds the last recording, writing it out if it
+// only exists in memory. For the places where a path is the interface:
+// the offline queue and test playback.
+bool saveRecordingFile() {
+  CaptureStaging& st = captureStaging;
+  if (st.spilled || st.saved || st.head == 0) return SD.exists("/recording.wav");
+
+  File file = SD.open("/recording.wav", FILE_WRITE);
+  if (!file) return false;
+  writeWavHeader(file, st.head, RECORD_SAMPLE_RATE);
+  bool ok = file.write(st.data, st.head) == st.head;
+  file.close();
+  st.saved = ok;
+  if (ok) {
+    recordingStoreStats.writeBytesAvoided -= 44 + st.head;
+    recordingStoreStats.lastBytesAvoided = 0;
+  }
+  return ok;
+}
+
+//========================================
+// Playback
+//========================================
+
+// The playback task owns the amplifier. Callers queue requests and return
+// immediately, so chimes and filler phrases sound while the network stages
+// block the loop. Voices are combined by the mixer: the answer crossfades
+// with a filler, and chimes or test tones duck the answer instead of
+// waiting for it.
+
+void initPlayback() {
+  for (int c = 0; c < CUE_COUNT; c++) bank.hasCue[c] = SD.exists(cueSounds[c].path);
+  bank.fillers = 0;
+  while (bank.fillers < BANK_MAX_FILLERS && SD.exists(String(BANK_DIR "/filler") + String(bank.fillers + 1) + ".wav")) {
+    bank.fillers++;
+  }
+  Serial.printf("[play] bank: start=%s stop=%s confirm=%s fillers=%d\n", bank.hasCue[CUE_START] ? "file" : "tone",
+                bank.hasCue[CUE_STOP] ? "file" : "tone", bank.hasCue[CUE_CONFIRM] ? "file" : "tone", bank.fillers);
+
+  volumeLimiter.setVolume(deviceConfig.volume);
+  int16_t* streamStorage = (int16_t*)malloc(JITTER_BUFFER_SAMPLES * sizeof(int16_t));
+  if (streamStorage) {
+    speechStream = new JitterBuffer(streamStorage, JITTER_BUFFER_SAMPLES, JITTER_UNDERRUN_PROBABILITY);
+  } else {
+    Serial.println("[play] no memory for the speech stream, TTS plays from SD");
+  }
+  for (int slot = VOICE_FILLER; slot <= VOICE_ANSWER; slot++) {
+    uint8_t* storage = (uint8_t*)malloc(READAHEAD_BLOCK_BYTES * READAHEAD_BLOCKS);
+    if (storage) voices[slot].readAhead = new ReadAhead(storage, READAHEAD_BLOCK_BYTES, READAHEAD_BLOCKS);
+  }
+
+  playbackQueue = xQueueCreate(PLAYBACK_QUEUE_LENGTH, sizeof(PlaybackRequest));
+  startTask(TASK_READ_AHEAD, readAheadTask, NULL, &readAheadTaskHandle);
+  startTask(TASK_PLAYBACK, playbackTask, NULL);
+  captureStopped = xSemaphoreCreateBinary();
+  if (psramFound()) {
+    captureStaging.size = (uint32_t)RECORD_SAMPLE_RATE * 2 * CAPTURE_STAGING_PSRAM_MS / 1000;
+    captureStaging.data = (uint8_t*)ps_malloc(captureStaging.size);
+  }
+  if (!captureStaging.data) {
+    captureStaging.size = CAPTURE_STAGING_INTERNAL;
+    captureStaging.data = (uint8_t*)malloc(captureStaging.size);
+  }
+  captureStaging.spillAt = captureStaging.size > 2 * CAPTURE_SPILL_HEADROOM
+                             ? captureStaging.size - CAPTURE_SPILL_HEADROOM
+                             : captureStaging.size / 2;
+  startTask(TASK_CAPTURE, captureTask, NULL, &captureTaskHandle);
+}
+
+void closeVoice(Voice& v) {
+  if (v.readAhead && !v.readAhead->idle()) {
+    v.readAhead->cancel();  // The read-ahead task closes the file
+    xTaskNotifyGive(readAheadTaskHandle);
+  }
+  if (v.file) v.file.close();
+  v.active = false;
+  v.stream = nullptr;
+  v.toneHz = 0;
+}
+
+bool fetchSample(Voice& v, int16_t& sample) {
+  if (v.stream) {
+    if (v.bufPos == v.bufLen) {
+      int n = v.stream->read(v.buf, PLAYBACK_BLOCK_SAMPLES);
+      if (n < 0) return false;
+      if (n == 0) {
+        sample = 0;  // Rebuffering after an underrun
+        return true;
+      }
+      v.bufLen = n;
+      v.bufPos = 0;
+    }
+    sample = v.buf[v.bufPos++];
+    return true;
+  }
+  if (v.toneHz) {
+    if (v.tonePos >= v.toneLength) return false;
+    uint32_t n = v.tonePos++;
+    const uint32_t attack = SAMPLE_RATE / 200;  // 5 ms, avoids a click
+    float envelope = n < attack ? (float)n / attack : (float)(v.toneLength - n) / (v.toneLength - attack);
+    sample = (int16_t)(8000.0f * envelope * sinf(2.0f * PI * v.toneHz * n / SAMPLE_RATE));
+    return true;
+  }
+  if (v.readAhead && v.bufPos == v.bufLen) {
+    int n = v.readAhead->read(v.coded ? v.codedBuf : (uint8_t*)v.buf, v.coded ? sizeof(v.codedBuf) : sizeof(v.buf));
+    xTaskNotifyGive(readAheadTaskHandle);
+    if (n < 0) return false;
+    v.bufLen = v.coded ? v.adpcm.decode(v.codedBuf, n, v.buf) : n / 2;
+    v.bufPos = 0;
+    if (v.bufLen == 0) {
+      sample = 0;  // The SD card is behind; counted by the read-ahead
+      return true;
+    }
+  } else if (v.bufPos == v.bufLen) {
+    uint8_t* dest = v.coded ? v.codedBuf : (uint8_t*)v.buf;
+    size_t want = min(v.coded ? (uint32_t)sizeof(v.codedBuf) : (uint32_t)sizeof(v.buf), v.remaining);
+    size_t got = want > 0 ? v.file.read(dest, want) : 0;
+    v.remaining -= got;
+    v.bufLen = v.coded ? v.adpcm.decode(v.codedBuf, got, v.buf) : got / 2;
+    v.bufPos = 0;
+    if (v.bufLen == 0) return false;
+  }
+  sample = v.buf[v.bufPos++];
+  return true;
+}
+
+bool startVoice(Voice& v, uint32_t sourceRate) {
+  v.step = ((uint64_t)sourceRate << 16) / SAMPLE_RATE;
+  v.phase = 0;
+  v.prev = 0;
+  v.bufLen = 0;
+  v.bufPos = 0;
+  v.active = fetchSample(v, v.next);
+  if (!v.active) closeVoice(v);
+  return v.active;
+}
+
+int32_t readAheadFile(void* ctx, uint8_t* buf, uint32_t len) {
+  return ((File*)ctx)->read(buf, len);
+}
+
+// Keeps the answer and filler files READAHEAD_BLOCKS blocks ahead of
+// playback, so SD latency spikes stall this task instead of the I2S feed
+void readAheadTask(void* param) {
+  for (;;) {
+    bool busy = false;
+    for (int i = 0; i < VOICE_COUNT; i++) {
+      ReadAhead* ra = voices[i].readAhead;
+      if (!ra) continue;
+      unsigned long start = micros();
+      if (ra->fillOne()) {
+        busy = true;
+        readAheadMaxMicros = max(readAheadMaxMicros, (uint32_t)(micros() - start));
+      }
+      if (ra->finished()) {
+        if (readAheadFiles[i]) readAheadFiles[i].close();
+        ra->release();
+      }
+    }
+    if (!busy) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(50));
+  }
+}
+
+// Reads the header of a mono 16-bit PCM or IMA ADPCM WAV and leaves the
+// file at the start of the samples. A file without a RIFF header is taken
+// as PCM at SAMPLE_RATE. Google TTS LINEAR16 responses carry a WAV header.
+bool readWavHeader(File& file, WavInfo& info) {
+  info.format = 1;
+  info.sampleRate = SAMPLE_RATE;
+  info.blockAlign = 2;
+  info.dataBytes = file.size();
+  uint8_t riff[12];
+  if (file.read(riff, sizeof(riff)) != sizeof(riff) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+    file.seek(0);
+    return info.dataBytes > 0;
+  }
+
+  info.dataBytes = 0;
+  uint8_t chunk[8];
+  while (file.read(chunk, sizeof(chunk)) == sizeof(chunk)) {
+    uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t fmt[16];
+      if (size < sizeof(fmt) || file.read(fmt, sizeof(fmt)) != sizeof(fmt)) return false;
+      uint16_t channels = fmt[2] | fmt[3] << 8;
+      uint16_t bits = fmt[14] | fmt[15] << 8;
+      info.format = fmt[0] | fmt[1] << 8;
+      info.sampleRate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | (uint32_t)fmt[7] << 24;
+      info.blockAlign = fmt[12] | fmt[13] << 8;
+      bool pcm = info.format == 1 && bits == 16;
+      bool adpcm = info.format == ImaAdpcm::FORMAT_TAG && bits == 4 && info.blockAlign > 4;
+      if (!(pcm || adpcm) || channels != 1 || info.sampleRate == 0) return false;
+      file.seek(file.position() + size - sizeof(fmt) + (size & 1));
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      // Streamed WAVs may leave the size at 0xffffffff
+      info.dataBytes = min(size, (uint32_t)(file.size() - file.position()));
+      return info.dataBytes > 0;
+    } else {
+      file.seek(file.position() + size + (size & 1));
+    }
+  }
+  return false;
+}
+
+bool openVoiceFile(Voice& v, const char* path) {
+  closeVoice(v);
+  v.file = SD.open(path, FILE_READ);
+  if (!v.file) return false;
+
+  WavInfo info;
+  v.remaining = readWavHeader(v.file, info) ? info.dataBytes : 0;
+  v.coded = info.format == ImaAdpcm::FORMAT_TAG;
+  if (v.coded) v.adpcm.begin(info.blockAlign);
+  uint32_t rate = info.sampleRate;
+
+  if (v.remaining == 0) {
+    closeVoice(v);
+    return false;
+  }
+  if (v.readAhead) {
+    // The previous file is released after the read in progress, if any
+    while (!v.readAhead->idle()) vTaskDelay(1);
+    int slot = &v - voices;
+    readAheadFiles[slot] = v.file;
+    v.file = File();
+    v.readAhead->begin(readAheadFile, &readAheadFiles[slot], v.remaining);
+    xTaskNotifyGive(readAheadTaskHandle);
+  }
+  return startVoice(v, rate);
+}
+
+bool startStreamVoice(Voice& v, JitterBuffer* stream) {
+  closeVoice(v);
+  if (!stream) return false;
+  v.stream = stream;
+  return startVoice(v, stream->sampleRate());
+}
+
+bool startTone(Voice& v, uint16_t hz, uint16_t ms) {
+  closeVoice(v);
+  v.toneHz = hz;
+  v.toneLength = (uint32_t)SAMPLE_RATE * ms / 1000;
+  v.tonePos = 0;
+  return startVoice(v, SAMPLE_RATE);
+}
+
+// Mixer source: the voice linearly resampled to SAMPLE_RATE. A stream
+// running low is played slightly slower to let it catch up.
+int pullVoice(void* ctx, int16_t* out, int count) {
+  Voice& v = *(Voice*)ctx;
+  uint32_t step = v.stream ? (uint32_t)(((uint64_t)v.step * v.stream->rateQ16()) >> 16) : v.step;
+  for (int i = 0; i < count; i++) {
+    out[i] = v.prev + ((((int32_t)v.next - v.prev) * (int32_t)(v.phase >> 1)) >> 15);
+    v.phase += step;
+    while (v.phase >= 0x10000) {
+      v.phase -= 0x10000;
+      v.prev = v.next;
+      if (!fetchSample(v, v.next)) return i + 1;
+    }
+  }
+  return count;
+}
+
+// Hands an opened voice to its mixer slot, or clears the slot
+bool startSlot(int slot, bool opened, int32_t gain = Mixer::UNITY) {
+  if (!opened) {
+    mixer.stop(slot);
+    return false;
+  }
+  mixer.start(slot, pullVoice, &voices[slot], voicePriority[slot], gain);
+  return true;
+}
+
+void playbackTask(void* param) {
+  static int32_t mixed[PLAYBACK_BLOCK_SAMPLES];
+  static int16_t out[PLAYBACK_BLOCK_SAMPLES];
+  PlaybackRequest filler;
+  bool fillerPending = false;
+  unsigned long fillerAt = 0;
+  bool silent = true;
+  bool mixHeld = false;
+  int64_t mixSince = 0;
+  int64_t lastWriteUs = 0;
+  const uint32_t ringUs = (uint64_t)I2S_DMA_BUF_COUNT * I2S_DMA_BUF_LEN * 1000000 / SAMPLE_RATE;
+
+  for (;;) {
+    TickType_t wait = 0;
+    if (!mixer.anyActive()) {
+      long untilFiller = (long)(fillerAt - millis());
+      wait = !fillerPending ? portMAX_DELAY : untilFiller > 0 ? pdMS_TO_TICKS(untilFiller) : 0;
+    }
+
+    PlaybackRequest req;
+    while (xQueueReceive(playbackQueue, &req, wait) == pdTRUE) {
+      wait = 0;
+      switch (req.kind) {
+        case PLAYBACK_ANSWER:
+        case PLAYBACK_STREAM:
+          {
+            fillerPending = false;
+            bool crossfade = mixer.active(VOICE_FILLER);
+            Voice& v = voices[VOICE_ANSWER];
+            bool opened = req.kind == PLAYBACK_STREAM ? startStreamVoice(v, speechStream) : openVoiceFile(v, req.path);
+            if (!startSlot(VOICE_ANSWER, opened, crossfade ? 0 : Mixer::UNITY)) {
+              Serial.printf("[play] cannot play %s\n", req.kind == PLAYBACK_STREAM ? "speech stream" : req.path);
+              isPlayingAudio = false;
+            } else if (crossfade) {
+              mixer.fade(VOICE_FILLER, 0, CROSSFADE_MS, true);
+              mixer.fade(VOICE_ANSWER, Mixer::UNITY, CROSSFADE_MS);
+              playbackStats.crossfades++;
+            }
+            break;
+          }
+        case PLAYBACK_CUE:
+          {
+            Voice& v = voices[VOICE_CUE];
+            if (startSlot(VOICE_CUE, req.path[0] ? openVoiceFile(v, req.path) : startTone(v, req.toneHz, req.toneMs))) {
+              playbackStats.cuesPlayed++;
+            }
+            break;
+          }
+        case PLAYBACK_FILLER:
+          if (!mixer.active(VOICE_ANSWER)) {
+            filler = req;
+            fillerPending = true;
+            fillerAt = millis() + req.delayMs;
+          }
+          break;
+        case PLAYBACK_TEST_TONE:
+          startSlot(VOICE_TONE, startTone(voices[VOICE_TONE], req.toneHz, req.toneMs));
+          break;
+        case PLAYBACK_STOP_CUES:
+          fillerPending = false;
+          if (mixer.active(VOICE_CUE)) mixer.fade(VOICE_CUE, 0, CROSSFADE_MS, true);
+          if (mixer.active(VOICE_FILLER)) mixer.fade(VOICE_FILLER, 0, CROSSFADE_MS, true);
+          break;
+        case PLAYBACK_STOP_ANSWER:
+          if (mixer.active(VOICE_ANSWER)) mixer.fade(VOICE_ANSWER, 0, CROSSFADE_MS, true);
+          break;
+        case PLAYBACK_SET_VOLUME:
+          volumeLimiter.setVolume(req.volume);
+          break;
+      }
+    }
+
+    if (fillerPending && (long)(millis() - fillerAt) >= 0) {
+      fillerPending = false;
+      if (!mixer.active(VOICE_ANSWER) && startSlot(VOICE_FILLER, openVoiceFile(voices[VOICE_FILLER], filler.path))) {
+        playbackStats.fillersPlayed++;
+      }
+    }
+
+    if (!mixer.anyActive()) {
+      // tx_desc_auto_clear is off, so stale DMA buffers would keep repeating
+      if (!silent) i2s_zero_dma_buffer(I2S_NUM_1);
+      silent = true;
+      if (mixHeld) perfEnd(PERF_MIX, mixSince);
+      mixHeld = false;
+      continue;
+    }
+    bool wasSilent = silent;
+    silent = false;
+    if (!mixHeld) {
+      mixSince = esp_timer_get_time();
+      mixHeld = perfBegin(PERF_MIX);
+    }
+
+    int64_t blockStart = esp_timer_get_time();
+    if (!wasSilent) {
+      uint32_t gap = blockStart - lastWriteUs;
+      if (gap > audioDeadlines.playbackMaxGapUs) audioDeadlines.playbackMaxGapUs = gap;
+      if (gap > ringUs) audioDeadlines.playbackMisses++;
+    }
+    mixer.mix(mixed, PLAYBACK_BLOCK_SAMPLES);
+    volumeLimiter.process(mixed, out, PLAYBACK_BLOCK_SAMPLES);
+    uint32_t blockUs = esp_timer_get_time() - blockStart;
+    if (blockUs > audioDeadlines.playbackMaxBlockUs) audioDeadlines.playbackMaxBlockUs = blockUs;
+    audioDeadlines.playbackBlocks++;
+    for (int i = 0; i < VOICE_COUNT; i++) {
+      if (voices[i].active && !mixer.active(i)) {
+        closeVoice(voices[i]);
+        if (i == VOICE_ANSWER) isPlayingAudio = false;
+      }
+    }
+    size_t bytesWritten = 0;
+    i2s_write(I2S_NUM_1, out, sizeof(out), &bytesWritten, portMAX_DELAY);
+    lastWriteUs = esp_timer_get_time();
+
+    unsigned long armedAt = playbackStats.feedbackArmedAt;
+    if (armedAt) {
+      playbackStats.feedbackArmedAt = 0;
+      uint32_t ms = millis() - armedAt;
+      playbackStats.lastFeedbackMs = ms;
+      playbackStats.feedbackMsTotal += ms;
+      playbackStats.feedbackCount++;
+      trace.feedbackMs = ms;
+    }
+  }
+}
+
+bool queuePlayback(const PlaybackRequest& req) {
+  powerWake();
+  return playbackQueue && xQueueSend(playbackQueue, &req, pdMS_TO_TICKS(100)) == pdTRUE;
+}
+
+// Starts the answer voice and returns; isPlayingAudio clears when it ends
+void playAudio(const char* filename) {
+  if (!SD.exists(filename)) {
+    setError("Failed to open audio file");
+    return;
+  }
+
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_ANSWER;
+  strncpy(req.path, filename, sizeof(req.path) - 1);
+  isPlayingAudio = true;
+  if (!queuePlayback(req)) {
+    isPlayingAudio = false;
+    setError("Audio playback unavailable");
+  }
+}
+
+// Starts the answer voice on speechStream; isPlayingAudio clears once the
+// stream has ended and drained
+void playSpeechStream() {
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_STREAM;
+  isPlayingAudio = true;
+  if (!queuePlayback(req)) isPlayingAudio = false;
+}
+
+void waitForPlayback() {
+  while (isPlayingAudio) delay(10);
+}
+
+bool isAudioPlaying() {
+  return isPlayingAudio;
+}
+
+// Bank chime, or a short synthesized tone when the bank has none
+void playCue(uint8_t cue) {
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_CUE;
+  if (bank.hasCue[cue]) {
+    strncpy(req.path, cueSounds[cue].path, sizeof(req.path) - 1);
+  } else {
+    req.toneHz = cueSounds[cue].toneHz;
+    req.toneMs = 90;
+  }
+  queuePlayback(req);
+}
+
+void playTestTone(uint16_t hz, uint16_t ms) {
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_TEST_TONE;
+  req.toneHz = hz;
+  req.toneMs = ms;
+  queuePlayback(req);
+}
+
+// Plays the next filler phrase after delayMs unless the answer starts first
+void scheduleFiller(uint32_t delayMs) {
+  if (bank.fillers == 0) return;
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_FILLER;
+  req.delayMs = delayMs;
+  snprintf(req.path, sizeof(req.path), BANK_DIR "/filler%d.wav", bank.nextFiller + 1);
+  bank.nextFiller = (bank.nextFiller + 1) % bank.fillers;
+  queuePlayback(req);
+}
+
+// Fades out any cue and drops a pending filler (errors, offline fallback)
+void stopCues() {
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_STOP_CUES;
+  queuePlayback(req);
+}
+
+// Volume step 0..VolumeLimiter::STEPS; ramps in the playback task
+void setVolume(int step, bool persist) {
+  deviceConfig.volume = constrain(step, 0, VolumeLimiter::STEPS);
+  if (persist) saveConfig();
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_SET_VOLUME;
+  req.volume = deviceConfig.volume;
+  queuePlayback(req);
+}
+
+// Starts the end-of-speech to first-audible-feedback measurement
+void armFeedbackTimer() {
+  playbackStats.feedbackArmedAt = millis();
+}
+
+//========================================
+// HTTP Request Bodies
+//========================================
+
+// Feeds a JsonBody or UploadBody to HTTPClient, which pulls request
+// bodies from a Stream in socket-sized reads
+template <typename Body>
+class BodyStream : public Stream {
+public:
+  BodyStream(Body& body)
+    : body(body) {}
+
+  int available() override {
+    return (int)min(body.remaining(), (size_t)INT32_MAX);
+  }
+  int read() override {
+    uint8_t c;
+    return body.read(&c, 1) == 1 ? c : -1;
+  }
+  int peek() override {
+    return -1;
+  }
+  size_t readBytes(char* buffer, size_t length) override {
+    return body.read((uint8_t*)buffer, length);
+  }
+  size_t write(uint8_t) override {
+    return 0;
+  }
+
+private:
+  Body& body;
+};
+
+// POSTs body with a Content-Length from its sizing pass
+int postJson(HTTPClient& http, JsonBody& body) {
+  if (!body.ok()) return HTTPC_ERROR_TOO_LESS_RAM;
+  BodyStream<JsonBody> stream(body);
+  return http.sendRequest("POST", &stream, body.size());
+}
+
+//========================================
+// Network Pre-warming
+//========================================
+
+void initNetwork() {
+  netMutex = xSemaphoreCreateMutex();
+  prewarmEvents = xEventGroupCreate();
+  sttStream.done = xSemaphoreCreateBinary();
+  sttStream.lock = xSemaphoreCreateMutex();
+  foregroundTask = xTaskGetCurrentTaskHandle();
+  linkEstimator.setPayloadInflation(sttBackends[STT_BACKEND].inflation);
+  for (int h = 0; h < API_HOST_COUNT; h++) {
+    // Same trust model as HTTPClient::begin(url) without a CA certificate
+    apiSockets[h].client.setInsecure();
+    apiSockets[h].state = SOCKET_IDLE;
+  }
+  startTask(TASK_PREWARM, prewarmTask, NULL);
+}
+
+// Resolves through a small cache. lwIP does not report record TTLs, so
+// entries expire after DNS_CACHE_TTL_MS, which is shorter than the TTL
+// of the hosts we talk to.
+bool resolveCached(const char* host, IPAddress& ip) {
+  unsigned long now = millis();
+  xSemaphoreTake(netMutex, portMAX_DELAY);
+  int freeSlot = 0;
+  for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+    if (dnsCache[i].host == host && now - dnsCache[i].resolvedAt < DNS_CACHE_TTL_MS) {
+      ip = dnsCache[i].ip;
+      xSemaphoreGive(netMutex);
+      return true;
+    }
+    if (!dnsCache[i].host || dnsCache[i].host == host || dnsCache[i].resolvedAt < dnsCache[freeSlot].resolvedAt) {
+      freeSlot = i;
+    }
+  }
+  xSemaphoreGive(netMutex);
+
+  if (!WiFi.hostByName(host, ip)) return false;
+
+  xSemaphoreTake(netMutex, portMAX_DELAY);
+  dnsCache[freeSlot].host = host;
+  dnsCache[freeSlot].ip = ip;
+  dnsCache[freeSlot].resolvedAt = millis();
+  xSemaphoreGive(netMutex);
+  return true;
+}
+
+bool connectApiSocket(ApiHost host) {
+  unsigned long start = millis();
+  IPAddress ip;
+  ApiSocket& socket = apiSockets[host];
+  socket.client.stop();
+  bool ok = resolveCached(apiHostNames[host], ip)
+            && socket.client.connect(ip, 443, apiHostNames[host], nullptr, nullptr, nullptr);
+  socket.connectMs = millis() - start;
+  socket.readyAt = millis();
+  if (ok) {
+    // TCP + TLS 1.2 take three round trips. Handshake crypto makes this an
+    // upper bound, which only makes profile switching more conservative.
+    linkEstimator.observeRtt(socket.connectMs / 3.0f);
+  }
+  return ok;
+}
+
+bool isSocketWarm(ApiHost host) {
+  ApiSocket& socket = apiSockets[host];
+  return socket.state == SOCKET_READY && socket.client.connected()
+         && millis() - socket.readyAt < PREWARM_MAX_IDLE_MS;
+}
+
+void prewarmTask(void* param) {
+  for (;;) {
+    EventBits_t bits = xEventGroupWaitBits(prewarmEvents, (1 << API_HOST_COUNT) - 1, pdTRUE, pdFALSE, portMAX_DELAY);
+    for (int h = 0; h < API_HOST_COUNT; h++) {
+      if (!(bits & (1 << h)) || WiFi.status() != WL_CONNECTED) continue;
+
+      xSemaphoreTake(netMutex, portMAX_DELAY);
+      bool claim = apiSockets[h].state == SOCKET_IDLE || (apiSockets[h].state == SOCKET_READY && !isSocketWarm((ApiHost)h));
+      if (claim) apiSockets[h].state = SOCKET_CONNECTING;
+      xSemaphoreGive(netMutex);
+      if (!claim) continue;
+
+      bool ok = connectApiSocket((ApiHost)h);
+      apiSockets[h].state = ok ? SOCKET_READY : SOCKET_IDLE;
+      Serial.printf("[prewarm] %s %s in %u ms\n", apiHostNames[h], ok ? "ready" : "failed", (unsigned)apiSockets[h].connectMs);
+    }
+  }
+}
+
+bool isApiProxied(ApiHost host) {
+  return API_PROXY_URL[0] != '\0' && apiHostProxied[host];
+}
+
+// Asks the pre-warm task to open sockets for the given hosts (bit mask of
+// ApiHost). Cheap and non-blocking; hosts already warm are left alone.
+void requestPrewarm(uint32_t hostMask) {
+  for (int h = 0; h < API_HOST_COUNT; h++) {
+    if (isApiProxied((ApiHost)h)) hostMask &= ~(1u << h);  // Nothing to warm on the LAN
+  }
+  if (hostMask && prewarmEvents && WiFi.status() == WL_CONNECTED) {
+    xEventGroupSetBits(prewarmEvents, hostMask);
+  }
+}
+
+// Claims the host's socket for a foreground request, waiting briefly for a
+// pre-warm that is already underway. Sets warm when it is already open.
+// Returns false if the socket is still busy connecting.
+bool claimApiSocket(ApiHost host, bool& warm, uint32_t& waitedMs) {
+  unsigned long start = millis();
+  while (apiSockets[host].state == SOCKET_CONNECTING && millis() - start < PREWARM_WAIT_MS) {
+    delay(5);
+  }
+  waitedMs = millis() - start;
+
+  xSemaphoreTake(netMutex, portMAX_DELAY);
+  bool claimed = apiSockets[host].state == SOCKET_IDLE || apiSockets[host].state == SOCKET_READY;
+  warm = claimed && isSocketWarm(host);
+  if (claimed) apiSockets[host].state = SOCKET_IN_USE;
+  xSemaphoreGive(netMutex);
+  return claimed;
+}
+
+// Returns the metered socket used for the request, or nullptr when the
+// request runs on a connection of its own.
+MeteredClient* beginApiRequest(HTTPClient& http, ApiHost host, const String& pathAndQuery) {
+  String url = isApiProxied(host) ? String(API_PROXY_URL) + pathAndQuery
+                                  : "https://" + String(apiHostNames[host]) + pathAndQuery;
+
+  // Foreground stages run on the host's socket, pre-warmed or else
+  // connected here through the DNS cache. Background work such as the
+  // offline queue drain uses a connection of its own.
+  MeteredClient* meter = nullptr;
+  bool warm = false;
+  uint32_t waitedMs = 0;
+  if (!isApiProxied(host) && xTaskGetCurrentTaskHandle() == foregroundTask && claimApiSocket(host, warm, waitedMs)) {
+    if (warm) {
+      trace.prewarmHits++;
+      if (apiSockets[host].connectMs > waitedMs) trace.prewarmSavedMs += apiSockets[host].connectMs - waitedMs;
+    } else {
+      trace.prewarmMisses++;
+      connectApiSocket(host);
+    }
+    http.begin(apiSockets[host].client, url);
+    meter = &apiSockets[host].client;
+    meter->resetMeter();
+  } else {
+    http.begin(url);
+  }
+  http.addHeader("Content-Type", "application/json");
+  // HTTP/1.0 responses are never chunked, so HttpBodyStream can read the
+  // body straight off the socket. It also stops HTTPClient from sending its
+  // identity-only Accept-Encoding line.
+  http.useHTTP10(true);
+#ifdef ACCEPT_GZIP_RESPONSES
+  http.addHeader("Accept-Encoding", "gzip, deflate");
+  http.setUserAgent("ESP32-Voice-AI (gzip)");  // Google compresses only for agents that name gzip
+#endif
+  static const char* headerKeys[] = { "Content-Encoding", "X-Cache" };
+  http.collectHeaders(headerKeys, 2);
+  return meter;
+}
+
+//========================================
+// HTTP Response Decoding
+//========================================
+
+// Reads a response body after a successful request. Sits between the
+// socket and the JSON parser: bounded by Content-Length when known, and
+// inflated through a fixed 32 KB window when the server compressed it.
+class HttpBodyStream : public Stream {
+public:
+  HttpBodyStream(HTTPClient& http)
+    : client(http.getStreamPtr()), remaining(http.getSize()) {
+    String encoding = http.header("Content-Encoding");
+    encoding.toLowerCase();
+    if (encoding == "gzip" || encoding == "deflate") {
+      window = (uint8_t*)malloc(Inflater::WINDOW_SIZE);
+      if (window) {
+        inflater = new Inflater(window, readRawByte, this);
+        inflater->reset(encoding == "gzip" ? Inflater::FORMAT_GZIP : Inflater::FORMAT_ZLIB);
+      } else {
+        noWindow = true;  // The body reads as empty and failed() reports it
+      }
+    }
+  }
+
+  ~HttpBodyStream() {
+    delete inflater;
+    free(window);
+  }
+
+  int available() override {
+    return outPos < outLen || fill() ? outLen - outPos : 0;
+  }
+
+  int read() override {
+    return outPos < outLen || fill() ? out[outPos++] : -1;
+  }
+
+  int peek() override {
+    return outPos < outLen || fill() ? out[outPos] : -1;
+  }
+
+  // Overridden so the end of the body does not wait out Stream's timeout
+  size_t readBytes(char* buffer, size_t length) override {
+    size_t total = 0;
+    while (total < length && (outPos < outLen || fill())) {
+      size_t n = min(length - total, outLen - outPos);
+      memcpy(buffer + total, out + outPos, n);
+      outPos += n;
+      total += n;
+    }
+    return total;
+  }
+
+  size_t write(uint8_t) override {
+    return 0;
+  }
+
+  String readAll() {
+    String result;
+    if (remaining > 0 && !inflater) result.reserve(remaining);
+    while (outPos < outLen || fill()) {
+      result.concat((const char*)out + outPos, outLen - outPos);
+      outPos = outLen;
+    }
+    return result;
+  }
+
+  // The body could not be decoded: corrupt, or no memory to inflate it
+  bool failed() const {
+    return noWindow || (inflater && inflater->failed());
+  }
+
+  // Decoded bytes readable without touching the network
+  size_t buffered() const {
+    return outLen - outPos;
+  }
+
+  // Adds this response to the downlink stats and logs what compression saved
+  void finish(const char* label) {
+    downlinkStats.responses++;
+    downlinkStats.wireBytes += wireBytes;
+    downlinkStats.decodedBytes += decodedBytes;
+    if (inflater) {
+      downlinkStats.compressedResponses++;
+      downlinkStats.inflateMicros += inflateMicros;
+      Serial.printf("[net] %s: %u wire bytes -> %u decoded (saved %d), inflate %u us\n",
+                    label, (unsigned)wireBytes, (unsigned)decodedBytes,
+                    (int)(decodedBytes - wireBytes), (unsigned)inflateMicros);
+      if (inflater->failed()) Serial.printf("[net] %s: corrupt compressed body\n", label);
+    } else if (noWindow) {
+      Serial.printf("[net] %s: no memory to inflate the body\n", label);
+    } else {
+      Serial.printf("[net] %s: %u bytes uncompressed\n", label, (unsigned)wireBytes);
+    }
+  }
+
+private:
+  WiFiClient* client;
+  int remaining;  // -1 when the body runs until the server closes
+  uint8_t* window = nullptr;
+  Inflater* inflater = nullptr;
+  bool noWindow = false;
+  uint8_t raw[512];
+  size_t rawLen = 0;
+  size_t rawPos = 0;
+  uint8_t out[512];
+  size_t outLen = 0;
+  size_t outPos = 0;
+  uint32_t wireBytes = 0;
+  uint32_t decodedBytes = 0;
+  uint32_t inflateMicros = 0;
+  uint32_t waitMicros = 0;
+
+  bool fillRaw() {
+    if (!client || remaining == 0) return false;
+    unsigned long start = micros();
+    unsigned long deadline = millis() + HTTP_BODY_TIMEOUT_MS;
+    while (client->available() <= 0) {
+      if (!client->connected() || millis() > deadline) return false;
+      delay(1);
+    }
+    size_t want = sizeof(raw);
+    if (remaining > 0 && (size_t)remaining < want) want = remaining;
+    int n = client->read(raw, want);
+    waitMicros += micros() - start;
+    if (n <= 0) return false;
+    rawLen = n;
+    rawPos = 0;
+    wireBytes += n;
+    if (remaining > 0) remaining -= n;
+    return true;
+  }
+
+  static int readRawByte(void* ctx) {
+    HttpBodyStream* self = (HttpBodyStream*)ctx;
+    if (self->rawPos >= self->rawLen && !self->fillRaw()) return -1;
+    return self->raw[self->rawPos++];
+  }
+
+  bool fill() {
+    outPos = 0;
+    outLen = 0;
+    if (noWindow) return false;
+    if (inflater) {
+      // Inflate time excludes the time spent waiting on the network
+      unsigned long start = micros();
+      uint32_t waitedBefore = waitMicros;
+      outLen = inflater->read(out, sizeof(out));
+      inflateMicros += (micros() - start) - (waitMicros - waitedBefore);
+    } else {
+      if (rawPos >= rawLen && !fillRaw()) return false;
+      outLen = rawLen - rawPos;
+      memcpy(out, raw + rawPos, outLen);
+      rawPos = rawLen;
+    }
+    decodedBytes += outLen;
+    return outLen > 0;
+  }
+};
+
+void endApiRequest(HTTPClient& http, ApiHost host) {
+  if (isApiProxied(host)) {
+    String cache = http.header("X-Cache");
+    proxyStats.requests++;
+    if (cache == "hit") proxyStats.hits++;
+    else if (cache == "shared") proxyStats.shared++;
+  }
+  http.end();
+  if (xTaskGetCurrentTaskHandle() == foregroundTask) {
+    xSemaphoreTake(netMutex, portMAX_DELAY);
+    if (apiSockets[host].state == SOCKET_IN_USE) apiSockets[host].state = SOCKET_IDLE;
+    xSemaphoreGive(netMutex);
+  }
+}
+
+//========================================
+// Interaction Trace
+//========================================
+
+void traceBegin() {
+  memset(&trace, 0, sizeof(trace));
+  trace.active = true;
+  archiveState.transcript = "";
+  archiveState.response = "";
+  trace.marks[TRACE_BUTTON] = millis();
+}
+
+void traceMark(TraceMark mark) {
+  if (trace.active) trace.marks[mark] = millis();
+}
+
+void traceReport() {
+  if (!trace.active) return;
+  static const char* const names[TRACE_MARK_COUNT] = { "button", "record", "stt", "llm", "tts", "play" };
+
+  String line = "[trace]";
+  unsigned long previous = trace.marks[TRACE_BUTTON];
+  for (int i = 1; i < TRACE_MARK_COUNT; i++) {
+    if (trace.marks[i] == 0) continue;
+    line += " " + String(names[i]) + "=" + String(trace.marks[i] - previous) + "ms";
+    previous = trace.marks[i];
+  }
+  line += " prewarm=" + String(trace.prewarmHits) + "/" + String(trace.prewarmHits + trace.prewarmMisses);
+  line += " saved=" + String(trace.prewarmSavedMs) + "ms";
+  if (trace.feedbackMs) line += " feedback=" + String(trace.feedbackMs) + "ms";
+  Serial.println(line);
+#ifdef ARCHIVE_ENABLED
+  archiveInteraction();
+#endif
+  trace.active = false;
+}
+
+//========================================
+// Upload Audio Encoding
+//========================================
+
+// Appends base64 to a String, carrying partial 3-byte groups across writes
+// so chunk boundaries never introduce padding mid-stream.
+struct Base64Writer {
+  String* out;
+  uint8_t carry[3];
+  size_t carryLen;
+
+  void write(const uint8_t* data, size_t len) {
+    while (len > 0 && carryLen > 0 && carryLen < 3) {
+      carry[carryLen++] = *data++;
+      len--;
+    }
+    if (carryLen == 3) {
+      *out += base64_encode(carry, 3);
+      carryLen = 0;
+    }
+    size_t whole = len - len % 3;
+    if (whole > 0) *out += base64_encode(data, whole);
+    for (size_t i = whole; i < len; i++) carry[carryLen++] = data[i];
+  }
+
+  void finish() {
+    if (carryLen > 0) *out += base64_encode(carry, carryLen);
+    carryLen = 0;
+  }
+
+  static void writeCallback(void* ctx, const uint8_t* data, size_t len) {
+    ((Base64Writer*)ctx)->write(data, len);
+  }
+};
+
+// Collects encoder output as is, for binary uploads of an encoding whose
+// size is only known once it is done (FLAC). Grows in PSRAM when present.
+struct ByteWriter {
+  uint8_t* data;
+  size_t len;
+  size_t capacity;
+  bool failed;
+
+  void write(const uint8_t* bytes, size_t n) {
+    if (failed) return;
+    if (len + n > capacity) {
+      size_t grown = max(capacity * 3 / 2, len + n + 1024);
+      uint8_t* p = (uint8_t*)(psramFound() ? ps_realloc(data, grown) : realloc(data, grown));
+      if (!p) {
+        failed = true;
+        return;
+      }
+      data = p;
+      capacity = grown;
+    }
+    memcpy(data + len, bytes, n);
+    len += n;
+  }
+
+  void release() {
+    free(data);
+    data = nullptr;
+    len = capacity = 0;
+  }
+
+  static void writeCallback(void* ctx, const uint8_t* data, size_t len) {
+    ((ByteWriter*)ctx)->write(data, len);
+  }
+};
+
+// G.711 mu-law
+uint8_t linearToMulaw(int16_t sample) {
+  const int bias = 0x84;
+  const int clip = 32635;
+  int sign = sample < 0 ? 0x80 : 0;
+  int magnitude = sign ? -(int)sample : sample;
+  if (magnitude > clip) magnitude = clip;
+  magnitude += bias;
+  int exponent = 7;
+  for (int mask = 0x4000; (magnitude & mask) == 0 && exponent > 0; mask >>= 1) exponent--;
+  int mantissa = (magnitude >> (exponent + 3)) & 0x0f;
+  return ~(sign | (exponent << 4) | mantissa);
+}
+
+// Zero-copy reader for the recording store. Spans of the last recording
+// point straight into the capture staging when the clip never left
+// memory; a spilled or queued clip is read from its WAV file through a
+// small buffer. Encoders and uploaders only see spans.
+class RecordingReader {
+public:
+  ~RecordingReader() { close(); }
+
+  // The last recording, wherever it lives
+  bool openLast() {
+    const CaptureStaging& st = captureStaging;
+    if (st.spilled || st.head == 0) return openFile("/recording.wav");
+    memory_ = st.data;
+    length_ = st.head;
+    sampleRate_ = RECORD_SAMPLE_RATE;
+    pos_ = 0;
+    return true;
+  }
+
+  bool openFile(const char* path) {
+    memory_ = nullptr;
+    file_ = SD.open(path, FILE_READ);
+    if (!file_) return false;
+    uint8_t header[44];
+    if (file_.read(header, sizeof(header)) != sizeof(header)) {
+      file_.close();
+      return false;
+    }
+    sampleRate_ = header[24] | (header[25] << 8) | (header[26] << 16) | ((uint32_t)header[27] << 24);
+    length_ = file_.size() - sizeof(header);
+    pos_ = 0;
+    return true;
+  }
+
+  // Hands out up to max bytes of PCM (whole samples); 0 at the end
+  uint32_t next(const uint8_t*& data, uint32_t max) {
+    uint32_t n = min(max, length_ - pos_) & ~1u;
+    if (memory_) {
+      data = memory_ + pos_;
+    } else {
+      n = file_.read(buffer_, min(n, (uint32_t)sizeof(buffer_))) & ~1u;
+      data = buffer_;
+    }
+    pos_ += n;
+    return n;
+  }
+
+  uint32_t length() const { return length_; }
+  uint32_t sampleRate() const { return sampleRate_; }
+
+  void close() {
+    if (memory_) recordingStoreStats.readBytesAvoided += pos_;
+    memory_ = nullptr;
+    if (file_) file_.close();
+  }
+
+private:
+  File file_;
+  const uint8_t* memory_ = nullptr;
+  uint32_t length_ = 0;
+  uint32_t pos_ = 0;
+  uint32_t sampleRate_ = RECORD_SAMPLE_RATE;
+  uint8_t buffer_[512];
+};
+
+// Streams the PCM of a recording through the profile's encoder into write.
+// Returns the encoded size.
+uint32_t encodeUploadAudio(RecordingReader& reader, UploadProfileId profile, uint32_t sampleRate,
+                           FlacEncoder::WriteFn write, void* ctx) {
+  const uint8_t* data;
+  uint8_t encoded[128];
+  uint32_t encodedBytes = 0;
+  uint32_t bytes;
+
+  PerfScope perfScope(PERF_ENCODE);
+  FlacEncoder* flac = nullptr;
+  if (profile == UPLOAD_FLAC_16K) {
+    flac = new FlacEncoder(sampleRate, write, ctx);
+    flac->begin();
+  }
+
+  while ((bytes = reader.next(data, sizeof(encoded) * 4)) > 0) {
+    const int16_t* samples = (const int16_t*)data;
+    size_t count = bytes / 2;
+    switch (profile) {
+      case UPLOAD_FLAC_16K:
+        flac->addSamples(samples, count);
+        break;
+      case UPLOAD_MULAW_8K:
+        // 16 kHz -> 8 kHz: average sample pairs as a cheap anti-alias filter
+        for (size_t i = 0; i + 1 < count; i += 2) {
+          encoded[i / 2] = linearToMulaw((samples[i] + samples[i + 1]) / 2);
+        }
+        write(ctx, encoded, count / 2);
+        encodedBytes += count / 2;
+        break;
+      default:
+        write(ctx, (const uint8_t*)samples, count * 2);
+        encodedBytes += count * 2;
+        break;
+    }
+  }
+
+  if (flac) {
+    flac->finish();
+    encodedBytes = flac->bytesWritten();
+    delete flac;
+  }
+  return encodedBytes;
+}
+
+// File content of a binary upload, pulled by UploadBody as HTTPClient
+// reads the body: PCM straight from the recording's spans, mu-law
+// converted span by span, or FLAC from the buffer it was encoded into
+typedef struct {
+  RecordingReader* reader;
+  UploadProfileId profile;
+  const uint8_t* encoded;
+  size_t encodedLen;
+  size_t encodedPos;
+  uint8_t spare;  // Second byte of a sample split across two reads
+  bool hasSpare;
+} UploadSource;
+
+size_t readUploadSource(void* ctx, uint8_t* out, size_t max) {
+  UploadSource* src = (UploadSource*)ctx;
+  size_t n = 0;
+  if (src->encoded) {
+    n = min(max, src->encodedLen - src->encodedPos);
+    memcpy(out, src->encoded + src->encodedPos, n);
+    src->encodedPos += n;
+    return n;
+  }
+  const uint8_t* data;
+  while (n < max) {
+    if (src->profile == UPLOAD_MULAW_8K) {
+      // Whole sample pairs, as in encodeUploadAudio
+      uint32_t bytes = src->reader->next(data, min((max - n) * 4, (size_t)512));
+      if (bytes < 4) break;
+      const int16_t* samples = (const int16_t*)data;
+      for (uint32_t i = 0; i + 1 < bytes / 2; i += 2) out[n++] = linearToMulaw((samples[i] + samples[i + 1]) / 2);
+    } else if (src->hasSpare) {
+      out[n++] = src->spare;
+      src->hasSpare = false;
+    } else {
+      // Reads can start mid-sample; the reader hands out whole ones
+      uint32_t bytes = src->reader->next(data, (max - n + 1) & ~1u);
+      if (bytes == 0) break;
+      uint32_t k = min(bytes, (uint32_t)(max - n));
+      memcpy(out + n, data, k);
+      n += k;
+      if (k < bytes) {
+        src->spare = data[k];
+        src->hasSpare = true;
+      }
+    }
+  }
+  return n;
+}
+
+// The upload body as HTTPClient pulls it. A source that runs dry leaves
+// the body short of its Content-Length, so available() then goes negative
+// and HTTPClient abandons the request at once instead of waiting out its
+// timeout on a server still expecting bytes. HTTPClient writes each read
+// to the socket before the next one, so the gaps between reads time the
+// upload for the link estimator, and the reads themselves time the
+// content as it is pulled from the recording.
+class UploadStream : public BodyStream<UploadBody> {
+public:
+  uint32_t bytesWritten = 0;  // Every read but the last has gone out
+  uint32_t writeMicros = 0;
+  uint32_t readMicros = 0;
+
+  UploadStream(UploadBody& body)
+    : BodyStream<UploadBody>(body), upload(body) {}
+
+  int available() override {
+    return upload.truncated() ? -1 : BodyStream<UploadBody>::available();
+  }
+  size_t readBytes(char* buffer, size_t length) override {
+    unsigned long start = micros();
+    if (lastLen) {
+      writeMicros += start - lastReturn;
+      bytesWritten += lastLen;
+    }
+    lastLen = BodyStream<UploadBody>::readBytes(buffer, length);
+    lastReturn = micros();
+    readMicros += lastReturn - start;
+    return lastLen;
+  }
+
+private:
+  UploadBody& upload;
+  size_t lastLen = 0;
+  unsigned long lastReturn = 0;
+};
+
+// Sends the recording as a WAV (or FLAC) file to a Whisper-style server,
+// as a multipart file part or as the whole body. PCM and mu-law go out as
+// HTTPClient reads them, with no payload buffer and no encode pass; FLAC is
+// encoded first, since Content-Length needs its size.
+bool transcribeBinary(RecordingReader& reader, UploadProfileId profile, uint32_t sampleRate, uint32_t uploadRate,
+                      String& transcript, String& error, int& httpCode) {
+  const SttBackend& backend = sttBackends[STT_BACKEND];
+  float audioSeconds = reader.length() / 2.0f / sampleRate;
+  UploadSource src = { &reader, profile, nullptr, 0, 0, 0, false };
+  ByteWriter flac = {};
+  uint8_t head[44];
+  size_t headLen = 0;
+  size_t length;
+  const char* filename = "speech.wav";
+  const char* contentType = "audio/wav";
+
+  unsigned long encodeStart = micros();
+  if (profile == UPLOAD_FLAC_16K) {
+    flac.capacity = (size_t)(uploadProfiles[profile].bytesPerSecond * audioSeconds) + 1024;
+    flac.data = (uint8_t*)(psramFound() ? ps_malloc(flac.capacity) : malloc(flac.capacity));
+    flac.failed = !flac.data;
+    encodeUploadAudio(reader, profile, sampleRate, ByteWriter::writeCallback, &flac);
+    if (flac.failed) {
+      flac.release();
+      error = "Out of memory for FLAC upload";
+      return false;
+    }
+    src.encoded = flac.data;
+    src.encodedLen = flac.len;
+    length = flac.len;
+    filename = "speech.flac";
+    contentType = "audio/flac";
+  } else if (profile == UPLOAD_MULAW_8K) {
+    length = reader.length() / 4;
+    buildWavHeader(head, length, uploadRate, 7, 8);
+    headLen = sizeof(head);
+  } else {
+    length = reader.length() & ~1u;
+    buildWavHeader(head, length, uploadRate);
+    headLen = sizeof(head);
+  }
+  uint32_t encodeMicros = micros() - encodeStart;
+
+  UploadBody body(backend.body == BODY_MULTIPART ? "voiceai-audio-boundary" : nullptr);
+  if (backend.body == BODY_MULTIPART) {
+    body.field("model", STT_SERVER_MODEL).field("language", "en").field("response_format", "json");
+  }
+  body.file("file", filename, contentType, head, headLen, readUploadSource, &src, length);
+  uploadStats.binaryUploads++;
+  uploadStats.bodyBytes += body.size();
+  uploadStats.base64BytesAvoided += (headLen + length + 2) / 3 * 4 - headLen - length;
+  uploadStats.lastEncodeMicros = encodeMicros;
+  uploadStats.encodeMicrosTotal += encodeMicros;
+  Serial.printf("[uplink] %s: %s, %u bytes as %s, base64 would add %u\n", backend.name, uploadProfiles[profile].name,
+                (unsigned)body.size(), body.contentType(), (unsigned)((headLen + length + 2) / 3 * 4 - headLen - length));
+
+  HTTPClient http;
+  http.begin(STT_SERVER_URL);
+  http.useHTTP10(true);
+  http.addHeader("Content-Type", body.contentType());
+  if (STT_SERVER_TOKEN[0]) http.addHeader("Authorization", "Bearer " STT_SERVER_TOKEN);
+  UploadStream stream(body);
+  httpCode = body.ok() ? http.sendRequest("POST", &stream, body.size()) : HTTPC_ERROR_TOO_LESS_RAM;
+  reader.close();
+  flac.release();
+  if (body.truncated()) {
+    httpCode = HTTPC_ERROR_SEND_PAYLOAD_FAILED;
+  } else if (httpCode > 0) {
+    // PCM and mu-law are encoded as they are read, FLAC before the request
+    linkEstimator.observeEncoding(profile, audioSeconds, length, (encodeMicros + stream.readMicros) / 1000.0f);
+    linkEstimator.observeUpload(stream.bytesWritten, stream.writeMicros);
+  }
+
+  bool ok = false;
+  if (httpCode == HTTP_CODE_OK) {
+    HttpBodyStream response(http);
+    DynamicJsonDocument doc(4096);
+    DeserializationError jsonError = deserializeJson(doc, response);
+    response.finish("Speech");
+    const char* text = doc["text"];
+    if (response.failed()) {
+      error = "Undecodable response body";
+    } else if (jsonError) {
+      error = "JSON Parse Err: " + String(jsonError.c_str());
+    } else if (text && text[0]) {
+      transcript = text;
+      transcript.trim();  // Whisper starts its text with a space
+      ok = true;
+    } else {
+      error = "No transcription";
+    }
+  } else {
+    error = "Speech server: " + String(httpCode);
+  }
+  http.end();
+  return ok;
+}
+
+//========================================
+// Speculative LLM Queries
+//========================================
+
+// speculative::normalize() for a String
+String normalizeTranscript(const String& text) {
+  char* buf = (char*)malloc(text.length() + 1);
+  if (!buf) return String();
+  speculative::normalize(text.c_str(), text.length(), buf);
+  String out(buf);
+  free(buf);
+  return out;
+}
+
+void speculationTask(void* param) {
+  String answer;
+  String error;
+  int httpCode = 0;
+  bool ok = fetchGeminiAnswer(speculation.query, answer, error, httpCode);
+
+  speculation.durationMs = millis() - speculation.startedAt;
+  if (speculation.cancelled) {
+    speculation.state = SPEC_IDLE;
+  } else {
+    speculation.answer = answer;
+    speculation.error = error;
+    speculation.ok = ok;
+    speculation.state = SPEC_DONE;
+  }
+  vTaskDelete(NULL);
+}
+
+void cancelSpeculation() {
+  if (speculation.state == SPEC_RUNNING) {
+    // The request cannot be aborted mid-flight; its result is discarded
+    speculation.cancelled = true;
+  } else {
+    speculation.state = SPEC_IDLE;
+  }
+}
+
+void resetSpeculation() {
+  cancelSpeculation();
+  speculationInterim.reset();
+}
+
+// Called with each interim result from a streaming recognizer. Starts the
+// Gemini request once the interim is stable, either by the recognizer's
+// own stability score or by not changing for SPECULATION_STABLE_MS.
+void onInterimTranscript(const String& text, float stability) {
+#ifdef SPECULATION_ENABLED
+  String normalized = normalizeTranscript(text);
+  unsigned long now = millis();
+  if (!speculationInterim.update(normalized.c_str(), normalized.length(), stability, now)) return;
+
+  if (speculation.state != SPEC_IDLE) {
+    if (speculation.query == normalized || speculation.cancelled) return;
+    cancelSpeculation();  // The user kept talking; the old guess is stale
+    if (speculation.state != SPEC_IDLE) return;
+  }
+
+  speculation.query = normalized;
+  speculation.cancelled = false;
+  speculation.startedAt = now;
+  speculation.state = SPEC_RUNNING;
+  if (startTask(TASK_SPECULATE, speculationTask, NULL) != pdPASS) {
+    speculation.state = SPEC_IDLE;
+    return;
+  }
+  speculationStats.attempts++;
+  Serial.printf("[speculate] \"%s\"\n", normalized.c_str());
+#endif
+}
+
+// Returns the speculative answer if it was asked for the same words as the
+// final transcript, waiting for it if still in flight. On a mismatch the
+// speculation is cancelled and the caller issues the real request.
+bool takeSpeculativeAnswer(const String& finalTranscript, String& answer) {
+  if (speculation.state == SPEC_IDLE || speculation.cancelled) return false;
+
+  unsigned long finalAt = millis();
+  if (normalizeTranscript(finalTranscript) != speculation.query) {
+    speculationStats.misses++;
+    cancelSpeculation();
+    return false;
+  }
+
+  while (speculation.state == SPEC_RUNNING) {
+    delay(5);
+  }
+  bool ok = speculation.ok;
+  if (ok) {
+    answer = speculation.answer;
+    // Without speculation the request would have started at finalAt
+    uint32_t saved = speculative::savedMs(speculation.startedAt, speculation.durationMs, finalAt);
+    speculationStats.hits++;
+    speculationStats.savedMs += saved;
+    Serial.printf("[speculate] hit, saved %u ms\n", (unsigned)saved);
+  } else {
+    speculationStats.misses++;
+  }
+  speculation.state = SPEC_IDLE;
+  return ok;
+}
+
+//========================================
+// Streaming Speech Recognition
+//========================================
+
+// Per-stream state of the stream task
+typedef struct {
+  SpeechGrpcReader* reader;
+  String finals;       // Final results, concatenated
+  uint32_t interims;
+  int grpcStatus;      // -1 until the trailers arrive
+  bool closed;
+  uint32_t closeCode;
+  int64_t finalUs;
+} SttStreamCall;
+
+typedef struct {
+  uint8_t rx[H2Client::RX_BUFFER_BYTES];
+  uint8_t messages[1024];  // One response message; transcripts are far smaller
+  uint8_t chunk[SpeechGrpc::AUDIO_PREFIX_MAX + RECORD_SAMPLE_RATE * 2 * STT_STREAM_CHUNK_MS / 1000];
+} SttStreamBuffers;
+
+int32_t sttStreamWrite(void* io, const uint8_t* data, uint32_t len) {
+  WiFiClientSecure* client = (WiFiClientSecure*)io;
+  unsigned long start = millis();
+  uint32_t sent = 0;
+  while (sent < len) {
+    size_t n = client->write(data + sent, len - sent);
+    if (n == 0) {
+      if (!client->connected() || millis() - start > HTTP_BODY_TIMEOUT_MS) return -1;
+      delay(1);
+      continue;
+    }
+    sent += n;
+  }
+  return len;
+}
+
+int32_t sttStreamRead(void* io, uint8_t* buf, uint32_t len) {
+  WiFiClientSecure* client = (WiFiClientSecure*)io;
+  int available = client->available();
+  if (available <= 0) return client->connected() ? 0 : -1;
+  int n = client->read(buf, min((uint32_t)available, len));
+  return n < 0 ? -1 : n;
+}
+
+void onSttResult(void* ctx, const SpeechGrpcReader::Result& r) {
+  SttStreamCall* call = (SttStreamCall*)ctx;
+  if (r.isFinal) {
+    call->finals.concat(r.transcript, r.transcriptLen);
+    call->finalUs = esp_timer_get_time();
+    return;
+  }
+  call->interims++;
+  SttStream& s = sttStream;
+  xSemaphoreTake(s.lock, portMAX_DELAY);
+  s.interim = "";
+  s.interim.concat(r.transcript, r.transcriptLen);
+  s.interimStability = r.stability;
+  s.interimFresh = true;
+  xSemaphoreGive(s.lock);
+}
+
+void onSttHeader(void* ctx, const char* name, size_t nameLen, const char* value, size_t valueLen) {
+  if (nameLen == 11 && memcmp(name, "grpc-status", 11) == 0) {
+    char digits[8] = "";
+    memcpy(digits, value, min(valueLen, sizeof(digits) - 1));
+    ((SttStreamCall*)ctx)->grpcStatus = atoi(digits);
+  }
+}
+
+void onSttData(void* ctx, const uint8_t* data, size_t len) {
+  ((SttStreamCall*)ctx)->reader->feed(data, len);
+}
+
+void onSttClosed(void* ctx, uint32_t errorCode) {
+  SttStreamCall* call = (SttStreamCall*)ctx;
+  call->closed = true;
+  call->closeCode = errorCode;
+}
+
+// Streams the capture staging from its start as the capture task fills it:
+// the config message, then one message per STT_STREAM_CHUNK_MS, the last
+// with END_STREAM once capture stops. Reads the staging through its own
+// cursor and gives up if the spill let the ring lap it.
+bool runSttStream(WiFiClientSecure& client, SttStreamBuffers& buf, SttStreamCall& call, String& error) {
+  SttStream& s = sttStream;
+  const CaptureStaging& st = captureStaging;
+  H2Client h2(buf.rx, sttStreamRead, sttStreamWrite, &client);
+  SpeechGrpcReader reader(buf.messages, sizeof(buf.messages), onSttResult, &call);
+  call.reader = &reader;
+
+  H2Client::Header headers[] = {
+    { ":method", "POST" },
+    { ":scheme", "https" },
+    { ":path", SpeechGrpc::path() },
+    { ":authority", apiHostNames[API_SPEECH] },
+    { "content-type", "application/grpc" },
+    { "te", "trailers" },
+    { "x-goog-api-key", deviceConfig.googleSpeechApiKey },
+  };
+  H2Client::Handler handler = { onSttHeader, onSttData, onSttClosed, &call };
+  uint32_t id = h2.start() ? h2.request(headers, sizeof(headers) / sizeof(headers[0]), false, handler) : 0;
+  if (!id) {
+    error = "HTTP/2 setup failed";
+    return false;
+  }
+
+  const uint32_t chunkBytes = sizeof(buf.chunk) - SpeechGrpc::AUDIO_PREFIX_MAX;
+  uint32_t chunkLen = SpeechGrpc::configRequest(buf.chunk, RECORD_SAMPLE_RATE, STT_STREAM_LANGUAGE, false, true);
+  uint32_t chunkPos = 0;
+  uint32_t streamed = 0;
+  bool last = false;
+  bool endSent = false;
+  while (!call.closed && !s.cancelled) {
+    if (chunkPos == chunkLen && !last) {
+      bool ended = s.audioEnded;  // Before head: once set, head is final
+      uint32_t available = st.head - streamed;
+      if (available >= chunkBytes || ended) {
+        uint32_t n = min(available, chunkBytes);
+        uint32_t prefix = n ? SpeechGrpc::audioPrefix(buf.chunk, n) : 0;
+        uint32_t start = streamed % st.size;
+        uint32_t first = min(n, st.size - start);
+        memcpy(buf.chunk + prefix, st.data + start, first);
+        memcpy(buf.chunk + prefix + first, st.data, n - first);
+        if (st.head - streamed > st.size) {
+          error = "Stream fell behind capture";
+          break;
+        }
+        streamed += n;
+        chunkLen = prefix + n;
+        chunkPos = 0;
+        last = ended && n == available;
+      }
+    }
+    if (chunkPos < chunkLen || (last && !endSent)) {
+      int32_t n = h2.send(id, buf.chunk + chunkPos, chunkLen - chunkPos, last);
+      if (n < 0) break;
+      chunkPos += n;
+      if (last && chunkPos == chunkLen) {
+        endSent = true;
+        s.audioEndUs = esp_timer_get_time();
+      }
+    }
+    if (!h2.poll()) break;
+    delay(endSent || chunkPos < chunkLen ? 2 : 10);  // Waiting on the server, or on the microphone
+  }
+
+  sttStreamStats.interims += call.interims;
+  sttStreamStats.windowStalls += h2.windowStalls();
+  bool ok = call.closed && call.closeCode == H2Client::NO_ERROR && call.grpcStatus == 0;
+  if (!ok && error.length() == 0) {
+    if (reader.errorCode()) {
+      error = "Speech stream: " + String(reader.errorCode()) + " " + reader.errorMessage();
+    } else if (call.grpcStatus > 0) {
+      error = "Speech stream: grpc-status " + String(call.grpcStatus);
+    } else if (s.cancelled) {
+      error = "Speech stream: cancelled";
+    } else {
+      error = "Speech stream: HTTP/2 error " + String((unsigned)(call.closed ? call.closeCode : h2.lastError()));
+    }
+  }
+  if (!call.closed) h2.cancel(id);
+  h2.close();
+  return ok;
+}
+
+void sttStreamTask(void* param) {
+  SttStream& s = sttStream;
+  SttStreamCall call = {};
+  call.grpcStatus = -1;
+  String error;
+  bool ok = false;
+
+  SttStreamBuffers* buf = (SttStreamBuffers*)malloc(sizeof(SttStreamBuffers));
+  WiFiClientSecure client;
+  static const char* alpn[] = { "h2", nullptr };
+  client.setInsecure();
+  client.setAlpnProtocols(alpn);
+  client.setHandshakeTimeout(5);
+  unsigned long connectStart = millis();
+  IPAddress ip;
+  if (!buf) {
+    error = "Speech stream: no memory";
+  } else if (!resolveCached(apiHostNames[API_SPEECH], ip)
+             || !client.connect(ip, 443, apiHostNames[API_SPEECH], nullptr, nullptr, nullptr)) {
+    error = "Speech stream: connect failed";
+  } else {
+    sttStreamStats.lastConnectMs = millis() - connectStart;
+    client.setNoDelay(true);
+    ok = runSttStream(client, *buf, call, error);
+  }
+  client.stop();
+  free(buf);
+
+  s.ok = ok && call.finals.length() > 0;
+  s.noSpeech = ok && call.finals.length() == 0;
+  s.transcript = call.finals;
+  s.error = error;
+  if (s.ok) {
+    sttStreamStats.lastFinalMs = (call.finalUs - s.audioEndUs) / 1000;
+    sttStreamStats.finalMsTotal += sttStreamStats.lastFinalMs;
+    sttStreamStats.transcripts++;
+    Serial.printf("[stt-stream] final %u ms after the end of audio, %u interims\n",
+                  (unsigned)sttStreamStats.lastFinalMs, (unsigned)call.interims);
+  } else if (!s.noSpeech) {
+    Serial.printf("[stt-stream] %s\n", error.c_str());
+  }
+  xSemaphoreGive(s.done);
+  s.running = false;
+  vTaskDelete(NULL);
+}
+
+// Starts streaming the recording that startRecording() just began
+void startSttStream() {
+#if defined(STREAMING_STT_ENABLED) && !defined(REALTIME_MODE) && !defined(GATEWAY_MODE)
+  SttStream& s = sttStream;
+  s.active = false;
+  if (WiFi.status() != WL_CONNECTED || !s.done) return;
+  if (s.running) {
+    sttStreamStats.busy++;  // A cancelled stream is still closing
+    return;
+  }
+  xSemaphoreTake(s.done, 0);  // Left over from a stream nobody waited for
+  s.audioEnded = false;
+  s.cancelled = false;
+  s.interim = "";
+  s.interimFresh = false;
+  s.interimPolledAt = 0;
+  s.running = true;
+  if (startTask(TASK_STT_STREAM, sttStreamTask, NULL) != pdPASS) {
+    s.running = false;
+    return;
+  }
+  s.active = true;
+  sttStreamStats.streams++;
+#endif
+}
+
+void cancelSttStream() {
+  sttStream.cancelled = true;
+  sttStream.active = false;
+}
+
+// Loop: hands the newest interim result to speculation. Unchanged text is
+// passed on again every chunk so its stability timer can run out.
+void pollStreamInterim() {
+  SttStream& s = sttStream;
+  unsigned long now = millis();
+  if (!s.active || (!s.interimFresh && now - s.interimPolledAt < STT_STREAM_CHUNK_MS)) return;
+  s.interimPolledAt = now;
+  xSemaphoreTake(s.lock, portMAX_DELAY);
+  String text = s.interim;
+  float stability = s.interimStability;
+  s.interimFresh = false;
+  xSemaphoreGive(s.lock);
+  if (text.length() > 0) onInterimTranscript(text, stability);
+}
+
+// Waits for the stream of the last recording. Returns false if there was
+// none or it failed, and the REST request has to be made; otherwise sets
+// transcribed, with the transcript or the error.
+bool takeStreamTranscript(String& transcript, bool& transcribed, String& error) {
+  SttStream& s = sttStream;
+  if (!s.active) return false;
+  unsigned long start = millis();
+  bool done = false;
+  while (!(done = xSemaphoreTake(s.done, pdMS_TO_TICKS(10)) == pdTRUE) && millis() - start < STT_STREAM_FINAL_WAIT_MS) {
+    pollStreamInterim();
+  }
+  if (!done) {
+    cancelSttStream();
+    sttStreamStats.fallbacks++;
+    Serial.println("[stt-stream] no final result in time, using the REST request");
+    return false;
+  }
+  s.active = false;
+  if (!s.ok && !s.noSpeech) {
+    sttStreamStats.fallbacks++;
+    return false;
+  }
+  transcribed = s.ok;
+  transcript = s.transcript;
+  if (s.noSpeech) error = "No transcription";
+  if (recordingStats.releaseUs) {
+    // Release edge to the last audio byte on the wire
+    recordingStats.releaseToUploadMs = max((int64_t)0, s.audioEndUs - recordingStats.releaseUs) / 1000;
+    recordingStats.releaseToUploadMsTotal += recordingStats.releaseToUploadMs;
+    recordingStats.releaseToUploadCount++;
+    recordingStats.releaseUs = 0;
+  }
+  return true;
+}
+
+//========================================
+// Realtime Voice Session
+//========================================
+
+typedef struct {
+  uint8_t rx[WsClient::RX_BUFFER_BYTES];
+  int16_t chunk[RECORD_SAMPLE_RATE * REALTIME_CHUNK_MS / 1000];
+} RealtimeBuffers;
+
+// Ends the answer on speechStream. A dropped answer is left alone: the
+// fallback may own speechStream by now.
+void endRealtimeAnswer() {
+  RealtimeState& r = realtime;
+  if (r.answering && !r.discarding) {
+    speechStream->end();
+    if (!r.playing) {
+      playSpeechStream();
+      r.playing = true;
+    }
+  }
+  r.answering = false;
+  r.discarding = false;
+}
+
+// Answer audio, in batches as it is decoded. The first batch of an answer
+// starts speechStream; playback starts once the prefill is in. Waits while
+// the buffer is full, which leaves the rest in the socket.
+void onRealtimeAudio(void* ctx, const int16_t* samples, size_t count, uint32_t sampleRate) {
+  RealtimeState& r = realtime;
+  if (r.discarding || !speechStream) return;
+  if (!r.answering) {
+    speechStream->begin(sampleRate);
+    r.answering = true;
+    r.playing = false;
+    realtimeStats.answers++;
+    realtimeStats.lastTurnMs = (esp_timer_get_time() - r.audioEndUs) / 1000;
+    realtimeStats.turnMsTotal += realtimeStats.lastTurnMs;
+    Serial.printf("[realtime] first audio %u ms after the end of speech\n", (unsigned)realtimeStats.lastTurnMs);
+  }
+  while (count > 0 && !r.discarding) {
+    uint32_t n = speechStream->push(samples, count, millis());
+    samples += n;
+    count -= n;
+    if (count > 0) delay(5);
+  }
+  if (!r.playing && !r.discarding && speechStream->prefilled()) {
+    playSpeechStream();
+    r.playing = true;
+  }
+}
+
+void onRealtimeEvent(void* ctx, RealtimeSession::Event event) {
+  RealtimeState& r = realtime;
+  switch (event) {
+    case RealtimeSession::EVENT_SETUP_COMPLETE:
+      r.ready = true;
+      break;
+    case RealtimeSession::EVENT_TURN_COMPLETE:
+      endRealtimeAnswer();
+      r.answered = true;
+      break;
+    case RealtimeSession::EVENT_INTERRUPTED:
+      endRealtimeAnswer();
+      break;
+    case RealtimeSession::EVENT_GO_AWAY:
+      r.goAway = true;
+      break;
+    default:
+      break;
+  }
+}
+
+// Connects and sends the setup; true once the session is ready for turns
+bool openRealtimeSession(WiFiClientSecure& client, WsClient& ws, RealtimeSession& session) {
+  RealtimeState& r = realtime;
+  r.ready = false;
+  r.goAway = false;
+  unsigned long start = millis();
+  IPAddress ip;
+  if (!resolveCached(apiHostNames[API_GEMINI], ip)
+      || !client.connect(ip, 443, apiHostNames[API_GEMINI], nullptr, nullptr, nullptr)) {
+    Serial.println("[realtime] connect failed");
+    return false;
+  }
+  client.setNoDelay(true);
+  String path = String(REALTIME_PATH) + "?key=" + deviceConfig.geminiApiKey;
+  if (!ws.start(apiHostNames[API_GEMINI], path.c_str())) return false;
+  bool sentSetup = false;
+  while (!r.ready && millis() - start < REALTIME_SETUP_WAIT_MS) {
+    if (!ws.poll() || ws.state() == WsClient::STATE_CLOSED) break;
+    if (ws.state() == WsClient::STATE_OPEN && !sentSetup) {
+      sentSetup = session.setup(REALTIME_MODEL);
+      if (!sentSetup) break;
+    }
+    delay(5);
+  }
+  if (!r.ready) {
+    Serial.printf("[realtime] setup failed, close code %u\n", (unsigned)ws.closeCode());
+    return false;
+  }
+  realtimeStats.lastConnectMs = millis() - start;
+  realtimeStats.sessions++;
+  Serial.printf("[realtime] session ready in %u ms\n", (unsigned)realtimeStats.lastConnectMs);
+  return true;
+}
+
+// Streams the capture staging from its start as the capture task fills
+// it, one message per REALTIME_CHUNK_MS, between activityStart and
+// activityEnd. Reads through its own cursor like runSttStream().
+bool streamRealtimeTurn(WsClient& ws, RealtimeSession& session, RealtimeBuffers& buf) {
+  RealtimeState& r = realtime;
+  const CaptureStaging& st = captureStaging;
+  uint32_t turn = r.turn;
+  if (!r.answering) r.discarding = false;  // Nothing left of an interrupted answer
+  if (!session.activityStart()) return false;
+  realtimeStats.turns++;
+
+  const uint32_t chunkBytes = sizeof(buf.chunk);
+  uint32_t streamed = 0;
+  while (r.turn == turn) {
+    bool ended = r.audioEnded;  // Before head: once set, head is final
+    uint32_t available = st.head - streamed;
+    if (available > st.size) {
+      Serial.println("[realtime] stream fell behind capture");
+      return false;
+    }
+    if (available >= chunkBytes || (ended && available > 0)) {
+      uint32_t n = min(available, chunkBytes);
+      uint32_t start = streamed % st.size;
+      uint32_t first = min(n, st.size - start);
+      memcpy(buf.chunk, st.data + start, first);
+      memcpy((uint8_t*)buf.chunk + first, st.data, n - first);
+      streamed += n;
+      if (!session.audio(buf.chunk, n / 2, RECORD_SAMPLE_RATE)) return false;
+      continue;
+    }
+    if (ended) break;
+    if (!ws.poll() || ws.state() != WsClient::STATE_OPEN) return false;
+    delay(10);  // Waiting on the microphone
+  }
+  r.audioEndUs = esp_timer_get_time();
+  return session.activityEnd();
+}
+
+// Owns the session: opens it for the first turn, streams each turn and
+// delivers the answers, and closes it once idle or when the server asks
+void realtimeTask(void* param) {
+  RealtimeState& r = realtime;
+  RealtimeBuffers* buf = (RealtimeBuffers*)malloc(sizeof(RealtimeBuffers));
+  RealtimeSession::Handler handler = { onRealtimeAudio, onRealtimeEvent, nullptr };
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // The first turn of a session
+    WiFiClientSecure client;
+    client.setInsecure();
+    client.setHandshakeTimeout(5);
+    WsClient ws(buf ? buf->rx : nullptr, sttStreamRead, sttStreamWrite, esp_random, &client);
+    RealtimeSession session(ws, handler);
+    if (!buf || !openRealtimeSession(client, ws, session)) {
+      realtimeStats.setupFailures++;
+      r.failed = true;
+      client.stop();
+      continue;
+    }
+
+    bool turn = true;
+    unsigned long lastActive = millis();
+    for (;;) {
+      if (turn && !streamRealtimeTurn(ws, session, *buf)) break;
+      if (turn) lastActive = millis();
+      if (!ws.poll() || ws.state() != WsClient::STATE_OPEN) break;
+      if (r.answering) lastActive = millis();
+      if (r.goAway || millis() - lastActive > REALTIME_IDLE_CLOSE_MS) {
+        ws.close();
+        unsigned long closeStart = millis();
+        while (ws.state() != WsClient::STATE_CLOSED && millis() - closeStart < 1000 && ws.poll()) delay(5);
+        break;
+      }
+      turn = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10)) > 0;
+    }
+
+    endRealtimeAnswer();
+    if (!r.answered) r.failed = true;
+    realtimeStats.audioBytesSent += session.audioBytesSent();
+    realtimeStats.audioSamplesReceived += session.audioSamplesReceived();
+    Serial.printf("[realtime] session closed, code %u\n", (unsigned)ws.closeCode());
+    client.stop();
+  }
+}
+
+void gatewayTask(void* param);
+
+// Makes the recording that startRecording() just began a realtime turn
+void startRealtimeTurn() {
+#if defined(REALTIME_MODE) || defined(GATEWAY_MODE)
+  RealtimeState& r = realtime;
+  r.active = false;
+  if (WiFi.status() != WL_CONNECTED || !speechStream) return;
+#ifdef GATEWAY_MODE
+  TaskFunction_t task = gatewayTask;
+#else
+  TaskFunction_t task = realtimeTask;
+#endif
+  if (!realtimeTaskHandle && startTask(TASK_REALTIME, task, NULL, &realtimeTaskHandle) != pdPASS) return;
+  r.turn++;
+  r.audioEnded = false;
+  r.answered = false;
+  r.failed = false;
+  r.playing = false;
+  r.interrupted = false;
+  r.active = true;
+  xTaskNotifyGive(realtimeTaskHandle);
+#endif
+}
+
+// Loop, after the release: waits for the answer to start playing. Returns
+// false if there was no realtime turn or the session failed before
+// answering, and the request pipeline has to answer instead.
+bool finishRealtimeTurn() {
+  RealtimeState& r = realtime;
+  if (!r.active) return false;
+  displayStatus("Thinking...");
+  currentState = STATE_QUERYING_AI;
+  unsigned long start = millis();
+  while (!r.playing && !r.answered && !r.failed && millis() - start < REALTIME_ANSWER_WAIT_MS) delay(10);
+  if (r.playing) {
+    traceMark(TRACE_TTS_DONE);
+    displayStatus("Playing response...");
+    currentState = STATE_PLAYING;
+    return true;
+  }
+  if (r.answered) {
+    // The model answered without speaking
+    r.active = false;
+    stopCues();
+    currentState = STATE_READY;
+    displayStatus(readyMessage());
+    return true;
+  }
+  r.discarding = true;  // A late answer would talk over the fallback
+  r.active = false;
+  realtimeStats.fallbacks++;
+  Serial.println(r.failed ? "[realtime] session failed, using the request pipeline"
+                          : "[realtime] no answer in time, using the request pipeline");
+  displayStatus("Processing speech...");
+  currentState = STATE_PROCESSING_SPEECH;
+  return false;
+}
+
+// Loop: a press while the answer plays. The answer voice fades out and the
+// rest of the answer is dropped; the press, still held, then starts the
+// next turn once the loop is back to ready.
+void interruptRealtimeAnswer() {
+  RealtimeState& r = realtime;
+  if (!isPlayingAudio || r.interrupted) return;
+  r.interrupted = true;
+  r.discarding = r.answering;
+  realtimeStats.interruptions++;
+  PlaybackRequest req = {};
+  req.kind = PLAYBACK_STOP_ANSWER;
+  queuePlayback(req);
+  Serial.println("[realtime] interrupted by the button");
+}
+
+//========================================
+// Voice Gateway Session
+//========================================
+
+typedef struct {
+  alignas(4) uint8_t rx[GatewaySession::RX_BUFFER_BYTES];
+  int16_t chunk[RECORD_SAMPLE_RATE * REALTIME_CHUNK_MS / 1000];
+  GatewaySession* session;
+  bool streaming;        // TURN_START sent, TURN_END not yet
+  bool turnOpen;         // TURN_END sent, TURN_DONE not yet back
+  uint8_t staleTurns;    // Cancelled turns whose TURN_DONE is still to come
+} GatewayLink;
+
+int32_t gatewayWrite(void* io, const uint8_t* data, uint32_t len) {
+  WiFiClient* client = (WiFiClient*)io;
+  unsigned long start = millis();
+  uint32_t sent = 0;
+  while (sent < len) {
+    size_t n = client->write(data + sent, len - sent);
+    if (n == 0) {
+      if (!client->connected() || millis() - start > HTTP_BODY_TIMEOUT_MS) return -1;
+      delay(1);
+      continue;
+    }
+    sent += n;
+  }
+  return len;
+}
+
+int32_t gatewayRead(void* io, uint8_t* buf, uint32_t len) {
+  WiFiClient* client = (WiFiClient*)io;
+  int available = client->available();
+  if (available <= 0) return client->connected() ? 0 : -1;
+  int n = client->read(buf, min((uint32_t)available, len));
+  return n < 0 ? -1 : n;
+}
+
+// Answer audio goes through onRealtimeAudio(); the rest ends the turn or
+// feeds the archive
+void onGatewayEvent(void* ctx, GatewaySession::Event event) {
+  RealtimeState& r = realtime;
+  GatewayLink& link = *(GatewayLink*)ctx;
+  GatewaySession& session = *link.session;
+  switch (event) {
+    case GatewaySession::EVENT_READY:
+      r.ready = true;
+      break;
+    case GatewaySession::EVENT_TRANSCRIPT:
+      if (link.staleTurns) break;
+      archiveState.transcript = "";
+      archiveState.transcript.concat(session.text(), session.textLength());
+      Serial.printf("[gateway] heard: %s\n", archiveState.transcript.c_str());
+      break;
+    case GatewaySession::EVENT_ANSWER_TEXT:
+      if (link.staleTurns) break;
+      archiveState.response = "";
+      archiveState.response.concat(session.text(), session.textLength());
+      break;
+    case GatewaySession::EVENT_TURN_DONE: {
+      endRealtimeAnswer();
+      if (link.staleTurns) {
+        link.staleTurns--;
+        break;
+      }
+      link.streaming = false;  // The turn failed before the user finished
+      link.turnOpen = false;
+      const gateway::TurnDone& t = session.turnDone();
+      gatewayStats.lastSttMs = t.sttMs;
+      gatewayStats.lastLlmMs = t.llmMs;
+      gatewayStats.lastTtsMs = t.ttsMs;
+      Serial.printf("[gateway] turn %s: stt %u ms, llm %u ms, tts %u ms\n",
+                    t.status <= gateway::STATUS_CANCELLED ? gateway::statusNames[t.status] : "?", (unsigned)t.sttMs,
+                    (unsigned)t.llmMs, (unsigned)t.ttsMs);
+      if (t.status == gateway::STATUS_OK || t.status == gateway::STATUS_NO_SPEECH) {
+        r.answered = true;
+      } else {
+        gatewayStats.failures++;
+        r.failed = true;  // The request pipeline tries the turn itself
+      }
+      break;
+    }
+    case GatewaySession::EVENT_ERROR:
+      Serial.printf("[gateway] error: %.*s\n", (int)session.textLength(), session.text());
+      break;
+    default:
+      break;
+  }
+}
+
+// Drops what is left of the answer being discarded (barge-in or fallback)
+void cancelGatewayTurn(GatewayLink& link) {
+  if (!realtime.discarding || !link.turnOpen) return;
+  link.turnOpen = false;
+  link.staleTurns++;
+  gatewayStats.cancels++;
+  link.session->cancel();
+}
+
+bool openGatewaySession(WiFiClient& client, GatewaySession& session) {
+  RealtimeState& r = realtime;
+  r.ready = false;
+  unsigned long start = millis();
+  if (!client.connect(GATEWAY_HOST, GATEWAY_PORT, GATEWAY_CONNECT_WAIT_MS)) {
+    Serial.println("[gateway] connect failed");
+    return false;
+  }
+  client.setNoDelay(true);
+  String id = WiFi.macAddress();
+  if (!session.hello(id.c_str(), RECORD_SAMPLE_RATE, GATEWAY_UPLINK_CODEC, GATEWAY_DOWNLINK_CODEC)) return false;
+  while (!r.ready && millis() - start < GATEWAY_CONNECT_WAIT_MS) {
+    if (!session.poll()) break;
+    delay(5);
+  }
+  if (!r.ready) {
+    Serial.println("[gateway] no READY from the gateway");
+    return false;
+  }
+  realtimeStats.lastConnectMs = millis() - start;
+  realtimeStats.sessions++;
+  Serial.printf("[gateway] session %u ready in %u ms\n", (unsigned)session.sessionId(),
+                (unsigned)realtimeStats.lastConnectMs);
+  return true;
+}
+
+// Streams the capture staging between TURN_START and TURN_END, as
+// streamRealtimeTurn() does
+bool streamGatewayTurn(GatewayLink& link) {
+  RealtimeState& r = realtime;
+  GatewaySession& session = *link.session;
+  const CaptureStaging& st = captureStaging;
+  uint32_t turn = r.turn;
+  cancelGatewayTurn(link);
+  if (!r.answering && !link.staleTurns) r.discarding = false;
+  if (!session.turnStart()) return false;
+  link.streaming = true;
+  realtimeStats.turns++;
+
+  const uint32_t chunkBytes = sizeof(link.chunk);
+  uint32_t streamed = 0;
+  while (r.turn == turn) {
+    bool ended = r.audioEnded;  // Before head: once set, head is final
+    uint32_t available = st.head - streamed;
+    if (available > st.size) {
+      Serial.println("[gateway] stream fell behind capture");
+      return false;
+    }
+    if (available >= chunkBytes || (ended && available > 0)) {
+      uint32_t n = min(available, chunkBytes);
+      uint32_t start = streamed % st.size;
+      uint32_t first = min(n, st.size - start);
+      memcpy(link.chunk, st.data + start, first);
+      memcpy((uint8_t*)link.chunk + first, st.data, n - first);
+      streamed += n;
+      if (!session.audio(link.chunk, n / 2)) return false;
+      continue;
+    }
+    if (ended) break;
+    if (!session.poll()) return false;  // The previous answer may still be arriving
+    if (!link.streaming) return true;   // TURN_DONE came early; the fallback has the turn
+    delay(10);  // Waiting on the microphone
+  }
+  r.audioEndUs = esp_timer_get_time();
+  link.streaming = false;
+  link.turnOpen = true;
+  return session.turnEnd();
+}
+
+// Owns the gateway connection: opens it for the first turn, streams each
+// turn and delivers the answers, and closes it once idle
+void gatewayTask(void* param) {
+  RealtimeState& r = realtime;
+  GatewayLink* link = (GatewayLink*)malloc(sizeof(GatewayLink));
+  GatewaySession::Handler handler = { onRealtimeAudio, onGatewayEvent, link };
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);  // The first turn of a session
+    WiFiClient client;
+    GatewaySession session(link ? link->rx : nullptr, gatewayRead, gatewayWrite, &client, handler);
+    if (link) {
+      link->session = &session;
+      link->streaming = false;
+      link->turnOpen = false;
+      link->staleTurns = 0;
+    }
+    if (!link || !openGatewaySession(client, session)) {
+      realtimeStats.setupFailures++;
+      r.failed = true;
+      client.stop();
+      continue;
+    }
+
+    bool turn = true;
+    unsigned long lastActive = millis();
+    for (;;) {
+      if (turn && !streamGatewayTurn(*link)) break;
+      if (turn) lastActive = millis();
+      cancelGatewayTurn(*link);
+      if (!session.poll()) break;
+      if (r.answering || link->turnOpen) lastActive = millis();
+      if (millis() - lastActive > REALTIME_IDLE_CLOSE_MS) break;
+      turn = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10)) > 0;
+    }
+
+    endRealtimeAnswer();
+    if (!r.answered) r.failed = true;
+    realtimeStats.audioBytesSent += session.bytesSent();
+    realtimeStats.audioSamplesReceived += session.audioSamplesReceived();
+    gatewayStats.bytesSent += session.bytesSent();
+    gatewayStats.bytesReceived += session.bytesReceived();
+    Serial.println("[gateway] session closed");
+    client.stop();
+  }
+}
 
-  // data subchunk
-  memcpy(header + 36, "data", 4);
-  header[40] = (dataLength & 0xff);
-  header[41] = ((dataLength >> 8) & 0xff);
-  header[42] = ((dataLength >> 16) & 0xff);
-  header[43] = ((dataLength >> 24) & 0xff);
+//========================================
+// Interaction Archive
+//========================================
 
-  file.seek(0);
-  file.write(header, 44);
+String archiveSegmentPath(uint32_t segment) {
+  char path[32];
+  snprintf(path, sizeof(path), ARCHIVE_DIR "/seg%06u.bin", (unsigned)segment);
+  return String(path);
 }
 
-void startRecording() {
-  // Close any previously open file
-  if (audioFile) {
-    audioFile.close();
+// Loads index.bin, or starts an empty archive if it is missing or from an
+// incompatible layout
+void initArchive() {
+  archive::IndexHeader& h = archiveState.header;
+  if (!SD.exists(ARCHIVE_DIR)) SD.mkdir(ARCHIVE_DIR);
+
+  File index = SD.open(ARCHIVE_INDEX_PATH, FILE_READ);
+  bool ok = index && index.read((uint8_t*)&h, sizeof(h)) == sizeof(h)
+            && h.magic == archive::MAGIC && h.version == archive::VERSION
+            && h.recordSize == sizeof(archive::Record) && h.slots == archive::SLOTS;
+  if (index) index.close();
+
+  if (!ok) {
+    // An archive from an older layout: its segments go with the index
+    if (h.magic == archive::MAGIC && h.lastSegment - h.firstSegment < ARCHIVE_BUDGET_BYTES / ARCHIVE_SEGMENT_BYTES) {
+      for (uint32_t seg = h.firstSegment; seg <= h.lastSegment; seg++) SD.remove(archiveSegmentPath(seg));
+    }
+    memset(&h, 0, sizeof(h));
+    h.magic = archive::MAGIC;
+    h.version = archive::VERSION;
+    h.recordSize = sizeof(archive::Record);
+    h.slots = archive::SLOTS;
+    h.nextSeq = 1;
+    SD.remove(archiveSegmentPath(0));
+
+    index = SD.open(ARCHIVE_INDEX_PATH, FILE_WRITE);
+    if (!index) {
+      Serial.println("[archive] cannot create index");
+      return;
+    }
+    uint8_t empty[512] = { 0 };
+    index.write((const uint8_t*)&h, sizeof(h));
+    for (uint32_t i = 0; i < archive::SLOTS * sizeof(archive::Record); i += sizeof(empty)) {
+      index.write(empty, sizeof(empty));
+    }
+    index.close();
+  }
+  archiveState.ready = true;
+  Serial.printf("[archive] %u interactions, segments %u-%u\n",
+                (unsigned)(h.nextSeq - 1), (unsigned)h.firstSegment, (unsigned)h.lastSegment);
+}
+
+uint16_t archiveSpan(unsigned long from, unsigned long to) {
+  if (!from || !to || to < from) return archive::NO_TIMING;
+  return min(to - from, (unsigned long)archive::NO_TIMING - 1);
+}
+
+// Appends the interaction that just ended: the recording as IMA ADPCM,
+// the transcript, the response and the stage timings. Runs from
+// traceReport(), before the next recording can reuse the capture staging.
+void archiveInteraction() {
+  if (!archiveState.ready || !trace.marks[TRACE_RECORD_END]) return;
+  RecordingReader reader;
+  if (!reader.openLast()) return;
+
+  unsigned long start = millis();
+  archive::IndexHeader& h = archiveState.header;
+  uint32_t transcriptBytes = min(archiveState.transcript.length(), (unsigned)ARCHIVE_TEXT_MAX);
+  uint32_t responseBytes = min(archiveState.response.length(), (unsigned)ARCHIVE_TEXT_MAX);
+  uint32_t estimate = reader.length() / 4 + transcriptBytes + responseBytes;
+
+  // Start a new segment when this one would overflow, then drop the
+  // oldest segments until the archive fits its budget again
+  if (h.lastSegmentBytes > 0 && h.lastSegmentBytes + estimate > ARCHIVE_SEGMENT_BYTES) {
+    h.lastSegment++;
+    h.lastSegmentBytes = 0;
+    SD.remove(archiveSegmentPath(h.lastSegment));  // Left over from an abandoned index
+  }
+  while ((h.lastSegment - h.firstSegment + 1) * (uint64_t)ARCHIVE_SEGMENT_BYTES > ARCHIVE_BUDGET_BYTES) {
+    SD.remove(archiveSegmentPath(h.firstSegment));
+    h.firstSegment++;
+    h.rotations++;
   }
-  // Open file for writing WAV data with .raw extension
-  audioFile = SD.open("/recording.wav", FILE_WRITE);
-  if (!audioFile) {
-    setError("Failed to open file for recording");
+
+  File segment = SD.open(archiveSegmentPath(h.lastSegment), FILE_APPEND);
+  if (!segment) {
+    Serial.println("[archive] cannot open segment");
     return;
   }
-  // Write placeholder WAV header (44 bytes)
-  uint8_t emptyHeader[44] = { 0 };
-  audioFile.write(emptyHeader, 44);
-  audioFile.flush();
 
-  Serial.println("Recording started");
+  archive::Record r = {};
+  r.seq = h.nextSeq;
+  r.segment = h.lastSegment;
+  r.offset = segment.size();
+  r.sampleRate = reader.sampleRate();
+
+  // Gathers reader spans into whole blocks; only the last may be short
+  static int16_t pcm[ImaAdpcm::samplesPerBlock(ADPCM_BLOCK_ALIGN)];
+  static uint8_t block[ADPCM_BLOCK_ALIGN];
+  const uint32_t perBlock = ImaAdpcm::samplesPerBlock(ADPCM_BLOCK_ALIGN);
+  ImaAdpcmEncoder adpcm;
+  uint32_t pending = 0;
+  const uint8_t* data;
+  uint32_t n;
+  r.blockAlign = ADPCM_BLOCK_ALIGN;
+  while ((n = reader.next(data, (perBlock - pending) * 2)) > 0) {
+    memcpy(pcm + pending, data, n);
+    pending += n / 2;
+    if (pending < perBlock) continue;
+    r.audioBytes += segment.write(block, adpcm.encodeBlock(pcm, pending, block));
+    r.sampleCount += pending;
+    pending = 0;
+  }
+  if (pending > 0) {
+    r.audioBytes += segment.write(block, adpcm.encodeBlock(pcm, pending, block));
+    r.sampleCount += pending;
+  }
+  reader.close();
+  r.transcriptBytes = transcriptBytes;
+  r.responseBytes = responseBytes;
+  segment.write((const uint8_t*)archiveState.transcript.c_str(), transcriptBytes);
+  segment.write((const uint8_t*)archiveState.response.c_str(), responseBytes);
+  h.lastSegmentBytes = segment.size();
+  segment.close();
+
+  const unsigned long* m = trace.marks;
+  unsigned long last = 0;
+  for (int i = 0; i < TRACE_MARK_COUNT; i++) last = max(last, m[i]);
+  r.uptimeSec = m[TRACE_BUTTON] / 1000;
+  r.timingsMs[archive::TIMING_RECORD] = archiveSpan(m[TRACE_BUTTON], m[TRACE_RECORD_END]);
+  r.timingsMs[archive::TIMING_STT] = archiveSpan(m[TRACE_RECORD_END], m[TRACE_STT_DONE]);
+  r.timingsMs[archive::TIMING_LLM] = archiveSpan(m[TRACE_STT_DONE], m[TRACE_LLM_DONE]);
+  r.timingsMs[archive::TIMING_TTS] = archiveSpan(m[TRACE_LLM_DONE], m[TRACE_TTS_DONE]);
+  r.timingsMs[archive::TIMING_PLAY] = archiveSpan(m[TRACE_TTS_DONE], m[TRACE_PLAYBACK_END]);
+  r.timingsMs[archive::TIMING_FEEDBACK] = trace.feedbackMs ? min(trace.feedbackMs, (uint32_t)archive::NO_TIMING - 1) : archive::NO_TIMING;
+  r.timingsMs[archive::TIMING_TOTAL] = archiveSpan(m[TRACE_BUTTON], last);
+  r.timingsMs[archive::TIMING_RESERVED] = archive::NO_TIMING;
+  r.crc = archive::recordCrc(r);
+
+  // Record, then header: a record the header does not count yet is ignored
+  File index = SD.open(ARCHIVE_INDEX_PATH, "r+");
+  if (!index) {
+    Serial.println("[archive] cannot open index");
+    return;
+  }
+  index.seek(archive::recordOffset(r.seq));
+  index.write((const uint8_t*)&r, sizeof(r));
+  h.nextSeq++;
+  index.seek(0);
+  index.write((const uint8_t*)&h, sizeof(h));
+  index.close();
+
+  archiveState.lastWriteMs = millis() - start;
+  archiveState.bytesWritten += r.audioBytes + transcriptBytes + responseBytes + sizeof(r);
+  Serial.printf("[archive] #%u: %u samples in %u bytes, %u ms\n", (unsigned)r.seq,
+                (unsigned)r.sampleCount, (unsigned)r.audioBytes, (unsigned)archiveState.lastWriteMs);
 }
 
-void stopRecording() {
-  if (audioFile) {
-    audioFile.flush();
-    uint32_t fileSize = audioFile.size();
-    uint32_t dataLength = fileSize - 44;
-    writeWavHeader(audioFile, dataLength);
-    audioFile.close();
-    Serial.println("Recording stopped");
+//========================================
+// Local Intents
+//========================================
+
+// Commands the device handles itself instead of sending them to Gemini.
+// Returns true when the transcript was one; the interaction ends here.
+bool handleLocalIntent(const String& transcript) {
+  String text = normalizeTranscript(transcript);
+  int volume = deviceConfig.volume;
+
+  if (text == "volume up" || text == "louder" || text == "turn it up" || text == "turn up the volume") {
+    volume += VOLUME_INTENT_STEP;
+  } else if (text == "volume down" || text == "quieter" || text == "softer" || text == "turn it down" || text == "turn down the volume") {
+    volume -= VOLUME_INTENT_STEP;
+  } else if (text == "mute" || text == "be quiet") {
+    volume = 0;
+  } else if (text == "max volume" || text == "full volume") {
+    volume = VolumeLimiter::STEPS;
+  } else if (text.startsWith("set volume to ") || text.startsWith("volume ")) {
+    // Spoken levels are 0-10
+    String level = text.substring(text.lastIndexOf(' ') + 1);
+    if (level.length() == 0 || level.length() > 2 || !isdigit((unsigned char)level[0])) return false;
+    volume = min((int)level.toInt(), 10) * VolumeLimiter::STEPS / 10;
   } else {
-    Serial.println("No recording file open");
+    return false;
   }
+
+  cancelSpeculation();
+  stopCues();
+  setVolume(volume, true);
+  playCue(CUE_CONFIRM);
+  Serial.printf("[intent] volume %d/%d\n", deviceConfig.volume, VolumeLimiter::STEPS);
+  traceReport();
+  displayStatus("Volume " + String(deviceConfig.volume) + "/" + String(VolumeLimiter::STEPS) + "\nPress to record");
+  currentState = STATE_READY;
+  return true;
 }
 
 //========================================
@@ -638,177 +4502,872 @@ void stopRecording() {
 //========================================
 
 void processSpeech() {
-  // Read recorded audio file from SD card
-  if (!SD.exists("/recording.wav")) {
+  RecordingReader reader;
+  if (!reader.openLast()) {
     setError("No audio file found");
     return;
   }
 
-  File file = SD.open("/recording.wav", FILE_READ);
-  if (!file) {
-    setError("Failed to open audio file");
-    return;
+  String transcript;
+  String error;
+  int httpCode = 0;
+  bool transcribed = false;
+  if (!takeStreamTranscript(transcript, transcribed, error)) {
+    transcribed = transcribeRecording(reader, transcript, error, httpCode);
   }
+  if (recordingStoreStats.lastBytesAvoided) {
+    recordingStoreStats.lastBytesAvoided += reader.length();  // The reread
+    Serial.printf("[record] SD I/O avoided: %u bytes\n", (unsigned)recordingStoreStats.lastBytesAvoided);
+  }
+  if (transcribed) {
+    traceMark(TRACE_STT_DONE);
+    Serial.print("Transcript: ");
+    Serial.println(transcript);
+    archiveState.transcript = transcript;
+    if (handleLocalIntent(transcript)) return;
+
+    displayStatus("Querying AI...");
+    currentState = STATE_QUERYING_AI;
+    queryGemini(transcript);
+  } else if (httpCode < 0 && saveRecordingFile() && enqueueUtterance("/recording.wav")) {
+    // Transport failure (no route, DNS, TLS): keep the utterance for later
+    stopCues();
+    displayStatus("Offline: saved for later\nPress to record");
+    currentState = STATE_READY;
+  } else {
+    setError(error);
+  }
+}
 
-  // Read entire file into base64 string in chunks to avoid large memory usage
-  String audioBase64 = "";
-  const size_t chunkSize = 512;
-  uint8_t buffer[chunkSize];
-  size_t bytesRead = 0;
+bool transcribeFile(const char* path, String& transcript, String& error, int& httpCode) {
+  httpCode = 0;
+  RecordingReader reader;
+  if (!reader.openFile(path)) {
+    error = "Failed to open audio file";
+    return false;
+  }
+  return transcribeRecording(reader, transcript, error, httpCode);
+}
 
-  while ((bytesRead = file.read(buffer, chunkSize)) > 0) {
-    audioBase64 += base64_encode(buffer, bytesRead);
+bool transcribeRecording(RecordingReader& reader, String& transcript, String& error, int& httpCode) {
+  httpCode = 0;
+  uint32_t sampleRate = reader.sampleRate();
+  float audioSeconds = reader.length() / 2.0f / sampleRate;
+
+  // Pick the upload encoding from the measured link. Background drains
+  // follow the foreground's choice without feeding its hysteresis.
+  UploadProfileId profile = xTaskGetCurrentTaskHandle() == foregroundTask
+                              ? linkEstimator.choose(audioSeconds)
+                              : linkEstimator.current();
+  if (sampleRate != RECORD_SAMPLE_RATE) {
+    profile = UPLOAD_LINEAR16_16K;  // Clip from older firmware; send as recorded
+  }
+  uint32_t uploadRate = profile == UPLOAD_LINEAR16_16K ? sampleRate : uploadProfiles[profile].sampleRate;
+  if (sttBackends[STT_BACKEND].body != BODY_JSON_BASE64) {
+    return transcribeBinary(reader, profile, sampleRate, uploadRate, transcript, error, httpCode);
   }
-  file.close();
 
-  Serial.print("Audio base64 length: ");
-  Serial.println(audioBase64.length());
+  String audioBase64 = "";
+  audioBase64.reserve((uint32_t)(uploadProfiles[profile].bytesPerSecond * audioSeconds * 4 / 3) + 16);
+  Base64Writer base64 = { &audioBase64 };
+  unsigned long encodeStart = micros();
+  uint32_t encodedBytes = encodeUploadAudio(reader, profile, sampleRate, Base64Writer::writeCallback, &base64);
+  base64.finish();
+  reader.close();
+  uint32_t encodeMicros = micros() - encodeStart;
+  linkEstimator.observeEncoding(profile, audioSeconds, encodedBytes, encodeMicros / 1000.0f);
+  uploadStats.jsonUploads++;
+  uploadStats.lastEncodeMicros = encodeMicros;
+  uploadStats.encodeMicrosTotal += encodeMicros;
+
+  Serial.printf("[uplink] %.1f kB/s, rtt %.0f ms: %s, %u bytes (base64 %u)\n",
+                linkEstimator.throughputBytesPerMs(), linkEstimator.rttMs(),
+                uploadProfiles[profile].name, (unsigned)encodedBytes, audioBase64.length());
   if (audioBase64.length() == 0) {
-    setError("Audio data is empty");
-    return;
+    error = "Audio data is empty";
+    return false;
   }
 
   HTTPClient http;
-  http.begin("https://speech.googleapis.com/v1/speech:recognize?key=" + String(deviceConfig.googleSpeechApiKey));
-  http.addHeader("Content-Type", "application/json");
-
-  String payload = "{\"config\":{\"encoding\":\"LINEAR16\",\"sampleRateHertz\":" + String(SAMPLE_RATE) + ",\"languageCode\":\"en-US\"},\"audio\":{\"content\":\"" + audioBase64 + "\"}}";
-
-  Serial.print("Payload: ");
-  Serial.println(payload);
-
-  int httpCode = http.POST(payload);
+  MeteredClient* meter = beginApiRequest(http, API_SPEECH, "/v1/speech:recognize?key=" + String(deviceConfig.googleSpeechApiKey));
+
+  // The base64 audio goes out from its own buffer rather than a copy
+  JsonBody payload;
+  payload.raw("{\"config\":{\"encoding\":")
+    .string(uploadProfiles[profile].encoding)
+    .raw(",\"sampleRateHertz\":")
+    .number(uploadRate)
+    .raw(",\"languageCode\":\"en-US\"},\"audio\":{\"content\":\"")
+    .raw(audioBase64.c_str(), audioBase64.length())
+    .raw("\"}}");
+
+  httpCode = postJson(http, payload);
+  uploadStats.bodyBytes += payload.size();
+  audioBase64 = String();
+  if (meter && httpCode > 0) {
+    linkEstimator.observeUpload(meter->bytesWritten, meter->writeMicros);
+    if (recordingStats.releaseUs && xTaskGetCurrentTaskHandle() == foregroundTask) {
+      // Release edge to the last byte of the request body on the wire
+      recordingStats.releaseToUploadMs = (meter->lastWriteUs - recordingStats.releaseUs) / 1000;
+      recordingStats.releaseToUploadMsTotal += recordingStats.releaseToUploadMs;
+      recordingStats.releaseToUploadCount++;
+      recordingStats.releaseUs = 0;
+    }
+  }
 
+  bool ok = false;
   if (httpCode == HTTP_CODE_OK) {
-    String response = http.getString();
+    HttpBodyStream body(http);
     DynamicJsonDocument doc(4096);
-    DeserializationError error = deserializeJson(doc, response);
-
-    if (!error && doc["results"].is<JsonArray>()) {
-      const char* transcript = doc["results"][0]["alternatives"][0]["transcript"];
-      Serial.print("Transcript: ");
-      Serial.println(transcript);
-
-      displayStatus("Querying AI...");
-      currentState = STATE_QUERYING_AI;
-      queryGemini(transcript);
-    } else if (error) {
-      setError("JSON Parse Err: " + String(error.c_str()));
+    DeserializationError jsonError = deserializeJson(doc, body);
+    body.finish("Speech");
+
+    if (body.failed()) {
+      error = "Undecodable response body";
+    } else if (!jsonError && doc["results"].is<JsonArray>()) {
+      const char* text = doc["results"][0]["alternatives"][0]["transcript"];
+      transcript = text ? text : "";
+      ok = true;
+    } else if (jsonError) {
+      error = "JSON Parse Err: " + String(jsonError.c_str());
     } else {
-      setError("No transcription");
+      error = "No transcription";
     }
   } else {
-    setError("Speech API: " + String(httpCode));
+    error = "Speech API: " + String(httpCode);
   }
 
-  http.end();
+  endApiRequest(http, API_SPEECH);
+  return ok;
 }
 
 void queryGemini(const String& query) {
+  String answer;
+  String error;
+  int httpCode = 0;
+  // TTS is next; open its socket while Gemini thinks
+  requestPrewarm(1 << API_TTS);
+  if (takeSpeculativeAnswer(query, answer) || fetchGeminiAnswer(query, answer, error, httpCode)) {
+    traceMark(TRACE_LLM_DONE);
+    Serial.print("AI Response: ");
+    Serial.println(answer);
+    archiveState.response = answer;
+
+    displayStatus("Converting to speech...");
+    currentState = STATE_PROCESSING_TTS;
+    textToSpeech(answer);
+  } else {
+    setError(error);
+  }
+}
+
+bool fetchGeminiAnswer(const String& query, String& answer, String& error, int& httpCode) {
   HTTPClient http;
-  http.begin("https://generativelanguage.googleapis.com/v1beta/models/gemini-pro:generateContent?key=" + String(deviceConfig.geminiApiKey));
-  http.addHeader("Content-Type", "application/json");
+  beginApiRequest(http, API_GEMINI, "/v1beta/models/gemini-pro:generateContent?key=" + String(deviceConfig.geminiApiKey));
 
-  String payload = "{\"contents\":[{\"parts\":[{\"text\":\"" + query + "\"}]}]}";
+  JsonBody payload;
+  payload.raw("{\"contents\":[{\"parts\":[{\"text\":").string(query.c_str(), query.length()).raw("}]}]}");
 
-  int httpCode = http.POST(payload);
+  httpCode = postJson(http, payload);
 
+  bool ok = false;
   if (httpCode == HTTP_CODE_OK) {
-    String response = http.getString();
+    HttpBodyStream body(http);
     DynamicJsonDocument doc(4096);
-    DeserializationError error = deserializeJson(doc, response);
+    DeserializationError jsonError = deserializeJson(doc, body);
+    body.finish("Gemini");
+
+    if (body.failed()) {
+      error = "Undecodable response body";
+    } else if (!jsonError && doc.containsKey("candidates")) {
+      const char* text = doc["candidates"][0]["content"]["parts"][0]["text"];
+      answer = text ? text : "";
+      ok = true;
+    } else if (jsonError) {
+      error = "JSON Parse Err: " + String(jsonError.c_str());
+    } else {
+      error = "No AI response";
+    }
+  } else {
+    error = "Gemini API: " + String(httpCode);
+  }
+
+  endApiRequest(http, API_GEMINI);
+  return ok;
+}
+
+// Collects SpeechText output up to the last sentence that fits in one
+// TTS request
+typedef struct {
+  String* out;
+  uint32_t sentenceEnd;
+  bool full;
+} SpokenSink;
+
+void collectSpoken(void* ctx, const char* text, size_t len, bool sentenceEnd) {
+  SpokenSink& sink = *(SpokenSink*)ctx;
+  if (sink.full) return;
+  if (sink.out->length() + len > TTS_MAX_BYTES) {
+    // Cut at the last sentence, or mid-sentence if even the first is too long
+    if (sink.sentenceEnd > 0) {
+      sink.out->remove(sink.sentenceEnd);
+    } else {
+      sink.out->concat(text, TTS_MAX_BYTES - sink.out->length());
+    }
+    sink.full = true;
+    return;
+  }
+  sink.out->concat(text, len);
+  if (sentenceEnd) sink.sentenceEnd = sink.out->length();
+}
 
-    if (!error && doc.containsKey("candidates")) {
-      const char* aiResponse = doc["candidates"][0]["content"]["parts"][0]["text"];
-      Serial.print("AI Response: ");
-      Serial.println(aiResponse);
+// The answer as it should be spoken: markdown stripped, abbreviations and
+// symbols spelled out, within the TTS input limit
+String spokenText(const String& answer) {
+  unsigned long start = micros();
+  String spoken;
+  spoken.reserve(min(answer.length(), (unsigned)TTS_MAX_BYTES));
+  SpokenSink sink = { &spoken, 0, false };
+  SpeechText normalizer(collectSpoken, &sink);
+  normalizer.write(answer.c_str(), answer.length());
+  normalizer.finish();
+
+  speechTextStats.answers++;
+  speechTextStats.bytesIn += normalizer.bytesIn();
+  speechTextStats.bytesOut += spoken.length();
+  speechTextStats.sentences += normalizer.sentences();
+  if (sink.full) speechTextStats.truncated++;
+  speechTextStats.lastMicros = micros() - start;
+  return spoken;
+}
 
-      displayStatus("Converting to speech...");
-      currentState = STATE_PROCESSING_TTS;
-      textToSpeech(aiResponse);
-    } else if (error) {
-      setError("JSON Parse Err: " + String(error.c_str()));
+void textToSpeech(const String& answer) {
+  String text = spokenText(answer);
+  String error;
+  int httpCode = 0;
+  if (speechStream) {
+    // Playback starts inside streamSpeech as soon as the prefill is buffered
+    if (streamSpeech(text, error, httpCode)) {
+      traceMark(TRACE_TTS_DONE);
+      displayStatus("Playing response...");
+      currentState = STATE_PLAYING;
+    } else {
+      setError(error);
     }
+    return;
+  }
+  if (synthesizeToFile(text, "/response.raw", error, httpCode)) {
+    traceMark(TRACE_TTS_DONE);
+    displayStatus("Playing response...");
+    currentState = STATE_PLAYING;
+    playAudio("/response.raw");
   } else {
-    setError("Gemini API: " + String(httpCode));
+    setError(error);
   }
+}
 
-  http.end();
+void ttsPayload(JsonBody& payload, const String& text) {
+  payload.raw("{\"input\":{\"text\":")
+    .string(text.c_str(), text.length())
+    .raw("},\"voice\":{\"languageCode\":\"en-US\",\"name\":\"en-US-Wavenet-D\"},\"audioConfig\":{\"audioEncoding\":\"LINEAR16\",\"speakingRate\":1.0,\"pitch\":0.0}}");
 }
 
-void textToSpeech(const String& text) {
+bool synthesizeToFile(const String& text, const char* path, String& error, int& httpCode) {
   HTTPClient http;
-  http.begin("https://texttospeech.googleapis.com/v1/text:synthesize?key=" + String(deviceConfig.googleTtsApiKey));
-  http.addHeader("Content-Type", "application/json");
-
-  String payload = "{\"input\":{\"text\":\"" + text + "\"},\"voice\":{\"languageCode\":\"en-US\",\"name\":\"en-US-Wavenet-D\"},\"audioConfig\":{\"audioEncoding\":\"LINEAR16\",\"speakingRate\":1.0,\"pitch\":0.0}}";
+  beginApiRequest(http, API_TTS, "/v1/text:synthesize?key=" + String(deviceConfig.googleTtsApiKey));
 
-  int httpCode = http.POST(payload);
+  JsonBody payload;
+  ttsPayload(payload, text);
+  httpCode = postJson(http, payload);
 
+  bool ok = false;
   if (httpCode == HTTP_CODE_OK) {
-    String response = http.getString();
+    HttpBodyStream body(http);
+    String response = body.readAll();
+    body.finish("TTS");
+    PerfScope perfScope(PERF_DECODE);
     DynamicJsonDocument doc(4096);
-    DeserializationError error = deserializeJson(doc, response);
+    DeserializationError jsonError = deserializeJson(doc, response);
 
-    if (!error && doc.containsKey("audioContent")) {
+    if (body.failed()) {
+      error = "Undecodable response body";
+    } else if (!jsonError && doc.containsKey("audioContent")) {
       const char* audioContent = doc["audioContent"];
       size_t decodedSize = calculateDecodedSize(audioContent);
       uint8_t* decodedAudio = (uint8_t*)malloc(decodedSize);
 
-      // Use the custom base64 decode function
-      int bytesDecoded = base64_decode(audioContent, decodedAudio);
+      if (decodedAudio) {
+        // Use the custom base64 decode function
+        int bytesDecoded = base64_decode(audioContent, decodedAudio);
 
-      displayStatus("Playing response...");
-      currentState = STATE_PLAYING;
-      // Save decoded audio to SD card for playback
-      if (audioFile) {
-        audioFile.close();
-      }
-      audioFile = SD.open("/response.raw", FILE_WRITE);
-      if (audioFile) {
-        audioFile.write(decodedAudio, bytesDecoded);
-        audioFile.close();
-        playAudio("/response.raw");
+        // Save decoded audio to SD card for playback
+        File file = SD.open(path, FILE_WRITE);
+        if (file) {
+          file.write(decodedAudio, bytesDecoded);
+          file.close();
+          ok = true;
+        } else {
+          error = "Failed to open response file";
+        }
+        free(decodedAudio);
       } else {
-        setError("Failed to open response file");
+        error = "Out of memory for TTS audio";
+      }
+    } else if (jsonError) {
+      error = "JSON Parse Err: " + String(jsonError.c_str());
+    } else {
+      error = "No TTS audio";
+    }
+  } else {
+    error = "TTS API: " + String(httpCode);
+  }
+
+  endApiRequest(http, API_TTS);
+  return ok;
+}
+
+int base64Value(int c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+// Pushes into speechStream, waiting while it is full. TCP flow control
+// holds the rest of the response back in the meantime.
+bool pushSpeech(const int16_t* samples, uint32_t count) {
+  unsigned long deadline = millis() + HTTP_BODY_TIMEOUT_MS;
+  while (count > 0) {
+    uint32_t n = speechStream->push(samples, count, millis());
+    samples += n;
+    count -= n;
+    if (count == 0) break;
+    if (millis() > deadline) return false;
+    delay(5);
+  }
+  return true;
+}
+
+// Like synthesizeToFile, but decodes audioContent while the response is
+// still arriving and feeds it to speechStream. Playback starts once the
+// jitter buffer's prefill target is in, instead of after the last byte.
+bool streamSpeech(const String& text, String& error, int& httpCode) {
+  HTTPClient http;
+  beginApiRequest(http, API_TTS, "/v1/text:synthesize?key=" + String(deviceConfig.googleTtsApiKey));
+
+  JsonBody payload;
+  ttsPayload(payload, text);
+  httpCode = postJson(http, payload);
+
+  bool ok = false;
+  if (httpCode == HTTP_CODE_OK) {
+    HttpBodyStream body(http);
+    if (!body.find("\"audioContent\"") || !body.find("\"")) {
+      error = body.failed() ? "Undecodable response body" : "No TTS audio";
+    } else {
+      uint8_t header[44];  // LINEAR16 responses start with a canonical WAV header
+      size_t headerLen = 0;
+      int16_t pcm[PLAYBACK_BLOCK_SAMPLES];
+      uint8_t* pcmBytes = (uint8_t*)pcm;
+      size_t pcmLen = 0;
+      uint32_t quad = 0;
+      int quadLen = 0;
+      bool started = false;
+      bool playing = false;
+      bool stalled = false;
+
+      for (;;) {
+        int c = body.read();
+        int value = c < 0 || c == '"' ? -1 : base64Value(c);
+        bool last = c < 0 || c == '"';
+        if (value < 0 && !last) continue;  // Padding or a JSON escape
+
+        uint8_t bytes[3];
+        int count = 0;
+        if (value >= 0) {
+          quad = quad << 6 | value;
+          if (++quadLen == 4) {
+            bytes[0] = quad >> 16;
+            bytes[1] = quad >> 8;
+            bytes[2] = quad;
+            count = 3;
+            quadLen = 0;
+          }
+        } else if (quadLen >= 2) {
+          quad <<= 6 * (4 - quadLen);
+          bytes[0] = quad >> 16;
+          bytes[1] = quad >> 8;
+          count = quadLen - 1;
+        }
+
+        for (int i = 0; i < count; i++) {
+          if (!started) {
+            header[headerLen++] = bytes[i];
+            if (headerLen < sizeof(header)) continue;
+            uint32_t rate = 24000;
+            if (memcmp(header, "RIFF", 4) == 0 && memcmp(header + 36, "data", 4) == 0) {
+              rate = header[24] | header[25] << 8 | header[26] << 16 | (uint32_t)header[27] << 24;
+            }
+            speechStream->begin(rate);
+            started = true;
+          } else {
+            pcmBytes[pcmLen++] = bytes[i];
+          }
+        }
+
+        // Hand over a batch when it is full, when the network has nothing
+        // more for us yet, or at the end
+        bool flush = pcmLen >= sizeof(pcm) - 2 || last || (count > 0 && body.buffered() == 0);
+        if (started && flush && pcmLen >= 2) {
+          size_t samples = pcmLen / 2;
+          if (!pushSpeech(pcm, samples)) {
+            stalled = true;
+            break;
+          }
+          if (pcmLen & 1) pcmBytes[0] = pcmBytes[pcmLen - 1];
+          pcmLen &= 1;
+          if (!playing && speechStream->prefilled()) {
+            playSpeechStream();
+            playing = true;
+          }
+        }
+        if (last) {
+          ok = c == '"' && !body.failed();
+          break;
+        }
       }
 
-      free(decodedAudio);
-    } else if (error) {
-      setError("JSON Parse Err: " + String(error.c_str()));
+      if (started) {
+        speechStream->end();
+        if (!playing) playSpeechStream();
+        Serial.printf("[tts] prefill %u ms, peak lag %.0f ms, jitter %.1f ms\n", (unsigned)speechStream->targetMs(),
+                      speechStream->peakLagMs(), speechStream->jitterMs());
+      }
+      if (!started) {
+        ok = false;
+        error = "No TTS audio";
+      } else if (stalled) {
+        error = "TTS playback stalled";
+      } else if (!ok) {
+        error = body.failed() ? "Undecodable response body" : "TTS stream truncated";
+      }
     }
+    body.finish("TTS");
   } else {
-    setError("TTS API: " + String(httpCode));
+    error = "TTS API: " + String(httpCode);
   }
 
-  http.end();
+  endApiRequest(http, API_TTS);
+  return ok;
 }
 
-void playAudio(const char* filename) {
-  isPlayingAudio = true;
+//========================================
+// Offline Utterance Queue
+//========================================
 
-  File file = SD.open(filename, FILE_READ);
-  if (!file) {
-    setError("Failed to open audio file");
-    isPlayingAudio = false;
+String queueAudioPath(uint32_t seq) {
+  return String(QUEUE_DIR) + "/u" + String(seq) + ".wav";
+}
+
+String queueAnswerPath(uint32_t seq) {
+  return String(QUEUE_DIR) + "/a" + String(seq) + ".raw";
+}
+
+int findQueueSlot(uint32_t seq) {
+  for (int i = 0; i < queueCount; i++) {
+    if (queueEntries[i].seq == seq) return i;
+  }
+  return -1;
+}
+
+void removeQueueSlot(int slot) {
+  for (int i = slot; i < queueCount - 1; i++) {
+    queueEntries[i] = queueEntries[i + 1];
+    queueInFlight[i] = queueInFlight[i + 1];
+    queueLastAttempt[i] = queueLastAttempt[i + 1];
+  }
+  queueCount--;
+}
+
+// Applies one journal record to the in-memory table (used for both live
+// updates and replay after a reboot).
+void applyQueueRecord(uint32_t seq, uint8_t status, uint8_t attempts) {
+  int slot = findQueueSlot(seq);
+  if (status == QUEUE_DONE || status == QUEUE_FAILED) {
+    if (slot >= 0) removeQueueSlot(slot);
+  } else if (slot >= 0) {
+    queueEntries[slot].status = status;
+    queueEntries[slot].attempts = attempts;
+  } else if (queueCount < QUEUE_MAX_PENDING) {
+    queueEntries[queueCount] = { seq, status, attempts, 0 };
+    queueInFlight[queueCount] = false;
+    queueLastAttempt[queueCount] = 0;
+    queueCount++;
+  }
+  if (seq >= queueNextSeq) queueNextSeq = seq + 1;
+}
+
+bool appendQueueRecord(uint32_t seq, uint8_t status, uint8_t attempts) {
+  queue_journal::Record rec = queue_journal::makeRecord(seq, status, attempts);
+
+  File journal = SD.open(QUEUE_JOURNAL_PATH, FILE_APPEND);
+  if (!journal) {
+    Serial.println("Queue: failed to open journal");
+    return false;
+  }
+  size_t written = journal.write((const uint8_t*)&rec, sizeof(rec));
+  journal.flush();
+  queueJournalSize = journal.size();
+  journal.close();
+  return written == sizeof(rec);
+}
+
+void saveQueueIndex() {
+  QueueIndexHeader header = { QUEUE_INDEX_MAGIC, queueCount, queueNextSeq, queueJournalSize, 0 };
+  uint32_t crc = crc32_le(0, (const uint8_t*)&header, offsetof(QueueIndexHeader, crc));
+  header.crc = crc32_le(crc, (const uint8_t*)queueEntries, queueCount * sizeof(QueueEntry));
+
+  File index = SD.open(QUEUE_INDEX_PATH, FILE_WRITE);
+  if (!index) {
+    Serial.println("Queue: failed to write index");
     return;
   }
+  index.write((const uint8_t*)&header, sizeof(header));
+  index.write((const uint8_t*)queueEntries, queueCount * sizeof(QueueEntry));
+  index.close();
+}
 
-  const size_t bufferSize = 512;
-  uint8_t buffer[bufferSize];
-  size_t bytesRead = 0;
-  size_t bytesWritten = 0;
+bool loadQueueIndex(uint32_t journalSize) {
+  File index = SD.open(QUEUE_INDEX_PATH, FILE_READ);
+  if (!index) return false;
+
+  QueueIndexHeader header;
+  bool ok = index.read((uint8_t*)&header, sizeof(header)) == sizeof(header)
+            && header.magic == QUEUE_INDEX_MAGIC
+            && header.count <= QUEUE_MAX_PENDING
+            && header.journalSize == journalSize;
+  if (ok) {
+    size_t entryBytes = header.count * sizeof(QueueEntry);
+    ok = index.read((uint8_t*)queueEntries, entryBytes) == entryBytes;
+    uint32_t crc = crc32_le(0, (const uint8_t*)&header, offsetof(QueueIndexHeader, crc));
+    ok = ok && crc32_le(crc, (const uint8_t*)queueEntries, entryBytes) == header.crc;
+  }
+  index.close();
 
-  while ((bytesRead = file.read(buffer, bufferSize)) > 0) {
-    i2s_write(I2S_NUM_1, buffer, bytesRead, &bytesWritten, portMAX_DELAY);
+  if (ok) {
+    queueCount = header.count;
+    queueNextSeq = header.nextSeq;
+    queueJournalSize = journalSize;
+  } else {
+    queueCount = 0;
   }
+  return ok;
+}
 
-  file.close();
-  isPlayingAudio = false;
+// Rewrites the journal with one record per live entry. Used to drop a torn
+// tail after power loss and to keep the journal from growing without bound.
+// The records go to a temp file that only replaces the journal once it is
+// complete, so a power cut at any point leaves one whole journal.
+void compactQueueJournal() {
+  File journal = SD.open(QUEUE_JOURNAL_TMP_PATH, FILE_WRITE);
+  if (!journal) {
+    Serial.println("Queue: failed to compact journal");
+    return;
+  }
+  bool ok = true;
+  for (int i = 0; i < queueCount && ok; i++) {
+    queue_journal::Record rec =
+      queue_journal::makeRecord(queueEntries[i].seq, queueEntries[i].status, queueEntries[i].attempts);
+    ok = journal.write((const uint8_t*)&rec, sizeof(rec)) == sizeof(rec);
+  }
+  journal.flush();
+  uint32_t size = journal.size();
+  journal.close();
+
+  if (!ok || !queue_journal::replaceFile(SD, QUEUE_JOURNAL_TMP_PATH, QUEUE_JOURNAL_PATH)) {
+    Serial.println("Queue: failed to compact journal");
+    if (SD.exists(QUEUE_JOURNAL_PATH)) SD.remove(QUEUE_JOURNAL_TMP_PATH);
+    return;
+  }
+  queueJournalSize = size;
 }
 
-bool isAudioPlaying() {
-  return isPlayingAudio;
+int32_t readJournalFile(void* ctx, uint8_t* buf, uint32_t len) {
+  return ((File*)ctx)->read(buf, len);
+}
+
+void replayQueueJournal() {
+  queueCount = 0;
+  File journal = SD.open(QUEUE_JOURNAL_PATH, FILE_READ);
+  if (!journal) {
+    queueJournalSize = 0;
+    return;
+  }
+
+  uint32_t fileSize = journal.size();
+  uint32_t validBytes = queue_journal::replay(readJournalFile, &journal, applyQueueRecord);
+  journal.close();
+  queueJournalSize = validBytes;
+
+  if (validBytes != fileSize) {
+    Serial.printf("Queue: dropping %u torn journal bytes\n", (unsigned)(fileSize - validBytes));
+    compactQueueJournal();
+  }
+}
+
+void initUtteranceQueue() {
+  queueMutex = xSemaphoreCreateMutex();
+  if (!SD.exists(QUEUE_DIR)) {
+    SD.mkdir(QUEUE_DIR);
+  }
+  queue_journal::recoverReplace(SD, QUEUE_JOURNAL_TMP_PATH, QUEUE_JOURNAL_PATH);
+
+  uint32_t journalSize = 0;
+  File journal = SD.open(QUEUE_JOURNAL_PATH, FILE_READ);
+  if (journal) {
+    journalSize = journal.size();
+    journal.close();
+  }
+
+  if (!loadQueueIndex(journalSize)) {
+    Serial.println("Queue: rebuilding index from journal");
+    replayQueueJournal();
+  }
+
+  // Reconcile with the files that actually made it to the card
+  bool changed = false;
+  for (int i = queueCount - 1; i >= 0; i--) {
+    QueueEntry& entry = queueEntries[i];
+    if (entry.status == QUEUE_ANSWERED && !SD.exists(queueAnswerPath(entry.seq))) {
+      entry.status = QUEUE_PENDING;
+      changed = true;
+    }
+    if (entry.status == QUEUE_PENDING && !SD.exists(queueAudioPath(entry.seq))) {
+      removeQueueSlot(i);
+      changed = true;
+    }
+    queueInFlight[i] = false;
+    queueLastAttempt[i] = 0;
+  }
+  if (changed || queueCount == 0) {
+    compactQueueJournal();
+  }
+  saveQueueIndex();
+
+  Serial.printf("Queue: %u pending utterances\n", queueCount);
+}
+
+void updateQueueEntry(uint32_t seq, uint8_t status, uint8_t attempts) {
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  appendQueueRecord(seq, status, attempts);
+  applyQueueRecord(seq, status, attempts);
+  if (queueCount == 0) {
+    compactQueueJournal();
+  }
+  saveQueueIndex();
+  xSemaphoreGive(queueMutex);
+}
+
+bool enqueueUtterance(const char* path) {
+  if (!queueMutex) return false;
+
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  if (queueCount >= QUEUE_MAX_PENDING) {
+    xSemaphoreGive(queueMutex);
+    Serial.println("Queue: full, dropping utterance");
+    return false;
+  }
+
+  // Journal first: a crash before the rename leaves an entry without audio,
+  // which recovery drops, rather than an orphaned file nobody references.
+  uint32_t seq = queueNextSeq;
+  bool ok = appendQueueRecord(seq, QUEUE_PENDING, 0) && SD.rename(path, queueAudioPath(seq));
+  if (ok) {
+    applyQueueRecord(seq, QUEUE_PENDING, 0);
+  } else {
+    appendQueueRecord(seq, QUEUE_FAILED, 0);
+    queueNextSeq = seq + 1;
+  }
+  saveQueueIndex();
+  xSemaphoreGive(queueMutex);
+
+  if (ok) {
+    Serial.printf("Queue: stored utterance #%u (%u pending)\n", (unsigned)seq, queueCount);
+  }
+  return ok;
+}
+
+// Rewrites a PCM WAV as IMA ADPCM in place, so answers that wait on SD
+// for the user take a quarter of the space. The file is left as it was if
+// it is not PCM or the rewrite fails.
+bool compressWavFile(const char* path) {
+  File in = SD.open(path, FILE_READ);
+  if (!in) return false;
+  WavInfo info;
+  if (!readWavHeader(in, info) || info.format != 1) {
+    in.close();
+    return false;
+  }
+  String tmpPath = String(path) + ".tmp";
+  File out = SD.open(tmpPath, FILE_WRITE);
+  if (!out) {
+    in.close();
+    return false;
+  }
+
+  const uint32_t perBlock = ImaAdpcm::samplesPerBlock(ADPCM_BLOCK_ALIGN);
+  int16_t pcm[ImaAdpcm::samplesPerBlock(ADPCM_BLOCK_ALIGN)];
+  uint8_t block[ADPCM_BLOCK_ALIGN];
+  ImaAdpcmEncoder adpcm;
+  uint32_t remaining = info.dataBytes;
+  uint32_t codedBytes = 0;
+  uint32_t samples = 0;
+  bool ok = out.write(block, ImaAdpcm::WAV_HEADER_BYTES) == ImaAdpcm::WAV_HEADER_BYTES;  // Header placeholder
+  while (ok && remaining >= 2) {
+    uint32_t got = in.read((uint8_t*)pcm, min(remaining, perBlock * 2)) / 2;
+    if (got == 0) break;
+    remaining -= got * 2;
+    size_t bytes = adpcm.encodeBlock(pcm, got, block);
+    ok = out.write(block, bytes) == bytes;
+    codedBytes += bytes;
+    samples += got;
+  }
+  in.close();
+  if (ok) {
+    ImaAdpcm::wavHeader(block, info.sampleRate, ADPCM_BLOCK_ALIGN, codedBytes, samples);
+    out.seek(0);
+    ok = out.write(block, ImaAdpcm::WAV_HEADER_BYTES) == ImaAdpcm::WAV_HEADER_BYTES;
+  }
+  out.close();
+  if (!ok || samples == 0) {
+    SD.remove(tmpPath);
+    return false;
+  }
+  // FAT will not rename over a file, so the PCM original steps aside and
+  // is only removed once the ADPCM copy has taken its name
+  String oldPath = String(path) + ".pcm";
+  SD.remove(oldPath);
+  if (!SD.rename(path, oldPath)) {
+    SD.remove(tmpPath);
+    return false;
+  }
+  if (!SD.rename(tmpPath, path)) {
+    SD.rename(oldPath, path);
+    SD.remove(tmpPath);
+    return false;
+  }
+  SD.remove(oldPath);
+  return true;
+}
+
+void queueDrainTask(void* param) {
+  uint32_t seq = (uint32_t)(uintptr_t)param;
+  unsigned long start = millis();
+
+  String transcript;
+  String answer;
+  String error;
+  int httpCode = 0;
+  bool ok = transcribeFile(queueAudioPath(seq).c_str(), transcript, error, httpCode)
+            && fetchGeminiAnswer(transcript, answer, error, httpCode)
+            && synthesizeToFile(spokenText(answer), queueAnswerPath(seq).c_str(), error, httpCode);
+  if (ok) compressWavFile(queueAnswerPath(seq).c_str());
+
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  int slot = findQueueSlot(seq);
+  uint8_t attempts = slot >= 0 ? queueEntries[slot].attempts + 1 : 1;
+  if (slot >= 0) {
+    queueInFlight[slot] = false;
+    queueLastAttempt[slot] = millis();
+  }
+  xSemaphoreGive(queueMutex);
+
+  if (ok) {
+    updateQueueEntry(seq, QUEUE_ANSWERED, attempts);
+    Serial.printf("Queue: answered #%u in %lu ms\n", (unsigned)seq, millis() - start);
+  } else if (httpCode < 0 && attempts < QUEUE_MAX_ATTEMPTS) {
+    updateQueueEntry(seq, QUEUE_PENDING, attempts);
+    Serial.printf("Queue: #%u will retry (%s)\n", (unsigned)seq, error.c_str());
+  } else {
+    updateQueueEntry(seq, QUEUE_FAILED, attempts);
+    SD.remove(queueAudioPath(seq));
+    SD.remove(queueAnswerPath(seq));
+    Serial.printf("Queue: giving up on #%u (%s)\n", (unsigned)seq, error.c_str());
+  }
+
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  queueActiveWorkers--;
+  xSemaphoreGive(queueMutex);
+  vTaskDelete(NULL);
+}
+
+// Starts background drain workers, never more than QUEUE_DRAIN_WORKERS at a
+// time so the foreground pipeline keeps enough heap for its own TLS session.
+void serviceUtteranceQueue() {
+  if (!queueMutex || queueCount == 0 || WiFi.status() != WL_CONNECTED) return;
+
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  unsigned long now = millis();
+  for (int i = 0; i < queueCount && queueActiveWorkers < QUEUE_DRAIN_WORKERS; i++) {
+    if (queueEntries[i].status != QUEUE_PENDING || queueInFlight[i]) continue;
+    if (queueLastAttempt[i] != 0 && now - queueLastAttempt[i] < QUEUE_RETRY_DELAY_MS) continue;
+
+    queueInFlight[i] = true;
+    queueActiveWorkers++;
+    if (startTask(TASK_QUEUE_DRAIN, queueDrainTask, (void*)(uintptr_t)queueEntries[i].seq) != pdPASS) {
+      queueInFlight[i] = false;
+      queueActiveWorkers--;
+      break;
+    }
+  }
+  xSemaphoreGive(queueMutex);
+}
+
+// Plays the oldest answered utterance, if any. Called from STATE_READY so
+// answers never interrupt a live interaction; until then they stay flagged
+// on the ready screen.
+bool playQueuedAnswer() {
+  if (!queueMutex || queueCount == 0 || isPlayingAudio) return false;
+
+  int32_t seq = -1;
+  xSemaphoreTake(queueMutex, portMAX_DELAY);
+  for (int i = 0; i < queueCount; i++) {
+    if (queueEntries[i].status == QUEUE_ANSWERED) {
+      seq = queueEntries[i].seq;
+      break;
+    }
+  }
+  xSemaphoreGive(queueMutex);
+  if (seq < 0) return false;
+
+  displayStatus("Answer to saved question...");
+  currentState = STATE_PLAYING;
+  playAudio(queueAnswerPath(seq).c_str());
+  waitForPlayback();  // The files are removed below
+
+  updateQueueEntry(seq, QUEUE_DONE, 0);
+  SD.remove(queueAudioPath(seq));
+  SD.remove(queueAnswerPath(seq));
+  return true;
+}
+
+int countQueueEntries(uint8_t status) {
+  int count = 0;
+  for (int i = 0; i < queueCount; i++) {
+    if (queueEntries[i].status == status) count++;
+  }
+  return count;
+}
+
+String readyMessage() {
+  String message = "Ready\nPress to record";
+  int pending = countQueueEntries(QUEUE_PENDING);
+  int answered = countQueueEntries(QUEUE_ANSWERED);
+  if (pending > 0) message += "\nQueued: " + String(pending);
+  if (answered > 0) message += "\nAnswers ready: " + String(answered);
+  return message;
 }
 
 //========================================
@@ -908,21 +5467,9 @@ size_t calculateDecodedSize(const char* base64String) {
 void displayStatus(const String& message) {
   Serial.print("[STATUS] ");
   Serial.println(message);
+  if (!displayReady) return;  // Still booting: serial only
 
-  // Reset TFT display pin manually to clear display
-  gfx->displayOn();
-  pinMode(1, OUTPUT);
-  digitalWrite(1, LOW);
-  delay(50);
-  digitalWrite(1, HIGH);
-  delay(50);
-
-  //init tft
-  gfx->begin();
-  digitalWrite(TFT_BL, LOW);
   gfx->fillScreen(BACKGROUND);
-  gfx->displayOn();
-  digitalWrite(TFT_BL, HIGH);
 
   gfx->setTextSize(2);
   gfx->setTextColor(WHITE);
@@ -954,5 +5501,6 @@ void setError(const String& message) {
   Serial.println(message);
   // Removed displayStatus call to avoid OLED usage
   // displayStatus("Error: " + message);
+  stopCues();
   currentState = STATE_ERROR;
 }
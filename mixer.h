@@ -0,0 +1,142 @@
+// Fixed-point playback mixer. Each slot pulls 16-bit mono samples from a
+// callback and is added into a 32-bit accumulator with its own gain, then
+// the sum saturates back to 16 bits. While a higher-priority slot plays,
+// lower-priority slots are ducked by DUCK_GAIN. Gain changes are spread
+// linearly across the block, so fades and ducking do not click. Plain C++,
+// no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+class Mixer {
+ public:
+  // Writes up to count samples and returns how many; fewer ends the slot
+  typedef int (*PullFn)(void* ctx, int16_t* out, int count);
+
+  static const int MAX_SLOTS = 4;
+  static const int MAX_BLOCK = 256;
+  static const int32_t UNITY = 1 << 15;         // Q15 gain of 1.0
+  static const int32_t DUCK_GAIN = UNITY / 4;   // -12 dB under a higher priority
+  static const uint32_t DUCK_RAMP_MS = 40;
+
+  explicit Mixer(uint32_t sampleRate) : sampleRate_(sampleRate) {}
+
+  void start(int slot, PullFn pull, void* ctx, uint8_t priority, int32_t gain = UNITY) {
+    Slot& s = slots_[slot];
+    s.pull = pull;
+    s.ctx = ctx;
+    s.priority = priority;
+    s.gain = gain;
+    s.target = gain;
+    s.step = 0;
+    s.stopAtTarget = false;
+    s.active = true;
+    s.duck = priority < topPriority() ? DUCK_GAIN : UNITY;
+  }
+
+  void stop(int slot) { slots_[slot].active = false; }
+
+  // Ramps the slot gain to target over ms. With stop set, the slot ends
+  // when the ramp completes (fade-out).
+  void fade(int slot, int32_t target, uint32_t ms, bool stop = false) {
+    Slot& s = slots_[slot];
+    int32_t samples = (int32_t)(sampleRate_ * ms / 1000);
+    int32_t distance = target > s.gain ? target - s.gain : s.gain - target;
+    s.target = target;
+    s.step = samples > 0 ? (distance + samples - 1) / samples : distance;
+    if (s.step == 0) s.step = 1;
+    s.stopAtTarget = stop;
+  }
+
+  bool active(int slot) const { return slots_[slot].active; }
+
+  bool anyActive() const {
+    for (int i = 0; i < MAX_SLOTS; i++) {
+      if (slots_[i].active) return true;
+    }
+    return false;
+  }
+
+  // Mixes count (<= MAX_BLOCK) samples of every active slot into out
+  void mix(int16_t* out, int count) {
+    mix(acc_, count);
+    saturate(out, acc_, count);
+  }
+
+  // Same, but leaves the unsaturated 32-bit sum for a following gain stage
+  void mix(int32_t* acc, int count) {
+    const int top = topPriority();
+    const int32_t duckStep = (UNITY - DUCK_GAIN) / (int32_t)(sampleRate_ * DUCK_RAMP_MS / 1000);
+    memset(acc, 0, count * sizeof(acc[0]));
+
+    for (int i = 0; i < MAX_SLOTS; i++) {
+      Slot& s = slots_[i];
+      if (!s.active) continue;
+
+      int got = s.pull(s.ctx, src_, count);
+      if (got < count) memset(src_ + got, 0, (count - got) * sizeof(src_[0]));
+
+      int32_t gainEnd = approach(s.gain, s.target, s.step, count);
+      int32_t duckEnd = approach(s.duck, s.priority < top ? DUCK_GAIN : UNITY, duckStep, count);
+      int32_t g0 = (s.gain * s.duck) >> 15;
+      int32_t g1 = (gainEnd * duckEnd) >> 15;
+      accumulate(acc, src_, count, g0, (g1 - g0) / count);
+      s.gain = gainEnd;
+      s.duck = duckEnd;
+
+      if (got < count || (s.stopAtTarget && s.gain == s.target)) s.active = false;
+    }
+  }
+
+ private:
+  struct Slot {
+    bool active;
+    PullFn pull;
+    void* ctx;
+    uint8_t priority;
+    bool stopAtTarget;
+    int32_t gain;    // Q15
+    int32_t target;
+    int32_t step;    // Per sample, magnitude
+    int32_t duck;    // Q15
+  };
+
+  uint32_t sampleRate_;
+  Slot slots_[MAX_SLOTS] = {};
+  int32_t acc_[MAX_BLOCK];
+  int16_t src_[MAX_BLOCK];
+
+  int topPriority() const {
+    int top = -1;
+    for (int i = 0; i < MAX_SLOTS; i++) {
+      if (slots_[i].active && slots_[i].priority > top) top = slots_[i].priority;
+    }
+    return top;
+  }
+
+  static int32_t approach(int32_t value, int32_t target, int32_t step, int count) {
+    int32_t delta = step * count;
+    if (value < target) return target - value > delta ? value + delta : target;
+    return value - target > delta ? value - delta : target;
+  }
+
+  // The two inner loops are branch-free over restrict pointers so the
+  // compiler can vectorize them where the target has SIMD.
+  static void accumulate(int32_t* __restrict acc, const int16_t* __restrict src, int count, int32_t gain, int32_t gainStep) {
+    if (gainStep == 0) {
+      for (int i = 0; i < count; i++) acc[i] += (src[i] * gain) >> 15;
+    } else {
+      for (int i = 0; i < count; i++) acc[i] += (src[i] * (gain + gainStep * i)) >> 15;
+    }
+  }
+
+  static void saturate(int16_t* __restrict out, const int32_t* __restrict acc, int count) {
+    for (int i = 0; i < count; i++) {
+      int32_t v = acc[i];
+      v = v > 32767 ? 32767 : v;
+      v = v < -32768 ? -32768 : v;
+      out[i] = (int16_t)v;
+    }
+  }
+};
@@ -0,0 +1,91 @@
+// Offline utterance queue journal: the record layout, replay of a journal
+// that may end in a torn record, and the replace protocol compaction uses
+// to swap in a rewritten journal. Plain C++, no Arduino dependencies; the
+// journal is read through ReadFn and files are replaced through any type
+// with exists/remove/rename (SD on the device, a simulated card in
+// tools/queue_check.cpp).
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace queue_journal {
+
+static const uint16_t RECORD_MAGIC = 0x5155;
+
+struct Record {
+  uint16_t magic;
+  uint8_t status;
+  uint8_t attempts;
+  uint32_t seq;
+  uint32_t crc;  // CRC32 of the fields above
+};
+
+static_assert(sizeof(Record) == 12, "record layout");
+
+// CRC-32 (IEEE, reflected), bitwise; chains like ROM crc32_le(crc, ...)
+inline uint32_t crc32(uint32_t crc, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+inline Record makeRecord(uint32_t seq, uint8_t status, uint8_t attempts) {
+  Record rec = { RECORD_MAGIC, status, attempts, seq, 0 };
+  rec.crc = crc32(0, &rec, offsetof(Record, crc));
+  return rec;
+}
+
+inline bool recordValid(const Record& rec) {
+  return rec.magic == RECORD_MAGIC && rec.crc == crc32(0, &rec, offsetof(Record, crc));
+}
+
+// Reads up to len bytes; returns the count, 0 at the end, < 0 on error
+typedef int32_t (*ReadFn)(void* ctx, uint8_t* buf, uint32_t len);
+
+// Feeds each record to apply(seq, status, attempts) up to the first torn
+// or corrupt one. Returns the bytes that held valid records; anything past
+// that is a tail the caller should compact away.
+template <typename Apply>
+uint32_t replay(ReadFn read, void* ctx, Apply apply) {
+  uint32_t validBytes = 0;
+  Record rec;
+  for (;;) {
+    uint32_t got = 0;
+    while (got < sizeof(rec)) {
+      int32_t n = read(ctx, (uint8_t*)&rec + got, sizeof(rec) - got);
+      if (n <= 0) return validBytes;
+      got += n;
+    }
+    if (!recordValid(rec)) return validBytes;
+    apply(rec.seq, rec.status, rec.attempts);
+    validBytes += sizeof(rec);
+  }
+}
+
+// Puts the finished file tmp in place of path. FAT cannot rename over an
+// existing file, so path goes first; a power cut between the two steps
+// leaves only tmp, which recoverReplace() moves into place at boot.
+template <typename Fs>
+bool replaceFile(Fs& fs, const char* tmp, const char* path) {
+  if (fs.exists(path) && !fs.remove(path)) return false;
+  return fs.rename(tmp, path);
+}
+
+// Finishes or rolls back a replaceFile() that a power cut interrupted.
+// While path still exists tmp may be partly written, so it is dropped.
+template <typename Fs>
+void recoverReplace(Fs& fs, const char* tmp, const char* path) {
+  if (!fs.exists(tmp)) return;
+  if (fs.exists(path)) {
+    fs.remove(tmp);
+  } else {
+    fs.rename(tmp, path);
+  }
+}
+
+}  // namespace queue_journal
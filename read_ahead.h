@@ -0,0 +1,136 @@
+// Read-ahead for file playback. A reader task keeps up to blockCount
+// blocks of the file loaded ahead of the consumer, so a slow or stalling
+// storage read delays the reader instead of the audio. One producer (the
+// reader task, which calls fillOne) and one consumer (read). Plain C++,
+// no Arduino dependencies; the storage is reached through ReadFn.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+class ReadAhead {
+ public:
+  // Reads up to len bytes; returns the count, 0 at the end, < 0 on error
+  typedef int32_t (*ReadFn)(void* ctx, uint8_t* buf, uint32_t len);
+
+  static const int MAX_BLOCKS = 8;
+
+  // storage holds blockSize * blockCount bytes; blockCount <= MAX_BLOCKS
+  ReadAhead(uint8_t* storage, uint32_t blockSize, uint32_t blockCount)
+    : storage_(storage), blockSize_(blockSize), blockCount_(blockCount) {}
+
+  // Consumer: starts reading length bytes. Only valid while idle().
+  void begin(ReadFn read, void* ctx, uint32_t length) {
+    read_ = read;
+    ctx_ = ctx;
+    remaining_ = length;
+    filled_.store(0, std::memory_order_relaxed);
+    consumed_.store(0, std::memory_order_relaxed);
+    pos_ = 0;
+    primed_ = false;
+    starving_ = false;
+    eof_.store(false, std::memory_order_relaxed);
+    state_.store(ACTIVE, std::memory_order_release);
+  }
+
+  // Consumer: abandons the stream. The producer stops at its next call.
+  void cancel() {
+    uint8_t active = ACTIVE;
+    state_.compare_exchange_strong(active, CANCELLED);
+  }
+
+  // Producer: loads the next block if one is free. Returns true if it read.
+  bool fillOne() {
+    if (state_.load(std::memory_order_acquire) != ACTIVE) return false;
+    uint32_t filled = filled_.load(std::memory_order_relaxed);
+    if (filled - consumed_.load(std::memory_order_acquire) >= blockCount_) return false;
+
+    uint32_t want = remaining_ < blockSize_ ? remaining_ : blockSize_;
+    int32_t n = want > 0 ? read_(ctx_, block(filled), want) : 0;
+    if (n <= 0) {
+      if (n < 0) errors_++;
+      eof_.store(true, std::memory_order_release);
+      uint8_t active = ACTIVE;
+      state_.compare_exchange_strong(active, FINISHED);
+      return false;
+    }
+    length_[filled % blockCount_] = n;
+    remaining_ -= n;
+    fills_++;
+    filled_.store(filled + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Producer: the stream is done with (read to the end or cancelled); the
+  // caller may release the file, then call release().
+  bool finished() const {
+    uint8_t state = state_.load(std::memory_order_acquire);
+    return state == FINISHED || state == CANCELLED;
+  }
+
+  void release() { state_.store(IDLE, std::memory_order_release); }
+
+  bool idle() const { return state_.load(std::memory_order_acquire) == IDLE; }
+
+  // Consumer: copies up to len bytes. Returns the count, 0 if the reader
+  // has fallen behind, or -1 at the end of the stream.
+  int read(uint8_t* out, uint32_t len) {
+    uint32_t total = 0;
+    while (total < len) {
+      bool eof = eof_.load(std::memory_order_acquire);
+      uint32_t consumed = consumed_.load(std::memory_order_relaxed);
+      if (consumed == filled_.load(std::memory_order_acquire)) {
+        if (total == 0 && eof) return -1;
+        break;
+      }
+      uint32_t index = consumed % blockCount_;
+      uint32_t n = length_[index] - pos_;
+      if (n > len - total) n = len - total;
+      memcpy(out + total, storage_ + index * blockSize_ + pos_, n);
+      pos_ += n;
+      total += n;
+      if (pos_ == length_[index]) {
+        pos_ = 0;
+        consumed_.store(consumed + 1, std::memory_order_release);
+      }
+    }
+
+    // Waiting for the first block is start-up, not an underrun
+    if (total == 0 && primed_ && !starving_) underruns_++;
+    starving_ = total == 0;
+    if (total > 0) primed_ = true;
+    return (int)total;
+  }
+
+  uint32_t underruns() const { return underruns_; }
+  uint32_t fills() const { return fills_; }
+  uint32_t errors() const { return errors_; }
+
+ private:
+  enum : uint8_t { IDLE, ACTIVE, CANCELLED, FINISHED };
+
+  uint8_t* storage_;
+  uint32_t blockSize_;
+  uint32_t blockCount_;
+  ReadFn read_ = nullptr;
+  void* ctx_ = nullptr;
+  std::atomic<uint8_t> state_{ IDLE };
+
+  // Producer side
+  uint32_t remaining_ = 0;
+  uint32_t length_[MAX_BLOCKS];
+  std::atomic<uint32_t> filled_{ 0 };  // Blocks loaded since begin()
+  std::atomic<bool> eof_{ false };
+  uint32_t fills_ = 0;
+  uint32_t errors_ = 0;
+
+  // Consumer side
+  std::atomic<uint32_t> consumed_{ 0 };  // Blocks fully read since begin()
+  uint32_t pos_ = 0;
+  bool primed_ = false;
+  bool starving_ = false;
+  uint32_t underruns_ = 0;
+
+  uint8_t* block(uint32_t n) { return storage_ + (n % blockCount_) * blockSize_; }
+};
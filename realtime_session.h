@@ -0,0 +1,388 @@
+// One realtime voice session (Gemini Live API, BidiGenerateContent) on a
+// WsClient: microphone PCM goes up, the spoken answer comes down, and the
+// turns are marked explicitly, so one connection replaces the speech,
+// LLM and TTS requests. The caller marks each turn with activityStart() and
+// activityEnd() (hold to talk), so the server's own voice activity
+// detection is switched off in setup().
+//
+// Messages are JSON both ways, and the service sends its own in binary
+// frames. Audio travels base64-encoded inside them: outgoing audio is
+// encoded straight into the frame, and incoming messages are scanned as
+// they arrive, with inlineData audio decoded into PCM batches on the way.
+// A message is never held whole, however long its audio. Plain C++, no
+// Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ws_client.h"
+
+class RealtimeSession {
+ public:
+  enum Event : uint8_t {
+    EVENT_SETUP_COMPLETE,
+    EVENT_GENERATION_COMPLETE,  // The model is done; audio may still be arriving
+    EVENT_TURN_COMPLETE,        // All of the answer has been sent
+    EVENT_INTERRUPTED,          // A new user turn cut the answer short
+    EVENT_GO_AWAY,              // The server will close the session soon
+    EVENT_CLOSED,               // The WebSocket is gone; see closeCode()
+  };
+
+  struct Handler {
+    void (*audio)(void* ctx, const int16_t* samples, size_t count, uint32_t sampleRate);
+    void (*event)(void* ctx, Event event);
+    void* ctx;
+  };
+
+  static const uint32_t OUTPUT_RATE_DEFAULT = 24000;
+
+  // Takes over the WebSocket's handler
+  RealtimeSession(WsClient& ws, const Handler& handler) : ws_(ws), handler_(handler) {
+    WsClient::Handler h = { onMessage, onClosed, this };
+    ws_.setHandler(h);
+  }
+
+  // First message once the WebSocket is open; wait for EVENT_SETUP_COMPLETE
+  bool setup(const char* model, const char* voice = nullptr) {
+    char json[384];
+    int n = snprintf(json, sizeof(json),
+                     "{\"setup\":{\"model\":\"%s\",\"generationConfig\":{\"responseModalities\":[\"AUDIO\"]%s%s%s},"
+                     "\"realtimeInputConfig\":{\"automaticActivityDetection\":{\"disabled\":true}}}}",
+                     model, voice ? ",\"speechConfig\":{\"voiceConfig\":{\"prebuiltVoiceConfig\":{\"voiceName\":\"" : "",
+                     voice ? voice : "", voice ? "\"}}}" : "");
+    return n > 0 && n < (int)sizeof(json) && sendText(json, n);
+  }
+
+  bool activityStart() {
+    static const char json[] = "{\"realtimeInput\":{\"activityStart\":{}}}";
+    return sendText(json, sizeof(json) - 1);
+  }
+
+  bool activityEnd() {
+    static const char json[] = "{\"realtimeInput\":{\"activityEnd\":{}}}";
+    return sendText(json, sizeof(json) - 1);
+  }
+
+  // One realtimeInput message of 16-bit mono PCM, base64-encoded into the
+  // frame as it is written
+  bool audio(const int16_t* samples, size_t count, uint32_t sampleRate) {
+    char prefix[96];
+    int prefixLen = snprintf(prefix, sizeof(prefix),
+                             "{\"realtimeInput\":{\"audio\":{\"mimeType\":\"audio/pcm;rate=%u\",\"data\":\"",
+                             (unsigned)sampleRate);
+    static const char suffix[] = "\"}}}";
+    const uint8_t* bytes = (const uint8_t*)samples;
+    size_t len = count * 2;
+    if (!ws_.beginMessage(false, prefixLen + (len + 2) / 3 * 4 + sizeof(suffix) - 1)) return false;
+    if (!ws_.write((const uint8_t*)prefix, prefixLen)) return false;
+    char out[128];
+    for (size_t i = 0; i < len; i += 96) {
+      size_t k = len - i < 96 ? len - i : 96;
+      size_t n = encodeBase64(bytes + i, k, out);
+      if (!ws_.write((const uint8_t*)out, n)) return false;
+    }
+    audioBytesSent_ += len;
+    return ws_.write((const uint8_t*)suffix, sizeof(suffix) - 1);
+  }
+
+  uint16_t closeCode() const { return ws_.closeCode(); }
+  uint32_t audioBytesSent() const { return audioBytesSent_; }
+  uint32_t audioSamplesReceived() const { return audioSamplesReceived_; }
+  uint32_t messagesReceived() const { return messages_; }
+
+ private:
+  static const int MAX_DEPTH = 8;
+  static const int KEY_MAX = 24;
+  static const int LITERAL_MAX = 8;
+  static const int MIME_MAX = 40;
+  static const int AUDIO_BATCH = 256;
+
+  enum StringKind : uint8_t { STRING_KEY, STRING_IGNORED, STRING_AUDIO, STRING_MIME };
+
+  WsClient& ws_;
+  Handler handler_;
+
+  // Scanner: the name of each open container, the key being read or
+  // last read, and the string or literal in progress
+  char names_[MAX_DEPTH][KEY_MAX];
+  bool isArray_[MAX_DEPTH];
+  int depth_ = 0;
+  char key_[KEY_MAX] = "";
+  int keyLen_ = 0;
+  bool expectKey_ = false;
+  bool inString_ = false;
+  bool escape_ = false;
+  StringKind stringKind_ = STRING_IGNORED;
+  char literal_[LITERAL_MAX];
+  int literalLen_ = 0;
+  char mime_[MIME_MAX];
+  int mimeLen_ = 0;
+
+  // Audio being decoded
+  uint32_t outputRate_ = OUTPUT_RATE_DEFAULT;
+  uint32_t quad_ = 0;
+  int quadLen_ = 0;
+  uint8_t carry_ = 0;
+  bool hasCarry_ = false;
+  int16_t batch_[AUDIO_BATCH];
+  int batchLen_ = 0;
+
+  uint32_t audioBytesSent_ = 0;
+  uint32_t audioSamplesReceived_ = 0;
+  uint32_t messages_ = 0;
+
+  bool sendText(const char* json, size_t len) {
+    return ws_.beginMessage(false, len) && ws_.write((const uint8_t*)json, len);
+  }
+
+  static size_t encodeBase64(const uint8_t* in, size_t len, char* out) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+      uint32_t v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0) | (i + 2 < len ? in[i + 2] : 0);
+      out[n++] = alphabet[v >> 18 & 63];
+      out[n++] = alphabet[v >> 12 & 63];
+      out[n++] = i + 1 < len ? alphabet[v >> 6 & 63] : '=';
+      out[n++] = i + 2 < len ? alphabet[v & 63] : '=';
+    }
+    return n;
+  }
+
+  // Text and binary messages carry the same JSON
+  static void onMessage(void* ctx, bool, const uint8_t* data, size_t len, bool end) {
+    RealtimeSession* s = (RealtimeSession*)ctx;
+    for (size_t i = 0; i < len; i++) s->scan((char)data[i]);
+    if (end) s->endMessage();
+  }
+
+  static void onClosed(void* ctx, uint16_t) {
+    ((RealtimeSession*)ctx)->emit(EVENT_CLOSED);
+  }
+
+  void endMessage() {
+    flushAudio();
+    messages_++;
+    depth_ = 0;
+    keyLen_ = 0;
+    key_[0] = '\0';
+    expectKey_ = false;
+    inString_ = false;
+    escape_ = false;
+    stringKind_ = STRING_IGNORED;
+    literalLen_ = 0;
+  }
+
+  const char* parent() const { return depth_ > 0 && depth_ <= MAX_DEPTH ? names_[depth_ - 1] : ""; }
+  bool inObject() const { return depth_ > 0 && depth_ <= MAX_DEPTH && !isArray_[depth_ - 1]; }
+
+  void scan(char c) {
+    if (inString_) {
+      if (escape_) {
+        escape_ = false;
+        stringChar(c);  // Only \/ can occur in the strings that are kept
+      } else if (c == '\\') {
+        escape_ = true;
+      } else if (c == '"') {
+        inString_ = false;
+        endString();
+      } else {
+        stringChar(c);
+      }
+      return;
+    }
+    switch (c) {
+      case '"':
+        inString_ = true;
+        beginString();
+        return;
+      case ':':
+        expectKey_ = false;
+        return;
+      case ',':
+        endLiteral();
+        expectKey_ = inObject();
+        return;
+      case '{':
+      case '[':
+        push(c == '[');
+        return;
+      case '}':
+      case ']':
+        endLiteral();
+        pop();
+        return;
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+        endLiteral();
+        return;
+      default:
+        if (literalLen_ < LITERAL_MAX - 1) literal_[literalLen_++] = c;
+    }
+  }
+
+  void push(bool array) {
+    // Array elements take the array's name, so a part knows it is in "parts"
+    const char* name = depth_ > 0 && depth_ <= MAX_DEPTH && isArray_[depth_ - 1] ? parent() : key_;
+    if (depth_ < MAX_DEPTH) {
+      strcpy(names_[depth_], name);
+      isArray_[depth_] = array;
+    }
+    depth_++;
+    if (!array && depth_ == 2) {
+      // Members of the top-level object that are events in themselves
+      if (strcmp(name, "setupComplete") == 0) emit(EVENT_SETUP_COMPLETE);
+      if (strcmp(name, "goAway") == 0) emit(EVENT_GO_AWAY);
+    }
+    expectKey_ = !array;
+    keyLen_ = 0;
+    key_[0] = '\0';
+  }
+
+  void pop() {
+    if (depth_ > 0) depth_--;
+    if (depth_ > 0 && depth_ <= MAX_DEPTH) {
+      strcpy(key_, names_[depth_]);
+    }
+    expectKey_ = false;
+  }
+
+  void beginString() {
+    if (inObject() && expectKey_) {
+      stringKind_ = STRING_KEY;
+      keyLen_ = 0;
+    } else if (strcmp(key_, "data") == 0 && strcmp(parent(), "inlineData") == 0) {
+      stringKind_ = STRING_AUDIO;
+      quad_ = 0;
+      quadLen_ = 0;
+    } else if (strcmp(key_, "mimeType") == 0 && strcmp(parent(), "inlineData") == 0) {
+      stringKind_ = STRING_MIME;
+      mimeLen_ = 0;
+    } else {
+      stringKind_ = STRING_IGNORED;
+    }
+  }
+
+  void stringChar(char c) {
+    switch (stringKind_) {
+      case STRING_KEY:
+        if (keyLen_ < KEY_MAX - 1) key_[keyLen_++] = c;
+        return;
+      case STRING_AUDIO:
+        base64Char(c);
+        return;
+      case STRING_MIME:
+        if (mimeLen_ < MIME_MAX - 1) mime_[mimeLen_++] = c;
+        return;
+      default:
+        return;
+    }
+  }
+
+  void endString() {
+    switch (stringKind_) {
+      case STRING_KEY:
+        key_[keyLen_] = '\0';
+        return;
+      case STRING_AUDIO:
+        flushAudio();
+        return;
+      case STRING_MIME:
+        {
+          mime_[mimeLen_] = '\0';
+          const char* rate = strstr(mime_, "rate=");
+          outputRate_ = rate ? (uint32_t)parseUint(rate + 5) : OUTPUT_RATE_DEFAULT;
+          if (outputRate_ == 0) outputRate_ = OUTPUT_RATE_DEFAULT;
+          return;
+        }
+      default:
+        return;
+    }
+  }
+
+  static uint32_t parseUint(const char* s) {
+    uint32_t v = 0;
+    while (*s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+    return v;
+  }
+
+  void endLiteral() {
+    if (literalLen_ == 0) return;
+    literal_[literalLen_] = '\0';
+    literalLen_ = 0;
+    if (strcmp(literal_, "true") != 0 || strcmp(parent(), "serverContent") != 0) return;
+    if (strcmp(key_, "turnComplete") == 0) {
+      flushAudio();
+      emit(EVENT_TURN_COMPLETE);
+    } else if (strcmp(key_, "generationComplete") == 0) {
+      emit(EVENT_GENERATION_COMPLETE);
+    } else if (strcmp(key_, "interrupted") == 0) {
+      flushAudio();
+      emit(EVENT_INTERRUPTED);
+    }
+  }
+
+  void emit(Event event) {
+    if (handler_.event) handler_.event(handler_.ctx, event);
+  }
+
+  static int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+' || c == '-') return 62;
+    if (c == '/' || c == '_') return 63;
+    return -1;
+  }
+
+  void base64Char(char c) {
+    int v = base64Value(c);
+    if (v < 0) return;  // Padding
+    quad_ = quad_ << 6 | v;
+    if (++quadLen_ < 4) return;
+    quadLen_ = 0;
+    audioByte(quad_ >> 16);
+    audioByte(quad_ >> 8);
+    audioByte(quad_);
+  }
+
+  void audioByte(uint8_t b) {
+    if (!hasCarry_) {
+      carry_ = b;
+      hasCarry_ = true;
+      return;
+    }
+    hasCarry_ = false;
+    batch_[batchLen_++] = (int16_t)(carry_ | b << 8);
+    if (batchLen_ == AUDIO_BATCH) deliverAudio();
+  }
+
+  // Decodes what a padded base64 string leaves in its last quad
+  void finishBase64() {
+    if (quadLen_ >= 2) {
+      uint32_t q = quad_ << 6 * (4 - quadLen_);
+      int bytes = quadLen_ - 1;
+      quadLen_ = 0;
+      audioByte(q >> 16);
+      if (bytes == 2) audioByte(q >> 8);
+    }
+    quadLen_ = 0;
+  }
+
+  // Hands over the decoded samples, the tail of a string included
+  void flushAudio() {
+    if (stringKind_ == STRING_AUDIO) finishBase64();
+    deliverAudio();
+  }
+
+  void deliverAudio() {
+    if (batchLen_ == 0) return;
+    audioSamplesReceived_ += batchLen_;
+    if (handler_.audio) handler_.audio(handler_.ctx, batch_, batchLen_, outputRate_);
+    batchLen_ = 0;
+  }
+};
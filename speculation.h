@@ -0,0 +1,78 @@
+// Speculative LLM queries: when an interim transcript is settled enough to
+// send ahead of the final one, and whether the final transcript asks the
+// same thing. Running and cancelling the request is left to the caller.
+// Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace speculative {
+
+// Lowercase, punctuation dropped, whitespace collapsed: interim and final
+// transcripts differ in exactly these ways when the words agree. out needs
+// len + 1 bytes; the result is NUL-terminated and its length returned.
+inline size_t normalize(const char* text, size_t len, char* out) {
+  size_t n = 0;
+  bool space = false;
+  for (size_t i = 0; i < len; i++) {
+    char c = text[i];
+    bool upper = c >= 'A' && c <= 'Z';
+    if (upper || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c & 0x80)) {
+      if (space && n > 0) out[n++] = ' ';
+      out[n++] = upper ? c - 'A' + 'a' : c;
+      space = false;
+    } else if (c == ' ' || (c >= '\t' && c <= '\r')) {
+      space = true;
+    }
+  }
+  out[n] = '\0';
+  return n;
+}
+
+// Tracks successive interim results. One is stable once the recognizer
+// scores it at minStability or its normalized text has gone stableMs
+// without changing. Only a hash of the text is kept.
+class StableInterim {
+ public:
+  StableInterim(float minStability, uint32_t stableMs)
+    : minStability_(minStability), stableMs_(stableMs) {}
+
+  void reset() {
+    hash_ = 0;
+    changedAt_ = 0;
+  }
+
+  // Feeds one normalized interim; unchanged text should be fed again now
+  // and then so the timer can run out. Empty text is never stable.
+  bool update(const char* normalized, size_t len, float stability, uint32_t nowMs) {
+    uint32_t h = hash(normalized, len);
+    if (h != hash_) {
+      hash_ = h;
+      changedAt_ = nowMs;
+    }
+    return len > 0 && (stability >= minStability_ || nowMs - changedAt_ >= stableMs_);
+  }
+
+ private:
+  float minStability_;
+  uint32_t stableMs_;
+  uint32_t hash_ = 0;
+  uint32_t changedAt_ = 0;
+
+  // FNV-1a; 0 is kept for "nothing yet"
+  static uint32_t hash(const char* s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h ? h : 1;
+  }
+};
+
+// Time the speculation saved on a hit: without it the request would have
+// started when the final transcript arrived
+inline uint32_t savedMs(uint32_t startedAt, uint32_t requestMs, uint32_t finalAt) {
+  uint32_t lead = finalAt - startedAt;
+  return requestMs < lead ? requestMs : lead;
+}
+
+}  // namespace speculative
@@ -0,0 +1,284 @@
+// The few protobuf messages of Google Speech-to-Text v1 StreamingRecognize,
+// framed for gRPC (a 5-byte prefix: compressed flag, then big-endian
+// length). Requests are written by hand: one StreamingRecognitionConfig
+// first, then audio_content messages whose bytes the caller sends straight
+// from its own buffer after audioPrefix(). Responses are reassembled across
+// HTTP/2 DATA frames and walked in place; only the fields used here are
+// read and everything else is skipped by wire type. Plain C++, no Arduino
+// dependencies.
+//
+//   StreamingRecognizeRequest    streaming_config = 1, audio_content = 2
+//   StreamingRecognitionConfig   config = 1, single_utterance = 2,
+//                                interim_results = 3
+//   RecognitionConfig            encoding = 1 (LINEAR16 = 1),
+//                                sample_rate_hertz = 2, language_code = 3
+//   StreamingRecognizeResponse   error = 1 (code = 1, message = 2),
+//                                results = 2, speech_event_type = 4
+//   StreamingRecognitionResult   alternatives = 1 (transcript = 1,
+//                                confidence = 2), is_final = 2,
+//                                stability = 3
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class SpeechGrpc {
+ public:
+  static const char* path() { return "/google.cloud.speech.v1.Speech/StreamingRecognize"; }
+
+  static const size_t PREFIX_BYTES = 5;
+  static const size_t AUDIO_PREFIX_MAX = PREFIX_BYTES + 1 + 5;
+  static const size_t CONFIG_MAX = 96;
+
+  // Writes the first request of a stream into out (CONFIG_MAX bytes) and
+  // returns its framed size
+  static size_t configRequest(uint8_t* out, uint32_t sampleRate, const char* languageCode,
+                              bool singleUtterance, bool interimResults) {
+    size_t langLen = strlen(languageCode);
+    if (langLen > 32) langLen = 32;
+
+    uint8_t recognition[48];
+    size_t r = 0;
+    r = putVarintField(recognition, r, 1, 1);  // LINEAR16
+    r = putVarintField(recognition, r, 2, sampleRate);
+    r = putBytesField(recognition, r, 3, (const uint8_t*)languageCode, langLen);
+
+    uint8_t streaming[64];
+    size_t s = putBytesField(streaming, 0, 1, recognition, r);
+    if (singleUtterance) s = putVarintField(streaming, s, 2, 1);
+    if (interimResults) s = putVarintField(streaming, s, 3, 1);
+
+    size_t n = putBytesField(out, PREFIX_BYTES, 1, streaming, s);
+    putPrefix(out, n - PREFIX_BYTES);
+    return n;
+  }
+
+  // Writes the start of a request carrying audioBytes of audio into out
+  // (AUDIO_PREFIX_MAX bytes); the audio itself follows on the wire
+  static size_t audioPrefix(uint8_t* out, uint32_t audioBytes) {
+    size_t n = PREFIX_BYTES;
+    out[n++] = 2 << 3 | WIRE_BYTES;
+    n = putVarint(out, n, audioBytes);
+    putPrefix(out, n - PREFIX_BYTES + audioBytes);
+    return n;
+  }
+
+  enum Wire : uint8_t { WIRE_VARINT = 0, WIRE_FIXED64 = 1, WIRE_BYTES = 2, WIRE_FIXED32 = 5 };
+
+ private:
+  static void putPrefix(uint8_t* out, uint32_t len) {
+    out[0] = 0;  // Not compressed
+    out[1] = len >> 24;
+    out[2] = len >> 16;
+    out[3] = len >> 8;
+    out[4] = len;
+  }
+
+  static size_t putVarint(uint8_t* out, size_t n, uint32_t v) {
+    while (v >= 0x80) {
+      out[n++] = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+  }
+
+  static size_t putVarintField(uint8_t* out, size_t n, uint8_t field, uint32_t v) {
+    out[n++] = field << 3 | WIRE_VARINT;
+    return putVarint(out, n, v);
+  }
+
+  static size_t putBytesField(uint8_t* out, size_t n, uint8_t field, const uint8_t* data, size_t len) {
+    out[n++] = field << 3 | WIRE_BYTES;
+    n = putVarint(out, n, len);
+    memcpy(out + n, data, len);
+    return n + len;
+  }
+};
+
+// Collects StreamingRecognizeResponse messages from the response body and
+// reports each result as it is complete. A message larger than the buffer
+// is skipped and counted; transcripts are far smaller.
+class SpeechGrpcReader {
+ public:
+  struct Result {
+    const char* transcript;  // Not terminated; points into the reader's buffer
+    size_t transcriptLen;
+    bool isFinal;
+    float stability;   // Interim results: how likely the text is to stay
+    float confidence;  // Final results
+  };
+
+  typedef void (*ResultFn)(void* ctx, const Result& result);
+
+  SpeechGrpcReader(uint8_t* buffer, size_t capacity, ResultFn onResult, void* ctx)
+    : buf_(buffer), cap_(capacity), onResult_(onResult), ctx_(ctx) {}
+
+  void feed(const uint8_t* data, size_t len) {
+    while (len > 0) {
+      if (prefixLen_ < SpeechGrpc::PREFIX_BYTES) {
+        prefix_[prefixLen_++] = *data++;
+        len--;
+        if (prefixLen_ == SpeechGrpc::PREFIX_BYTES) {
+          need_ = (uint32_t)prefix_[1] << 24 | (uint32_t)prefix_[2] << 16 | prefix_[3] << 8 | prefix_[4];
+          have_ = 0;
+          if (need_ == 0) endMessage();
+        }
+        continue;
+      }
+      size_t k = need_ - have_ < len ? need_ - have_ : len;
+      if (need_ <= cap_ && prefix_[0] == 0) memcpy(buf_ + have_, data, k);
+      have_ += k;
+      data += k;
+      len -= k;
+      if (have_ == need_) endMessage();
+    }
+  }
+
+  // google.rpc.Status from an error field; 0 if none arrived
+  int32_t errorCode() const { return errorCode_; }
+  const char* errorMessage() const { return errorMessage_; }
+  bool endOfUtterance() const { return endOfUtterance_; }
+  uint32_t messages() const { return messages_; }
+  uint32_t skipped() const { return skipped_; }
+
+ private:
+  uint8_t* buf_;
+  size_t cap_;
+  ResultFn onResult_;
+  void* ctx_;
+
+  uint8_t prefix_[SpeechGrpc::PREFIX_BYTES];
+  size_t prefixLen_ = 0;
+  uint32_t need_ = 0;
+  uint32_t have_ = 0;
+
+  int32_t errorCode_ = 0;
+  char errorMessage_[96] = "";
+  bool endOfUtterance_ = false;
+  uint32_t messages_ = 0;
+  uint32_t skipped_ = 0;
+
+  // One field of a message being walked
+  struct Field {
+    uint32_t number;
+    uint8_t wire;
+    uint64_t value;        // Varint and fixed
+    const uint8_t* bytes;  // Length-delimited
+    uint32_t len;
+  };
+
+  static bool next(const uint8_t*& p, const uint8_t* end, Field& f) {
+    if (p >= end) return false;
+    uint64_t key;
+    if (!varint(p, end, key)) return false;
+    f.number = key >> 3;
+    f.wire = key & 7;
+    switch (f.wire) {
+      case SpeechGrpc::WIRE_VARINT:
+        return varint(p, end, f.value);
+      case SpeechGrpc::WIRE_FIXED64:
+        if (end - p < 8) return false;
+        f.value = 0;
+        for (int i = 7; i >= 0; i--) f.value = f.value << 8 | p[i];
+        p += 8;
+        return true;
+      case SpeechGrpc::WIRE_BYTES:
+        {
+          uint64_t len;
+          if (!varint(p, end, len) || len > (uint64_t)(end - p)) return false;
+          f.bytes = p;
+          f.len = len;
+          p += len;
+          return true;
+        }
+      case SpeechGrpc::WIRE_FIXED32:
+        if (end - p < 4) return false;
+        f.value = (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | p[1] << 8 | p[0];
+        p += 4;
+        return true;
+      default:
+        return false;  // Groups are not used by these messages
+    }
+  }
+
+  static bool varint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+      uint8_t b = *p++;
+      v |= (uint64_t)(b & 0x7f) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  static float asFloat(uint64_t bits) {
+    uint32_t b = bits;
+    float f;
+    memcpy(&f, &b, 4);
+    return f;
+  }
+
+  void endMessage() {
+    prefixLen_ = 0;
+    if (need_ > cap_ || prefix_[0] != 0) {
+      skipped_++;  // Too large, or compressed though we never offered it
+      return;
+    }
+    messages_++;
+    const uint8_t* p = buf_;
+    const uint8_t* end = buf_ + need_;
+    Field f;
+    while (next(p, end, f)) {
+      if (f.number == 1 && f.wire == SpeechGrpc::WIRE_BYTES) {
+        readStatus(f.bytes, f.bytes + f.len);
+      } else if (f.number == 2 && f.wire == SpeechGrpc::WIRE_BYTES) {
+        readResult(f.bytes, f.bytes + f.len);
+      } else if (f.number == 4 && f.wire == SpeechGrpc::WIRE_VARINT) {
+        endOfUtterance_ |= f.value == 1;  // END_OF_SINGLE_UTTERANCE
+      }
+    }
+  }
+
+  void readStatus(const uint8_t* p, const uint8_t* end) {
+    Field f;
+    while (next(p, end, f)) {
+      if (f.number == 1 && f.wire == SpeechGrpc::WIRE_VARINT) {
+        errorCode_ = (int32_t)f.value;
+      } else if (f.number == 2 && f.wire == SpeechGrpc::WIRE_BYTES) {
+        size_t n = f.len < sizeof(errorMessage_) - 1 ? f.len : sizeof(errorMessage_) - 1;
+        memcpy(errorMessage_, f.bytes, n);
+        errorMessage_[n] = '\0';
+      }
+    }
+  }
+
+  // Only the first alternative is reported: the most likely one
+  void readResult(const uint8_t* p, const uint8_t* end) {
+    Result r = { "", 0, false, 0.0f, 0.0f };
+    bool haveAlternative = false;
+    Field f;
+    while (next(p, end, f)) {
+      if (f.number == 1 && f.wire == SpeechGrpc::WIRE_BYTES && !haveAlternative) {
+        haveAlternative = true;
+        const uint8_t* a = f.bytes;
+        const uint8_t* aEnd = f.bytes + f.len;
+        Field g;
+        while (next(a, aEnd, g)) {
+          if (g.number == 1 && g.wire == SpeechGrpc::WIRE_BYTES) {
+            r.transcript = (const char*)g.bytes;
+            r.transcriptLen = g.len;
+          } else if (g.number == 2 && g.wire == SpeechGrpc::WIRE_FIXED32) {
+            r.confidence = asFloat(g.value);
+          }
+        }
+      } else if (f.number == 2 && f.wire == SpeechGrpc::WIRE_VARINT) {
+        r.isFinal = f.value != 0;
+      } else if (f.number == 3 && f.wire == SpeechGrpc::WIRE_FIXED32) {
+        r.stability = asFloat(f.value);
+      }
+    }
+    if (haveAlternative && onResult_) onResult_(ctx_, r);
+  }
+};
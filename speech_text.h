@@ -0,0 +1,373 @@
+// Turns an LLM answer written in markdown into text for a TTS voice, in
+// one pass over text that may arrive in pieces. Markup is stripped: code
+// blocks are left out, headings and list items become sentences, links
+// keep only their text, and emphasis, inline code and table rules go.
+// Common abbreviations and the symbols voices misread (%, &, °, ranges
+// such as 3-5) are spelled out; plain digits are left to the voice, which
+// reads them well, and so are phone numbers and dates. Output goes to the
+// sink in pieces that each end at a sentence boundary or when the buffer
+// fills. Lookahead is bounded by the link and word buffers. Plain C++, no
+// Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class SpeechText {
+ public:
+  // Receives normalized text; sentenceEnd marks the end of a sentence
+  typedef void (*SinkFn)(void* ctx, const char* text, size_t len, bool sentenceEnd);
+
+  SpeechText(SinkFn sink, void* ctx)
+    : sink_(sink), ctx_(ctx) {}
+
+  void write(const char* text, size_t len) {
+    bytesIn_ += len;
+    for (size_t i = 0; i < len; i++) feed(text[i]);
+  }
+
+  // Flushes whatever is still held back; the text ends here
+  void finish() {
+    feed('\n');
+    flushOut(false);
+  }
+
+  uint32_t bytesIn() const { return bytesIn_; }
+  uint32_t bytesOut() const { return bytesOut_; }
+  uint32_t sentences() const { return sentences_; }
+
+ private:
+  static const int LINK_MAX = 96;
+  static const int WORD_MAX = 40;
+  static const int OUT_MAX = 128;
+  static const int PREFIX_MAX = 8;
+
+  enum LinkState : uint8_t { LINK_NONE, LINK_TEXT, LINK_CLOSE, LINK_URL };
+
+  SinkFn sink_;
+  void* ctx_;
+
+  // Markdown: line prefixes, fences, inline code and links
+  bool lineStart_ = true;
+  bool inFence_ = false;
+  bool skipping_ = false;  // Rest of a fence line
+  bool inCode_ = false;
+  bool replaying_ = false;
+  char prefix_[PREFIX_MAX];
+  int prefixLen_ = 0;
+  LinkState link_ = LINK_NONE;
+  char linkText_[LINK_MAX];
+  int linkLen_ = 0;
+
+  // Words: abbreviations, symbols and sentence ends
+  char word_[WORD_MAX];
+  int wordLen_ = 0;
+  char out_[OUT_MAX];
+  int outLen_ = 0;
+  char lastChar_ = 0;  // Last character emitted, 0 at the start
+  bool open_ = false;  // Text emitted since the last sentence end
+
+  uint32_t bytesIn_ = 0;
+  uint32_t bytesOut_ = 0;
+  uint32_t sentences_ = 0;
+
+  void feed(char c) {
+    if (c == '\r') return;
+    if (c == '\n') {
+      endLine();
+      return;
+    }
+    if (lineStart_) {
+      // Hold the start of the line until it is clear whether it is markup
+      if (prefixLen_ < PREFIX_MAX && (prefixLen_ == 0 ? strchr("#>-*+`0123456789 \t", c) : strchr("#>-*+`0123456789 \t.)", c))) {
+        prefix_[prefixLen_++] = c;
+        return;
+      }
+      endPrefix();
+    }
+    if (!inFence_) inlineChar(c);
+  }
+
+  // Decides what the held line start was and replays what is text
+  void endPrefix() {
+    lineStart_ = false;
+    int n = prefixLen_;
+    prefixLen_ = 0;
+    int i = 0;
+    while (i < n && (prefix_[i] == ' ' || prefix_[i] == '\t')) i++;
+    if (n - i >= 3 && strncmp(prefix_ + i, "```", 3) == 0) {
+      inFence_ = !inFence_;
+      inCode_ = false;
+      skipping_ = true;
+      return;
+    }
+    if (inFence_) {
+      skipping_ = true;
+      return;
+    }
+    int j = i;
+    if (j < n && (prefix_[j] == '#' || prefix_[j] == '>')) {
+      while (j < n && (prefix_[j] == '#' || prefix_[j] == '>')) j++;
+    } else if (j + 1 < n && strchr("-*+", prefix_[j]) && (prefix_[j + 1] == ' ' || prefix_[j + 1] == '\t')) {
+      j++;
+    } else {
+      while (j < n && prefix_[j] >= '0' && prefix_[j] <= '9') j++;
+      bool numbered = j > i && j + 1 < n && (prefix_[j] == '.' || prefix_[j] == ')') && prefix_[j + 1] == ' ';
+      j = numbered ? j + 1 : i;
+    }
+    for (; j < n; j++) inlineChar(prefix_[j]);
+  }
+
+  void endLine() {
+    if (lineStart_ && prefixLen_ > 0) endPrefix();
+    if (skipping_ || inFence_) {
+      skipping_ = false;
+    } else {
+      if (link_ != LINK_NONE) replayLink(false);
+      inCode_ = false;
+      flushWord();
+      // A heading, list item or paragraph is a sentence even without a stop
+      if (open_ && !strchr(".!?:;,", lastChar_)) emit('.');
+      endSentence();
+    }
+    lineStart_ = true;
+  }
+
+  void inlineChar(char c) {
+    if (skipping_) return;
+    if (link_ == LINK_TEXT && !replaying_) {
+      if (c == ']') {
+        link_ = LINK_CLOSE;
+      } else if (c == '[' || linkLen_ == LINK_MAX) {
+        replayLink(true);
+        inlineChar(c);
+      } else {
+        linkText_[linkLen_++] = c;
+      }
+      return;
+    }
+    if (link_ == LINK_CLOSE) {
+      if (c == '(') {
+        link_ = LINK_URL;
+        return;
+      }
+      replayLink(false);
+    } else if (link_ == LINK_URL) {
+      if (c == ')') replayLink(false);
+      return;
+    }
+
+    if (inCode_) {
+      if (c == '`') {
+        inCode_ = false;
+      } else {
+        wordChar(c);
+      }
+      return;
+    }
+    switch (c) {
+      case '`':
+        inCode_ = true;
+        return;
+      case '*':
+      case '~':
+        return;
+      case '_':
+        wordChar(' ');
+        return;
+      case '|':
+        wordChar(',');
+        wordChar(' ');
+        return;
+      case '[':
+        if (replaying_) return;
+        link_ = LINK_TEXT;
+        linkLen_ = 0;
+        return;
+      case ']':
+        return;
+      default:
+        wordChar(c);
+    }
+  }
+
+  // Sends the held link text on as plain text; an unfinished link keeps
+  // its bracket so nothing the answer said is lost
+  void replayLink(bool unfinished) {
+    link_ = LINK_NONE;
+    replaying_ = true;
+    if (unfinished) wordChar(' ');
+    for (int i = 0; i < linkLen_; i++) inlineChar(linkText_[i]);
+    replaying_ = false;
+    linkLen_ = 0;
+  }
+
+  void wordChar(char c) {
+    if (c == ' ' || c == '\t') {
+      flushWord();
+      return;
+    }
+    if (wordLen_ == WORD_MAX) {
+      if (isUrl(word_, wordLen_)) return;  // Only its start is needed
+      flushWord();
+    }
+    word_[wordLen_++] = c;
+  }
+
+  struct Abbreviation {
+    const char* text;
+    const char* spoken;
+    bool endsSentence;
+  };
+
+  static const Abbreviation* findAbbreviation(const char* w, int len) {
+    static const Abbreviation table[] = {
+      { "e.g.", "for example", false }, { "E.g.", "For example", false },
+      { "i.e.", "that is", false }, { "I.e.", "That is", false },
+      { "etc.", "et cetera.", true }, { "vs.", "versus", false },
+      { "approx.", "approximately", false }, { "Dr.", "Doctor", false },
+      { "Mr.", "Mister", false }, { "Mrs.", "Missus", false },
+      { "St.", "Saint", false }, { "No.", "number", false },
+    };
+    for (const Abbreviation& a : table) {
+      if ((int)strlen(a.text) == len && memcmp(a.text, w, len) == 0) return &a;
+    }
+    return nullptr;
+  }
+
+  static bool isUrl(const char* w, int len) {
+    return (len >= 7 && memcmp(w, "http://", 7) == 0) || (len >= 8 && memcmp(w, "https://", 8) == 0)
+           || (len >= 4 && memcmp(w, "www.", 4) == 0);
+  }
+
+  static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+  static bool isAlnum(char c) { return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (uint8_t)c >= 0x80; }
+
+  // Index of the hyphen in a short numeric range such as 3-5, 10-20 or
+  // 1990-2000, or -1. Four digits only pair with four, so phone numbers
+  // (555-1234) keep their hyphen; so do dates, codes and leading zeros.
+  static int rangeHyphen(const char* w, int len) {
+    int at = -1;
+    for (int i = 0; i < len; i++) {
+      if (w[i] != '-') continue;
+      if (at >= 0) return -1;
+      at = i;
+    }
+    if (at < 0) return -1;
+    int a = at;
+    while (a > 0 && isDigit(w[a - 1])) a--;
+    int b = at + 1;
+    while (b < len && isDigit(w[b])) b++;
+    int left = at - a;
+    int right = b - at - 1;
+    if (left < 1 || left > 4 || right < 1 || right > 4 || (left == 4) != (right == 4)) return -1;
+    if ((left > 1 && w[a] == '0') || (right > 1 && w[at + 1] == '0')) return -1;
+    if ((a > 0 && isAlnum(w[a - 1])) || (b < len && isAlnum(w[b]))) return -1;
+    int from = 0;
+    int to = 0;
+    for (int i = a; i < at; i++) from = from * 10 + (w[i] - '0');
+    for (int i = at + 1; i < b; i++) to = to * 10 + (w[i] - '0');
+    return from < to ? at : -1;
+  }
+
+  void flushWord() {
+    int len = wordLen_;
+    wordLen_ = 0;
+    if (len == 0) return;
+    const char* w = word_;
+
+    if (isUrl(w, len)) {
+      emitWord("link", 4);
+      return;
+    }
+
+    // Surrounding punctuation is kept apart so "(e.g.," still matches
+    int lead = 0;
+    while (lead < len && strchr("(\"'", w[lead])) lead++;
+    int core = len;
+    while (core > lead && strchr(",;:)\"'", w[core - 1])) core--;
+    const Abbreviation* abbr = findAbbreviation(w + lead, core - lead);
+    if (abbr) {
+      emitSpace();
+      for (int i = 0; i < lead; i++) emit(w[i]);
+      for (const char* p = abbr->spoken; *p; p++) emit(*p);
+      for (int i = core; i < len; i++) emit(w[i]);
+      if (abbr->endsSentence && core == len) endSentence();
+      return;
+    }
+
+    bool text = false;
+    for (int i = 0; i < len && !text; i++) text = isAlnum(w[i]) || w[i] == '&' || w[i] == '%';
+    if (!text) {
+      // Rules, bullets and table borders; keep one stop if they carried one
+      for (int i = 0; i < len; i++) {
+        if (strchr(".,;:!?", w[i]) && lastChar_ && isAlnum(lastChar_)) {
+          emit(w[i]);
+          if (strchr(".!?", w[i])) endSentence();
+          break;
+        }
+      }
+      return;
+    }
+
+    int range = rangeHyphen(w, len);
+    bool spaced = false;
+    for (int i = 0; i < len; i++) {
+      char c = w[i];
+      if (c == '&') {
+        emitWord("and", 3);
+        spaced = true;
+      } else if (c == '%') {
+        emitWord("percent", 7);
+        spaced = true;
+      } else if ((uint8_t)c == 0xc2 && i + 1 < len && (uint8_t)w[i + 1] == 0xb0) {
+        emitWord("degrees", 7);
+        spaced = true;
+        i++;
+      } else if (i == range) {
+        emitWord("to", 2);
+        spaced = true;
+      } else {
+        if (i == 0 || spaced) emitSpace();
+        spaced = false;
+        emit(c);
+      }
+    }
+
+    // A stop ends a sentence unless it belongs to an initial such as "J."
+    int end = len;
+    while (end > 0 && strchr(")\"'", w[end - 1])) end--;
+    if (end > 0 && strchr(".!?", w[end - 1]) && !(end == 2 && w[0] >= 'A' && w[0] <= 'Z')) endSentence();
+  }
+
+  void emitWord(const char* s, size_t len) {
+    emitSpace();
+    for (size_t i = 0; i < len; i++) emit(s[i]);
+  }
+
+  void emitSpace() {
+    if (lastChar_ && lastChar_ != ' ') emit(' ');
+  }
+
+  void emit(char c) {
+    if (outLen_ == OUT_MAX) flushOut(false);
+    out_[outLen_++] = c;
+    lastChar_ = c;
+    open_ = true;
+  }
+
+  void endSentence() {
+    if (!open_) return;
+    open_ = false;
+    sentences_++;
+    flushOut(true);
+  }
+
+  void flushOut(bool sentenceEnd) {
+    if (outLen_ == 0 && !sentenceEnd) return;
+    bytesOut_ += outLen_;
+    sink_(ctx_, out_, outLen_, sentenceEnd);
+    outLen_ = 0;
+  }
+};
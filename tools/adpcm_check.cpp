@@ -0,0 +1,188 @@
+// Round-trips audio through ima_adpcm.h the way the firmware stores it
+// (256-byte blocks, as compressWavFile() and the archive write them) and
+// checks the result: the SNR of the decoded audio must reach MIN_SNR_DB,
+// and decoding in pieces of any size, as playback reads them off SD, must
+// give the same samples as decoding whole blocks. Reports the compression
+// ratio and encode and decode speed.
+//
+// The default input is 20 s of generated speech-band audio: a voiced
+// source gliding between 100 and 220 Hz, shaped by three moving formants,
+// with unvoiced noise bursts, syllable envelopes and pauses.
+//
+//   g++ -O2 -std=c++17 -I.. -o adpcm_check adpcm_check.cpp
+//   ./adpcm_check                 # generated speech-band audio
+//   ./adpcm_check speech.wav      # 16-bit mono WAV
+#include "ima_adpcm.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+static const uint16_t BLOCK_ALIGN = 256;  // ADPCM_BLOCK_ALIGN in main.cpp
+static const double MIN_SNR_DB = 30.0;
+static const size_t PIECES[] = { 1, 37, 512, 8192 };
+
+static double cpuMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static bool loadWav(const char* path, std::vector<int16_t>& pcm, uint32_t& rate) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t h[44];
+  bool ok = fread(h, 1, 44, f) == 44 && memcmp(h, "RIFF", 4) == 0 && h[20] == 1 && h[22] == 1 && h[34] == 16;
+  if (ok) {
+    rate = h[24] | h[25] << 8 | h[26] << 16 | (uint32_t)h[27] << 24;
+    int16_t s[1024];
+    size_t n;
+    while ((n = fread(s, 2, 1024, f)) > 0) pcm.insert(pcm.end(), s, s + n);
+  }
+  fclose(f);
+  return ok;
+}
+
+// Speech-like audio limited to the telephone band, peaking near -6 dBFS
+static std::vector<int16_t> speechBand(uint32_t rate, double seconds) {
+  std::vector<int16_t> pcm((size_t)(rate * seconds));
+  srand(7);
+  double phase = 0;
+  double noiseLp = 0;
+  for (size_t i = 0; i < pcm.size(); i++) {
+    double t = (double)i / rate;
+    double syllable = fmod(t, 0.25) / 0.25;  // 4 syllables a second
+    bool pause = fmod(t, 3.0) >= 2.5;         // A breath every 3 s
+    bool fricative = fmod(t, 1.0) < 0.5;      // Half the syllables open with one
+    double envelope = pause ? 0 : sin(M_PI * syllable);
+
+    double f0 = 160 + 60 * sin(2 * M_PI * 0.7 * t);
+    phase += 2 * M_PI * f0 / rate;
+    const double formants[3] = { 500 + 200 * sin(2 * M_PI * 1.3 * t), 1500 + 500 * sin(2 * M_PI * 0.9 * t),
+                                 2500 + 300 * sin(2 * M_PI * 0.5 * t) };
+    double voiced = 0;
+    for (int h = 1; h * f0 < 3400; h++) {
+      double f = h * f0;
+      double gain = 0;
+      for (double fc : formants) gain += exp(-(f - fc) * (f - fc) / (2 * 150.0 * 150.0)) * 500 / fc;
+      voiced += gain * sin(h * phase) / sqrt((double)h);
+    }
+
+    double noise = (double)rand() / RAND_MAX * 2 - 1;
+    double hiss = noise - noiseLp;  // High-passed, like /s/
+    noiseLp += 0.3 * (noise - noiseLp);
+
+    // The fricative hands over to the vowel across 20 ms, well below its level
+    double vowel = fricative ? fmin(fmax((syllable - 0.15) / 0.08, 0), 1) : 1;
+    double v = (1 - vowel) * 0.05 * hiss + vowel * 0.35 * voiced;
+    pcm[i] = (int16_t)lrint(16000 * envelope * v);
+  }
+  return pcm;
+}
+
+static std::vector<uint8_t> encode(const std::vector<int16_t>& pcm) {
+  const size_t perBlock = ImaAdpcm::samplesPerBlock(BLOCK_ALIGN);
+  std::vector<uint8_t> out;
+  uint8_t block[BLOCK_ALIGN];
+  ImaAdpcmEncoder encoder;
+  for (size_t i = 0; i < pcm.size(); i += perBlock) {
+    size_t n = pcm.size() - i < perBlock ? pcm.size() - i : perBlock;
+    size_t bytes = encoder.encodeBlock(&pcm[i], n, block);
+    out.insert(out.end(), block, block + bytes);
+  }
+  return out;
+}
+
+static std::vector<int16_t> decode(const std::vector<uint8_t>& coded, size_t piece) {
+  std::vector<int16_t> out(coded.size() * 2 + 2);
+  ImaAdpcmDecoder decoder;
+  decoder.begin(BLOCK_ALIGN);
+  size_t n = 0;
+  for (size_t i = 0; i < coded.size(); i += piece) {
+    size_t len = coded.size() - i < piece ? coded.size() - i : piece;
+    n += decoder.decode(&coded[i], len, &out[n]);
+  }
+  out.resize(n);
+  return out;
+}
+
+int main(int argc, char** argv) {
+  std::vector<int16_t> pcm;
+  uint32_t rate = 16000;
+  if (argc > 1) {
+    if (!loadWav(argv[1], pcm, rate)) {
+      fprintf(stderr, "%s: not a 16-bit mono PCM WAV\n", argv[1]);
+      return 1;
+    }
+  } else {
+    pcm = speechBand(rate, 20);
+  }
+  double seconds = (double)pcm.size() / rate;
+  int failures = 0;
+
+  std::vector<uint8_t> coded = encode(pcm);
+  std::vector<int16_t> decoded = decode(coded, BLOCK_ALIGN);
+
+  // The last block's odd half-byte may decode one extra sample
+  if (decoded.size() < pcm.size()) {
+    printf("FAIL decoded %zu samples of %zu\n", decoded.size(), pcm.size());
+    return 1;
+  }
+  double signal = 0;
+  double error = 0;
+  int32_t maxError = 0;
+  for (size_t i = 0; i < pcm.size(); i++) {
+    double d = (double)pcm[i] - decoded[i];
+    signal += (double)pcm[i] * pcm[i];
+    error += d * d;
+    if (fabs(d) > maxError) maxError = (int32_t)fabs(d);
+  }
+  double snr = error > 0 ? 10 * log10(signal / error) : 99;
+  printf("audio:   %.1f s at %u Hz, %zu -> %zu bytes (%.2f:1)\n", seconds, rate, pcm.size() * 2,
+         coded.size() + ImaAdpcm::WAV_HEADER_BYTES,
+         pcm.size() * 2.0 / (coded.size() + ImaAdpcm::WAV_HEADER_BYTES));
+  printf("quality: SNR %.1f dB (minimum %.0f), largest error %d\n", snr, MIN_SNR_DB, maxError);
+  if (snr < MIN_SNR_DB) {
+    printf("FAIL SNR below %.0f dB\n", MIN_SNR_DB);
+    failures++;
+  }
+
+  for (size_t piece : PIECES) {
+    if (decode(coded, piece) != decoded) {
+      printf("FAIL decoding in %zu-byte pieces differs\n", piece);
+      failures++;
+    }
+  }
+
+  // Speed, as multiples of real time over repeated passes
+  int passes = 0;
+  double start = cpuMicros();
+  double encodeUs = 0;
+  while (encodeUs < 300000) {
+    coded = encode(pcm);
+    passes++;
+    encodeUs = cpuMicros() - start;
+  }
+  double encodeX = seconds * 1e6 * passes / encodeUs;
+  passes = 0;
+  start = cpuMicros();
+  double decodeUs = 0;
+  while (decodeUs < 300000) {
+    decoded = decode(coded, 37);
+    passes++;
+    decodeUs = cpuMicros() - start;
+  }
+  double decodeX = seconds * 1e6 * passes / decodeUs;
+  printf("speed:   encode %.0fx real time, decode %.0fx in 37-byte pieces\n", encodeX, decodeX);
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,1162 @@
+// Caching proxy for the fleet's LLM and TTS requests. Devices point
+// API_PROXY_URL at it (plain HTTP on the LAN), and it forwards
+// generateContent and text:synthesize to Google over keep-alive TLS
+// connections. Identical requests that arrive while one is upstream wait
+// for it instead of going out again (single-flight), and successful
+// responses are kept in a content-addressed store: each body is a file
+// named by its SHA-256, so devices asking for the same audio share one
+// copy, and the index from request hashes to bodies is a memory-mapped
+// table that survives restarts. Hits go out with sendfile(), from the
+// page cache to the socket without a copy through the proxy. The least
+// recently used responses are evicted once the store is full; LLM answers
+// also expire (--llm-ttl), since the world they describe moves on.
+//
+// A request's hash covers the route, the path with its query (and so the
+// API key: only devices with the same key share responses),
+// Accept-Encoding and the body. One thread runs an epoll loop for the
+// devices; upstream calls run on worker threads, each with its own
+// connections. --record writes every request for tools/api_cache_replay.
+//
+//   g++ -O2 -std=c++17 -o api_cache_proxy api_cache_proxy.cpp -lssl -lcrypto -lpthread
+//   ./api_cache_proxy --store /var/cache/voiceai                # Google APIs
+//   ./api_cache_proxy --upstream http://127.0.0.1:8090          # tools/cache_standin.py
+//   ./api_cache_proxy --upstream http://127.0.0.1:8090 --record fleet.rec
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+static const size_t REQUEST_HEAD_MAX = 8192;
+static const size_t REQUEST_BODY_MAX = 256 * 1024;  // TTS input is capped at 5000 bytes
+static const size_t RESPONSE_MAX = 64 << 20;
+static const int UPSTREAM_TIMEOUT_S = 30;
+static const double REPORT_INTERVAL_MS = 10000;
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static uint32_t nowSeconds() {
+  return (uint32_t)time(nullptr);
+}
+
+struct Config {
+  int port = 8088;
+  std::string store = "api-cache";
+  uint64_t storeBytes = 1024ull << 20;
+  uint32_t entries = 65536;
+  std::string geminiUrl = "https://generativelanguage.googleapis.com";
+  std::string ttsUrl = "https://texttospeech.googleapis.com";
+  int llmTtl = 3600;  // Seconds; 0 keeps LLM answers out of the store
+  int workers = 32;  // Blocking calls; each mostly waits on the model
+  std::string record;
+  bool verbose = false;
+};
+static Config config;
+
+//----------------------------------------
+// Content store
+//----------------------------------------
+
+struct Hash {
+  uint8_t b[32];
+  bool operator==(const Hash& o) const { return memcmp(b, o.b, sizeof(b)) == 0; }
+};
+
+struct HashOf {
+  size_t operator()(const Hash& h) const {
+    size_t v;
+    memcpy(&v, h.b, sizeof(v));
+    return v;
+  }
+};
+
+static std::string hex(const Hash& h) {
+  static const char digits[] = "0123456789abcdef";
+  std::string s(64, '0');
+  for (int i = 0; i < 32; i++) {
+    s[i * 2] = digits[h.b[i] >> 4];
+    s[i * 2 + 1] = digits[h.b[i] & 15];
+  }
+  return s;
+}
+
+static Hash sha256(const void* data, size_t len) {
+  Hash h;
+  EVP_Digest(data, len, h.b, nullptr, EVP_sha256(), nullptr);
+  return h;
+}
+
+// The index file: a header, then an open-addressed table of entries keyed
+// by request hash. Everything is fixed-size, so the table is used in place
+// through the mapping and needs no parsing at startup.
+struct IndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t slots;
+  uint8_t reserved[48];
+};
+
+enum SlotState : uint8_t { SLOT_EMPTY, SLOT_USED, SLOT_DELETED };
+
+struct IndexEntry {
+  Hash key;      // Of the request
+  Hash content;  // Of the body; names its file
+  uint64_t size;
+  uint32_t lastUsed;  // Unix seconds
+  uint32_t expires;   // Unix seconds; 0 never
+  uint8_t state;
+  uint8_t reserved[15];
+  char contentType[48];
+  char contentEncoding[16];
+};
+
+static_assert(sizeof(IndexHeader) == 64, "index header layout");
+static_assert(sizeof(IndexEntry) == 160, "index entry layout");
+
+static const char INDEX_MAGIC[8] = { 'V', 'A', 'I', 'C', 'A', 'C', 'H', 'E' };
+static const uint32_t INDEX_VERSION = 1;
+
+class ContentStore {
+ public:
+  uint64_t evictions = 0;
+  uint64_t expirations = 0;
+  uint64_t dedupedWrites = 0;  // Bodies already stored under another request
+
+  bool open(const std::string& dir, uint32_t slots, uint64_t capacity) {
+    dir_ = dir;
+    capacity_ = capacity;
+    mkdir(dir.c_str(), 0755);
+    mkdir((dir + "/objects").c_str(), 0755);
+    std::string path = dir + "/index";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return false;
+    size_t bytes = sizeof(IndexHeader) + (size_t)slots * sizeof(IndexEntry);
+    struct stat st;
+    fstat(fd, &st);
+    bool resized = (size_t)st.st_size != bytes;
+    if ((resized && ftruncate(fd, 0) != 0) || ftruncate(fd, bytes) != 0) {  // A table of another size starts empty
+      ::close(fd);
+      return false;
+    }
+    void* map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+    header_ = (IndexHeader*)map;
+    table_ = (IndexEntry*)((uint8_t*)map + sizeof(IndexHeader));
+    if (resized || memcmp(header_->magic, INDEX_MAGIC, 8) != 0 || header_->version != INDEX_VERSION
+        || header_->slots != slots) {
+      memset(map, 0, bytes);
+      memcpy(header_->magic, INDEX_MAGIC, 8);
+      header_->version = INDEX_VERSION;
+      header_->slots = slots;
+    }
+    slots_ = slots;
+    lruPos_.resize(slots);
+
+    // Rebuild what only lives in memory: the LRU order and object refcounts
+    std::vector<uint32_t> used;
+    for (uint32_t i = 0; i < slots_; i++) {
+      IndexEntry& e = table_[i];
+      if (e.state == SLOT_DELETED) deleted_++;
+      if (e.state != SLOT_USED) continue;
+      struct stat os;
+      if (stat(objectPath(e.content).c_str(), &os) != 0 || (uint64_t)os.st_size != e.size) {
+        e.state = SLOT_DELETED;  // The body went missing
+        deleted_++;
+        continue;
+      }
+      used.push_back(i);
+    }
+    std::sort(used.begin(), used.end(), [this](uint32_t a, uint32_t b) {
+      return table_[a].lastUsed > table_[b].lastUsed;
+    });
+    for (uint32_t i : used) {
+      lruPos_[i] = lru_.insert(lru_.end(), i);
+      ref(table_[i]);
+    }
+    while (bytes_ > capacity_ && !lru_.empty()) evict(lru_.back());
+    return true;
+  }
+
+  // Slot of a live entry for key, or -1. Expired entries are dropped here.
+  int find(const Hash& key) {
+    uint32_t i = home(key);
+    for (uint32_t n = 0; n < slots_; n++, i = (i + 1) % slots_) {
+      IndexEntry& e = table_[i];
+      if (e.state == SLOT_EMPTY) return -1;
+      if (e.state == SLOT_USED && e.key == key) {
+        if (e.expires && e.expires <= nowSeconds()) {
+          expirations++;
+          remove(i);
+          return -1;
+        }
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void touch(int slot) {
+    table_[slot].lastUsed = nowSeconds();
+    lru_.splice(lru_.begin(), lru_, lruPos_[slot]);
+  }
+
+  const IndexEntry& entry(int slot) const { return table_[slot]; }
+
+  int openBody(int slot) const { return ::open(objectPath(table_[slot].content).c_str(), O_RDONLY); }
+
+  // Stores body for key; returns its slot, or -1 if it cannot be stored
+  int put(const Hash& key, const std::string& body, const std::string& type, const std::string& encoding,
+          uint32_t ttl) {
+    if (body.size() > capacity_ / 4) return -1;  // One response may not flush the store
+    int old = find(key);
+    if (old >= 0) remove(old);
+    if ((lru_.size() + deleted_ + 1) * 10 > (size_t)slots_ * 9) {
+      while ((lru_.size() + 1) * 10 > (size_t)slots_ * 8 && !lru_.empty()) evict(lru_.back());
+      rehash();
+    }
+    // Evicting first, so the body is not unlinked under the entry that shares it
+    Hash content = sha256(body.data(), body.size());
+    while (bytes_ + (refs_.count(content) ? 0 : body.size()) > capacity_ && !lru_.empty()) evict(lru_.back());
+    if (refs_.count(content)) {
+      dedupedWrites++;
+    } else if (!writeObject(content, body)) {
+      return -1;
+    }
+    uint32_t i = home(key);
+    while (table_[i].state == SLOT_USED) i = (i + 1) % slots_;
+    IndexEntry& e = table_[i];
+    if (e.state == SLOT_DELETED) deleted_--;
+    memset(&e, 0, sizeof(e));
+    e.key = key;
+    e.content = content;
+    e.size = body.size();
+    e.lastUsed = nowSeconds();
+    e.expires = ttl ? e.lastUsed + ttl : 0;
+    snprintf(e.contentType, sizeof(e.contentType), "%s", type.c_str());
+    snprintf(e.contentEncoding, sizeof(e.contentEncoding), "%s", encoding.c_str());
+    e.state = SLOT_USED;
+    lruPos_[i] = lru_.insert(lru_.begin(), i);
+    ref(e);
+    return i;
+  }
+
+  size_t entries() const { return lru_.size(); }
+  size_t objects() const { return refs_.size(); }
+  uint64_t bytes() const { return bytes_; }
+  uint64_t capacity() const { return capacity_; }
+
+ private:
+  struct Object {
+    uint32_t refs;
+    uint64_t size;
+  };
+
+  std::string dir_;
+  uint64_t capacity_ = 0;
+  IndexHeader* header_ = nullptr;
+  IndexEntry* table_ = nullptr;
+  uint32_t slots_ = 0;
+  uint32_t deleted_ = 0;
+  uint64_t bytes_ = 0;  // Of distinct bodies
+  std::list<uint32_t> lru_;  // Slots, most recent first
+  std::vector<std::list<uint32_t>::iterator> lruPos_;
+  std::unordered_map<Hash, Object, HashOf> refs_;
+
+  uint32_t home(const Hash& key) const { return HashOf()(key) % slots_; }
+
+  std::string objectPath(const Hash& content) const {
+    std::string h = hex(content);
+    return dir_ + "/objects/" + h.substr(0, 2) + "/" + h.substr(2);
+  }
+
+  // Written aside and renamed, so a crash never leaves a short body under
+  // a content name
+  bool writeObject(const Hash& content, const std::string& body) {
+    std::string h = hex(content);
+    mkdir((dir_ + "/objects/" + h.substr(0, 2)).c_str(), 0755);
+    std::string path = objectPath(content);
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    size_t off = 0;
+    while (off < body.size()) {
+      ssize_t n = write(fd, body.data() + off, body.size() - off);
+      if (n <= 0) break;
+      off += n;
+    }
+    ::close(fd);
+    if (off != body.size() || rename(tmp.c_str(), path.c_str()) != 0) {
+      unlink(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  void ref(const IndexEntry& e) {
+    Object& o = refs_[e.content];
+    if (o.refs++ == 0) {
+      o.size = e.size;
+      bytes_ += e.size;
+    }
+  }
+
+  void remove(uint32_t slot) {
+    IndexEntry& e = table_[slot];
+    std::unordered_map<Hash, Object, HashOf>::iterator it = refs_.find(e.content);
+    if (it != refs_.end() && --it->second.refs == 0) {
+      unlink(objectPath(e.content).c_str());
+      bytes_ -= it->second.size;
+      refs_.erase(it);
+    }
+    lru_.erase(lruPos_[slot]);
+    e.state = SLOT_DELETED;
+    deleted_++;
+  }
+
+  void evict(uint32_t slot) {
+    evictions++;
+    remove(slot);
+  }
+
+  // Drops the tombstones: entries are taken out and put back in LRU order
+  void rehash() {
+    std::vector<IndexEntry> live;
+    for (uint32_t slot : lru_) live.push_back(table_[slot]);
+    memset(table_, 0, (size_t)slots_ * sizeof(IndexEntry));
+    lru_.clear();
+    deleted_ = 0;
+    for (const IndexEntry& e : live) {
+      uint32_t i = home(e.key);
+      while (table_[i].state == SLOT_USED) i = (i + 1) % slots_;
+      table_[i] = e;
+      lruPos_[i] = lru_.insert(lru_.end(), i);
+    }
+  }
+};
+
+static ContentStore store;
+
+//----------------------------------------
+// Upstream calls (worker threads)
+//----------------------------------------
+
+struct Route {
+  const char* name;
+  std::string host;
+  int port = 443;
+  bool tls = true;
+  int ttl = 0;  // Store lifetime in seconds, 0 for none; < 0 keeps it out
+};
+
+enum RouteId { ROUTE_GEMINI, ROUTE_TTS, ROUTE_COUNT };
+static Route routes[ROUTE_COUNT] = { { "gemini", "", 443, true, 0 }, { "tts", "", 443, true, 0 } };
+static SSL_CTX* sslCtx = nullptr;
+
+struct Client;
+
+// One upstream call and everyone waiting on it
+struct Flight {
+  Hash key;
+  RouteId route;
+  std::string path;
+  std::string acceptEncoding;
+  std::string apiKey;  // x-goog-api-key, when the device sent one
+  std::string body;
+  std::vector<Client*> waiters;
+  // Filled in by the worker
+  int status = 0;
+  std::string contentType;
+  std::string contentEncoding;
+  std::string response;
+  std::string error;
+  double upstreamMs = 0;
+};
+
+// A worker's keep-alive connection to one route
+struct UpstreamConn {
+  int fd = -1;
+  SSL* ssl = nullptr;
+  std::string in;
+  size_t inPos = 0;
+  uint32_t requests = 0;
+};
+
+static std::mutex jobLock;
+static std::condition_variable jobReady;
+static std::deque<Flight*> jobs;
+static std::mutex doneLock;
+static std::vector<Flight*> finished;
+static int doneFd = -1;
+
+static bool parseUrl(const std::string& url, Route& r) {
+  size_t start;
+  if (url.compare(0, 8, "https://") == 0) {
+    r.tls = true;
+    r.port = 443;
+    start = 8;
+  } else if (url.compare(0, 7, "http://") == 0) {
+    r.tls = false;
+    r.port = 80;
+    start = 7;
+  } else {
+    return false;
+  }
+  std::string hostPort = url.substr(start, url.find('/', start) - start);
+  size_t colon = hostPort.find(':');
+  r.host = hostPort.substr(0, colon);
+  if (colon != std::string::npos) r.port = atoi(hostPort.c_str() + colon + 1);
+  return !r.host.empty() && r.port > 0;
+}
+
+static void closeUpstream(UpstreamConn& c) {
+  if (c.ssl) SSL_free(c.ssl);
+  if (c.fd >= 0) close(c.fd);
+  c = UpstreamConn();
+}
+
+static bool connectUpstream(const Route& r, UpstreamConn& c, std::string& error) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(r.host.c_str(), std::to_string(r.port).c_str(), &hints, &res) != 0 || !res) {
+    error = "cannot resolve " + r.host;
+    return false;
+  }
+  c.fd = socket(res->ai_family, SOCK_STREAM, 0);
+  timeval timeout = { UPSTREAM_TIMEOUT_S, 0 };
+  setsockopt(c.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(c.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  int one = 1;
+  setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  int rc = connect(c.fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (rc != 0) {
+    error = "cannot connect to " + r.host;
+    closeUpstream(c);
+    return false;
+  }
+  if (r.tls) {
+    c.ssl = SSL_new(sslCtx);
+    SSL_set_fd(c.ssl, c.fd);
+    SSL_set_tlsext_host_name(c.ssl, r.host.c_str());
+    SSL_set1_host(c.ssl, r.host.c_str());
+    if (SSL_connect(c.ssl) != 1) {
+      error = "TLS handshake with " + r.host + " failed";
+      closeUpstream(c);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool upstreamWrite(UpstreamConn& c, const std::string& data) {
+  size_t off = 0;
+  while (off < data.size()) {
+    ssize_t n = c.ssl ? SSL_write(c.ssl, data.data() + off, data.size() - off)
+                      : send(c.fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    off += n;
+  }
+  return true;
+}
+
+// Makes at least one more byte available in c.in; false at the end
+static bool upstreamFill(UpstreamConn& c) {
+  if (c.inPos > 0 && c.inPos == c.in.size()) {
+    c.in.clear();
+    c.inPos = 0;
+  }
+  char buf[65536];
+  ssize_t n = c.ssl ? SSL_read(c.ssl, buf, sizeof(buf)) : recv(c.fd, buf, sizeof(buf), 0);
+  if (n <= 0) return false;
+  c.in.append(buf, n);
+  return true;
+}
+
+static bool upstreamLine(UpstreamConn& c, std::string& line) {
+  for (;;) {
+    size_t end = c.in.find("\r\n", c.inPos);
+    if (end != std::string::npos) {
+      line.assign(c.in, c.inPos, end - c.inPos);
+      c.inPos = end + 2;
+      return true;
+    }
+    if (c.in.size() - c.inPos > REQUEST_HEAD_MAX || !upstreamFill(c)) return false;
+  }
+}
+
+static bool upstreamBytes(UpstreamConn& c, size_t len, std::string& out) {
+  while (len > 0) {
+    if (c.inPos == c.in.size() && !upstreamFill(c)) return false;
+    size_t n = std::min(len, c.in.size() - c.inPos);
+    out.append(c.in, c.inPos, n);
+    c.inPos += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool headerIs(const std::string& line, const char* name, std::string& value) {
+  size_t len = strlen(name);
+  if (line.size() <= len || strncasecmp(line.c_str(), name, len) != 0 || line[len] != ':') return false;
+  size_t start = line.find_first_not_of(" \t", len + 1);
+  value = start == std::string::npos ? "" : line.substr(start);
+  return true;
+}
+
+// One request and its response on c. False if the connection failed,
+// with the flight's error set.
+static bool exchange(const Route& r, UpstreamConn& c, Flight* f) {
+  std::string host = r.port == (r.tls ? 443 : 80) ? r.host : r.host + ":" + std::to_string(r.port);
+  std::string request = "POST " + f->path + " HTTP/1.1\r\nHost: " + host
+                        + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(f->body.size())
+                        + "\r\nConnection: keep-alive\r\n";
+  if (!f->acceptEncoding.empty()) request += "Accept-Encoding: " + f->acceptEncoding + "\r\n";
+  if (!f->apiKey.empty()) request += "x-goog-api-key: " + f->apiKey + "\r\n";
+  request += "\r\n";
+  request += f->body;
+  c.requests++;
+  std::string line;
+  if (!upstreamWrite(c, request) || !upstreamLine(c, line) || line.compare(0, 5, "HTTP/") != 0) {
+    f->error = "no response from " + r.host;
+    return false;
+  }
+  size_t space = line.find(' ');
+  f->status = space == std::string::npos ? 0 : atoi(line.c_str() + space + 1);
+  long long length = -1;
+  bool chunked = false;
+  bool keepAlive = line.compare(0, 8, "HTTP/1.1") == 0;
+  std::string value;
+  for (;;) {
+    if (!upstreamLine(c, line)) {
+      f->error = "truncated response headers";
+      return false;
+    }
+    if (line.empty()) break;
+    if (headerIs(line, "Content-Length", value)) length = atoll(value.c_str());
+    else if (headerIs(line, "Transfer-Encoding", value)) chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+    else if (headerIs(line, "Content-Type", value)) f->contentType = value;
+    else if (headerIs(line, "Content-Encoding", value)) f->contentEncoding = value;
+    else if (headerIs(line, "Connection", value)) keepAlive = strcasecmp(value.c_str(), "close") != 0;
+  }
+  bool ok;
+  if (chunked) {
+    ok = true;
+    for (;;) {
+      if (!upstreamLine(c, line)) {
+        ok = false;
+        break;
+      }
+      size_t size = strtoul(line.c_str(), nullptr, 16);
+      if (size == 0) {
+        while ((ok = upstreamLine(c, line)) && !line.empty()) {}  // Trailers
+        break;
+      }
+      if (f->response.size() + size > RESPONSE_MAX || !upstreamBytes(c, size, f->response)
+          || !upstreamLine(c, line)) {
+        ok = false;
+        break;
+      }
+    }
+  } else if (length >= 0) {
+    ok = (size_t)length <= RESPONSE_MAX && upstreamBytes(c, length, f->response);
+  } else {
+    while (upstreamFill(c) && c.in.size() - c.inPos < RESPONSE_MAX) {}
+    f->response.append(c.in, c.inPos, std::string::npos);
+    c.inPos = c.in.size();
+    ok = true;
+    keepAlive = false;
+  }
+  if (!ok) {
+    f->error = "truncated response body";
+    f->status = 0;
+    return false;
+  }
+  if (!keepAlive) closeUpstream(c);
+  return true;
+}
+
+static void fetch(UpstreamConn& c, Flight* f) {
+  const Route& r = routes[f->route];
+  double start = nowMs();
+  for (int attempt = 0; attempt < 2; attempt++) {
+    f->error.clear();
+    f->status = 0;
+    f->response.clear();
+    if (c.fd < 0 && !connectUpstream(r, c, f->error)) break;
+    bool reused = c.requests > 0;
+    if (exchange(r, c, f)) break;
+    closeUpstream(c);
+    if (!reused) break;  // Only a keep-alive connection the server dropped is worth a retry
+  }
+  f->upstreamMs = nowMs() - start;
+}
+
+static void workerMain() {
+  UpstreamConn conns[ROUTE_COUNT];
+  for (;;) {
+    Flight* f;
+    {
+      std::unique_lock<std::mutex> lock(jobLock);
+      jobReady.wait(lock, [] { return !jobs.empty(); });
+      f = jobs.front();
+      jobs.pop_front();
+    }
+    fetch(conns[f->route], f);
+    {
+      std::lock_guard<std::mutex> lock(doneLock);
+      finished.push_back(f);
+    }
+    uint64_t one = 1;
+    if (write(doneFd, &one, sizeof(one)) < 0) perror("eventfd");
+  }
+}
+
+//----------------------------------------
+// Devices
+//----------------------------------------
+
+enum Outcome { OUTCOME_HIT, OUTCOME_SHARED, OUTCOME_MISS, OUTCOME_PASS, OUTCOME_ERROR, OUTCOME_COUNT };
+static const char* const outcomeNames[OUTCOME_COUNT] = { "hit", "shared", "miss", "pass", "error" };
+
+struct Stats {
+  uint64_t requests = 0;
+  uint64_t outcomes[ROUTE_COUNT][OUTCOME_COUNT] = {};
+  uint64_t upstreamCalls = 0;
+  uint64_t bytesFromStore = 0;
+  uint64_t bytesFromMemory = 0;
+  std::vector<double> latency[OUTCOME_COUNT];  // Since the last report
+};
+static Stats stats;
+
+static int epfd = -1;
+static volatile sig_atomic_t stopping = 0;
+static FILE* recordFile = nullptr;
+static double startedAt = 0;
+
+// epoll data: the handler of whatever owns the descriptor
+struct Watch {
+  void (*fn)(void* ctx, uint32_t events);
+  void* ctx;
+};
+
+struct Client {
+  int fd = -1;
+  Watch w;
+  std::string in;
+  bool waiting = false;  // On a flight
+  bool responding = false;
+  bool keepAlive = false;
+  bool http10 = false;
+  RouteId route = ROUTE_GEMINI;
+  Outcome outcome = OUTCOME_MISS;
+  double requestAt = 0;
+  std::string out;  // Response head, or the whole response when not from the store
+  size_t outPos = 0;
+  int bodyFd = -1;  // Store body, sent with sendfile() after out
+  off_t bodyOff = 0;
+  size_t bodyLeft = 0;
+  bool wantWrite = false;
+  bool dead = false;
+};
+
+static std::unordered_map<Hash, Flight*, HashOf> flights;
+
+static void watch(int fd, Watch* w, uint32_t events, bool add) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = w;
+  epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+static const char* reason(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    case 429: return "Too Many Requests";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    default: return "Status";
+  }
+}
+
+static std::string responseHead(Client* c, int status, const std::string& type, const std::string& encoding,
+                                size_t length, const char* cache) {
+  std::string h = std::string(c->http10 ? "HTTP/1.0 " : "HTTP/1.1 ") + std::to_string(status) + " " + reason(status)
+                  + "\r\nContent-Type: " + (type.empty() ? "application/json" : type)
+                  + "\r\nContent-Length: " + std::to_string(length) + "\r\n";
+  if (!encoding.empty()) h += "Content-Encoding: " + encoding + "\r\n";
+  h += std::string("X-Cache: ") + cache + "\r\nConnection: " + (c->keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+  return h;
+}
+
+static void flushClient(Client* c);
+
+static void respond(Client* c, int status, const std::string& type, const std::string& encoding,
+                    const std::string& body, Outcome outcome) {
+  c->waiting = false;
+  c->responding = true;
+  c->outcome = outcome;
+  c->out = responseHead(c, status, type, encoding, body.size(), outcomeNames[outcome]) + body;
+  c->outPos = 0;
+  stats.bytesFromMemory += body.size();
+  flushClient(c);
+}
+
+static void respondError(Client* c, int status, const char* message) {
+  respond(c, status, "application/json", "",
+          "{\"error\":{\"code\":" + std::to_string(status) + ",\"message\":\"" + message + "\"}}", OUTCOME_ERROR);
+}
+
+static bool respondFromStore(Client* c, int slot, Outcome outcome) {
+  const IndexEntry& e = store.entry(slot);
+  int fd = store.openBody(slot);
+  if (fd < 0) return false;
+  c->waiting = false;
+  c->responding = true;
+  c->outcome = outcome;
+  c->out = responseHead(c, 200, e.contentType, e.contentEncoding, e.size, outcomeNames[outcome]);
+  c->outPos = 0;
+  c->bodyFd = fd;
+  c->bodyOff = 0;
+  c->bodyLeft = e.size;
+  stats.bytesFromStore += e.size;
+  flushClient(c);
+  return true;
+}
+
+static void handleRequests(Client* c);
+
+// The response is out: account for it and take the next request
+static void finishResponse(Client* c) {
+  if (c->bodyFd >= 0) close(c->bodyFd);
+  c->bodyFd = -1;
+  c->responding = false;
+  c->out.clear();
+  c->outPos = 0;
+  stats.outcomes[c->route][c->outcome]++;
+  stats.latency[c->outcome].push_back(nowMs() - c->requestAt);
+  if (!c->keepAlive) {
+    c->dead = true;
+    return;
+  }
+  handleRequests(c);
+}
+
+static void flushClient(Client* c) {
+  while (c->outPos < c->out.size()) {
+    ssize_t n = send(c->fd, c->out.data() + c->outPos, c->out.size() - c->outPos, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      c->dead = true;
+      return;
+    }
+    c->outPos += n;
+  }
+  while (c->outPos == c->out.size() && c->bodyLeft > 0) {
+    ssize_t n = sendfile(c->fd, c->bodyFd, &c->bodyOff, c->bodyLeft);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      c->dead = true;
+      return;
+    }
+    if (n == 0) {  // The body shrank under us; the device sees a short response
+      c->dead = true;
+      return;
+    }
+    c->bodyLeft -= n;
+  }
+  bool want = c->outPos < c->out.size() || c->bodyLeft > 0;
+  if (want != c->wantWrite) {
+    c->wantWrite = want;
+    watch(c->fd, &c->w, EPOLLIN | (want ? (uint32_t)EPOLLOUT : 0), false);
+  }
+  if (!want && c->responding) finishResponse(c);
+}
+
+static Hash requestKey(RouteId route, const std::string& path, const std::string& accept, const std::string& apiKey,
+                       const std::string& body) {
+  EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+  EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+  const std::string* parts[] = { &path, &accept, &apiKey, &body };
+  EVP_DigestUpdate(ctx, routes[route].name, strlen(routes[route].name) + 1);
+  for (const std::string* p : parts) {
+    uint64_t len = p->size();  // Length-prefixed, so parts cannot run together
+    EVP_DigestUpdate(ctx, &len, sizeof(len));
+    EVP_DigestUpdate(ctx, p->data(), p->size());
+  }
+  Hash h;
+  EVP_DigestFinal_ex(ctx, h.b, nullptr);
+  EVP_MD_CTX_free(ctx);
+  return h;
+}
+
+static void record(RouteId route, const std::string& path, const std::string& accept, const std::string& body) {
+  if (!recordFile) return;
+  fprintf(recordFile, "%.0f\t%s\t%s\t%s\t%zu\n", nowMs() - startedAt, routes[route].name, path.c_str(),
+          accept.empty() ? "-" : accept.c_str(), body.size());
+  fwrite(body.data(), 1, body.size(), recordFile);
+  fputc('\n', recordFile);
+}
+
+static void serve(Client* c, const std::string& method, const std::string& path, const std::string& accept,
+                  const std::string& apiKey, const std::string& body) {
+  c->requestAt = nowMs();
+  stats.requests++;
+  size_t query = path.find('?');
+  std::string resource = path.substr(0, query);
+  if (resource.compare(0, 15, "/v1beta/models/") == 0 && resource.find(":generateContent") != std::string::npos) {
+    c->route = ROUTE_GEMINI;
+  } else if (resource == "/v1/text:synthesize") {
+    c->route = ROUTE_TTS;
+  } else {
+    return respondError(c, 404, "not a proxied API");
+  }
+  if (method != "POST") return respondError(c, 405, "POST only");
+  record(c->route, path, accept, body);
+
+  Hash key = requestKey(c->route, path, accept, apiKey, body);
+  int slot = routes[c->route].ttl >= 0 ? store.find(key) : -1;
+  if (slot >= 0) {
+    store.touch(slot);
+    if (respondFromStore(c, slot, OUTCOME_HIT)) return;
+  }
+  c->waiting = true;
+  std::unordered_map<Hash, Flight*, HashOf>::iterator it = flights.find(key);
+  if (it != flights.end()) {
+    it->second->waiters.push_back(c);
+    return;
+  }
+  Flight* f = new Flight();
+  f->key = key;
+  f->route = c->route;
+  f->path = path;
+  f->acceptEncoding = accept;
+  f->apiKey = apiKey;
+  f->body = body;
+  f->waiters.push_back(c);
+  flights[key] = f;
+  stats.upstreamCalls++;
+  {
+    std::lock_guard<std::mutex> lock(jobLock);
+    jobs.push_back(f);
+  }
+  jobReady.notify_one();
+}
+
+// Parses and serves the requests buffered in c->in, one at a time
+static void handleRequests(Client* c) {
+  while (!c->dead && !c->waiting && !c->responding) {
+    size_t end = c->in.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      if (c->in.size() > REQUEST_HEAD_MAX) {
+        c->keepAlive = false;
+        respondError(c, 400, "request head too large");
+      }
+      return;
+    }
+    size_t lineEnd = c->in.find("\r\n");
+    std::string line = c->in.substr(0, lineEnd);
+    size_t s1 = line.find(' ');
+    size_t s2 = line.rfind(' ');
+    if (s1 == std::string::npos || s2 <= s1) {
+      c->keepAlive = false;
+      return respondError(c, 400, "bad request line");
+    }
+    std::string method = line.substr(0, s1);
+    std::string path = line.substr(s1 + 1, s2 - s1 - 1);
+    c->http10 = line.compare(s2 + 1, std::string::npos, "HTTP/1.0") == 0;
+    c->keepAlive = !c->http10;
+    size_t length = 0;
+    std::string accept, apiKey, value;
+    size_t pos = lineEnd + 2;
+    while (pos < end) {
+      size_t next = c->in.find("\r\n", pos);
+      std::string header = c->in.substr(pos, next - pos);
+      pos = next + 2;
+      if (headerIs(header, "Content-Length", value)) length = strtoul(value.c_str(), nullptr, 10);
+      else if (headerIs(header, "Accept-Encoding", value)) accept = value;
+      else if (headerIs(header, "x-goog-api-key", value)) apiKey = value;
+      else if (headerIs(header, "Connection", value)) {
+        c->keepAlive = c->http10 ? strcasecmp(value.c_str(), "keep-alive") == 0 : strcasecmp(value.c_str(), "close") != 0;
+      }
+    }
+    if (length > REQUEST_BODY_MAX) {
+      c->keepAlive = false;
+      return respondError(c, 413, "request body too large");
+    }
+    if (c->in.size() < end + 4 + length) return;  // The body is still coming
+    std::string body = c->in.substr(end + 4, length);
+    c->in.erase(0, end + 4 + length);
+    serve(c, method, path, accept, apiKey, body);
+  }
+}
+
+static void closeClient(Client* c) {
+  if (c->waiting) {
+    for (auto& f : flights) {
+      std::vector<Client*>& w = f.second->waiters;
+      w.erase(std::remove(w.begin(), w.end(), c), w.end());
+    }
+  }
+  if (c->bodyFd >= 0) close(c->bodyFd);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+  close(c->fd);
+  delete c;
+}
+
+static void clientEvents(void* ctx, uint32_t events) {
+  Client* c = (Client*)ctx;
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    char buf[16384];
+    for (;;) {
+      ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      if (n <= 0) {
+        c->dead = true;
+        break;
+      }
+      c->in.append(buf, n);
+    }
+    if (!c->dead) handleRequests(c);
+  }
+  if (!c->dead && (events & EPOLLOUT)) flushClient(c);
+  if (c->dead) closeClient(c);
+}
+
+// Upstream calls the workers finished: store what can be kept and answer
+// everyone who waited
+static void doneEvents(void*, uint32_t) {
+  uint64_t count;
+  if (read(doneFd, &count, sizeof(count)) < 0) return;
+  std::vector<Flight*> batch;
+  {
+    std::lock_guard<std::mutex> lock(doneLock);
+    batch.swap(finished);
+  }
+  for (Flight* f : batch) {
+    flights.erase(f->key);
+    const Route& r = routes[f->route];
+    int slot = -1;
+    if (f->status == 200 && r.ttl >= 0) {
+      slot = store.put(f->key, f->response, f->contentType, f->contentEncoding, r.ttl);
+    }
+    if (config.verbose || !f->error.empty()) {
+      printf("[%s] %d in %.0f ms, %zu bytes%s%s, %zu waiting\n", r.name, f->status, f->upstreamMs, f->response.size(),
+             f->error.empty() ? "" : ": ", f->error.c_str(), f->waiters.size());
+    }
+    for (size_t i = 0; i < f->waiters.size(); i++) {
+      Client* c = f->waiters[i];
+      Outcome outcome = i == 0 ? OUTCOME_MISS : OUTCOME_SHARED;
+      if (f->status == 0) {
+        respondError(c, 502, f->error.c_str());
+      } else if (slot < 0 || !respondFromStore(c, slot, outcome)) {
+        respond(c, f->status, f->contentType, f->contentEncoding, f->response,
+                f->status == 200 ? (i == 0 ? OUTCOME_PASS : OUTCOME_SHARED) : OUTCOME_ERROR);
+      }
+      if (c->dead) {
+        // Left for the epoll loop; the socket reports the error again
+        c->dead = false;
+        shutdown(c->fd, SHUT_RDWR);
+      }
+    }
+    delete f;
+  }
+}
+
+static int listener = -1;
+static Watch listenWatch;
+static Watch doneWatch;
+
+static void acceptClients(void*, uint32_t) {
+  for (;;) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) return;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Client* c = new Client();
+    c->fd = fd;
+    c->w = { clientEvents, c };
+    watch(fd, &c->w, EPOLLIN, true);
+  }
+}
+
+static double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static void report(double seconds) {
+  uint64_t total[OUTCOME_COUNT] = {};
+  for (int r = 0; r < ROUTE_COUNT; r++) {
+    for (int o = 0; o < OUTCOME_COUNT; o++) total[o] += stats.outcomes[r][o];
+  }
+  uint64_t served = total[OUTCOME_HIT] + total[OUTCOME_SHARED] + total[OUTCOME_MISS] + total[OUTCOME_PASS];
+  printf("[proxy] %llu requests, %llu upstream | hit %llu, shared %llu, miss %llu, pass %llu, error %llu | %.1f%% "
+         "answered without a call\n",
+         (unsigned long long)stats.requests, (unsigned long long)stats.upstreamCalls,
+         (unsigned long long)total[OUTCOME_HIT], (unsigned long long)total[OUTCOME_SHARED],
+         (unsigned long long)total[OUTCOME_MISS], (unsigned long long)total[OUTCOME_PASS],
+         (unsigned long long)total[OUTCOME_ERROR],
+         served ? 100.0 * (total[OUTCOME_HIT] + total[OUTCOME_SHARED]) / served : 0.0);
+  printf("[proxy]   last %.0f s: hit p50 %.1f p99 %.1f ms (%zu), miss p50 %.0f p99 %.0f ms (%zu)\n", seconds,
+         percentile(stats.latency[OUTCOME_HIT], 0.5), percentile(stats.latency[OUTCOME_HIT], 0.99),
+         stats.latency[OUTCOME_HIT].size(), percentile(stats.latency[OUTCOME_MISS], 0.5),
+         percentile(stats.latency[OUTCOME_MISS], 0.99), stats.latency[OUTCOME_MISS].size());
+  printf("[proxy]   store %zu entries, %zu bodies, %.1f of %.0f MB | %llu evicted, %llu expired, %llu deduplicated\n",
+         store.entries(), store.objects(), store.bytes() / 1048576.0, store.capacity() / 1048576.0,
+         (unsigned long long)store.evictions, (unsigned long long)store.expirations,
+         (unsigned long long)store.dedupedWrites);
+  fflush(stdout);
+  for (std::vector<double>& v : stats.latency) v.clear();
+}
+
+static void onSignal(int) {
+  stopping = 1;
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--port 8088] [--store DIR] [--store-mb 1024] [--entries 65536] [--llm-ttl 3600]\n"
+          "       [--workers 32] [--upstream URL | --gemini URL --tts URL] [--record FILE] [--verbose]\n",
+          argv0);
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (a == "--verbose") {
+      config.verbose = true;
+      continue;
+    }
+    if (!v) {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+    if (a == "--port") config.port = atoi(v);
+    else if (a == "--store") config.store = v;
+    else if (a == "--store-mb") config.storeBytes = (uint64_t)atoll(v) << 20;
+    else if (a == "--entries") config.entries = std::max(1024, atoi(v));
+    else if (a == "--llm-ttl") config.llmTtl = atoi(v);
+    else if (a == "--workers") config.workers = std::max(1, atoi(v));
+    else if (a == "--upstream") config.geminiUrl = config.ttsUrl = v;
+    else if (a == "--gemini") config.geminiUrl = v;
+    else if (a == "--tts") config.ttsUrl = v;
+    else if (a == "--record") config.record = v;
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (!parseUrl(config.geminiUrl, routes[ROUTE_GEMINI]) || !parseUrl(config.ttsUrl, routes[ROUTE_TTS])) {
+    fprintf(stderr, "upstream URLs are http:// or https://host[:port]\n");
+    return 2;
+  }
+  routes[ROUTE_GEMINI].ttl = config.llmTtl > 0 ? config.llmTtl : -1;
+  routes[ROUTE_TTS].ttl = 0;  // Audio for a sentence does not go stale
+  if (!store.open(config.store, config.entries, config.storeBytes)) {
+    fprintf(stderr, "cannot open the store in %s: %s\n", config.store.c_str(), strerror(errno));
+    return 1;
+  }
+  if (!config.record.empty() && !(recordFile = fopen(config.record.c_str(), "a"))) {
+    fprintf(stderr, "cannot open %s\n", config.record.c_str());
+    return 1;
+  }
+
+  rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  sslCtx = SSL_CTX_new(TLS_client_method());
+  SSL_CTX_set_default_verify_paths(sslCtx);
+  SSL_CTX_set_verify(sslCtx, SSL_VERIFY_PEER, nullptr);
+
+  epfd = epoll_create1(0);
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.port);
+  if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 512) != 0) {
+    fprintf(stderr, "cannot listen on port %d: %s\n", config.port, strerror(errno));
+    return 1;
+  }
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+  listenWatch = { acceptClients, nullptr };
+  watch(listener, &listenWatch, EPOLLIN, true);
+  doneFd = eventfd(0, EFD_NONBLOCK);
+  doneWatch = { doneEvents, nullptr };
+  watch(doneFd, &doneWatch, EPOLLIN, true);
+  for (int i = 0; i < config.workers; i++) std::thread(workerMain).detach();
+
+  startedAt = nowMs();
+  printf("[proxy] listening on port %d; gemini %s:%d, tts %s:%d; store %s, %zu entries, %.1f of %.0f MB\n", config.port,
+         routes[ROUTE_GEMINI].host.c_str(), routes[ROUTE_GEMINI].port, routes[ROUTE_TTS].host.c_str(),
+         routes[ROUTE_TTS].port, config.store.c_str(), store.entries(), store.bytes() / 1048576.0,
+         store.capacity() / 1048576.0);
+  fflush(stdout);
+  double lastReport = startedAt;
+  epoll_event events[256];
+  while (!stopping) {
+    int n = epoll_wait(epfd, events, 256, 1000);
+    for (int i = 0; i < n; i++) {
+      Watch* w = (Watch*)events[i].data.ptr;
+      w->fn(w->ctx, events[i].events);
+    }
+    double now = nowMs();
+    if (now - lastReport >= REPORT_INTERVAL_MS) {
+      report((now - lastReport) / 1000);
+      lastReport = now;
+    }
+  }
+  report((nowMs() - lastReport) / 1000);
+  if (recordFile) fclose(recordFile);
+  _exit(0);  // Workers may be blocked in a call; nothing of theirs needs finishing
+}
@@ -0,0 +1,486 @@
+// Replays device traffic at tools/api_cache_proxy and reports the hit rate
+// and latency by outcome (X-Cache: hit, shared or miss). The traffic is a
+// recording from the proxy's --record, or one --synthesize makes for a
+// simulated fleet. Requests go out at their recorded times (--speed
+// compresses them) over keep-alive connections, as many at once as the
+// recording has; pointed straight at tools/cache_standin.py instead of the
+// proxy, the same replay gives the latency without a cache.
+//
+// The synthetic fleet asks a catalogue of everyday questions with Zipf
+// popularity, a long tail of questions nobody else asks, and a few bursts
+// where many devices ask the same thing within seconds (an alarm going off
+// across a building). Each turn is a generateContent request and, once the
+// answer is in, a synthesize request for its spoken text; the bodies are
+// built with json_body.h and speech_text.h as the firmware builds them.
+//
+//   g++ -O2 -std=c++17 -I.. -o api_cache_replay api_cache_replay.cpp -lpthread
+//   ./api_cache_replay --synthesize fleet.rec --devices 200 --minutes 10
+//   ./api_cache_replay 127.0.0.1 8088 fleet.rec --speed 10    # Through the proxy
+//   ./api_cache_replay 127.0.0.1 8090 fleet.rec --speed 10    # Straight to the stand-in
+#include "json_body.h"
+#include "speech_text.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char* const GEMINI_PATH = "/v1beta/models/gemini-pro:generateContent?key=FLEET_KEY";
+static const char* const TTS_PATH = "/v1/text:synthesize?key=FLEET_KEY";
+static const char* const ACCEPT = "gzip, deflate";  // ACCEPT_GZIP_RESPONSES
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+struct Request {
+  double atMs;
+  std::string route;
+  std::string path;
+  std::string accept;
+  std::string body;
+};
+
+//----------------------------------------
+// Recordings
+//----------------------------------------
+
+// Lines of "ms<TAB>route<TAB>path<TAB>accept-encoding or -<TAB>body bytes",
+// each followed by the body and a newline
+static bool loadRecording(const char* path, std::vector<Request>& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  char line[4096];
+  while (fgets(line, sizeof(line), f)) {
+    char* fields[5];
+    int n = 0;
+    for (char* p = line; n < 5; n++) {
+      fields[n] = p;
+      p = strpbrk(p, "\t\n");
+      if (!p) break;
+      *p++ = '\0';
+    }
+    if (n < 4) break;
+    Request r;
+    r.atMs = atof(fields[0]);
+    r.route = fields[1];
+    r.path = fields[2];
+    r.accept = strcmp(fields[3], "-") == 0 ? "" : fields[3];
+    r.body.resize(strtoul(fields[4], nullptr, 10));
+    if (fread(&r.body[0], 1, r.body.size(), f) != r.body.size() || fgetc(f) != '\n') break;
+    out.push_back(r);
+  }
+  fclose(f);
+  std::stable_sort(out.begin(), out.end(), [](const Request& a, const Request& b) { return a.atMs < b.atMs; });
+  return !out.empty();
+}
+
+static void writeRequest(FILE* f, const Request& r) {
+  fprintf(f, "%.0f\t%s\t%s\t%s\t%zu\n", r.atMs, r.route.c_str(), r.path.c_str(), r.accept.empty() ? "-" : r.accept.c_str(),
+          r.body.size());
+  fwrite(r.body.data(), 1, r.body.size(), f);
+  fputc('\n', f);
+}
+
+//----------------------------------------
+// Synthetic fleet
+//----------------------------------------
+
+static const char* const EVERYDAY[] = {
+  "what is the weather like today",
+  "will it rain tomorrow",
+  "what time is it",
+  "set a timer for ten minutes",
+  "tell me a joke",
+  "what is the news today",
+  "how many days until christmas",
+  "what should I cook for dinner",
+  "how do I boil an egg",
+  "what is the capital of australia",
+  "how far away is the moon",
+  "who won the football game last night",
+  "what is a good name for a cat",
+  "tell me a fun fact",
+  "how do you say thank you in japanese",
+  "what is the meaning of life",
+  "how tall is mount everest",
+  "what day is it today",
+  "recommend a good book",
+  "how many calories are in a banana",
+};
+static const char* const CITIES[] = {
+  "lisbon", "london", "paris", "berlin", "madrid", "rome", "tokyo", "new york", "sydney", "toronto",
+};
+static const char* const CITY_QUESTIONS[] = {
+  "what is the weather like in %s",
+  "what time is it in %s",
+  "what should I visit in %s",
+};
+
+// Must match answer_for() in tools/cache_standin.py, so replayed TTS
+// bodies are the ones the stand-in's answers would produce
+static std::string answerFor(const std::string& question) {
+  std::string q = question;
+  while (!q.empty() && strchr("?.! ", q.back())) q.pop_back();
+  size_t pos = 0;
+  for (int k = 0; k < 3; k++) {
+    size_t space = q.find(' ', pos);
+    if (space == std::string::npos) break;
+    pos = space + 1;
+  }
+  std::string topic = q.substr(pos);
+  if (topic.empty()) return "Sorry, I did not catch that.";
+  return "Here is what I know about " + topic + ". It depends a little on where you are and when you ask. "
+         "The short version is that most people find it simpler than it sounds. Ask me again if you want more detail.";
+}
+
+static void appendSpoken(void* ctx, const char* text, size_t len, bool) {
+  ((std::string*)ctx)->append(text, len);
+}
+
+static std::string readBody(JsonBody& body) {
+  std::string out(body.size(), '\0');
+  size_t n = body.read((uint8_t*)&out[0], out.size());
+  out.resize(n);
+  return out;
+}
+
+static std::string geminiBody(const std::string& question) {
+  JsonBody payload;
+  payload.raw("{\"contents\":[{\"parts\":[{\"text\":").string(question.c_str(), question.size()).raw("}]}]}");
+  return readBody(payload);
+}
+
+// spokenText() and ttsPayload() in main.cpp
+static std::string ttsBody(const std::string& answer) {
+  std::string spoken;
+  SpeechText normalizer(appendSpoken, &spoken);
+  normalizer.write(answer.c_str(), answer.size());
+  normalizer.finish();
+  JsonBody payload;
+  payload.raw("{\"input\":{\"text\":")
+    .string(spoken.c_str(), spoken.size())
+    .raw("},\"voice\":{\"languageCode\":\"en-US\",\"name\":\"en-US-Wavenet-D\"},\"audioConfig\":{\"audioEncoding\":\"LINEAR16\",\"speakingRate\":1.0,\"pitch\":0.0}}");
+  return readBody(payload);
+}
+
+struct FleetOptions {
+  int devices = 200;
+  double minutes = 10;
+  double turnsPerHour = 20;  // Per device
+  double popular = 0.7;      // Share of turns from the catalogue
+  double zipf = 1.0;
+  int bursts = 2;
+  double burstShare = 0.3;  // Of the devices
+  double answerMs = 1500;   // generateContent to synthesize
+  unsigned seed = 1;
+};
+
+static void addTurn(std::vector<Request>& out, double atMs, const std::string& question, double answerMs) {
+  out.push_back({ atMs, "gemini", GEMINI_PATH, ACCEPT, geminiBody(question) });
+  out.push_back({ atMs + answerMs, "tts", TTS_PATH, ACCEPT, ttsBody(answerFor(question)) });
+}
+
+static std::vector<Request> synthesize(const FleetOptions& o) {
+  std::vector<std::string> catalogue(EVERYDAY, EVERYDAY + sizeof(EVERYDAY) / sizeof(EVERYDAY[0]));
+  for (const char* city : CITIES) {
+    for (const char* format : CITY_QUESTIONS) {
+      char q[96];
+      snprintf(q, sizeof(q), format, city);
+      catalogue.push_back(q);
+    }
+  }
+  std::vector<double> weights;
+  for (size_t rank = 1; rank <= catalogue.size(); rank++) weights.push_back(1.0 / pow((double)rank, o.zipf));
+
+  std::mt19937 rng(o.seed);
+  std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+  std::uniform_real_distribution<double> unit(0, 1);
+  std::exponential_distribution<double> gap(o.turnsPerHour / 3600000.0);
+  double endMs = o.minutes * 60000;
+  std::vector<Request> out;
+  uint32_t unique = 0;
+  for (int d = 0; d < o.devices; d++) {
+    for (double t = gap(rng); t < endMs; t += gap(rng)) {
+      std::string question;
+      if (unit(rng) < o.popular) {
+        question = catalogue[pick(rng)];
+      } else {
+        char q[96];
+        snprintf(q, sizeof(q), "tell me something about topic %u from device %d", ++unique, d);
+        question = q;
+      }
+      addTurn(out, t, question, o.answerMs + unit(rng) * 500);
+    }
+  }
+  for (int b = 0; b < o.bursts; b++) {
+    double t = unit(rng) * endMs * 0.9;
+    const std::string& question = catalogue[(size_t)(unit(rng) * 5)];
+    for (int d = 0; d < o.devices; d++) {
+      if (unit(rng) < o.burstShare) addTurn(out, t + unit(rng) * 5000, question, o.answerMs + unit(rng) * 500);
+    }
+  }
+  std::stable_sort(out.begin(), out.end(), [](const Request& a, const Request& b) { return a.atMs < b.atMs; });
+  return out;
+}
+
+//----------------------------------------
+// Replay
+//----------------------------------------
+
+struct Result {
+  int request;
+  int status;
+  std::string outcome;  // X-Cache, or "direct" without one
+  double ms;            // Request sent to the last body byte
+  double lateMs;        // Behind its recorded time when sent
+  size_t bytes;
+};
+
+static sockaddr_in target;
+static std::vector<Request> requests;
+static std::atomic<size_t> nextRequest(0);
+static std::mutex resultLock;
+static std::vector<Result> results;
+static double speed = 1;
+static double startMs = 0;
+
+static int connectTarget() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  timeval timeout = { 60, 0 };
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (connect(fd, (sockaddr*)&target, sizeof(target)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static bool sendAll(int fd, const std::string& data) {
+  size_t off = 0;
+  while (off < data.size()) {
+    ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    off += n;
+  }
+  return true;
+}
+
+// One response on fd; false if the connection broke. keepAlive says
+// whether fd can take another request.
+static bool readResponse(int fd, std::string& buffer, Result& r, bool& keepAlive) {
+  size_t end;
+  char chunk[65536];
+  while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) return false;
+    buffer.append(chunk, n);
+  }
+  std::string head = buffer.substr(0, end);
+  buffer.erase(0, end + 4);
+  size_t space = head.find(' ');
+  r.status = space == std::string::npos ? 0 : atoi(head.c_str() + space + 1);
+  keepAlive = head.compare(0, 8, "HTTP/1.1") == 0;
+  size_t length = 0;
+  r.outcome = "direct";
+  for (size_t pos = head.find("\r\n"); pos != std::string::npos;) {
+    size_t next = head.find("\r\n", pos + 2);
+    std::string line = head.substr(pos + 2, next == std::string::npos ? std::string::npos : next - pos - 2);
+    pos = next;
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    std::string name = line.substr(0, colon);
+    std::string value = line.substr(line.find_first_not_of(' ', colon + 1));
+    if (strcasecmp(name.c_str(), "Content-Length") == 0) length = strtoul(value.c_str(), nullptr, 10);
+    else if (strcasecmp(name.c_str(), "X-Cache") == 0) r.outcome = value;
+    else if (strcasecmp(name.c_str(), "Connection") == 0) keepAlive = strcasecmp(value.c_str(), "close") != 0;
+  }
+  while (buffer.size() < length) {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0) return false;
+    buffer.append(chunk, n);
+  }
+  r.bytes = length;
+  buffer.erase(0, length);
+  return true;
+}
+
+static void connectionMain() {
+  int fd = -1;
+  std::string buffer;
+  for (;;) {
+    size_t i = nextRequest++;
+    if (i >= requests.size()) break;
+    const Request& q = requests[i];
+    double due = startMs + q.atMs / speed;
+    double wait = due - nowMs();
+    if (wait > 0) usleep((useconds_t)(wait * 1000));
+    std::string head = "POST " + q.path + " HTTP/1.1\r\nHost: " + inet_ntoa(target.sin_addr)
+                       + "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(q.body.size())
+                       + "\r\nConnection: keep-alive\r\n";
+    if (!q.accept.empty()) head += "Accept-Encoding: " + q.accept + "\r\n";
+    head += "\r\n";
+    Result r = { (int)i, 0, "failed", 0, 0, 0 };
+    bool keepAlive = false;
+    for (int attempt = 0; attempt < 2; attempt++) {
+      if (fd < 0) fd = connectTarget();
+      double sent = nowMs();
+      r.lateMs = std::max(0.0, sent - due);
+      if (fd >= 0 && sendAll(fd, head + q.body) && readResponse(fd, buffer, r, keepAlive)) {
+        r.ms = nowMs() - sent;
+        break;
+      }
+      r.outcome = "failed";
+      if (fd >= 0) close(fd);
+      fd = -1;
+      buffer.clear();
+    }
+    if (!keepAlive && fd >= 0) {
+      close(fd);
+      fd = -1;
+      buffer.clear();
+    }
+    std::lock_guard<std::mutex> lock(resultLock);
+    results.push_back(r);
+  }
+  if (fd >= 0) close(fd);
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static void reportRow(const char* route, const char* outcome, const std::vector<double>& ms, size_t total) {
+  if (ms.empty()) return;
+  printf("%-7s %-8s %7zu %6.1f%% %9.1f %9.1f %9.1f\n", route, outcome, ms.size(), 100.0 * ms.size() / total,
+         percentile(ms, 0.5), percentile(ms, 0.9), percentile(ms, 0.99));
+}
+
+static void report(double seconds) {
+  static const char* const outcomes[] = { "hit", "shared", "miss", "pass", "error", "direct", "failed" };
+  static const char* const routeNames[] = { "gemini", "tts", "all" };
+  printf("%zu requests replayed in %.1f s (recorded over %.1f s)\n", results.size(), seconds,
+         requests.empty() ? 0 : requests.back().atMs / 1000);
+  printf("%-7s %-8s %7s %7s %9s %9s %9s\n", "route", "outcome", "count", "share", "p50 ms", "p90 ms", "p99 ms");
+  size_t served = 0, fromCache = 0, bytes = 0, errors = 0;
+  std::vector<double> late;
+  for (const char* route : routeNames) {
+    bool all = strcmp(route, "all") == 0;
+    std::vector<double> every;
+    size_t total = 0;
+    for (const Result& r : results) total += all || requests[r.request].route == route;
+    for (const char* outcome : outcomes) {
+      std::vector<double> ms;
+      for (const Result& r : results) {
+        if ((all || requests[r.request].route == route) && r.outcome == outcome) ms.push_back(r.ms);
+      }
+      reportRow(route, outcome, ms, total);
+      every.insert(every.end(), ms.begin(), ms.end());
+    }
+    reportRow(route, "any", every, total);
+  }
+  for (const Result& r : results) {
+    late.push_back(r.lateMs);
+    bytes += r.bytes;
+    if (r.status != 200) errors++;
+    if (r.outcome == "failed") continue;
+    served++;
+    fromCache += r.outcome == "hit" || r.outcome == "shared";
+  }
+  printf("answered without an upstream call: %.1f%% | %zu non-200 | %.1f MB of responses | sent late p99 %.1f ms\n",
+         served ? 100.0 * fromCache / served : 0.0, errors, bytes / 1048576.0, percentile(late, 0.99));
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s HOST PORT RECORDING [--speed 1] [--connections 256]\n"
+          "       %s --synthesize RECORDING [--devices 200] [--minutes 10] [--turns-per-hour 20] [--popular 0.7]\n"
+          "          [--zipf 1.0] [--bursts 2] [--burst-share 0.3] [--seed 1]\n",
+          argv0, argv0);
+}
+
+int main(int argc, char** argv) {
+  if (argc >= 3 && strcmp(argv[1], "--synthesize") == 0) {
+    FleetOptions o;
+    for (int i = 3; i + 1 < argc; i += 2) {
+      std::string a = argv[i];
+      double v = atof(argv[i + 1]);
+      if (a == "--devices") o.devices = (int)v;
+      else if (a == "--minutes") o.minutes = v;
+      else if (a == "--turns-per-hour") o.turnsPerHour = v;
+      else if (a == "--popular") o.popular = v;
+      else if (a == "--zipf") o.zipf = v;
+      else if (a == "--bursts") o.bursts = (int)v;
+      else if (a == "--burst-share") o.burstShare = v;
+      else if (a == "--seed") o.seed = (unsigned)v;
+      else {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+    std::vector<Request> fleet = synthesize(o);
+    FILE* f = fopen(argv[2], "wb");
+    if (!f) {
+      fprintf(stderr, "cannot write %s\n", argv[2]);
+      return 1;
+    }
+    for (const Request& r : fleet) writeRequest(f, r);
+    fclose(f);
+    printf("%zu requests from %d devices over %.0f minutes written to %s\n", fleet.size(), o.devices, o.minutes,
+           argv[2]);
+    return 0;
+  }
+  if (argc < 4) {
+    usage(argv[0]);
+    return 2;
+  }
+  int connections = 256;
+  for (int i = 4; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--speed") == 0) speed = std::max(0.01, atof(argv[i + 1]));
+    else if (strcmp(argv[i], "--connections") == 0) connections = std::max(1, atoi(argv[i + 1]));
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  target.sin_family = AF_INET;
+  target.sin_port = htons(atoi(argv[2]));
+  if (inet_pton(AF_INET, argv[1], &target.sin_addr) != 1) {
+    fprintf(stderr, "HOST is an IPv4 address\n");
+    return 2;
+  }
+  if (!loadRecording(argv[3], requests)) {
+    fprintf(stderr, "cannot read a recording from %s\n", argv[3]);
+    return 1;
+  }
+  printf("replaying %zu requests at %gx over %d connections\n", requests.size(), speed, connections);
+  fflush(stdout);
+  startMs = nowMs() - requests.front().atMs / speed;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < connections; i++) threads.emplace_back(connectionMain);
+  for (std::thread& t : threads) t.join();
+  report((nowMs() - startMs) / 1000);
+  return 0;
+}
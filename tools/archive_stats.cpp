@@ -0,0 +1,168 @@
+// Reads an interaction archive copied off the SD card and prints the
+// latency distribution of each stage. The index and segments are
+// memory-mapped, so large archives cost no copying.
+//
+//   g++ -O2 -std=c++17 -I.. -o archive_stats archive_stats.cpp
+//   ./archive_stats /media/sd/archive          # Stage latency table
+//   ./archive_stats /media/sd/archive --list   # One line per interaction
+//   ./archive_stats /media/sd/archive --wav 42 out.wav  # Export a recording
+#include "archive_format.h"
+#include "ima_adpcm.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct Mapping {
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+
+  bool open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data = (const uint8_t*)p;
+        size = st.st_size;
+      }
+    }
+    close(fd);
+    return data != nullptr;
+  }
+
+  ~Mapping() {
+    if (data) munmap((void*)data, size);
+  }
+};
+
+static uint16_t percentile(const std::vector<uint16_t>& sorted, double p) {
+  size_t rank = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[rank];
+}
+
+static std::string segmentPath(const std::string& dir, uint32_t segment) {
+  char name[32];
+  snprintf(name, sizeof(name), "/seg%06u.bin", segment);
+  return dir + name;
+}
+
+static void listRecords(const std::string& dir, const std::vector<archive::Record>& records) {
+  uint32_t mapped = UINT32_MAX;
+  Mapping* segment = nullptr;
+  for (const archive::Record& r : records) {
+    if (r.segment != mapped) {
+      delete segment;
+      segment = new Mapping;
+      if (!segment->open(segmentPath(dir, r.segment))) fprintf(stderr, "segment %u missing\n", r.segment);
+      mapped = r.segment;
+    }
+    std::string transcript, response;
+    uint64_t text = (uint64_t)r.offset + r.audioBytes;
+    if (segment->data && text + r.transcriptBytes + r.responseBytes <= segment->size) {
+      transcript.assign((const char*)segment->data + text, r.transcriptBytes);
+      response.assign((const char*)segment->data + text + r.transcriptBytes, r.responseBytes);
+    }
+    printf("#%-6u up %7us  %5.1fs audio  total %5s ms  \"%s\" -> \"%.60s\"\n", r.seq, r.uptimeSec,
+           r.sampleRate ? (double)r.sampleCount / r.sampleRate : 0.0,
+           r.timingsMs[archive::TIMING_TOTAL] == archive::NO_TIMING
+             ? "-" : std::to_string(r.timingsMs[archive::TIMING_TOTAL]).c_str(),
+           transcript.c_str(), response.c_str());
+  }
+  delete segment;
+}
+
+// The audio is stored as WAV 0x11 blocks, so a header is all it takes
+static int exportWav(const std::string& dir, const archive::Record& r, const char* outPath) {
+  Mapping segment;
+  if (!segment.open(segmentPath(dir, r.segment)) || (uint64_t)r.offset + r.audioBytes > segment.size) {
+    fprintf(stderr, "audio of #%u is missing\n", r.seq);
+    return 1;
+  }
+  FILE* out = fopen(outPath, "wb");
+  if (!out) {
+    perror(outPath);
+    return 1;
+  }
+  uint8_t header[ImaAdpcm::WAV_HEADER_BYTES];
+  ImaAdpcm::wavHeader(header, r.sampleRate, r.blockAlign, r.audioBytes, r.sampleCount);
+  fwrite(header, 1, sizeof(header), out);
+  fwrite(segment.data + r.offset, 1, r.audioBytes, out);
+  fclose(out);
+  printf("#%u: %u samples at %u Hz to %s\n", r.seq, r.sampleCount, r.sampleRate, outPath);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <archive dir> [--list | --wav <seq> <out.wav>]\n", argv[0]);
+    return 2;
+  }
+  std::string dir = argv[1];
+  bool list = argc > 2 && strcmp(argv[2], "--list") == 0;
+  bool wav = argc > 4 && strcmp(argv[2], "--wav") == 0;
+
+  Mapping index;
+  if (!index.open(dir + "/index.bin") || index.size < sizeof(archive::IndexHeader)) {
+    fprintf(stderr, "%s/index.bin: cannot read\n", dir.c_str());
+    return 1;
+  }
+  const archive::IndexHeader* h = (const archive::IndexHeader*)index.data;
+  if (h->magic != archive::MAGIC || h->version != archive::VERSION
+      || h->recordSize != sizeof(archive::Record)
+      || index.size < archive::recordOffset(h->slots - 1) + sizeof(archive::Record)) {
+    fprintf(stderr, "%s/index.bin: not a version %u archive\n", dir.c_str(), archive::VERSION);
+    return 1;
+  }
+
+  // Keep records that are intact, still counted by the header and whose
+  // audio has not been rotated away
+  std::vector<archive::Record> records;
+  for (uint32_t slot = 0; slot < h->slots; slot++) {
+    archive::Record r;
+    memcpy(&r, index.data + sizeof(archive::IndexHeader) + slot * sizeof(r), sizeof(r));
+    if (r.seq == 0 || r.seq >= h->nextSeq || r.crc != archive::recordCrc(r)) continue;
+    if (r.segment < h->firstSegment) continue;
+    records.push_back(r);
+  }
+  std::sort(records.begin(), records.end(),
+            [](const archive::Record& a, const archive::Record& b) { return a.seq < b.seq; });
+
+  if (wav) {
+    uint32_t seq = strtoul(argv[3], nullptr, 10);
+    for (const archive::Record& r : records) {
+      if (r.seq == seq) return exportWav(dir, r, argv[4]);
+    }
+    fprintf(stderr, "#%u is not in the archive\n", seq);
+    return 1;
+  }
+
+  printf("%zu interactions (of %u recorded), segments %u-%u, %u rotated away\n", records.size(),
+         h->nextSeq - 1, h->firstSegment, h->lastSegment, h->rotations);
+  if (records.empty()) return 0;
+  if (list) listRecords(dir, records);
+
+  printf("\n%-9s %6s %7s %7s %7s %7s %7s %7s\n", "stage", "count", "min", "p50", "p90", "p99", "max", "mean");
+  for (int t = 0; t < archive::TIMING_RESERVED; t++) {
+    std::vector<uint16_t> ms;
+    for (const archive::Record& r : records) {
+      if (r.timingsMs[t] != archive::NO_TIMING) ms.push_back(r.timingsMs[t]);
+    }
+    if (ms.empty()) continue;
+    std::sort(ms.begin(), ms.end());
+    double sum = 0;
+    for (uint16_t v : ms) sum += v;
+    printf("%-9s %6zu %7u %7u %7u %7u %7u %7.0f\n", archive::timingNames[t], ms.size(), ms.front(),
+           percentile(ms, 0.5), percentile(ms, 0.9), percentile(ms, 0.99), ms.back(), sum / ms.size());
+  }
+  return 0;
+}
@@ -0,0 +1,370 @@
+// Runs the boot sequence of setup() and loop() on the host with simulated
+// init costs, and compares time to READY with the serial boot it
+// replaced. The new boot is mirrored step for step, and each init call
+// is a sleep of its simulated cost:
+// - config, then WiFi.begin() (association runs in the background);
+// - SD (mount, offline queue, archive) and audio in two threads, while
+//   the main thread initializes the display once;
+// - a join on an event group, then initPlayback();
+// - the loop polls for association and falls back to WiFiMulti's scan
+//   once the driver reports the first network missing, or after
+//   WIFI_FAST_CONNECT_MS.
+// Phase durations are recorded with the same bootPhaseBegin/End
+// bookkeeping and the same "[boot]" line as the device.
+//
+// The old boot reset the TFT on every displayStatus(), mounted SD and
+// brought up audio one after the other, and only scanned for WiFi from
+// loop(). It then held "WiFi connected" on screen for 2 s. The archive
+// phase is counted in both boots so that only the sequencing differs.
+//
+// Costs are drawn per boot from the ranges in COSTS. The ranges are
+// estimates from the datasheet delays and typical SD and WiFi timings,
+// not measurements. Simulated time runs SCALE times faster than the
+// wall clock.
+//
+//   g++ -O2 -std=c++17 -I.. -o boot_sim boot_sim.cpp -lpthread
+//   ./boot_sim               # 40 boots of each, 10% with the first network out of range
+//   ./boot_sim 100 0.5       # boots, chance the first network is out of range
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const double SCALE = 20;
+static const uint32_t WIFI_FAST_CONNECT_MS = 5000;  // main.cpp
+static const uint32_t LOOP_MS = 10;                  // One pass of loop() while connecting
+
+//----------------------------------------------------------------------
+// Simulated costs, ms
+//----------------------------------------------------------------------
+
+enum Cost {
+  COST_TFT_INIT,      // Reset pulse (2 x 50 ms), gfx->begin(), fill
+  COST_TFT_REDRAW,    // displayStatus() once the display is up
+  COST_CONFIG,        // EEPROM.begin() and loadConfig()
+  COST_WIFI_BEGIN,    // WiFi.mode() and WiFi.begin() returning
+  COST_ASSOCIATE,     // Association and DHCP, in the background
+  COST_NO_SSID,       // The driver's own scan before it reports WL_NO_SSID_AVAIL
+  COST_SCAN,          // WiFiMulti's scan of all channels
+  COST_SD,            // SPI.begin() and SD.begin()
+  COST_QUEUE,         // Journal replay
+  COST_ARCHIVE,
+  COST_AUDIO,         // Two I2S driver installs
+  COST_PLAYBACK,      // initPlayback(): audio bank off SD, tasks
+  COST_POWER,         // initPower() and initPerf()
+  COST_COUNT
+};
+
+static const struct {
+  const char* name;
+  uint32_t minMs;
+  uint32_t maxMs;
+} COSTS[COST_COUNT] = {
+  { "tft_init", 230, 260 },   { "tft_redraw", 20, 40 },  { "config", 15, 40 },   { "wifi_begin", 3, 10 },
+  { "associate", 800, 2500 }, { "no_ssid", 1200, 2500 }, { "scan", 1500, 2500 }, { "sd", 150, 600 },
+  { "queue", 10, 200 },       { "archive", 10, 80 },     { "audio", 15, 30 },    { "playback", 50, 250 },
+  { "power", 3, 8 },
+};
+
+struct Draw {
+  uint32_t ms[COST_COUNT];
+  bool firstInRange;  // The first configured network answers the direct association
+};
+
+static Draw draw(double outOfRange) {
+  Draw d;
+  for (int i = 0; i < COST_COUNT; i++) d.ms[i] = COSTS[i].minMs + rand() % (COSTS[i].maxMs - COSTS[i].minMs + 1);
+  d.firstInRange = (double)rand() / RAND_MAX >= outOfRange;
+  return d;
+}
+
+//----------------------------------------------------------------------
+// Simulated board
+//----------------------------------------------------------------------
+
+struct Board {
+  std::chrono::steady_clock::time_point powerOn = std::chrono::steady_clock::now();
+
+  uint32_t millis() const {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - powerOn);
+    return (uint32_t)(us.count() * SCALE / 1000);
+  }
+
+  void busy(uint32_t ms) const {
+    std::this_thread::sleep_for(std::chrono::microseconds((long)(ms * 1000 / SCALE)));
+  }
+};
+
+// xEventGroupSetBits / xEventGroupWaitBits(all bits)
+struct EventGroup {
+  std::mutex m;
+  std::condition_variable cv;
+  uint32_t bits = 0;
+
+  void set(uint32_t b) {
+    std::lock_guard<std::mutex> lock(m);
+    bits |= b;
+    cv.notify_all();
+  }
+
+  void waitAll(uint32_t b) {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [&] { return (bits & b) == b; });
+  }
+};
+
+// As in main.cpp
+enum BootPhase {
+  BOOT_CONFIG,
+  BOOT_WIFI_START,
+  BOOT_DISPLAY,
+  BOOT_SD,
+  BOOT_QUEUE,
+  BOOT_ARCHIVE,
+  BOOT_AUDIO,
+  BOOT_PLAYBACK,
+  BOOT_PHASE_COUNT
+};
+static const char* const bootPhaseNames[BOOT_PHASE_COUNT] = { "config", "wifi_start", "display", "sd", "queue", "archive", "audio", "playback" };
+#define BOOT_SD_DONE (1 << 0)
+#define BOOT_AUDIO_DONE (1 << 1)
+
+struct BootTimings {
+  uint32_t startMs[BOOT_PHASE_COUNT];
+  uint32_t durationMs[BOOT_PHASE_COUNT];
+  uint32_t setupMs;
+  uint32_t wifiMs;
+  uint32_t readyMs;
+};
+
+struct Boot {
+  Board board;
+  Draw cost;
+  BootTimings timings = {};
+  EventGroup events;
+  bool displayReady = false;
+  uint32_t connectStartMs = 0;  // wifiConnectStartMs
+  uint32_t associateAt = 0;     // When the direct association completes, 0 for never
+  uint32_t noSsidAt = 0;        // When the driver gives up on it, 0 for never
+
+  void phaseBegin(int phase) { timings.startMs[phase] = board.millis(); }
+  void phaseEnd(int phase) { timings.durationMs[phase] = board.millis() - timings.startMs[phase]; }
+
+  std::string report() const {
+    std::string line = "[boot]";
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) {
+      line += std::string(" ") + bootPhaseNames[i] + "=" + std::to_string(timings.durationMs[i]);
+    }
+    line += " | setup@" + std::to_string(timings.setupMs);
+    line += " wifi@" + std::to_string(timings.wifiMs);
+    line += " ready@" + std::to_string(timings.readyMs);
+    return line;
+  }
+
+  // Serial only until the display is up
+  void displayStatus() {
+    if (displayReady) board.busy(cost.ms[COST_TFT_REDRAW]);
+  }
+
+  void connectToWiFi() {
+    board.busy(cost.ms[COST_WIFI_BEGIN]);
+    displayStatus();
+    connectStartMs = board.millis();
+    if (cost.firstInRange) {
+      associateAt = connectStartMs + cost.ms[COST_ASSOCIATE];
+    } else {
+      noSsidAt = connectStartMs + cost.ms[COST_NO_SSID];
+    }
+  }
+
+  void sdTask() {
+    phaseBegin(BOOT_SD);
+    board.busy(cost.ms[COST_SD]);
+    phaseEnd(BOOT_SD);
+    phaseBegin(BOOT_QUEUE);
+    board.busy(cost.ms[COST_QUEUE]);
+    phaseEnd(BOOT_QUEUE);
+    phaseBegin(BOOT_ARCHIVE);
+    board.busy(cost.ms[COST_ARCHIVE]);
+    phaseEnd(BOOT_ARCHIVE);
+    events.set(BOOT_SD_DONE);
+  }
+
+  void audioTask() {
+    phaseBegin(BOOT_AUDIO);
+    board.busy(cost.ms[COST_AUDIO]);
+    phaseEnd(BOOT_AUDIO);
+    events.set(BOOT_AUDIO_DONE);
+  }
+
+  void setup() {
+    phaseBegin(BOOT_CONFIG);
+    board.busy(cost.ms[COST_CONFIG]);
+    phaseEnd(BOOT_CONFIG);
+
+    phaseBegin(BOOT_WIFI_START);
+    connectToWiFi();
+    phaseEnd(BOOT_WIFI_START);
+
+    std::thread sd(&Boot::sdTask, this);
+    std::thread audio(&Boot::audioTask, this);
+    phaseBegin(BOOT_DISPLAY);
+    board.busy(cost.ms[COST_TFT_INIT]);
+    displayReady = true;
+    phaseEnd(BOOT_DISPLAY);
+    displayStatus();
+
+    events.waitAll(BOOT_SD_DONE | BOOT_AUDIO_DONE);
+    sd.join();  // The tasks delete themselves on the device
+    audio.join();
+
+    phaseBegin(BOOT_PLAYBACK);
+    board.busy(cost.ms[COST_PLAYBACK]);
+    phaseEnd(BOOT_PLAYBACK);
+    board.busy(cost.ms[COST_POWER]);
+    timings.setupMs = board.millis();
+    displayStatus();
+  }
+
+  // STATE_WIFI_CONNECTING, then STATE_WIFI_CONNECTED
+  void loopUntilReady() {
+    for (;;) {
+      uint32_t now = board.millis();
+      bool connected = associateAt && now >= associateAt;
+      bool noSsid = noSsidAt && now >= noSsidAt;
+      if (!connected && (noSsid || now - connectStartMs > WIFI_FAST_CONNECT_MS)) {
+        board.busy(cost.ms[COST_SCAN] + cost.ms[COST_ASSOCIATE]);  // wifiMulti.run() blocks
+        connected = true;
+      }
+      if (connected) break;
+      board.busy(LOOP_MS);
+    }
+    timings.wifiMs = board.millis();
+    displayStatus();
+    displayStatus();  // readyMessage()
+    timings.readyMs = board.millis();
+  }
+};
+
+// The boot before the sequencer, for comparison: every displayStatus()
+// reset and re-initialized the TFT
+static uint32_t oldBoot(const Draw& cost, uint32_t& setupMs) {
+  Board board;
+  auto displayStatus = [&] { board.busy(cost.ms[COST_TFT_INIT]); };
+  board.busy(cost.ms[COST_TFT_INIT]);
+  displayStatus();  // "Booting...Next Sd Init"
+  board.busy(cost.ms[COST_CONFIG]);
+  board.busy(cost.ms[COST_SD]);
+  displayStatus();  // "SD Card Ready"
+  board.busy(cost.ms[COST_QUEUE] + cost.ms[COST_ARCHIVE]);
+  board.busy(cost.ms[COST_AUDIO] + cost.ms[COST_PLAYBACK]);
+  board.busy(cost.ms[COST_WIFI_BEGIN]);
+  displayStatus();  // "Connecting WiFi..."
+  board.busy(cost.ms[COST_POWER]);
+  setupMs = board.millis();
+  board.busy(cost.ms[COST_SCAN] + cost.ms[COST_ASSOCIATE]);  // loop(): wifiMulti.run()
+  displayStatus();  // "WiFi Connected..."
+  board.busy(2000);
+  displayStatus();  // readyMessage()
+  return board.millis();
+}
+
+//----------------------------------------------------------------------
+
+static int failures = 0;
+
+static void fail(int boot, const char* what) {
+  if (failures++ < 10) printf("FAIL boot %d: %s\n", boot, what);
+}
+
+// Checks one boot against the order setup() promises. Durations are only
+// reported: host scheduling jitter makes them too loose to assert.
+static void check(int n, const Boot& b) {
+  const BootTimings& t = b.timings;
+  uint32_t displayEnd = t.startMs[BOOT_DISPLAY] + t.durationMs[BOOT_DISPLAY];
+  if (t.startMs[BOOT_SD] >= displayEnd || t.startMs[BOOT_AUDIO] >= displayEnd) fail(n, "SD and audio did not overlap the display");
+  if (t.startMs[BOOT_WIFI_START] > t.startMs[BOOT_SD]) fail(n, "association started after SD");
+  uint32_t sdEnd = t.startMs[BOOT_ARCHIVE] + t.durationMs[BOOT_ARCHIVE];
+  uint32_t audioEnd = t.startMs[BOOT_AUDIO] + t.durationMs[BOOT_AUDIO];
+  if (t.startMs[BOOT_PLAYBACK] + 1 < std::max(sdEnd, audioEnd)) fail(n, "playback started before SD and audio were up");
+  if (!(t.setupMs <= t.readyMs && t.wifiMs <= t.readyMs)) fail(n, "milestones out of order");
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, double p) {
+  std::sort(v.begin(), v.end());
+  return v[(size_t)(p * (v.size() - 1) + 0.5)];
+}
+
+static double mean(const std::vector<uint32_t>& v) {
+  double sum = 0;
+  for (uint32_t x : v) sum += x;
+  return sum / v.size();
+}
+
+int main(int argc, char** argv) {
+  int boots = argc > 1 ? atoi(argv[1]) : 40;
+  double outOfRange = argc > 2 ? atof(argv[2]) : 0.1;
+  srand(5);
+
+  // Ready times by whether the first network was in range, sequencer then serial
+  std::vector<uint32_t> newSetup, oldSetup, newReady, oldReady;
+  std::vector<uint32_t> ready[2][2];
+  double phaseSum[BOOT_PHASE_COUNT] = {};
+  std::string sample;
+  for (int n = 0; n < boots; n++) {
+    Draw cost = draw(outOfRange);
+
+    Boot boot;
+    boot.cost = cost;
+    boot.setup();
+    boot.loopUntilReady();
+    check(n, boot);
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++) phaseSum[i] += boot.timings.durationMs[i];
+    if (n == 0) sample = boot.report();
+
+    uint32_t setupMs;
+    uint32_t serialReady = oldBoot(cost, setupMs);
+    newSetup.push_back(boot.timings.setupMs);
+    newReady.push_back(boot.timings.readyMs);
+    oldSetup.push_back(setupMs);
+    oldReady.push_back(serialReady);
+    ready[cost.firstInRange][0].push_back(boot.timings.readyMs);
+    ready[cost.firstInRange][1].push_back(serialReady);
+  }
+
+  printf("%d boots, first network out of range in %zu\n", boots, ready[0][0].size());
+  printf("first boot: %s\n", sample.c_str());
+  printf("mean phase:");
+  for (int i = 0; i < BOOT_PHASE_COUNT; i++) printf(" %s=%.0f", bootPhaseNames[i], phaseSum[i] / boots);
+  printf("\n\n%-26s %10s %10s %10s\n", "", "setup", "ready", "ready p95");
+  printf("%-26s %7.0f ms %7.0f ms %7u ms\n", "serial boot", mean(oldSetup), mean(oldReady), percentile(oldReady, 0.95));
+  printf("%-26s %7.0f ms %7.0f ms %7u ms\n", "sequencer", mean(newSetup), mean(newReady), percentile(newReady, 0.95));
+  static const char* const split[2] = { "  first network away", "  first network in range" };
+  for (int near = 1; near >= 0; near--) {
+    if (ready[near][0].empty()) continue;
+    printf("%-26s %10s %7.0f ms %7u ms (serial %.0f ms)\n", split[near], "", mean(ready[near][0]),
+           percentile(ready[near][0], 0.95), mean(ready[near][1]));
+  }
+
+  if (mean(newReady) >= mean(oldReady)) {
+    failures++;
+    printf("FAIL the sequencer is not faster to READY on average\n");
+  }
+  if (!ready[0][0].empty() && mean(ready[0][0]) >= mean(ready[0][1])) {
+    failures++;
+    printf("FAIL the sequencer is not faster to READY with the first network away\n");
+  }
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
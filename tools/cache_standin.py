@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Gemini and TTS APIs behind tools/api_cache_proxy.
+
+Plain HTTP/1.1 with keep-alive on one port, so the proxy can be pointed at
+it with --upstream http://127.0.0.1:8090:
+
+    POST /v1beta/models/<model>:generateContent   an answer made from the
+        question, after --llm-ms
+    POST /v1/text:synthesize                       a LINEAR16 WAV of
+        --ms-per-char per input character, base64 in audioContent, after
+        --tts-ms
+
+Answers depend only on the question, as a cache would need them to. The
+calls each API took are printed every 10 s: with the proxy in front, they
+are its misses; replayed straight at the stand-in, they are all requests.
+
+    ./cache_standin.py --port 8090
+"""
+import argparse
+import base64
+import json
+import math
+import struct
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+TTS_RATE = 24000
+
+_calls = {"gemini": 0, "tts": 0}
+_lock = threading.Lock()
+_speech = {}
+
+
+def answer_for(question):
+    topic = question.rstrip("?.! ").split(" ", 3)[-1] if question else ""
+    if not topic:
+        return "Sorry, I did not catch that."
+    return ("Here is what I know about %s. It depends a little on where you are and when you ask. "
+            "The short version is that most people find it simpler than it sounds. "
+            "Ask me again if you want more detail." % topic)
+
+
+def speech_response(chars, ms_per_char):
+    """A synthesize response for chars characters of text; built once per length."""
+    key = (chars, ms_per_char)
+    if key not in _speech:
+        samples = int(TTS_RATE * chars * ms_per_char / 1000)
+        pcm = bytearray(samples * 2)
+        for i in range(samples):
+            struct.pack_into("<h", pcm, i * 2, int(6000 * math.sin(2 * math.pi * 220 * i / TTS_RATE)))
+        header = (b"RIFF" + struct.pack("<I", 36 + len(pcm)) + b"WAVEfmt " +
+                  struct.pack("<IHHIIHH", 16, 1, 1, TTS_RATE, TTS_RATE * 2, 2, 16) + b"data" +
+                  struct.pack("<I", len(pcm)))
+        audio = base64.b64encode(header + bytes(pcm)).decode()
+        _speech[key] = json.dumps({"audioContent": audio}).encode()
+    return _speech[key]
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers["Content-Length"]))
+        path = self.path.split("?", 1)[0]
+        try:
+            if path.startswith("/v1beta/models/") and path.endswith(":generateContent"):
+                question = json.loads(body)["contents"][0]["parts"][0]["text"]
+                reply = {"candidates": [{"content": {"parts": [{"text": answer_for(question)}], "role": "model"},
+                                         "finishReason": "STOP"}]}
+                data = json.dumps(reply).encode()
+                api, delay = "gemini", self.server.args.llm_ms
+            elif path == "/v1/text:synthesize":
+                text = json.loads(body)["input"]["text"]
+                data = speech_response(len(text), self.server.args.ms_per_char)
+                api, delay = "tts", self.server.args.tts_ms
+            else:
+                self.send_error(404)
+                return
+        except (ValueError, KeyError, IndexError) as e:
+            self.send_error(400, str(e))
+            return
+        with _lock:
+            _calls[api] += 1
+        time.sleep(delay / 1000.0)
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json; charset=UTF-8")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def report():
+    last = dict(_calls)
+    while True:
+        time.sleep(10)
+        with _lock:
+            now = dict(_calls)
+        if now != last:
+            print("calls: gemini %d (+%d), tts %d (+%d)" % (now["gemini"], now["gemini"] - last["gemini"],
+                                                           now["tts"], now["tts"] - last["tts"]), flush=True)
+        last = now
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=8090)
+    parser.add_argument("--llm-ms", type=int, default=1200, help="request to the answer")
+    parser.add_argument("--tts-ms", type=int, default=400, help="request to the audio")
+    parser.add_argument("--ms-per-char", type=int, default=60, help="speech length per input character")
+    args = parser.parse_args()
+    server = ThreadingHTTPServer(("127.0.0.1", args.port), Handler)
+    server.daemon_threads = True
+    server.args = args
+    threading.Thread(target=report, daemon=True).start()
+    print("listening on 127.0.0.1:%d" % args.port, flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
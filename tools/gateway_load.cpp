@@ -0,0 +1,365 @@
+// Load generator for tools/voice_gateway: simulates N devices, each on its
+// own gateway connection through gateway_session.h as the firmware uses it,
+// taking hold-to-talk turns with think time between them, and reports the
+// turn latency (TURN_END to the first answer audio) at each device count.
+// Microphone audio is paced in real time, 100 ms chunks, and the next turn
+// waits for the answer to have "played". One thread polls every socket.
+//
+//   g++ -O2 -std=c++17 -I.. -o gateway_load gateway_load.cpp
+//   ./gateway_load 127.0.0.1 7700                          # 1..400 devices, 30 s each
+//   ./gateway_load 127.0.0.1 7700 --devices 50,100 --seconds 60 --pcm
+//   ./gateway_load 127.0.0.1 7700 --pid $(pgrep voice_gateway)   # Adds gateway CPU
+#include "gateway_protocol.h"
+#include "gateway_session.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+static const uint32_t RATE = 16000;
+static const uint32_t CHUNK_MS = 100;
+static const double DRAIN_MS = 30000;  // For turns still running when a level ends
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int32_t sockWrite(void* io, const uint8_t* data, uint32_t len) {
+  int fd = *(int*)io;
+  uint32_t sent = 0;
+  while (sent < len) {
+    ssize_t n = ::send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    sent += n;
+  }
+  return len;
+}
+
+static int32_t sockRead(void* io, uint8_t* buf, uint32_t len) {
+  ssize_t n = ::recv(*(int*)io, buf, len, MSG_DONTWAIT);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+  return n == 0 ? -1 : n;
+}
+
+enum State { IDLE, TALKING, WAITING, DONE };
+
+struct Device {
+  int fd = -1;
+  GatewaySession* session = nullptr;
+  alignas(4) uint8_t rx[GatewaySession::RX_BUFFER_BYTES];
+  State state = IDLE;
+  bool closed = false;
+  double nextTurnAt = 0;  // IDLE: when to start talking
+  double talkStart = 0;
+  size_t chunksSent = 0;
+  double endOfSpeech = 0;
+  double firstAudio = 0;
+  size_t answerSamples = 0;
+  uint32_t answerRate = 0;
+};
+
+struct Level {
+  int devices = 0;
+  int connected = 0;
+  std::vector<double> latencies;
+  std::vector<double> stt, llm, tts;
+  int failed = 0;
+  int statuses[8] = {};
+  double bytesUp = 0;
+  double bytesDown = 0;
+  double cpuSeconds = -1;
+  double seconds = 0;
+};
+
+static struct {
+  std::vector<int16_t> speech;
+  double speechMs = 2000;
+  double thinkMs = 4000;
+  bool pcm = false;
+  Level* level = nullptr;
+  std::string lastError;
+} run;
+
+static void finishTurn(Device* d, bool failed) {
+  if (d->state != WAITING && d->state != TALKING) return;
+  if (failed) run.level->failed++;
+  d->state = d->closed ? DONE : IDLE;
+  // Next turn once the answer has played, and the user has thought
+  double played = d->firstAudio && d->answerRate ? d->firstAudio + d->answerSamples * 1000.0 / d->answerRate : 0;
+  d->nextTurnAt = std::max(nowMs(), played) + run.thinkMs * (0.5 + (double)random() / RAND_MAX);
+}
+
+static void onAudio(void* ctx, const int16_t*, size_t count, uint32_t sampleRate) {
+  Device* d = (Device*)ctx;
+  if (d->state != WAITING) return;
+  if (d->answerSamples == 0) {
+    d->firstAudio = nowMs();
+    run.level->latencies.push_back(d->firstAudio - d->endOfSpeech);
+  }
+  d->answerSamples += count;
+  d->answerRate = sampleRate;
+}
+
+static void onEvent(void* ctx, GatewaySession::Event event) {
+  Device* d = (Device*)ctx;
+  switch (event) {
+    case GatewaySession::EVENT_TURN_DONE: {
+      const gateway::TurnDone& t = d->session->turnDone();
+      if (t.status < sizeof(run.level->statuses) / sizeof(run.level->statuses[0])) run.level->statuses[t.status]++;
+      bool ok = t.status == gateway::STATUS_OK && d->answerSamples > 0;
+      if (ok) {
+        run.level->stt.push_back(t.sttMs);
+        run.level->llm.push_back(t.llmMs);
+        run.level->tts.push_back(t.ttsMs);
+      }
+      finishTurn(d, !ok);
+      break;
+    }
+    case GatewaySession::EVENT_ERROR:
+      run.lastError.assign(d->session->text(), d->session->textLength());
+      break;
+    case GatewaySession::EVENT_CLOSED:
+      d->closed = true;
+      finishTurn(d, true);
+      d->state = DONE;
+      break;
+    default:
+      break;
+  }
+}
+
+static int connectTo(const char* host, int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, host, &addr.sin_addr);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+// utime + stime of a process, in seconds
+static double processCpu(int pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE* f = fopen(path, "r");
+  if (!f) return -1;
+  char buf[1024];
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = '\0';
+  const char* p = strrchr(buf, ')');  // The name may hold spaces
+  unsigned long utime = 0, stime = 0;
+  if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void pollDevices(std::vector<Device*>& devices, std::vector<pollfd>& fds, int timeoutMs) {
+  fds.clear();
+  for (Device* d : devices) fds.push_back({ d->closed ? -1 : d->fd, POLLIN, 0 });
+  if (poll(fds.data(), fds.size(), timeoutMs) <= 0) return;
+  for (size_t i = 0; i < fds.size(); i++) {
+    if (fds[i].revents) devices[i]->session->poll();
+  }
+}
+
+// One device count: connect, take turns for seconds, let the last turns finish
+static void runLevel(const char* host, int port, Level& level, double seconds, int pid) {
+  run.level = &level;
+  std::vector<Device*> devices;
+  std::vector<pollfd> fds;
+  for (int i = 0; i < level.devices; i++) {
+    Device* d = new Device();
+    d->fd = connectTo(host, port);
+    if (d->fd < 0) {
+      delete d;
+      continue;
+    }
+    GatewaySession::Handler handler = { onAudio, onEvent, d };
+    d->session = new GatewaySession(d->rx, sockRead, sockWrite, &d->fd, handler);
+    char id[24];
+    snprintf(id, sizeof(id), "load-%d", i);
+    d->session->hello(id, RATE, run.pcm ? gateway::CODEC_PCM16 : gateway::CODEC_IMA_ADPCM,
+                      run.pcm ? gateway::CODEC_PCM16 : gateway::CODEC_IMA_ADPCM);
+    devices.push_back(d);
+  }
+  double readyBy = nowMs() + 5000;
+  while (nowMs() < readyBy) {
+    pollDevices(devices, fds, 10);
+    bool all = true;
+    for (Device* d : devices) all = all && (d->session->ready() || d->closed);
+    if (all) break;
+  }
+  for (Device* d : devices) level.connected += d->session->ready() && !d->closed;
+
+  // Spread the first turns over one turn cycle so they do not all land at once
+  double start = nowMs();
+  double cycle = run.speechMs + run.thinkMs;
+  for (Device* d : devices) {
+    d->state = d->session->ready() && !d->closed ? IDLE : DONE;
+    d->nextTurnAt = start + cycle * random() / RAND_MAX;
+  }
+  double cpuStart = pid ? processCpu(pid) : -1;
+  double stopTurns = start + seconds * 1000;
+  size_t chunk = RATE * CHUNK_MS / 1000;
+  size_t chunks = (size_t)(run.speechMs / CHUNK_MS);
+  for (;;) {
+    pollDevices(devices, fds, 5);
+    double now = nowMs();
+    bool busy = false;
+    for (Device* d : devices) {
+      if (d->state == IDLE && now >= d->nextTurnAt && now < stopTurns) {
+        d->state = TALKING;
+        d->talkStart = now;
+        d->chunksSent = 0;
+        d->firstAudio = 0;
+        d->answerSamples = 0;
+        d->session->turnStart();
+      }
+      // Chunks go out on the capture clock, catching up after a slow poll
+      while (d->state == TALKING && d->chunksSent < chunks && now >= d->talkStart + (d->chunksSent + 1) * CHUNK_MS) {
+        size_t offset = (d->chunksSent * chunk) % (run.speech.size() - chunk);
+        d->session->audio(run.speech.data() + offset, chunk);
+        d->chunksSent++;
+      }
+      if (d->state == TALKING && d->chunksSent == chunks) {
+        d->session->turnEnd();
+        d->endOfSpeech = nowMs();
+        d->state = WAITING;
+      }
+      busy = busy || d->state == TALKING || d->state == WAITING;
+    }
+    if (now >= stopTurns && (!busy || now >= stopTurns + DRAIN_MS)) break;
+  }
+  level.seconds = (nowMs() - start) / 1000;
+  if (pid && cpuStart >= 0) level.cpuSeconds = processCpu(pid) - cpuStart;
+  for (Device* d : devices) {
+    if (d->state == TALKING || d->state == WAITING) level.failed++;
+    level.bytesUp += d->session->bytesSent();
+    level.bytesDown += d->session->bytesReceived();
+    close(d->fd);
+    delete d->session;
+    delete d;
+  }
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  size_t i = (size_t)(p * (v.size() - 1) + 0.5);
+  return v[i];
+}
+
+static void speechLikeTone(std::vector<int16_t>& pcm, double ms) {
+  size_t n = (size_t)(RATE * ms / 1000) + RATE;  // A second spare, so chunks can start anywhere
+  pcm.resize(n);
+  double phase = 0;
+  for (size_t i = 0; i < n; i++) {
+    double t = (double)i / RATE;
+    double f = 140 + 60 * sin(2 * M_PI * 3 * t);                      // Wandering pitch
+    double envelope = 0.55 + 0.45 * sin(2 * M_PI * 4 * t);            // Syllables
+    phase += 2 * M_PI * f / RATE;
+    double v = sin(phase) + 0.4 * sin(2 * phase) + 0.2 * sin(3 * phase);
+    pcm[i] = (int16_t)(6000 * envelope * v + (random() % 200 - 100));
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "usage: %s <host> <port> [--devices 1,25,...] [--seconds 30] [--speech-ms 2000] [--think-ms 4000]\n"
+            "       [--pcm] [--pid <gateway pid>]\n",
+            argv[0]);
+    return 2;
+  }
+  const char* host = argv[1];
+  int port = atoi(argv[2]);
+  std::vector<int> counts = { 1, 25, 50, 100, 200, 400 };
+  double seconds = 30;
+  int pid = 0;
+  for (int i = 3; i < argc; i++) {
+    std::string a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : "";
+    if (a == "--pcm") {
+      run.pcm = true;
+      continue;
+    }
+    i++;
+    if (a == "--devices") {
+      counts.clear();
+      for (const char* p = v; *p; p = strchr(p, ',') ? strchr(p, ',') + 1 : p + strlen(p)) counts.push_back(atoi(p));
+    } else if (a == "--seconds") {
+      seconds = atof(v);
+    } else if (a == "--speech-ms") {
+      run.speechMs = std::max(200.0, atof(v));
+    } else if (a == "--think-ms") {
+      run.thinkMs = atof(v);
+    } else if (a == "--pid") {
+      pid = atoi(v);
+    } else {
+      fprintf(stderr, "unknown option %s\n", a.c_str());
+      return 2;
+    }
+  }
+
+  rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+  srandom(1);
+  speechLikeTone(run.speech, run.speechMs);
+
+  printf("%s uplink and downlink, %.0f ms of speech per turn, %.0f ms mean think time, %.0f s per level\n",
+         run.pcm ? "PCM16" : "IMA ADPCM", run.speechMs, run.thinkMs, seconds);
+  printf("latency: end of speech (TURN_END) to the first answer audio; stages: gateway medians\n\n");
+  printf("devices  turns  failed  turns/s     p50     p90     p99     max   stt  llm  tts  up KB/turn  down KB/turn%s\n",
+         pid ? "  gateway CPU" : "");
+  for (int count : counts) {
+    Level level;
+    level.devices = count;
+    runLevel(host, port, level, seconds, pid);
+    size_t turns = level.latencies.size();
+    double perTurn = turns ? 1.0 / turns / 1024 : 0;
+    printf("%4d/%-4d %5zu  %6d  %7.1f  %6.0f  %6.0f  %6.0f  %6.0f  %4.0f %4.0f %4.0f  %10.1f  %12.1f",
+           level.connected, count, turns, level.failed, turns / level.seconds, percentile(level.latencies, 0.5),
+           percentile(level.latencies, 0.9), percentile(level.latencies, 0.99), percentile(level.latencies, 1),
+           percentile(level.stt, 0.5), percentile(level.llm, 0.5), percentile(level.tts, 0.5),
+           level.bytesUp * perTurn, level.bytesDown * perTurn);
+    if (level.cpuSeconds >= 0) printf("  %10.0f%%", 100 * level.cpuSeconds / level.seconds);
+    printf("\n");
+    fflush(stdout);
+    if (level.failed) {
+      printf("         statuses:");
+      for (int s = 0; s <= gateway::STATUS_CANCELLED; s++) {
+        if (level.statuses[s]) printf(" %s %d", gateway::statusNames[s], level.statuses[s]);
+      }
+      printf("%s%s\n", run.lastError.empty() ? "" : "; last error: ", run.lastError.c_str());
+      run.lastError.clear();
+    }
+    sleep(1);  // Lets the gateway close the level's connections
+  }
+  return 0;
+}
@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+"""Local stand-in for the three Google APIs behind tools/voice_gateway.
+
+Speaks HTTP/2 over plain TCP (prior knowledge, no TLS) on one port, so the
+gateway can be pointed at it with --upstream http://127.0.0.1:8443:
+
+  /google.cloud.speech.v1.Speech/StreamingRecognize   gRPC; the final
+      result follows the end of the request stream after --stt-ms
+  /v1beta/models/<model>:generateContent              a scripted markdown
+      answer after --llm-ms
+  /v1/text:synthesize                                 a LINEAR16 WAV of
+      --ms-per-char per input character, after --tts-ms
+
+Many streams share each connection, as they do on the real services, and
+responses respect the client's flow-control windows. Each connection is
+served by its own process, so a gateway's pool of connections gets as many
+cores.
+
+    pip install h2
+    ./gateway_standin.py --port 8443
+"""
+import argparse
+import base64
+import json
+import math
+import os
+import signal
+import socket
+import struct
+import time
+
+import h2.config
+import h2.connection
+import h2.events
+import h2.exceptions
+import h2.settings
+
+STT_PATH = "/google.cloud.speech.v1.Speech/StreamingRecognize"
+TTS_PATH = "/v1/text:synthesize"
+TRANSCRIPT = "what is the weather like in Lisbon tomorrow morning"
+ANSWER = ("**Tomorrow morning** in Lisbon looks sunny, around 18°C. "
+          "A light breeze comes in from the northwest. "
+          "It should warm up to 24°C by the afternoon.")
+TTS_RATE = 24000
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+
+def field_bytes(number, data):
+    return varint(number << 3 | 2) + varint(len(data)) + data
+
+
+def final_result(transcript):
+    alternative = field_bytes(1, transcript.encode()) + varint(2 << 3 | 5) + struct.pack("<f", 0.93)
+    result = field_bytes(1, alternative) + varint(2 << 3) + varint(1)
+    message = field_bytes(2, result)
+    return b"\0" + struct.pack(">I", len(message)) + message
+
+
+def audio_bytes(body):
+    """Bytes of audio_content in a run of framed StreamingRecognizeRequests."""
+    total, pos = 0, 0
+    while pos + 5 <= len(body):
+        length = struct.unpack(">I", body[pos + 1:pos + 5])[0]
+        message = body[pos + 5:pos + 5 + length]
+        pos += 5 + length
+        if message[:1] == b"\x12":  # audio_content = 2, length-delimited
+            n, shift, i = 0, 0, 1
+            while True:
+                b = message[i]
+                n |= (b & 0x7F) << shift
+                i += 1
+                if not b & 0x80:
+                    break
+                shift += 7
+            total += n
+    return total
+
+
+_speech = {}
+
+
+def speech_response(chars, ms_per_char):
+    """A synthesize response for chars characters of text; cached by length."""
+    key = (chars, ms_per_char)
+    if key not in _speech:
+        samples = int(TTS_RATE * chars * ms_per_char / 1000)
+        pcm = bytearray(samples * 2)
+        for i in range(samples):
+            struct.pack_into("<h", pcm, i * 2, int(6000 * math.sin(2 * math.pi * 220 * i / TTS_RATE)))
+        header = (b"RIFF" + struct.pack("<I", 36 + len(pcm)) + b"WAVEfmt " +
+                  struct.pack("<IHHIIHH", 16, 1, 1, TTS_RATE, TTS_RATE * 2, 2, 16) + b"data" +
+                  struct.pack("<I", len(pcm)))
+        audio = base64.b64encode(header + bytes(pcm)).decode()
+        _speech[key] = json.dumps({"audioContent": audio}).encode()
+    return _speech[key]
+
+
+class Stream:
+    def __init__(self, stream_id, headers):
+        self.id = stream_id
+        self.path = headers.get(":path", "")
+        self.key = headers.get("x-goog-api-key")
+        self.body = bytearray()
+        self.reply_at = None
+        self.out = b""
+        self.trailers = None
+        self.sending = False
+
+
+def reply(conn, stream, status, body, content_type, trailers=None):
+    conn.send_headers(stream.id, [(":status", str(status)), ("content-type", content_type)])
+    stream.out = body
+    stream.trailers = trailers
+    stream.sending = True
+
+
+def flush(conn, stream):
+    """Sends as much of the response as the windows allow."""
+    while stream.out:
+        window = min(conn.local_flow_control_window(stream.id), conn.max_outbound_frame_size)
+        if window <= 0:
+            return
+        chunk, stream.out = stream.out[:window], stream.out[window:]
+        conn.send_data(stream.id, chunk, end_stream=not stream.out and stream.trailers is None)
+    if stream.trailers is not None:
+        conn.send_headers(stream.id, stream.trailers, end_stream=True)
+    stream.sending = False
+
+
+def respond(conn, stream, args):
+    if not stream.key:
+        reply(conn, stream, 403, b'{"error":{"code":403,"message":"API key missing"}}', "application/json")
+    elif stream.path == STT_PATH:
+        seconds = audio_bytes(bytes(stream.body)) / 2.0 / 16000
+        text = TRANSCRIPT if seconds >= 0.3 else ""
+        reply(conn, stream, 200, final_result(text) if text else b"", "application/grpc", [("grpc-status", "0")])
+    elif stream.path.endswith(":generateContent"):
+        query = json.loads(stream.body)["contents"][0]["parts"][0]["text"]
+        answer = ANSWER if query else "Sorry, I did not catch that."
+        body = {"candidates": [{"content": {"parts": [{"text": answer}], "role": "model"}, "finishReason": "STOP"}]}
+        reply(conn, stream, 200, json.dumps(body).encode(), "application/json")
+    elif stream.path == TTS_PATH:
+        text = json.loads(stream.body)["input"]["text"]
+        reply(conn, stream, 200, speech_response(len(text), args.ms_per_char), "application/json")
+    else:
+        reply(conn, stream, 404, b'{"error":{"code":404,"message":"not found"}}', "application/json")
+
+
+def delay_for(stream, args):
+    if stream.path == STT_PATH:
+        return args.stt_ms
+    if stream.path == TTS_PATH:
+        return args.tts_ms
+    return args.llm_ms
+
+
+def serve(sock, args):
+    conn = h2.connection.H2Connection(h2.config.H2Configuration(client_side=False, header_encoding="utf-8"))
+    conn.initiate_connection()
+    conn.update_settings({h2.settings.SettingCodes.MAX_CONCURRENT_STREAMS: 100})
+    sock.sendall(conn.data_to_send())
+    streams = {}
+    served = 0
+    while True:
+        now = time.monotonic()
+        due = [s.reply_at for s in streams.values() if s.reply_at]
+        sock.settimeout(max(0.0005, min(due) - now) if due else 0.05)
+        try:
+            data = sock.recv(262144)
+            if not data:
+                break
+        except socket.timeout:
+            data = None
+        except ConnectionError:
+            break
+        try:
+            events = conn.receive_data(data) if data else []
+        except h2.exceptions.ProtocolError as e:
+            print("protocol error: %s" % e)
+            break
+        for event in events:
+            if isinstance(event, h2.events.RequestReceived):
+                streams[event.stream_id] = Stream(event.stream_id, dict(event.headers))
+            elif isinstance(event, h2.events.DataReceived):
+                conn.acknowledge_received_data(event.flow_controlled_length, event.stream_id)
+                stream = streams.get(event.stream_id)
+                if stream:
+                    stream.body += event.data
+            elif isinstance(event, h2.events.StreamEnded):
+                stream = streams.get(event.stream_id)
+                if stream:
+                    stream.reply_at = time.monotonic() + delay_for(stream, args) / 1000.0
+            elif isinstance(event, h2.events.StreamReset):
+                streams.pop(event.stream_id, None)
+            elif isinstance(event, h2.events.ConnectionTerminated):
+                sock.sendall(conn.data_to_send())
+                return
+
+        now = time.monotonic()
+        for stream in list(streams.values()):
+            try:
+                if stream.reply_at and now >= stream.reply_at:
+                    stream.reply_at = None
+                    respond(conn, stream, args)
+                    served += 1
+                if stream.sending:
+                    flush(conn, stream)
+                    if not stream.sending:
+                        del streams[stream.id]
+            except h2.exceptions.StreamClosedError:
+                del streams[stream.id]
+        out = conn.data_to_send()
+        if out:
+            try:
+                sock.settimeout(None)  # The timeout above is for reads; a busy gateway may take a while
+                sock.sendall(out)
+            except ConnectionError:
+                break
+    print("connection closed after %d responses" % served, flush=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--stt-ms", type=int, default=150, help="end of audio to the final result")
+    parser.add_argument("--llm-ms", type=int, default=600, help="request to the answer")
+    parser.add_argument("--tts-ms", type=int, default=150, help="request to the audio")
+    parser.add_argument("--ms-per-char", type=int, default=60, help="speech length per input character")
+    args = parser.parse_args()
+
+    signal.signal(signal.SIGCHLD, signal.SIG_IGN)  # Connection processes are not waited for
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind(("127.0.0.1", args.port))
+    listener.listen(16)
+    print("listening on 127.0.0.1:%d" % args.port, flush=True)
+    while True:
+        sock, _ = listener.accept()
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        if os.fork() == 0:
+            listener.close()
+            serve(sock, args)
+            os._exit(0)
+        sock.close()
+
+
+if __name__ == "__main__":
+    main()
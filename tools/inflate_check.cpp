@@ -0,0 +1,208 @@
+// Compresses API response bodies with zlib the way servers send them
+// (gzip, zlib and raw deflate, at zlib's default level) and decodes them
+// through inflate.h the way HttpBodyStream does: 512-byte socket reads in,
+// 512-byte decoded pieces out, one 32 KB window. Checks that every body
+// comes back byte for byte and that a truncated or corrupted body reports
+// failed(), then reports the downlink bytes saved and the inflate CPU cost.
+//
+// The built-in bodies are shaped like the Gemini and TTS responses (see
+// tools/cache_standin.py). Recorded response bodies named on the command
+// line, uncompressed, replace them.
+//
+//   g++ -O2 -std=c++17 -I.. -o inflate_check inflate_check.cpp -lz
+//   ./inflate_check                          # built-in responses
+//   ./inflate_check gemini.json tts.json     # recorded responses
+#include "inflate.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+static const size_t SOCKET_READ = 512;  // HttpBodyStream::raw
+static const size_t OUT_PIECE = 512;    // HttpBodyStream::out
+
+static double cpuMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+//----------------------------------------------------------------------
+// Bodies
+//----------------------------------------------------------------------
+
+static std::string geminiResponse() {
+  std::string text;
+  while (text.size() < 1500) {
+    text += "Here is what I know about tides. The moon's gravity pulls the oceans into a bulge, "
+            "and the Earth turns beneath it, so most coasts see two high tides a day.\\n\\n"
+            "* **Spring tides** come with the full and new moon.\\n* **Neap tides** come in between.\\n";
+  }
+  return "{\n  \"candidates\": [\n    {\n      \"content\": {\n        \"parts\": [\n          {\n"
+         "            \"text\": \"" + text + "\"\n          }\n        ],\n        \"role\": \"model\"\n      },\n"
+         "      \"finishReason\": \"STOP\",\n      \"avgLogprobs\": -0.21\n    }\n  ],\n"
+         "  \"usageMetadata\": {\n    \"promptTokenCount\": 12,\n    \"candidatesTokenCount\": 356,\n"
+         "    \"totalTokenCount\": 368\n  },\n  \"modelVersion\": \"gemini-1.5-flash\"\n}\n";
+}
+
+// A LINEAR16 WAV of speech-like audio, base64 in audioContent
+static std::string ttsResponse() {
+  const uint32_t rate = 24000;
+  std::vector<uint8_t> wav(44 + rate * 3 * 2);  // 3 s
+  for (size_t i = 0; i < rate * 3; i++) {
+    double t = (double)i / rate;
+    double v = 0.3 * sin(2 * M_PI * 180 * t) + 0.15 * sin(2 * M_PI * 720 * t) + 0.05 * sin(2 * M_PI * 2100 * t);
+    int16_t s = (int16_t)(12000 * v * (0.5 + 0.5 * sin(2 * M_PI * 3 * t)));
+    wav[44 + i * 2] = (uint8_t)s;
+    wav[45 + i * 2] = (uint8_t)(s >> 8);
+  }
+  memcpy(&wav[0], "RIFF", 4);
+  memcpy(&wav[8], "WAVEfmt ", 8);
+
+  static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out = "{\n  \"audioContent\": \"";
+  for (size_t i = 0; i < wav.size(); i += 3) {
+    uint32_t n = wav[i] << 16 | (i + 1 < wav.size() ? wav[i + 1] << 8 : 0) | (i + 2 < wav.size() ? wav[i + 2] : 0);
+    out += b64[n >> 18 & 63];
+    out += b64[n >> 12 & 63];
+    out += i + 1 < wav.size() ? b64[n >> 6 & 63] : '=';
+    out += i + 2 < wav.size() ? b64[n & 63] : '=';
+  }
+  return out + "\"\n}\n";
+}
+
+static bool readFile(const char* path, std::string& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Compression and decoding
+//----------------------------------------------------------------------
+
+static const char* const formatNames[] = { "deflate", "zlib", "gzip" };
+
+static std::vector<uint8_t> compress(const std::string& body, Inflater::Format format) {
+  static const int windowBits[] = { -15, 15, 15 + 16 };
+  z_stream z = {};
+  deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits[format], 8, Z_DEFAULT_STRATEGY);
+  std::vector<uint8_t> out(deflateBound(&z, body.size()));
+  z.next_in = (Bytef*)body.data();
+  z.avail_in = body.size();
+  z.next_out = out.data();
+  z.avail_out = out.size();
+  deflate(&z, Z_FINISH);
+  out.resize(z.total_out);
+  deflateEnd(&z);
+  return out;
+}
+
+// The socket side of HttpBodyStream: bytes arrive in reads of SOCKET_READ
+struct Wire {
+  const std::vector<uint8_t>* data;
+  size_t pos;
+  uint8_t raw[SOCKET_READ];
+  size_t rawLen;
+  size_t rawPos;
+};
+
+static int readRawByte(void* ctx) {
+  Wire* w = (Wire*)ctx;
+  if (w->rawPos >= w->rawLen) {
+    size_t n = w->data->size() - w->pos < SOCKET_READ ? w->data->size() - w->pos : SOCKET_READ;
+    if (n == 0) return -1;
+    memcpy(w->raw, w->data->data() + w->pos, n);
+    w->pos += n;
+    w->rawLen = n;
+    w->rawPos = 0;
+  }
+  return w->raw[w->rawPos++];
+}
+
+static uint8_t window[Inflater::WINDOW_SIZE];
+
+// Returns false if the inflater reported the body as undecodable
+static bool inflateBody(const std::vector<uint8_t>& wire, Inflater::Format format, std::string& out) {
+  Wire w = { &wire, 0, {}, 0, 0 };
+  Inflater inflater(window, readRawByte, &w);
+  inflater.reset(format);
+  out.clear();
+  uint8_t piece[OUT_PIECE];
+  size_t n;
+  while ((n = inflater.read(piece, sizeof(piece))) > 0) out.append((const char*)piece, n);
+  return !inflater.failed();
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> names;
+  std::vector<std::string> bodies;
+  for (int i = 1; i < argc; i++) {
+    std::string body;
+    if (!readFile(argv[i], body)) {
+      perror(argv[i]);
+      return 1;
+    }
+    names.push_back(argv[i]);
+    bodies.push_back(body);
+  }
+  if (bodies.empty()) {
+    names = { "gemini", "tts" };
+    bodies = { geminiResponse(), ttsResponse() };
+  }
+
+  int failures = 0;
+  printf("%-10s %-8s %10s %10s %7s %10s %9s\n", "body", "format", "decoded", "wire", "saved", "inflate", "speed");
+  for (size_t b = 0; b < bodies.size(); b++) {
+    const std::string& body = bodies[b];
+    for (int f = Inflater::FORMAT_RAW; f <= Inflater::FORMAT_GZIP; f++) {
+      Inflater::Format format = (Inflater::Format)f;
+      std::vector<uint8_t> wire = compress(body, format);
+
+      std::string out;
+      if (!inflateBody(wire, format, out) || out != body) {
+        printf("FAIL %s %s: did not round-trip\n", names[b].c_str(), formatNames[f]);
+        failures++;
+        continue;
+      }
+
+      // A body cut short or damaged in transit must fail, not end quietly
+      std::vector<uint8_t> cut(wire.begin(), wire.begin() + wire.size() / 2);
+      std::vector<uint8_t> damaged = wire;
+      damaged[damaged.size() - 1] ^= 0x55;  // Trailer, or the last block for raw deflate
+      bool damageCaught = !inflateBody(damaged, format, out) || out != body;
+      if (inflateBody(cut, format, out) || !damageCaught) {
+        printf("FAIL %s %s: a truncated or corrupt body was not reported\n", names[b].c_str(), formatNames[f]);
+        failures++;
+      }
+
+      int passes = 0;
+      double start = cpuMicros();
+      double elapsed = 0;
+      while (elapsed < 200000) {
+        inflateBody(wire, format, out);
+        passes++;
+        elapsed = cpuMicros() - start;
+      }
+      double us = elapsed / passes;
+      printf("%-10s %-8s %10zu %10zu %6.0f%% %8.0f us %5.0f MB/s\n", names[b].c_str(), formatNames[f], body.size(),
+             wire.size(), 100.0 * (body.size() - wire.size()) / body.size(), us, body.size() / us);
+    }
+  }
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
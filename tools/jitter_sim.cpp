@@ -0,0 +1,284 @@
+// Replays TTS response arrival traces through jitter_buffer.h the way
+// streamSpeech() and the playback task use it, one simulated millisecond
+// at a time, and reports the latency against underrun tradeoff for a
+// range of allowed underrun probabilities.
+//
+// Producer: each trace line is one network read of the base64 response
+// body. Its bytes are decoded to 24 kHz PCM and pushed in batches of at
+// most 255 samples, as streamSpeech() does, holding back what does not
+// fit as pushSpeech() does. Playback starts once prefilled() is true.
+// Consumer: fetchSample() pulls PLAYBACK_BLOCK_SAMPLES at a time and
+// plays them at the stream rate, or at rateQ16() while stretching.
+// Every stream is checked to play back complete and in order.
+//
+// The estimator learns across streams, so each probability runs the
+// whole trace from a fresh buffer. The built-in traces are generated:
+// a fast link, ordinary WiFi with short stalls, and a busy network with
+// longer ones. A recorded trace replaces them: one "<ms> <bytes>" line
+// per network read, a blank line between streams, # for comments.
+//
+//   g++ -O2 -std=c++17 -I.. -o jitter_sim jitter_sim.cpp
+//   ./jitter_sim                 # generated traces, 300 streams each
+//   ./jitter_sim tts_reads.txt   # recorded trace
+#include "jitter_buffer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static const uint32_t STREAM_RATE = 24000;      // LINEAR16 TTS responses
+static const uint32_t CAPACITY = 16384;         // JITTER_BUFFER_SAMPLES
+static const int BLOCK = 256;                   // PLAYBACK_BLOCK_SAMPLES
+static const uint32_t PUSH_BATCH = 255;         // streamSpeech()'s pcm batch
+static const float PROBABILITIES[] = { 0.5f, 0.1f, 0.05f, 0.01f, 0.001f };
+static const int DEFAULT_PROBABILITY = 3;       // JITTER_UNDERRUN_PROBABILITY
+
+struct Read {
+  uint32_t ms;
+  uint32_t bytes;
+};
+typedef std::vector<Read> Stream;
+
+struct Trace {
+  std::string name;
+  std::vector<Stream> streams;
+};
+
+//----------------------------------------------------------------------
+// Traces
+//----------------------------------------------------------------------
+
+// Streams of 2-8 s answers sent in 1460-byte segments at speedup times
+// real time, with exponential spacing and, per segment, a stallChance of
+// a stall between stallMin and stallMax ms
+static Trace generate(const char* name, double speedup, double stallChance, uint32_t stallMin, uint32_t stallMax,
+                      int streams) {
+  Trace trace = { name, {} };
+  const double realTimeBytesPerMs = STREAM_RATE * 2 * 4 / 3 / 1000.0;  // base64 PCM
+  for (int s = 0; s < streams; s++) {
+    uint32_t total = (uint32_t)((2 + rand() % 7) * STREAM_RATE * 2 * 4 / 3);
+    Stream stream;
+    double t = 0;
+    for (uint32_t sent = 0; sent < total;) {
+      uint32_t seg = total - sent < 1460 ? total - sent : 1460;
+      double spacing = seg / (realTimeBytesPerMs * speedup);
+      t += spacing * -log(1 - (double)rand() / ((double)RAND_MAX + 1));
+      if ((double)rand() / RAND_MAX < stallChance) t += stallMin + rand() % (stallMax - stallMin + 1);
+      stream.push_back({ (uint32_t)t, seg });
+      sent += seg;
+    }
+    trace.streams.push_back(stream);
+  }
+  return trace;
+}
+
+static bool load(const char* path, Trace& trace) {
+  FILE* f = fopen(path, "r");
+  if (!f) return false;
+  trace.name = path;
+  Stream stream;
+  char line[128];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned ms, bytes;
+    if (line[0] == '#') continue;
+    if (sscanf(line, "%u %u", &ms, &bytes) == 2) {
+      stream.push_back({ ms, bytes });
+    } else if (!stream.empty()) {
+      trace.streams.push_back(stream);
+      stream.clear();
+    }
+  }
+  if (!stream.empty()) trace.streams.push_back(stream);
+  fclose(f);
+  return !trace.streams.empty();
+}
+
+//----------------------------------------------------------------------
+// Simulation
+//----------------------------------------------------------------------
+
+struct Result {
+  uint32_t startMs;   // First byte to playback start
+  uint32_t targetMs;
+  float peakLagMs;
+  uint32_t underruns;
+  uint32_t stretches;
+  double gapMs;       // Silence heard after playback started
+  bool intact;        // Every sample played, in order
+};
+
+static Result play(JitterBuffer& buffer, const Stream& stream) {
+  static int16_t storageIn[PUSH_BATCH];
+  Result r = {};
+  r.intact = true;
+  uint32_t underrunsBefore = buffer.underruns();
+  uint32_t stretchesBefore = buffer.stretches();
+
+  buffer.begin(STREAM_RATE);
+  r.targetMs = buffer.targetMs();
+  uint32_t t0 = stream[0].ms;
+  size_t next = 0;
+  uint64_t bytesIn = 0;
+  uint32_t decoded = 0;  // Samples decoded so far
+  uint32_t pushed = 0;
+  bool ended = false;
+  bool playing = false;
+
+  int16_t local[BLOCK];
+  int localLen = 0;
+  int localPos = 0;
+  uint32_t expect = 0;  // Next sample value the consumer should see
+  double owed = 0;      // Stream samples due at the playback rate
+
+  for (uint32_t now = 0;; now++) {
+    // Producer: the network reads due by now, then as much as fits
+    while (next < stream.size() && stream[next].ms - t0 <= now) {
+      bytesIn += stream[next++].bytes;
+      decoded = (uint32_t)(bytesIn * 3 / 8);
+    }
+    while (pushed < decoded) {
+      uint32_t n = decoded - pushed < PUSH_BATCH ? decoded - pushed : PUSH_BATCH;
+      for (uint32_t i = 0; i < n; i++) storageIn[i] = (int16_t)(pushed + i);
+      uint32_t got = buffer.push(storageIn, n, now);
+      pushed += got;
+      if (got < n) break;  // Full: pushSpeech() waits
+    }
+    if (!ended && next == stream.size() && pushed == decoded) {
+      buffer.end();
+      ended = true;
+    }
+    if (!playing && (buffer.prefilled() || ended)) {
+      playing = true;
+      r.startMs = now;
+      continue;  // The playback task picks the stream up on its next block
+    }
+    if (!playing) continue;
+
+    // Consumer: this millisecond's samples, a block at a time
+    owed += STREAM_RATE / 1000.0 * buffer.rateQ16() / 65536.0;
+    bool done = false;
+    while (owed >= 1) {
+      if (localPos == localLen) {
+        int n = buffer.read(local, BLOCK);
+        if (n < 0) {
+          done = true;
+          break;
+        }
+        if (n == 0) {
+          r.gapMs += owed * 1000.0 / STREAM_RATE;
+          owed = 0;
+          break;
+        }
+        localLen = n;
+        localPos = 0;
+      }
+      int take = localLen - localPos < (int)owed ? localLen - localPos : (int)owed;
+      for (int i = 0; i < take; i++) r.intact &= local[localPos + i] == (int16_t)expect++;
+      localPos += take;
+      owed -= take;
+    }
+    if (done) break;
+  }
+  r.intact &= expect == decoded;
+  r.peakLagMs = buffer.peakLagMs();
+  r.underruns = buffer.underruns() - underrunsBefore;
+  r.stretches = buffer.stretches() - stretchesBefore;
+  return r;
+}
+
+static int failures = 0;
+
+struct Summary {
+  double meanTargetMs;
+  double meanStartMs;
+  uint32_t p95StartMs;
+  double underrunStreams;  // Fraction with at least one
+  double gapMsPerStream;
+  double stretchesPerStream;
+  double meanPeakLagMs;
+};
+
+static Summary simulate(const Trace& trace, float probability) {
+  static int16_t storage[CAPACITY];
+  JitterBuffer buffer(storage, CAPACITY, probability);
+  std::vector<uint32_t> starts;
+  Summary s = {};
+  int withUnderrun = 0;
+  for (size_t i = 0; i < trace.streams.size(); i++) {
+    Result r = play(buffer, trace.streams[i]);
+    if (!r.intact) {
+      if (failures++ < 10) printf("FAIL %s stream %zu: samples lost or out of order\n", trace.name.c_str(), i);
+    }
+    if ((r.underruns > 0) != (r.gapMs > 0)) {
+      if (failures++ < 10) printf("FAIL %s stream %zu: underrun count and gaps disagree\n", trace.name.c_str(), i);
+    }
+    starts.push_back(r.startMs);
+    s.meanTargetMs += r.targetMs;
+    s.meanStartMs += r.startMs;
+    s.gapMsPerStream += r.gapMs;
+    s.stretchesPerStream += r.stretches;
+    s.meanPeakLagMs += r.peakLagMs;
+    if (r.underruns) withUnderrun++;
+  }
+  double n = trace.streams.size();
+  std::sort(starts.begin(), starts.end());
+  s.meanTargetMs /= n;
+  s.meanStartMs /= n;
+  s.p95StartMs = starts[(size_t)(0.95 * (n - 1))];
+  s.underrunStreams = withUnderrun / n;
+  s.gapMsPerStream /= n;
+  s.stretchesPerStream /= n;
+  s.meanPeakLagMs /= n;
+  return s;
+}
+
+int main(int argc, char** argv) {
+  std::vector<Trace> traces;
+  if (argc > 1) {
+    Trace trace;
+    if (!load(argv[1], trace)) {
+      fprintf(stderr, "%s: no streams\n", argv[1]);
+      return 1;
+    }
+    traces.push_back(trace);
+  } else {
+    srand(11);
+    traces.push_back(generate("fast link", 4.0, 0, 0, 0, 300));
+    traces.push_back(generate("wifi", 2.0, 0.004, 50, 250, 300));
+    traces.push_back(generate("busy wifi", 1.3, 0.01, 100, 500, 300));
+  }
+
+  for (const Trace& trace : traces) {
+    printf("%s: %zu streams\n", trace.name.c_str(), trace.streams.size());
+    printf("  %8s %9s %11s %9s %10s %10s %10s %10s\n", "p(gap)", "prefill", "start mean", "p95", "underruns",
+           "gap/stream", "stretches", "peak lag");
+    double first = -1, last = -1;
+    for (size_t p = 0; p < sizeof(PROBABILITIES) / sizeof(PROBABILITIES[0]); p++) {
+      Summary s = simulate(trace, PROBABILITIES[p]);
+      printf("  %7.3f%c %6.0f ms %8.0f ms %6u ms %9.1f%% %7.1f ms %10.2f %7.0f ms\n", PROBABILITIES[p],
+             (int)p == DEFAULT_PROBABILITY ? '*' : ' ', s.meanTargetMs, s.meanStartMs, s.p95StartMs, 100 * s.underrunStreams,
+             s.gapMsPerStream, s.stretchesPerStream, s.meanPeakLagMs);
+      if (p == 0) first = s.underrunStreams;
+      last = s.underrunStreams;
+    }
+    // A stricter probability buys a longer prefill, never more gaps
+    if (last > first) {
+      failures++;
+      printf("FAIL %s: the strictest setting has more underruns than the loosest\n", trace.name.c_str());
+    }
+  }
+  printf("(* JITTER_UNDERRUN_PROBABILITY; prefill is the mean target, capped at %.0f ms by the capacity;\n"
+         " start is first byte to playback; underruns is the share of streams with a gap)\n",
+         CAPACITY * 750.0 / STREAM_RATE);
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,224 @@
+// Feeds link_estimator.h synthetic upload traces the way
+// transcribeRecording() does (choose() for each clip, then observeRtt(),
+// observeEncoding() and observeUpload() once the request is out) and
+// checks the upload profile decisions:
+// - choose() stays on LINEAR16 until an upload has been measured;
+// - each link settles on the profile with the lowest expected latency:
+//   LINEAR16 on a fast LAN, FLAC on a 2 Mbit/s uplink, mu-law at
+//   200 kbit/s, and LINEAR16 where FLAC wins by less than SWITCH_MARGIN;
+// - after a step change, every switch comes on the SWITCH_CONFIRMATIONS-th
+//   consecutive win by SWITCH_MARGIN, and the profile does not flap;
+// - a single outlier upload does not switch the profile.
+//
+// Throughput on each upload varies +-20% around the link's rate. Body
+// sizes are base64 JSON (4/3 of the encoded audio), as for the default
+// STT backend.
+//
+//   g++ -O2 -std=c++17 -I.. -o link_estimator_check link_estimator_check.cpp
+//   ./link_estimator_check
+#include "link_estimator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const float INFLATION = 4.0f / 3.0f;  // sttBackends[STT_BACKEND_GOOGLE].inflation
+
+// What the encoders actually produce for speech, per second of audio
+static const float ENCODED_BYTES_PER_SECOND[UPLOAD_PROFILE_COUNT] = { 32000, 18000, 8000 };
+static const float ENCODE_MS_PER_SECOND[UPLOAD_PROFILE_COUNT] = { 0, 22, 1 };
+
+struct Link {
+  const char* name;
+  float bytesPerMs;
+  float rttMs;
+};
+
+static const Link LAN = { "lan 20 Mbit/s", 2500, 10 };
+static const Link DSL = { "uplink 2 Mbit/s", 250, 30 };
+static const Link SLOW = { "uplink 200 kbit/s", 25, 80 };
+static const Link NEAR_MARGIN = { "uplink 3.7 Mbit/s", 460, 20 };
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    failures++;
+    printf("FAIL %s\n", what);
+  }
+}
+
+static float clipSeconds() { return 2 + rand() % 5; }
+
+static float jitter() { return 0.8f + 0.4f * rand() / RAND_MAX; }
+
+// The measurements of one request on the link, as transcribeRecording()
+// reports them
+static void observe(LinkEstimator& estimator, UploadProfileId profile, float seconds, float bytesPerMs, float rttMs) {
+  uint32_t encoded = (uint32_t)(ENCODED_BYTES_PER_SECOND[profile] * seconds);
+  uint32_t body = (uint32_t)(encoded * INFLATION);
+  estimator.observeRtt(rttMs);
+  estimator.observeEncoding(profile, seconds, encoded, ENCODE_MS_PER_SECOND[profile] * seconds);
+  estimator.observeUpload(body, (uint32_t)(body * 1000.0f / bytesPerMs));
+}
+
+// The profile the model prefers right now, ignoring hysteresis
+static UploadProfileId fastest(const LinkEstimator& estimator, float seconds) {
+  UploadProfileId best = UPLOAD_LINEAR16_16K;
+  for (int i = 1; i < UPLOAD_PROFILE_COUNT; i++) {
+    if (estimator.expectedLatencyMs((UploadProfileId)i, seconds) < estimator.expectedLatencyMs(best, seconds)) {
+      best = (UploadProfileId)i;
+    }
+  }
+  return best;
+}
+
+// Mirrors the hysteresis rule from the outside: a profile becomes current
+// on its SWITCH_CONFIRMATIONS-th consecutive win by SWITCH_MARGIN
+struct Hysteresis {
+  UploadProfileId candidate = UPLOAD_LINEAR16_16K;
+  int wins = 0;
+
+  UploadProfileId expect(const LinkEstimator& estimator, float seconds) {
+    UploadProfileId current = estimator.current();
+    UploadProfileId best = fastest(estimator, seconds);
+    float currentMs = estimator.expectedLatencyMs(current, seconds);
+    if (best == current || estimator.expectedLatencyMs(best, seconds) > currentMs * (1 - LinkEstimator::SWITCH_MARGIN)) {
+      wins = 0;
+      return current;
+    }
+    wins = best == candidate ? wins + 1 : 1;
+    candidate = best;
+    if (wins < LinkEstimator::SWITCH_CONFIRMATIONS) return current;
+    wins = 0;
+    return best;
+  }
+};
+
+// Runs uploads over the link and returns how often the profile changed.
+// Every choice is checked against the hysteresis rule.
+static int run(LinkEstimator& estimator, Hysteresis& model, const Link& link, int uploads, bool& followed) {
+  int switches = 0;
+  for (int i = 0; i < uploads; i++) {
+    float seconds = clipSeconds();
+    UploadProfileId before = estimator.current();
+    UploadProfileId expected = model.expect(estimator, seconds);
+    UploadProfileId profile = estimator.choose(seconds);
+    followed &= profile == expected;
+    if (profile != before) switches++;
+    observe(estimator, profile, seconds, link.bytesPerMs * jitter(), link.rttMs * jitter());
+  }
+  return switches;
+}
+
+//----------------------------------------------------------------------
+// Checks
+//----------------------------------------------------------------------
+
+static void coldStart() {
+  LinkEstimator estimator;
+  bool stayed = true;
+  for (int i = 0; i < 10; i++) {
+    estimator.observeRtt(SLOW.rttMs);
+    estimator.observeEncoding(UPLOAD_LINEAR16_16K, 3, 96000, 0);
+    // Too small to time the link: it only fills the socket's send buffer
+    estimator.observeUpload(LinkEstimator::MIN_UPLOAD_BYTES - 1, 5000000);
+    stayed &= estimator.choose(clipSeconds()) == UPLOAD_LINEAR16_16K;
+  }
+  check(stayed && !estimator.hasThroughput(), "choose() leaves LINEAR16 before an upload was measured");
+
+  // The first measured upload is enough to start counting wins
+  observe(estimator, UPLOAD_LINEAR16_16K, 3, SLOW.bytesPerMs, SLOW.rttMs);
+  for (int i = 0; i < LinkEstimator::SWITCH_CONFIRMATIONS; i++) estimator.choose(3);
+  check(estimator.current() == UPLOAD_MULAW_8K, "the first measured upload does not let choose() move");
+  printf("cold:     LINEAR16 for 10 clips with no throughput, %s after one slow upload\n",
+         uploadProfiles[estimator.current()].name);
+}
+
+static void winners() {
+  struct Case {
+    Link link;
+    UploadProfileId winner;
+  };
+  const Case cases[] = {
+    { LAN, UPLOAD_LINEAR16_16K },
+    { DSL, UPLOAD_FLAC_16K },
+    { SLOW, UPLOAD_MULAW_8K },
+    { NEAR_MARGIN, UPLOAD_LINEAR16_16K },  // FLAC is faster, but not by SWITCH_MARGIN
+  };
+  printf("winners:\n");
+  for (const Case& c : cases) {
+    LinkEstimator estimator;
+    Hysteresis model;
+    bool followed = true;
+    run(estimator, model, c.link, 20, followed);
+    int late = run(estimator, model, c.link, 40, followed);
+    printf("  %-18s %-13s (%d switches once settled)\n", c.link.name, uploadProfiles[estimator.current()].name, late);
+    if (estimator.current() != c.winner || late != 0 || !followed) {
+      failures++;
+      printf("FAIL %s: expected %s to win and stay\n", c.link.name, uploadProfiles[c.winner].name);
+    }
+  }
+  LinkEstimator near;
+  Hysteresis model;
+  bool followed = true;
+  run(near, model, NEAR_MARGIN, 20, followed);
+  check(fastest(near, 4) == UPLOAD_FLAC_16K, "the near-margin link does not favour FLAC without hysteresis");
+}
+
+static void stepChange() {
+  LinkEstimator estimator;
+  Hysteresis model;
+  bool followed = true;
+  run(estimator, model, LAN, 20, followed);
+  int down = run(estimator, model, SLOW, 20, followed);
+  UploadProfileId slow = estimator.current();
+  int up = run(estimator, model, LAN, 20, followed);
+  check(followed, "a switch came without SWITCH_CONFIRMATIONS wins by SWITCH_MARGIN");
+  check(slow == UPLOAD_MULAW_8K && estimator.current() == UPLOAD_LINEAR16_16K, "a step change is not followed");
+  check(down <= 2 && up <= 2, "the profile flaps after a step change");
+  printf("step:     lan -> 200 kbit/s -> lan: %d and %d switches, each on win %d by %.0f%%\n", down, up,
+         LinkEstimator::SWITCH_CONFIRMATIONS, LinkEstimator::SWITCH_MARGIN * 100);
+}
+
+// One upload far off the link's rate, e.g. a body that fit in the send
+// buffer or a write that stalled on a retransmit
+static void outlier(const Link& link, float factor, UploadProfileId settled) {
+  LinkEstimator estimator;
+  for (int i = 0; i < 20; i++) observe(estimator, estimator.choose(4), 4, link.bytesPerMs, link.rttMs);
+  UploadProfileId before = estimator.current();
+  observe(estimator, estimator.choose(4), 4, link.bytesPerMs * factor, link.rttMs);
+  bool held = before == settled;
+  for (int i = 0; i < 20; i++) {
+    held &= estimator.choose(4) == settled;
+    observe(estimator, estimator.current(), 4, link.bytesPerMs, link.rttMs);
+  }
+  printf("  %-18s x%-6g %s\n", link.name, factor, held ? "held" : "switched");
+  if (!held) {
+    failures++;
+    printf("FAIL %s: one upload at %g times the rate switched the profile\n", link.name, factor);
+  }
+}
+
+static void outliers() {
+  printf("outliers:\n");
+  outlier(SLOW, 100, UPLOAD_MULAW_8K);
+  outlier(SLOW, 10, UPLOAD_MULAW_8K);
+  outlier(DSL, 10, UPLOAD_FLAC_16K);
+  outlier(DSL, 0.1f, UPLOAD_FLAC_16K);
+  outlier(LAN, 0.01f, UPLOAD_LINEAR16_16K);
+}
+
+int main() {
+  srand(5);
+  coldStart();
+  winners();
+  stepChange();
+  outliers();
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
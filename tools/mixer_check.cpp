@@ -0,0 +1,248 @@
+// Drives mixer.h the way the playback task does (256-sample blocks at
+// 44.1 kHz, up to MAX_SLOTS sources) and checks what the voice depends
+// on: a single source at unity comes out unchanged, loud sources saturate
+// instead of wrapping, a lower-priority slot ducks to DUCK_GAIN and comes
+// back when the higher one ends, fades move without steps, and a slot
+// whose source runs dry ends with silence. Then reports the mix cost per
+// output block as the number of sources grows, with steady, ramping and
+// ducked gains, against the block's real-time budget.
+//
+// Building with -fno-tree-vectorize gives the plain scalar loops, which
+// is closer to what the ESP32 toolchain produces.
+//
+//   g++ -O2 -std=c++17 -I.. -o mixer_check mixer_check.cpp
+//   ./mixer_check
+#include "mixer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+static const uint32_t SAMPLE_RATE = 44100;  // SAMPLE_RATE in main.cpp
+static const int BLOCK = 256;               // PLAYBACK_BLOCK_SAMPLES
+
+static double cpuMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+//----------------------------------------------------------------------
+// Sources
+//----------------------------------------------------------------------
+
+// Loops over a fixed buffer, optionally ending after limit samples
+struct Source {
+  std::vector<int16_t> samples;
+  size_t pos = 0;
+  size_t limit = SIZE_MAX;
+};
+
+static int pullSource(void* ctx, int16_t* out, int count) {
+  Source* s = (Source*)ctx;
+  int n = 0;
+  while (n < count && s->limit > 0) {
+    size_t run = s->samples.size() - s->pos;
+    if (run > (size_t)(count - n)) run = count - n;
+    if (run > s->limit) run = s->limit;
+    memcpy(out + n, &s->samples[s->pos], run * sizeof(out[0]));
+    n += run;
+    s->pos = (s->pos + run) % s->samples.size();
+    s->limit -= run;
+  }
+  return n;
+}
+
+static Source constant(int16_t value) {
+  Source s;
+  s.samples.assign(BLOCK, value);
+  return s;
+}
+
+// A second of band-limited noise near -6 dBFS, like decoded speech
+static Source noise(unsigned seed) {
+  Source s;
+  s.samples.resize(SAMPLE_RATE);
+  srand(seed);
+  double lp = 0;
+  for (int16_t& v : s.samples) {
+    lp += 0.2 * ((double)rand() / RAND_MAX * 2 - 1 - lp);
+    v = (int16_t)lrint(fmax(-1, fmin(1, lp * 4)) * 16000);
+  }
+  return s;
+}
+
+//----------------------------------------------------------------------
+// Checks
+//----------------------------------------------------------------------
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    failures++;
+    printf("FAIL %s\n", what);
+  }
+}
+
+static void checks() {
+  int16_t out[BLOCK];
+
+  {
+    Mixer mixer(SAMPLE_RATE);
+    Source speech = noise(1);
+    mixer.start(0, pullSource, &speech, 1);
+    bool same = true;
+    for (int b = 0; b < 20; b++) {
+      size_t from = speech.pos;
+      mixer.mix(out, BLOCK);
+      for (int i = 0; i < BLOCK; i++) same &= out[i] == speech.samples[from + i];
+    }
+    check(same, "one source at unity is not passed through unchanged");
+  }
+
+  {
+    Mixer mixer(SAMPLE_RATE);
+    Source loud[Mixer::MAX_SLOTS] = { constant(30000), constant(30000), constant(-30000), constant(30000) };
+    for (int i = 0; i < Mixer::MAX_SLOTS; i++) mixer.start(i, pullSource, &loud[i], 1);
+    mixer.mix(out, BLOCK);
+    check(out[0] == 32767 && out[BLOCK - 1] == 32767, "four loud sources do not saturate to full scale");
+    Mixer quiet(SAMPLE_RATE);
+    Source low[2] = { constant(-30000), constant(-30000) };
+    for (int i = 0; i < 2; i++) quiet.start(i, pullSource, &low[i], 1);
+    quiet.mix(out, BLOCK);
+    check(out[0] == -32768, "two loud negative sources do not saturate to full scale");
+  }
+
+  {
+    // The answer under a chime: ducked within DUCK_RAMP_MS, back after
+    Mixer mixer(SAMPLE_RATE);
+    Source answer = constant(16000);
+    Source chime = constant(0);
+    chime.limit = SAMPLE_RATE / 5;
+    mixer.start(0, pullSource, &answer, 1);
+    mixer.start(1, pullSource, &chime, 2);
+    const int rampBlocks = (int)(SAMPLE_RATE * Mixer::DUCK_RAMP_MS / 1000 / BLOCK) + 2;  // The step rounds down
+    int prev = 16000;
+    bool smooth = true;
+    for (int b = 0; b < rampBlocks; b++) {
+      mixer.mix(out, BLOCK);
+      for (int i = 0; i < BLOCK; i++) {
+        smooth &= out[i] <= prev && prev - out[i] < 64;
+        prev = out[i];
+      }
+    }
+    int ducked = 16000 * Mixer::DUCK_GAIN / Mixer::UNITY;
+    check(abs(out[BLOCK - 1] - ducked) <= 2, "a lower-priority slot is not ducked to DUCK_GAIN");
+    check(smooth, "ducking steps instead of ramping");
+    while (mixer.active(1)) mixer.mix(out, BLOCK);
+    // A ramp lands on its target with the first sample of the next block
+    for (int b = 0; b <= rampBlocks; b++) mixer.mix(out, BLOCK);
+    check(out[0] == 16000 && out[BLOCK - 1] == 16000, "a ducked slot does not come back when the higher one ends");
+  }
+
+  {
+    // Filler-to-answer crossfade: both ramps monotonic, no steps
+    Mixer mixer(SAMPLE_RATE);
+    Source filler = constant(16000);
+    Source answer = constant(-16000);
+    mixer.start(0, pullSource, &filler, 1);
+    mixer.start(1, pullSource, &answer, 1, 0);
+    mixer.fade(0, 0, 150, true);
+    mixer.fade(1, Mixer::UNITY, 150);
+    int prev = 16000;
+    bool smooth = true;
+    int blocks = 0;
+    while (mixer.active(0) && blocks++ < 100) {
+      mixer.mix(out, BLOCK);
+      for (int i = 0; i < BLOCK; i++) {
+        smooth &= out[i] <= prev && prev - out[i] < 64;
+        prev = out[i];
+      }
+    }
+    check(!mixer.active(0), "a fade-out with stop does not end the slot");
+    check(smooth, "a crossfade steps instead of ramping");
+    mixer.mix(out, BLOCK);
+    check(out[0] == -16000 && out[BLOCK - 1] == -16000, "a crossfade does not end on the new source at unity");
+  }
+
+  {
+    Mixer mixer(SAMPLE_RATE);
+    Source tone = constant(1000);
+    tone.limit = 100;
+    mixer.start(0, pullSource, &tone, 1);
+    mixer.mix(out, BLOCK);
+    check(out[99] == 1000 && out[100] == 0 && out[BLOCK - 1] == 0, "a short pull is not padded with silence");
+    check(!mixer.active(0) && !mixer.anyActive(), "a slot whose source ran dry is still active");
+  }
+
+  printf("checks:  unity, saturation, ducking, crossfade, end of source\n");
+}
+
+//----------------------------------------------------------------------
+// Cost per block
+//----------------------------------------------------------------------
+
+enum Gains { STEADY, RAMPING, DUCKED };
+
+static double blockCost(int sources, Gains gains) {
+  Mixer mixer(SAMPLE_RATE);
+  std::vector<Source> src;
+  for (int i = 0; i < sources; i++) src.push_back(noise(i + 1));
+  for (int i = 0; i < sources; i++) {
+    // Ducked: one slot above the rest, with the duck ramp already done
+    uint8_t priority = gains == DUCKED && i == sources - 1 ? 2 : 1;
+    mixer.start(i, pullSource, &src[i], priority, Mixer::UNITY / 2);
+  }
+  int16_t out[BLOCK];
+  for (int b = 0; b < 20; b++) mixer.mix(out, BLOCK);
+
+  long blocks = 0;
+  int32_t sink = 0;
+  double start = cpuMicros();
+  double elapsed = 0;
+  while (elapsed < 200000) {
+    for (int b = 0; b < 64; b++) {
+      // A fade that never arrives keeps every block on the ramping loop
+      if (gains == RAMPING) {
+        for (int i = 0; i < sources; i++) mixer.fade(i, (blocks + b) & 1 ? Mixer::UNITY : 0, 1000);
+      }
+      mixer.mix(out, BLOCK);
+      sink += out[b];
+    }
+    blocks += 64;
+    elapsed = cpuMicros() - start;
+  }
+  if (sink == 0x7fffffff) printf(" ");  // Keeps the output live
+  return elapsed / blocks;
+}
+
+static void bench() {
+  const double budgetUs = BLOCK * 1e6 / SAMPLE_RATE;
+  printf("cost per %d-sample block (budget %.0f us at %u Hz):\n", BLOCK, budgetUs, SAMPLE_RATE);
+  printf("%8s %10s %10s %10s %12s\n", "sources", "steady", "ramping", "ducked", "per source");
+  double one = 0;
+  for (int n = 1; n <= Mixer::MAX_SLOTS; n++) {
+    double us[3];
+    for (int g = STEADY; g <= DUCKED; g++) us[g] = blockCost(n, (Gains)g);
+    if (n == 1) one = us[STEADY];
+    printf("%8d %7.2f us %7.2f us %7.2f us %9.2f us\n", n, us[STEADY], us[RAMPING], us[DUCKED],
+           n > 1 ? (us[STEADY] - one) / (n - 1) : us[STEADY]);
+  }
+}
+
+int main() {
+  checks();
+  bench();
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,394 @@
+// Checks the offline queue journal (queue_journal.h) against power loss
+// and measures how fast a full queue drains through it.
+//
+// Recovery runs on a simulated card that loses power after a given number
+// of writes, removes or renames, with writes torn at byte granularity. For
+// every cut point it boots the way initUtteranceQueue() does and checks the
+// queue it rebuilds:
+//   - appends: every record written before the cut is replayed, the torn
+//     one is not, and the valid length ends at the last whole record;
+//   - compaction: the rebuilt queue equals the live one wherever the cut
+//     lands, for the temp-file protocol compactQueueJournal() uses (and,
+//     for comparison, for the old remove-then-append rewrite).
+// Drain throughput replays the firmware's journal and index writes for a
+// full queue (pending, answered, done, then compaction) against files in a
+// host directory, each write flushed and synced the way the firmware
+// flushes to SD. The cloud stages are not part of it: this is the
+// bookkeeping cost per utterance, which the drain pays on top of them.
+//
+//   g++ -O2 -std=c++17 -I.. -o queue_check queue_check.cpp
+//   ./queue_check                 # drain files in /tmp
+//   ./queue_check /mnt/sdcard     # drain files on a mounted card
+#include "queue_journal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Mirrors main.cpp
+static const int MAX_PENDING = 32;
+enum { PENDING = 1, ANSWERED = 2, DONE = 3, FAILED = 4 };
+static const char* const JOURNAL = "/queue/journal.bin";
+static const char* const JOURNAL_TMP = "/queue/journal.tmp";
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+//----------------------------------------------------------------------
+// Queue table, applied the way applyQueueRecord() applies records
+//----------------------------------------------------------------------
+
+struct Entry {
+  uint8_t status;
+  uint8_t attempts;
+};
+typedef std::map<uint32_t, Entry> Table;
+
+static void apply(Table& t, uint32_t seq, uint8_t status, uint8_t attempts) {
+  if (status == DONE || status == FAILED) {
+    t.erase(seq);
+  } else if (t.count(seq) || (int)t.size() < MAX_PENDING) {
+    t[seq] = { status, attempts };
+  }
+}
+
+static bool same(const Table& a, const Table& b) {
+  if (a.size() != b.size()) return false;
+  for (auto it = a.begin(), jt = b.begin(); it != a.end(); ++it, ++jt) {
+    if (it->first != jt->first || it->second.status != jt->second.status
+        || it->second.attempts != jt->second.attempts) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Simulated card
+//----------------------------------------------------------------------
+
+struct PowerCut {};
+
+// Every written byte, remove and rename costs one step of budget; when it
+// runs out the card stops, keeping whatever the step before left behind.
+struct SimCard {
+  std::map<std::string, std::vector<uint8_t>> files;
+  long budget = -1;  // < 0: never cut
+
+  void step() {
+    if (budget == 0) throw PowerCut();
+    if (budget > 0) budget--;
+  }
+  bool exists(const char* path) { return files.count(path) != 0; }
+  bool remove(const char* path) {
+    if (!exists(path)) return false;
+    step();
+    files.erase(path);
+    return true;
+  }
+  bool rename(const char* from, const char* to) {
+    if (!exists(from) || exists(to)) return false;  // FAT will not rename over a file
+    step();
+    files[to] = files[from];
+    files.erase(from);
+    return true;
+  }
+  void create(const char* path) {
+    step();
+    files[path].clear();
+  }
+  void append(const char* path, const void* data, size_t len) {
+    std::vector<uint8_t>& f = files[path];
+    for (size_t i = 0; i < len; i++) {
+      step();
+      f.push_back(((const uint8_t*)data)[i]);
+    }
+  }
+};
+
+struct ReadCursor {
+  const std::vector<uint8_t>* data;
+  size_t pos;
+};
+
+static int32_t readCursor(void* ctx, uint8_t* buf, uint32_t len) {
+  ReadCursor* c = (ReadCursor*)ctx;
+  uint32_t n = (uint32_t)(c->data->size() - c->pos);
+  if (n > len) n = len;
+  memcpy(buf, c->data->data() + c->pos, n);
+  c->pos += n;
+  return n;
+}
+
+static void appendRecord(SimCard& card, uint32_t seq, uint8_t status, uint8_t attempts) {
+  queue_journal::Record rec = queue_journal::makeRecord(seq, status, attempts);
+  card.append(JOURNAL, &rec, sizeof(rec));
+}
+
+// compactQueueJournal()
+static void compact(SimCard& card, const Table& live) {
+  card.create(JOURNAL_TMP);
+  for (auto& e : live) {
+    queue_journal::Record rec = queue_journal::makeRecord(e.first, e.second.status, e.second.attempts);
+    card.append(JOURNAL_TMP, &rec, sizeof(rec));
+  }
+  if (!queue_journal::replaceFile(card, JOURNAL_TMP, JOURNAL) && card.exists(JOURNAL)) {
+    card.remove(JOURNAL_TMP);
+  }
+}
+
+// The rewrite compaction used before: remove, then append each record
+static void compactInPlace(SimCard& card, const Table& live) {
+  card.remove(JOURNAL);
+  for (auto& e : live) appendRecord(card, e.first, e.second.status, e.second.attempts);
+}
+
+// initUtteranceQueue() without an index: recover, then replay
+static Table boot(SimCard& card, uint32_t* validBytes = nullptr) {
+  card.budget = -1;
+  queue_journal::recoverReplace(card, JOURNAL_TMP, JOURNAL);
+  Table t;
+  uint32_t valid = 0;
+  if (card.exists(JOURNAL)) {
+    ReadCursor c = { &card.files[JOURNAL], 0 };
+    valid = queue_journal::replay(readCursor, &c,
+                                  [&](uint32_t seq, uint8_t status, uint8_t attempts) { apply(t, seq, status, attempts); });
+  }
+  if (validBytes) *validBytes = valid;
+  return t;
+}
+
+//----------------------------------------------------------------------
+// Workload: utterances queued offline, some retried, some answered
+//----------------------------------------------------------------------
+
+struct Op {
+  uint32_t seq;
+  uint8_t status;
+  uint8_t attempts;
+};
+
+static std::vector<Op> workload(uint32_t seed, int utterances) {
+  srand(seed);
+  std::vector<Op> ops;
+  std::vector<uint32_t> open;
+  uint32_t next = 1;
+  while (next <= (uint32_t)utterances || !open.empty()) {
+    if (next <= (uint32_t)utterances && (open.empty() || rand() % 3 != 0)) {
+      ops.push_back({ next, PENDING, 0 });
+      open.push_back(next++);
+      continue;
+    }
+    size_t i = rand() % open.size();
+    uint32_t seq = open[i];
+    switch (rand() % 4) {
+      case 0:
+        ops.push_back({ seq, PENDING, (uint8_t)(1 + rand() % 2) });  // Transport failure, retried
+        break;
+      case 1:
+        ops.push_back({ seq, ANSWERED, 0 });
+        break;
+      default:
+        ops.push_back({ seq, rand() % 5 == 0 ? (uint8_t)FAILED : (uint8_t)DONE, 0 });
+        open.erase(open.begin() + i);
+        break;
+    }
+  }
+  return ops;
+}
+
+//----------------------------------------------------------------------
+// Recovery checks
+//----------------------------------------------------------------------
+
+static int failures = 0;
+
+static void fail(const char* what, long cut) {
+  if (failures++ < 10) printf("  FAIL %s (cut after %ld steps)\n", what, cut);
+}
+
+// A torn append: the journal stops at every byte of every record
+static void checkTornAppends(const std::vector<Op>& ops) {
+  SimCard full;
+  std::vector<Table> after(1);
+  for (const Op& op : ops) {
+    appendRecord(full, op.seq, op.status, op.attempts);
+    after.push_back(after.back());
+    apply(after.back(), op.seq, op.status, op.attempts);
+  }
+  const std::vector<uint8_t>& journal = full.files[JOURNAL];
+  const size_t recordBytes = sizeof(queue_journal::Record);
+
+  for (size_t cut = 0; cut <= journal.size(); cut++) {
+    SimCard card;
+    card.files[JOURNAL].assign(journal.begin(), journal.begin() + cut);
+    uint32_t valid;
+    Table t = boot(card, &valid);
+    size_t whole = cut / recordBytes;
+    if (valid != whole * recordBytes) fail("torn append: valid length", (long)cut);
+    if (!same(t, after[whole])) fail("torn append: rebuilt queue", (long)cut);
+  }
+
+  // A corrupt byte anywhere in a record stops replay before that record
+  for (size_t pos = 0; pos < journal.size(); pos += 5) {
+    SimCard card;
+    card.files[JOURNAL] = journal;
+    card.files[JOURNAL][pos] ^= 0x40;
+    uint32_t valid;
+    Table t = boot(card, &valid);
+    size_t whole = pos / recordBytes;
+    if (valid != whole * recordBytes || !same(t, after[whole])) fail("corrupt record", (long)pos);
+  }
+  printf("torn appends:  %zu records, %zu cut points, %zu corrupt bytes checked\n", ops.size(),
+         journal.size() + 1, (journal.size() + 4) / 5);
+}
+
+// Power lost at every step of a compaction. Returns the cut points at
+// which the rebuilt queue differed from the live one.
+static long checkCompaction(const std::vector<Op>& ops, size_t tornTail,
+                            void (*compactFn)(SimCard&, const Table&), long* cuts) {
+  SimCard base;
+  Table live;
+  for (const Op& op : ops) {
+    appendRecord(base, op.seq, op.status, op.attempts);
+    apply(live, op.seq, op.status, op.attempts);
+  }
+  queue_journal::Record torn = queue_journal::makeRecord(0xfffffff0, PENDING, 0);
+  base.append(JOURNAL, &torn, tornTail);
+
+  long lost = 0;
+  for (long budget = 0;; budget++) {
+    SimCard card = base;
+    card.budget = budget;
+    bool finished = true;
+    try {
+      compactFn(card, live);
+    } catch (PowerCut&) {
+      finished = false;
+    }
+    Table t = boot(card);
+    if (!same(t, live)) lost++;
+    if (finished) {
+      *cuts = budget + 1;
+      // A finished compaction leaves exactly the live records
+      uint32_t valid;
+      boot(card, &valid);
+      if (card.exists(JOURNAL_TMP) || valid != card.files[JOURNAL].size()
+          || valid != live.size() * sizeof(queue_journal::Record)) {
+        fail("compaction result", budget);
+      }
+      return lost;
+    }
+  }
+}
+
+//----------------------------------------------------------------------
+// Drain throughput on a host directory
+//----------------------------------------------------------------------
+
+static void writeFile(const std::string& path, const void* data, size_t len, bool append) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+  if (fd < 0 || write(fd, data, len) != (ssize_t)len) {
+    perror(path.c_str());
+    exit(1);
+  }
+  fsync(fd);
+  close(fd);
+}
+
+// updateQueueEntry(): journal record, then the index snapshot
+static void hostUpdate(const std::string& dir, Table& live, uint32_t seq, uint8_t status, uint8_t attempts,
+                       size_t* bytes) {
+  queue_journal::Record rec = queue_journal::makeRecord(seq, status, attempts);
+  writeFile(dir + "/journal.bin", &rec, sizeof(rec), true);
+  apply(live, seq, status, attempts);
+  uint8_t index[16 + MAX_PENDING * 8] = {};  // QueueIndexHeader + QueueEntry[]
+  size_t indexBytes = 16 + live.size() * 8;
+  writeFile(dir + "/index.bin", index, indexBytes, false);
+  *bytes += sizeof(rec) + indexBytes;
+}
+
+static void hostCompact(const std::string& dir, const Table& live, size_t* bytes) {
+  std::vector<queue_journal::Record> recs;
+  for (auto& e : live) recs.push_back(queue_journal::makeRecord(e.first, e.second.status, e.second.attempts));
+  std::string tmp = dir + "/journal.tmp";
+  writeFile(tmp, recs.data(), recs.size() * sizeof(recs[0]), false);
+  if (::rename(tmp.c_str(), (dir + "/journal.bin").c_str()) != 0) {
+    perror("rename");
+    exit(1);
+  }
+  *bytes += recs.size() * sizeof(recs[0]);
+}
+
+static void checkDrain(const char* where) {
+  std::string dir = std::string(where) + "/queue_check.XXXXXX";
+  if (!mkdtemp(&dir[0])) {
+    perror(where);
+    exit(1);
+  }
+
+  const int rounds = 10;
+  size_t bytes = 0;
+  double start = nowMs();
+  Table live;
+  uint32_t seq = 1;
+  for (int r = 0; r < rounds; r++) {
+    uint32_t first = seq;
+    for (int i = 0; i < MAX_PENDING; i++) hostUpdate(dir, live, seq++, PENDING, 0, &bytes);
+    for (uint32_t s = first; s < seq; s++) {
+      hostUpdate(dir, live, s, ANSWERED, 0, &bytes);
+      hostUpdate(dir, live, s, DONE, 0, &bytes);
+    }
+    hostCompact(dir, live, &bytes);  // The queue ran empty
+  }
+  double ms = nowMs() - start;
+  int drained = rounds * MAX_PENDING;
+  printf("drain:         %d utterances in %.0f ms, %.2f ms each (%.0f/s), %.1f KB written, in %s\n", drained, ms,
+         ms / drained, drained * 1000.0 / ms, bytes / 1024.0, where);
+
+  ::remove((dir + "/journal.bin").c_str());
+  ::remove((dir + "/index.bin").c_str());
+  rmdir(dir.c_str());
+}
+
+int main(int argc, char** argv) {
+  std::vector<Op> ops = workload(1, 40);
+  checkTornAppends(ops);
+
+  // Compact part way through, with live entries, and after a torn append
+  const size_t prefixes[] = { ops.size() / 4, ops.size() / 2, ops.size() };
+  for (size_t n : prefixes) {
+    std::vector<Op> prefix(ops.begin(), ops.begin() + n);
+    for (size_t tail : { (size_t)0, (size_t)7 }) {
+      long cuts = 0;
+      long lost = checkCompaction(prefix, tail, compact, &cuts);
+      long oldCuts = 0;
+      long oldLost = checkCompaction(prefix, tail, compactInPlace, &oldCuts);
+      Table live;
+      for (const Op& op : prefix) apply(live, op.seq, op.status, op.attempts);
+      printf("compaction:    %2zu live, torn tail %zu: temp+rename lost the queue at %ld of %ld cuts;"
+             " remove+append at %ld of %ld\n",
+             live.size(), tail, lost, cuts, oldLost, oldCuts);
+      if (lost) fail("compaction lost entries", lost);
+    }
+  }
+
+  checkDrain(argc > 1 ? argv[1] : "/tmp");
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
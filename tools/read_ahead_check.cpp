@@ -0,0 +1,279 @@
+// Plays answers off a file-backed storage shim through read_ahead.h the
+// way the playback and read-ahead tasks do, and compares the audible gaps
+// with the old inline path, where playAudio() read 512 bytes and then
+// blocked in i2s_write. The shim reads a real file through ReadFn and
+// charges each read an SD-like latency: a fixed command cost, SPI
+// transfer time and, per 512-byte sector, a chance of a stall such as a
+// card's internal garbage collection.
+//
+// Time is simulated, so a run covers an hour of audio in a moment and
+// gives the same numbers every time.
+// - Inline: each 512-byte read drains the I2S DMA ring (22 ms of output),
+//   and any latency beyond what the ring holds is a gap.
+// - Read-ahead: one reader fills blocks while there is room, and the
+//   consumer reads 512 bytes per PLAYBACK_BLOCK_SAMPLES buffer. It plays
+//   silence while read() returns 0.
+// Every byte played is checked against the file.
+//
+//   g++ -O2 -std=c++17 -I.. -o read_ahead_check read_ahead_check.cpp
+//   ./read_ahead_check              # 400 answers of 2-10 s per card
+//   ./read_ahead_check 2000 5       # answers, seed
+#include "read_ahead.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+static const double BYTES_PER_US = 24000 * 2 / 1e6;         // 24 kHz 16-bit answers
+static const double DMA_SLACK_US = 16 * 60 * 1e6 / 44100;   // I2S_DMA_BUF_COUNT x I2S_DMA_BUF_LEN
+static const uint32_t CONSUMER_READ = 512;                  // sizeof(Voice::buf)
+static const uint32_t MAX_ANSWER = 10 * 24000 * 2;
+static const char* const FILE_PATH = "/tmp/read_ahead_check.pcm";
+
+//----------------------------------------------------------------------
+// Storage shim
+//----------------------------------------------------------------------
+
+struct Card {
+  const char* name;
+  double spikeChance;  // Per 512-byte sector
+  double spikeMinUs;
+  double spikeMaxUs;
+};
+
+static const Card CARDS[] = {
+  { "fast card", 0.0002, 5000, 30000 },
+  { "slow card", 0.001, 20000, 150000 },
+  { "worn card", 0.003, 50000, 300000 },
+};
+
+struct Storage {
+  int fd;
+  uint32_t pos;
+};
+
+static int32_t readStorage(void* ctx, uint8_t* buf, uint32_t len) {
+  Storage* s = (Storage*)ctx;
+  ssize_t n = pread(s->fd, buf, len, s->pos);
+  if (n > 0) s->pos += n;
+  return (int32_t)n;
+}
+
+static double random01() { return (double)rand() / ((double)RAND_MAX + 1); }
+
+// 0.3 ms per command plus ~1.5 MB/s over SPI, plus any stalls
+static double latencyUs(const Card& card, uint32_t len) {
+  double us = 300 + len / 1.5;
+  for (uint32_t sector = 0; sector < len; sector += 512) {
+    if (random01() < card.spikeChance) us += card.spikeMinUs + random01() * (card.spikeMaxUs - card.spikeMinUs);
+  }
+  return us;
+}
+
+static uint8_t expected(uint32_t offset) { return (uint8_t)(offset * 7 + (offset >> 9)); }
+
+static int failures = 0;
+
+static void verify(const uint8_t* data, uint32_t offset, uint32_t len, bool& intact) {
+  for (uint32_t i = 0; i < len; i++) intact &= data[i] == expected(offset + i);
+}
+
+//----------------------------------------------------------------------
+// Playback
+//----------------------------------------------------------------------
+
+struct Stats {
+  uint32_t gaps = 0;
+  double gapUs = 0;
+  double longestGapUs = 0;
+  double startUs = 0;  // Summed over answers
+  uint32_t counted = 0;  // Underruns reported by ReadAhead
+  bool intact = true;
+
+  void gap(double us) {
+    gaps++;
+    gapUs += us;
+    if (us > longestGapUs) longestGapUs = us;
+  }
+};
+
+static void playInline(int fd, const Card& card, uint32_t length, Stats& stats) {
+  Storage storage = { fd, 0 };
+  uint8_t buf[CONSUMER_READ];
+  double queuedUs = 0;  // Output waiting in the DMA ring
+  bool started = false;
+  for (uint32_t offset = 0;;) {
+    uint32_t want = length - offset < CONSUMER_READ ? length - offset : CONSUMER_READ;
+    double us = latencyUs(card, want);
+    int32_t n = want > 0 ? readStorage(&storage, buf, want) : 0;
+    if (n <= 0) break;
+    verify(buf, offset, n, stats.intact);
+    offset += n;
+    if (!started) {
+      stats.startUs += us;
+      started = true;
+    } else if (us > queuedUs) {
+      stats.gap(us - queuedUs);
+    }
+    queuedUs = us > queuedUs ? 0 : queuedUs - us;
+    // i2s_write returns once the ring has room for the rest
+    queuedUs += n / BYTES_PER_US;
+    if (queuedUs > DMA_SLACK_US) queuedUs = DMA_SLACK_US;
+  }
+}
+
+static void playReadAhead(int fd, const Card& card, uint32_t blockSize, uint32_t blocks, uint32_t length,
+                          Stats& stats) {
+  static std::vector<uint8_t> ring;
+  ring.resize(blockSize * blocks);
+  ReadAhead ra(ring.data(), blockSize, blocks);
+  Storage storage = { fd, 0 };
+  ra.begin(readStorage, &storage, length);
+
+  const double never = 1e300;
+  uint32_t requested = 0;  // Bytes asked of the reader so far, for the next read's size
+  uint32_t reads = 0;      // Blocks started, to tell whether there is room for another
+  uint32_t consumedBlocks = 0;
+  double readDone = never;  // When the read in flight completes
+  bool readerWaiting = true;
+
+  // The reader starts a read when it is free and a block is free
+  auto startRead = [&](double now) {
+    if (ra.finished() || reads - consumedBlocks >= blocks) {
+      readerWaiting = true;
+      return;
+    }
+    uint32_t want = length - requested < blockSize ? length - requested : blockSize;
+    readerWaiting = false;
+    reads++;
+    requested += want;
+    readDone = now + (want > 0 ? latencyUs(card, want) : 0);
+  };
+  startRead(0);
+
+  uint8_t buf[CONSUMER_READ];
+  uint32_t offset = 0;
+  bool started = false;
+  double consumerAt = 0;
+  uint32_t underrunsBefore = ra.underruns();
+  for (;;) {
+    if (readDone <= consumerAt) {
+      double now = readDone;
+      readDone = never;
+      ra.fillOne();
+      startRead(now);
+      continue;
+    }
+    int n = ra.read(buf, sizeof(buf));
+    if (n < 0) break;
+    if (n == 0) {
+      if (readDone == never) {
+        failures++;
+        printf("FAIL the consumer starved with no read in flight\n");
+        break;
+      }
+      if (started) stats.gap(readDone - consumerAt);
+      consumerAt = readDone;
+      continue;
+    }
+    if (!started) {
+      stats.startUs += consumerAt;
+      started = true;
+    }
+    verify(buf, offset, n, stats.intact);
+    offset += n;
+    consumerAt += n / BYTES_PER_US;
+    consumedBlocks = offset / blockSize;  // Whole blocks handed back
+    if (readerWaiting) startRead(consumerAt);  // xTaskNotifyGive(readAheadTaskHandle)
+  }
+  stats.intact &= offset == length;
+  stats.counted += ra.underruns() - underrunsBefore;
+}
+
+//----------------------------------------------------------------------
+
+struct Config {
+  uint32_t blockSize;
+  uint32_t blocks;
+};
+
+static const Config CONFIGS[] = { { 8192, 2 }, { 8192, 4 }, { 16384, 2 }, { 32768, 2 } };
+
+static void report(const char* name, const Stats& s, int answers, double audioMinutes) {
+  printf("  %-14s %8.1f %10.0f ms %9.0f ms %8.1f ms\n", name, s.gaps / audioMinutes, s.gapUs / 1000 / audioMinutes,
+         s.longestGapUs / 1000, s.startUs / 1000 / answers);
+}
+
+int main(int argc, char** argv) {
+  int answers = argc > 1 ? atoi(argv[1]) : 400;
+  unsigned seed = argc > 2 ? atoi(argv[2]) : 1;
+
+  int fd = open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(FILE_PATH);
+    return 1;
+  }
+  std::vector<uint8_t> contents(MAX_ANSWER);
+  for (uint32_t i = 0; i < MAX_ANSWER; i++) contents[i] = expected(i);
+  if (write(fd, contents.data(), contents.size()) != (ssize_t)contents.size()) {
+    perror(FILE_PATH);
+    return 1;
+  }
+
+  srand(seed);
+  std::vector<uint32_t> lengths;
+  double seconds = 0;
+  for (int i = 0; i < answers; i++) {
+    uint32_t len = (2 + rand() % 9) * 24000 * 2 - rand() % 4096 * 2;  // 2-10 s, not block aligned
+    lengths.push_back(len);
+    seconds += len / (BYTES_PER_US * 1e6);
+  }
+  double minutes = seconds / 60;
+  printf("%d answers, %.0f minutes of audio; gaps per minute of audio\n", answers, minutes);
+
+  for (const Card& card : CARDS) {
+    printf("%s:\n  %-14s %8s %13s %12s %11s\n", card.name, "", "gaps/min", "silence/min", "longest", "start");
+    srand(seed);
+    Stats inlineStats;
+    for (uint32_t len : lengths) playInline(fd, card, len, inlineStats);
+    report("inline 512 B", inlineStats, answers, minutes);
+    if (!inlineStats.intact) {
+      failures++;
+      printf("FAIL inline playback did not match the file\n");
+    }
+
+    for (const Config& c : CONFIGS) {
+      srand(seed);  // Same card behaviour for every configuration
+      Stats stats;
+      for (uint32_t len : lengths) playReadAhead(fd, card, c.blockSize, c.blocks, len, stats);
+      char name[32];
+      snprintf(name, sizeof(name), "%u x %2u KB%s", c.blocks, c.blockSize / 1024, &c == CONFIGS ? " *" : "");
+      report(name, stats, answers, minutes);
+      if (!stats.intact) {
+        failures++;
+        printf("FAIL read-ahead %s did not match the file\n", name);
+      }
+      if (stats.counted != stats.gaps) {
+        failures++;
+        printf("FAIL read-ahead %s counted %u underruns for %u gaps\n", name, stats.counted, stats.gaps);
+      }
+      if (&c == CONFIGS && stats.gapUs > inlineStats.gapUs) {
+        failures++;
+        printf("FAIL the default read-ahead leaves more silence than inline reads\n");
+      }
+    }
+  }
+  printf("(* READAHEAD_BLOCK_BYTES x READAHEAD_BLOCKS; start is the mean wait for the first bytes)\n");
+
+  close(fd);
+  unlink(FILE_PATH);
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Local stand-in for a realtime voice session (Gemini Live API).
+
+Speaks the BidiGenerateContent WebSocket protocol over plain TCP so
+ws_client.h and realtime_session.h can be exercised on a Linux host. Turns
+are marked by the client with activityStart and activityEnd. After each
+turn the stand-in waits --think-ms, then streams --answer-ms of 24 kHz
+speech-like audio in 40 ms messages, a little faster than real time as the
+service does, and ends with generationComplete and turnComplete. An
+activityStart while an answer is streaming interrupts it. Replies go out
+in binary frames, as the service sends them.
+
+    pip install websockets
+    ./realtime_standin.py --port 8765 --think-ms 300
+"""
+import argparse
+import asyncio
+import base64
+import json
+import math
+import struct
+import time
+
+import websockets
+
+PATH = "/ws/google.ai.generativelanguage.v1beta.GenerativeService.BidiGenerateContent"
+OUTPUT_RATE = 24000
+CHUNK_MS = 40
+
+
+def answer_audio(ms):
+    """A warbling tone with a syllable envelope, so it sounds like speech to a meter."""
+    samples = []
+    for i in range(OUTPUT_RATE * ms // 1000):
+        t = i / OUTPUT_RATE
+        envelope = 0.5 + 0.5 * math.sin(2 * math.pi * 4 * t)
+        samples.append(int(6000 * envelope * math.sin(2 * math.pi * (180 + 40 * math.sin(2 * math.pi * 3 * t)) * t)))
+    return struct.pack("<%dh" % len(samples), *samples)
+
+
+async def send(ws, message):
+    await ws.send(json.dumps(message).encode())
+
+
+async def answer(ws, args, pcm, turn):
+    await asyncio.sleep(args.think_ms / 1000.0)
+    chunk = OUTPUT_RATE * 2 * CHUNK_MS // 1000
+    start = time.monotonic()
+    for n, offset in enumerate(range(0, len(pcm), chunk)):
+        part = {"inlineData": {"mimeType": "audio/pcm;rate=%d" % OUTPUT_RATE,
+                               "data": base64.b64encode(pcm[offset:offset + chunk]).decode()}}
+        await send(ws, {"serverContent": {"modelTurn": {"parts": [part]}}})
+        # Ahead of real time by --lead-ms, then paced
+        due = start + (n * CHUNK_MS - args.lead_ms) / 1000.0
+        await asyncio.sleep(max(0.0, due - time.monotonic()))
+    await send(ws, {"serverContent": {"generationComplete": True}})
+    await send(ws, {"serverContent": {"turnComplete": True}})
+    print("turn %d answered with %d ms of audio" % (turn, args.answer_ms))
+
+
+async def session(ws, args, pcm):
+    path = ws.request.path
+    if not path.startswith(PATH) or "key=" not in path:
+        await ws.close(1008, "bad path or missing key")
+        return
+    setup = json.loads(await ws.recv())
+    if "setup" not in setup:
+        await ws.close(1007, "setup must come first")
+        return
+    detection = setup["setup"].get("realtimeInputConfig", {}).get("automaticActivityDetection", {})
+    print("setup model=%s manual turns=%s" % (setup["setup"].get("model"), detection.get("disabled")))
+    await send(ws, {"setupComplete": {}})
+
+    turn = 0
+    audio_bytes = 0
+    responding = None
+    async for raw in ws:
+        message = json.loads(raw)
+        realtime = message.get("realtimeInput", {})
+        if "activityStart" in realtime:
+            if responding and not responding.done():
+                responding.cancel()
+                await send(ws, {"serverContent": {"interrupted": True}})
+                print("turn %d interrupted" % turn)
+            turn += 1
+            audio_bytes = 0
+        elif "audio" in realtime:
+            audio_bytes += len(base64.b64decode(realtime["audio"]["data"]))
+        elif "activityEnd" in realtime:
+            print("turn %d: %.2f s of audio" % (turn, audio_bytes / 32000.0))
+            responding = asyncio.create_task(answer(ws, args, pcm, turn))
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=8765)
+    parser.add_argument("--think-ms", type=int, default=300, help="End of turn to the first answer audio")
+    parser.add_argument("--answer-ms", type=int, default=2000)
+    parser.add_argument("--lead-ms", type=int, default=400, help="How far ahead of real time the answer streams")
+    args = parser.parse_args()
+    pcm = answer_audio(args.answer_ms)  # Once, so it is not part of the turn latency
+    async with websockets.serve(lambda ws: session(ws, args, pcm), "127.0.0.1", args.port, max_size=None):
+        print("listening on 127.0.0.1:%d" % args.port)
+        await asyncio.Future()
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
@@ -0,0 +1,256 @@
+// Runs hold-to-talk turns through ws_client.h and realtime_session.h the way
+// the firmware does, against tools/realtime_standin.py or any plaintext
+// BidiGenerateContent WebSocket, and reports the turn latency: the time
+// from the end of speech (activityEnd) to the first answer audio.
+//
+//   g++ -O2 -std=c++17 -I.. -o realtime_turn_check realtime_turn_check.cpp
+//   ./realtime_turn_check 127.0.0.1 8765                 # 3 turns of 2 s
+//   ./realtime_turn_check 127.0.0.1 8765 5 speech.wav    # 16-bit mono WAV
+//   ./realtime_turn_check 127.0.0.1 8765 3 --barge       # Interrupt answers
+#include "ws_client.h"
+#include "realtime_session.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+static const uint32_t CHUNK_MS = 100;
+static const double BARGE_AFTER_MS = 300;  // Of answer audio before the next turn starts
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int32_t sockWrite(void* io, const uint8_t* data, uint32_t len) {
+  int fd = *(int*)io;
+  uint32_t sent = 0;
+  while (sent < len) {
+    ssize_t n = ::send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    sent += n;
+  }
+  return len;
+}
+
+static int32_t sockRead(void* io, uint8_t* buf, uint32_t len) {
+  ssize_t n = ::recv(*(int*)io, buf, len, MSG_DONTWAIT);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+  return n == 0 ? -1 : n;
+}
+
+static uint32_t randomWord() {
+  return (uint32_t)random();
+}
+
+struct Turn {
+  double endOfSpeech = 0;
+  double firstAudio = 0;
+  double complete = 0;
+  size_t samples = 0;
+  uint32_t rate = 0;
+  bool interrupted = false;
+};
+
+struct Run {
+  bool setupComplete = false;
+  bool closed = false;
+  std::vector<Turn> turns;
+};
+
+static void onAudio(void* ctx, const int16_t*, size_t count, uint32_t sampleRate) {
+  Run* r = (Run*)ctx;
+  if (r->turns.empty()) return;
+  Turn& t = r->turns.back();
+  if (t.samples == 0) t.firstAudio = nowMs();
+  t.samples += count;
+  t.rate = sampleRate;
+}
+
+static void onEvent(void* ctx, RealtimeSession::Event event) {
+  Run* r = (Run*)ctx;
+  switch (event) {
+    case RealtimeSession::EVENT_SETUP_COMPLETE:
+      r->setupComplete = true;
+      break;
+    case RealtimeSession::EVENT_TURN_COMPLETE:
+      if (!r->turns.empty()) r->turns.back().complete = nowMs();
+      break;
+    case RealtimeSession::EVENT_INTERRUPTED:
+      // Reported against the answer it cut short
+      if (r->turns.size() >= 2) r->turns[r->turns.size() - 2].interrupted = true;
+      break;
+    case RealtimeSession::EVENT_CLOSED:
+      r->closed = true;
+      break;
+    default:
+      break;
+  }
+}
+
+static bool loadWav(const char* path, std::vector<int16_t>& pcm, uint32_t& rate) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t h[44];
+  bool ok = fread(h, 1, 44, f) == 44 && memcmp(h, "RIFF", 4) == 0 && h[20] == 1 && h[22] == 1 && h[34] == 16;
+  if (ok) {
+    rate = h[24] | h[25] << 8 | h[26] << 16 | (uint32_t)h[27] << 24;
+    int16_t s[1024];
+    size_t n;
+    while ((n = fread(s, 2, 1024, f)) > 0) pcm.insert(pcm.end(), s, s + n);
+  }
+  fclose(f);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <host> <port> [turns] [file.wav] [--barge]\n", argv[0]);
+    return 2;
+  }
+  int turnCount = 3;
+  bool barge = false;
+  const char* wav = nullptr;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--barge") == 0) {
+      barge = true;
+    } else if (atoi(argv[i]) > 0) {
+      turnCount = atoi(argv[i]);
+    } else {
+      wav = argv[i];
+    }
+  }
+
+  std::vector<int16_t> pcm;
+  uint32_t rate = 16000;
+  if (wav) {
+    if (!loadWav(wav, pcm, rate)) {
+      fprintf(stderr, "%s: not a 16-bit mono PCM WAV\n", wav);
+      return 1;
+    }
+  } else {
+    for (uint32_t i = 0; i < rate * 2; i++) pcm.push_back((int16_t)(8000 * sin(2 * M_PI * 440 * i / rate)));
+  }
+
+  srandom(time(nullptr));
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(argv[2]));
+  inet_pton(AF_INET, argv[1], &addr.sin_addr);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  double connectStart = nowMs();
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    return 1;
+  }
+
+  static uint8_t rx[WsClient::RX_BUFFER_BYTES];
+  WsClient ws(rx, sockRead, sockWrite, randomWord, &fd);
+  Run run;
+  RealtimeSession session(ws, { onAudio, onEvent, &run });
+
+  std::string host = std::string(argv[1]) + ":" + argv[2];
+  std::string path = "/ws/google.ai.generativelanguage.v1beta.GenerativeService.BidiGenerateContent?key=stand-in";
+  if (!ws.start(host.c_str(), path.c_str())) return 1;
+  bool sentSetup = false;
+  while (!run.setupComplete && !run.closed && nowMs() - connectStart < 5000) {
+    if (!ws.poll()) break;
+    if (ws.state() == WsClient::STATE_OPEN && !sentSetup) {
+      sentSetup = session.setup("models/stand-in");
+      if (!sentSetup) break;
+    }
+    usleep(1000);
+  }
+  if (!run.setupComplete) {
+    fprintf(stderr, "no setupComplete (close code %u)\n", session.closeCode());
+    return 1;
+  }
+  printf("session ready in %.1f ms, %d turns of %.1f s at %u Hz%s\n", nowMs() - connectStart, turnCount,
+         pcm.size() / (double)rate, rate, barge ? ", barging in" : "");
+
+  uint32_t chunkSamples = rate * CHUNK_MS / 1000;
+  for (int n = 0; n < turnCount && !run.closed; n++) {
+    // With --barge every turn after the first starts over the answer
+    if (n > 0 && barge) {
+      Turn& prev = run.turns.back();
+      while (!run.closed && (prev.samples == 0 || nowMs() - prev.firstAudio < BARGE_AFTER_MS)) {
+        if (!ws.poll()) break;
+        usleep(1000);
+      }
+    }
+    run.turns.push_back(Turn());
+    if (!session.activityStart()) break;
+    double start = nowMs();
+    size_t sample = 0;
+    bool ok = true;
+    while (ok && sample < pcm.size()) {
+      // Pace like a microphone: a chunk exists once it has been spoken
+      if (start + (sample + chunkSamples) * 1000.0 / rate > nowMs()) {
+        ok = ws.poll();
+        usleep(1000);
+        continue;
+      }
+      size_t k = std::min<size_t>(chunkSamples, pcm.size() - sample);
+      ok = session.audio(pcm.data() + sample, k, rate) && ws.poll();
+      sample += k;
+    }
+    if (!ok || !session.activityEnd()) break;
+    Turn& t = run.turns.back();
+    t.endOfSpeech = nowMs();
+    bool last = n == turnCount - 1;
+    while (!run.closed && t.complete == 0 && !(barge && !last)) {
+      if (!ws.poll()) break;
+      if (nowMs() - t.endOfSpeech > 15000) break;
+      usleep(1000);
+    }
+  }
+  ws.close();
+  double closeStart = nowMs();
+  while (!run.closed && nowMs() - closeStart < 1000 && ws.poll()) usleep(1000);
+  close(fd);
+
+  std::vector<double> latencies;
+  int interrupted = 0;
+  bool ok = run.turns.size() == (size_t)turnCount;
+  for (size_t i = 0; i < run.turns.size(); i++) {
+    const Turn& t = run.turns[i];
+    if (t.samples == 0) {
+      printf("turn %zu  no answer audio\n", i + 1);
+      ok = false;
+      continue;
+    }
+    latencies.push_back(t.firstAudio - t.endOfSpeech);
+    interrupted += t.interrupted;
+    printf("turn %zu  first audio %.1f ms after the end of speech, %.2f s of answer at %u Hz%s\n", i + 1,
+           t.firstAudio - t.endOfSpeech, t.samples / (double)t.rate, t.rate,
+           t.interrupted ? ", interrupted" : t.complete > 0 ? "" : ", not completed");
+    if (!t.interrupted && t.complete == 0) ok = false;
+  }
+  if (barge && interrupted != turnCount - 1) ok = false;
+  std::sort(latencies.begin(), latencies.end());
+  printf("\n%s: close code %u\n", ok ? "ok" : "FAILED", session.closeCode());
+  if (!latencies.empty()) {
+    printf("turn latency     min %.1f ms, median %.1f ms, max %.1f ms\n", latencies.front(),
+           latencies[latencies.size() / 2], latencies.back());
+  }
+  if (barge) printf("interrupted      %d of %d answers\n", interrupted, turnCount - 1);
+  printf("bytes            %u sent, %u received in %u messages\n", ws.bytesSent(), ws.bytesReceived(),
+         session.messagesReceived());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+// Runs scripted utterances through speculation.h the way
+// onInterimTranscript() and takeSpeculativeAnswer() use it, on a simulated
+// clock with a Gemini request that takes a fixed time. Each script is a
+// timeline of interim results (text and recognizer stability) and a final
+// transcript, and names the outcome it must produce:
+// - a hit when the final asks what the stable interim asked, even with
+//   different case and punctuation, with the saved time equal to the
+//   part of the request that ran before the final arrived;
+// - a miss, and the real request, when the final's words differ;
+// - a restart when the user pauses mid-sentence and keeps talking: the
+//   stale guess is dropped once it lands and the full question is sent;
+// - no attempt for interims that never settle or are empty.
+// normalize() and the stability rule are also checked on their own.
+// Then reports, per script, the wait from the final transcript to the
+// answer with and without speculation.
+//
+//   g++ -O2 -std=c++17 -I.. -o speculation_check speculation_check.cpp
+//   ./speculation_check               # SPECULATION_* defaults, 1200 ms LLM
+//   ./speculation_check 600 150 0.6   # LLM ms, stable ms, min stability
+#include "speculation.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+static const uint32_t LOOP_MS = 50;  // How often the newest interim is fed again
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    failures++;
+    printf("FAIL %s\n", what);
+  }
+}
+
+static std::string normalize(const std::string& text) {
+  std::vector<char> buf(text.size() + 1);
+  size_t n = speculative::normalize(text.c_str(), text.size(), buf.data());
+  return std::string(buf.data(), n);
+}
+
+//----------------------------------------------------------------------
+// Scripts
+//----------------------------------------------------------------------
+
+struct Interim {
+  uint32_t ms;
+  const char* text;
+  float stability;
+};
+
+enum Outcome { HIT, MISS, NONE };
+
+struct Script {
+  const char* name;
+  std::vector<Interim> interims;
+  uint32_t finalMs;
+  const char* final;
+  Outcome expect;
+  int attempts;  // Speculative requests started
+};
+
+static const char* const OUTCOMES[] = { "hit", "miss", "none" };
+
+static std::vector<Script> scripts() {
+  return {
+    { "settles, then final",
+      { { 0, "what's", 0.1f }, { 300, "what's the weather", 0.2f }, { 600, "what's the weather in Paris", 0.3f } },
+      1400, "What's the weather in Paris?", HIT, 1 },
+    { "recognizer sure at once",
+      { { 0, "turn", 0.1f }, { 250, "turn on the lights", 0.9f } },
+      600, "Turn on the lights.", HIT, 1 },
+    { "pause mid-sentence",
+      { { 0, "set a timer", 0.1f }, { 200, "set a timer for", 0.2f }, { 1400, "set a timer for ten minutes", 0.3f } },
+      2200, "Set a timer for ten minutes.", HIT, 2 },
+    { "last word revised",
+      { { 0, "call", 0.1f }, { 300, "call mom", 0.3f } },
+      1100, "Call Tom.", MISS, 1 },
+    { "never settles",
+      { { 0, "tell", 0.1f }, { 200, "tell me", 0.1f }, { 400, "tell me a", 0.1f }, { 600, "tell me a joke", 0.1f } },
+      800, "Tell me a joke.", NONE, 0 },
+    { "only noise",
+      { { 0, "", 0.9f }, { 300, "...", 0.9f } },
+      900, "", NONE, 0 },
+  };
+}
+
+//----------------------------------------------------------------------
+// Simulation
+//----------------------------------------------------------------------
+
+struct Options {
+  uint32_t llmMs = 1200;
+  uint32_t stableMs = 400;   // SPECULATION_STABLE_MS
+  float minStability = 0.8f; // SPECULATION_MIN_STABILITY
+};
+
+enum SpecState { SPEC_IDLE, SPEC_RUNNING, SPEC_DONE };
+
+struct Result {
+  Outcome outcome;
+  int attempts;
+  uint32_t savedMs;
+  uint32_t waitMs;  // Final transcript to answer
+};
+
+static Result run(const Script& s, const Options& o) {
+  speculative::StableInterim interim(o.minStability, o.stableMs);
+  SpecState state = SPEC_IDLE;
+  bool cancelled = false;
+  std::string query;
+  uint32_t startedAt = 0;
+  Result r = { NONE, 0, 0, o.llmMs };
+
+  size_t next = 0;
+  const char* newest = nullptr;
+  float stability = 0;
+  for (uint32_t now = 0; now < s.finalMs; now++) {
+    // The request in flight lands; a cancelled one is discarded
+    if (state == SPEC_RUNNING && now - startedAt >= o.llmMs) state = cancelled ? SPEC_IDLE : SPEC_DONE;
+
+    bool arrived = next < s.interims.size() && s.interims[next].ms == now;
+    if (arrived) {
+      newest = s.interims[next].text;
+      stability = s.interims[next].stability;
+      next++;
+    }
+    if (!newest || (!arrived && now % LOOP_MS)) continue;
+
+    // onInterimTranscript()
+    std::string normalized = normalize(newest);
+    if (!interim.update(normalized.c_str(), normalized.size(), stability, now)) continue;
+    if (state != SPEC_IDLE) {
+      if (query == normalized || cancelled) continue;
+      if (state == SPEC_RUNNING) {
+        cancelled = true;
+        continue;
+      }
+      state = SPEC_IDLE;
+    }
+    query = normalized;
+    cancelled = false;
+    startedAt = now;
+    state = SPEC_RUNNING;
+    r.attempts++;
+  }
+
+  // takeSpeculativeAnswer()
+  if (state == SPEC_IDLE || cancelled) return r;
+  if (normalize(s.final) != query) {
+    r.outcome = MISS;
+    return r;
+  }
+  r.outcome = HIT;
+  r.savedMs = speculative::savedMs(startedAt, o.llmMs, s.finalMs);
+  uint32_t doneAt = startedAt + o.llmMs;
+  r.waitMs = doneAt > s.finalMs ? doneAt - s.finalMs : 0;
+  return r;
+}
+
+//----------------------------------------------------------------------
+// Checks
+//----------------------------------------------------------------------
+
+static void rules() {
+  check(normalize("  What's   the\tWeather?!") == "whats the weather", "normalize() does not fold case, punctuation and spaces");
+  check(normalize("...") == "" && normalize("") == "", "normalize() leaves text in punctuation-only input");
+  check(normalize("caf\xc3\xa9 22") == "caf\xc3\xa9 22", "normalize() mangles UTF-8 or digits");
+
+  speculative::StableInterim interim(0.8f, 400);
+  check(!interim.update("hi", 2, 0.1f, 1000), "a new interim is stable at once");
+  check(!interim.update("hi", 2, 0.1f, 1399), "an interim is stable before stableMs");
+  check(interim.update("hi", 2, 0.1f, 1400), "an interim unchanged for stableMs is not stable");
+  check(!interim.update("hi there", 8, 0.1f, 1500), "a changed interim keeps the old timer");
+  check(interim.update("hi there", 8, 0.8f, 1501), "minStability does not make an interim stable");
+  check(!interim.update("", 0, 1.0f, 5000), "empty text is stable");
+
+  check(speculative::savedMs(1000, 1200, 1500) == 500, "savedMs() counts more than the lead over the final");
+  check(speculative::savedMs(1000, 300, 1500) == 300, "savedMs() counts more than the request took");
+}
+
+int main(int argc, char** argv) {
+  Options o;
+  if (argc > 1) o.llmMs = atoi(argv[1]);
+  if (argc > 2) o.stableMs = atoi(argv[2]);
+  if (argc > 3) o.minStability = atof(argv[3]);
+  bool defaults = argc == 1;
+
+  rules();
+
+  printf("LLM %u ms, stable after %u ms or at stability %.2f\n", o.llmMs, o.stableMs, o.minStability);
+  printf("  %-26s %-5s %8s %8s %11s %11s\n", "", "", "attempts", "saved", "wait", "without");
+  int hits = 0;
+  for (const Script& s : scripts()) {
+    Result r = run(s, o);
+    printf("  %-26s %-5s %8d %5u ms %8u ms %8u ms\n", s.name, OUTCOMES[r.outcome], r.attempts, r.savedMs, r.waitMs,
+           o.llmMs);
+    if (r.outcome == HIT) hits++;
+    // The scripts are timed for the defaults; other settings only report
+    if (defaults && (r.outcome != s.expect || r.attempts != s.attempts)) {
+      failures++;
+      printf("FAIL %s: %s after %d attempts, expected %s after %d\n", s.name, OUTCOMES[r.outcome], r.attempts,
+             OUTCOMES[s.expect], s.attempts);
+    }
+    if (r.outcome == HIT && r.savedMs + r.waitMs != o.llmMs) {
+      failures++;
+      printf("FAIL %s: saved and waited time do not add up to the request\n", s.name);
+    }
+  }
+  printf("%d hits of %zu\n", hits, scripts().size());
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
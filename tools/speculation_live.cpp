@@ -0,0 +1,403 @@
+// Runs speculative Gemini queries the way the firmware does, against the
+// local stand-ins: audio streams to tools/stt_standin.py through
+// h2_client.h and speech_grpc.h, interim results go through
+// speculation.h, and a stable interim starts a generateContent request to
+// tools/cache_standin.py on a worker thread, as speculationTask() does.
+// When the final transcript arrives it either takes the speculative answer
+// or cancels it and asks again, as takeSpeculativeAnswer() does. Each run
+// also makes the plain request after the final transcript, for the
+// latency without speculation.
+//
+// Reports attempts, hits and misses, the time saved, and the wait from the
+// final transcript to the answer with and without speculation. The
+// stand-in's interims grow by two words every half second; lower
+// --stable-ms or --min-stability to see misses on half-finished questions.
+//
+//   ./stt_standin.py --port 50051 & ./cache_standin.py --port 8090 --llm-ms 1200 &
+//   g++ -O2 -std=c++17 -I.. -o speculation_live speculation_live.cpp -lpthread
+//   ./speculation_live 127.0.0.1 50051 127.0.0.1 8090
+//   ./speculation_live 127.0.0.1 50051 127.0.0.1 8090 --runs 10 --seconds 2 --stable-ms 150
+#include "h2_client.h"
+#include "json_body.h"
+#include "speculation.h"
+#include "speech_grpc.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint32_t CHUNK_MS = 100;  // STT_STREAM_CHUNK_MS
+static const uint32_t RATE = 16000;
+static const char* const GEMINI_PATH = "/v1beta/models/gemini-pro:generateContent?key=stand-in";
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int connectTo(const char* host, const char* port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(port));
+  inet_pton(AF_INET, host, &addr.sin_addr);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int32_t sockWrite(void* io, const uint8_t* data, uint32_t len) {
+  int fd = *(int*)io;
+  uint32_t sent = 0;
+  while (sent < len) {
+    ssize_t n = ::send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    sent += n;
+  }
+  return len;
+}
+
+static int32_t sockRead(void* io, uint8_t* buf, uint32_t len) {
+  ssize_t n = ::recv(*(int*)io, buf, len, MSG_DONTWAIT);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+  return n == 0 ? -1 : n;
+}
+
+//----------------------------------------------------------------------
+// generateContent, as fetchGeminiAnswer() sends it
+//----------------------------------------------------------------------
+
+static const char* geminiHost;
+static const char* geminiPort;
+
+// True on a 200 with its whole body read
+static bool askGemini(const std::string& question) {
+  int fd = connectTo(geminiHost, geminiPort);
+  if (fd < 0) return false;
+  JsonBody payload;
+  payload.raw("{\"contents\":[{\"parts\":[{\"text\":").string(question.c_str(), question.size()).raw("}]}]}");
+  std::string body(payload.size(), '\0');
+  body.resize(payload.read((uint8_t*)&body[0], body.size()));
+  char head[256];
+  snprintf(head, sizeof(head),
+           "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+           "Connection: close\r\n\r\n",
+           GEMINI_PATH, geminiHost, body.size());
+  std::string request = head + body;
+  bool ok = sockWrite(&fd, (const uint8_t*)request.data(), request.size()) == (int32_t)request.size();
+
+  std::string response;
+  char chunk[16384];
+  ssize_t n;
+  while (ok && (n = recv(fd, chunk, sizeof(chunk), 0)) > 0) response.append(chunk, n);
+  close(fd);
+  size_t end = response.find("\r\n\r\n");
+  const char* length = strcasestr(response.c_str(), "\r\nContent-Length:");
+  return ok && response.compare(0, 12, "HTTP/1.1 200") == 0 && end != std::string::npos && length
+         && response.size() - end - 4 == strtoul(length + 17, nullptr, 10);
+}
+
+//----------------------------------------------------------------------
+// Speculation, as onInterimTranscript() and takeSpeculativeAnswer() run it
+//----------------------------------------------------------------------
+
+enum SpeculationState { SPEC_IDLE, SPEC_RUNNING, SPEC_DONE };
+
+struct Speculation {
+  std::atomic<int> state{ SPEC_IDLE };
+  std::atomic<bool> cancelled{ false };
+  std::string query;
+  bool ok = false;
+  double startedAt = 0;
+  double durationMs = 0;
+  double doneAt = 0;
+  std::vector<std::thread> workers;  // Cancelled requests run on and are joined at the end of a run
+};
+
+struct Totals {
+  int attempts = 0;
+  int hits = 0;
+  int misses = 0;
+  double savedMs = 0;
+};
+
+static Speculation spec;
+static Totals totals;
+static double runStart;
+
+static void speculationTask() {
+  bool ok = askGemini(spec.query);
+  spec.durationMs = nowMs() - spec.startedAt;
+  spec.doneAt = nowMs();
+  if (spec.cancelled) {
+    spec.state = SPEC_IDLE;
+  } else {
+    spec.ok = ok;
+    spec.state = SPEC_DONE;
+  }
+}
+
+static void cancelSpeculation() {
+  if (spec.state == SPEC_RUNNING) {
+    spec.cancelled = true;
+  } else {
+    spec.state = SPEC_IDLE;
+  }
+}
+
+static std::string normalize(const std::string& text) {
+  std::string out(text.size() + 1, '\0');
+  out.resize(speculative::normalize(text.data(), text.size(), &out[0]));
+  return out;
+}
+
+static void onInterimTranscript(speculative::StableInterim& interim, const std::string& text, float stability) {
+  std::string normalized = normalize(text);
+  if (!interim.update(normalized.data(), normalized.size(), stability, (uint32_t)nowMs())) return;
+
+  if (spec.state != SPEC_IDLE) {
+    if (spec.query == normalized || spec.cancelled) return;
+    cancelSpeculation();
+    if (spec.state != SPEC_IDLE) return;
+  }
+  spec.query = normalized;
+  spec.cancelled = false;
+  spec.startedAt = nowMs();
+  spec.state = SPEC_RUNNING;
+  spec.workers.emplace_back(speculationTask);
+  totals.attempts++;
+  printf("%8.0f ms  speculate \"%s\"\n", nowMs() - runStart, normalized.c_str());
+}
+
+// Returns the outcome and sets waitMs: final transcript to answer
+static const char* takeAnswer(const std::string& finalTranscript, double finalAt, double& waitMs) {
+  const char* outcome = "none";
+  if (spec.state != SPEC_IDLE && !spec.cancelled) {
+    if (normalize(finalTranscript) != spec.query) {
+      totals.misses++;
+      cancelSpeculation();
+      outcome = "miss";
+    } else {
+      while (spec.state == SPEC_RUNNING) usleep(1000);
+      bool ok = spec.ok;
+      spec.state = SPEC_IDLE;
+      if (ok) {
+        totals.hits++;
+        totals.savedMs += speculative::savedMs((uint32_t)spec.startedAt, (uint32_t)spec.durationMs, (uint32_t)finalAt);
+        waitMs = spec.doneAt > finalAt ? spec.doneAt - finalAt : 0;
+        return "hit";
+      }
+      totals.misses++;
+      outcome = "failed";
+    }
+  }
+  askGemini(finalTranscript);
+  waitMs = nowMs() - finalAt;
+  return outcome;
+}
+
+//----------------------------------------------------------------------
+// One utterance streamed to the recognizer
+//----------------------------------------------------------------------
+
+struct Call {
+  std::string interim;
+  float stability = 0;
+  bool fresh = false;
+  int interims = 0;
+  std::string transcript;
+  double finalAt = 0;
+  bool closed = false;
+};
+
+static SpeechGrpcReader* reader;
+
+static void onResult(void* ctx, const SpeechGrpcReader::Result& r) {
+  Call* c = (Call*)ctx;
+  std::string text(r.transcript, r.transcriptLen);
+  if (r.isFinal) {
+    c->transcript += text;
+    c->finalAt = nowMs();
+  } else {
+    c->interim = text;
+    c->stability = r.stability;
+    c->fresh = true;
+    c->interims++;
+  }
+}
+
+static void onHeader(void*, const char*, size_t, const char*, size_t) {}
+
+static void onData(void*, const uint8_t* data, size_t len) {
+  reader->feed(data, len);
+}
+
+static void onClosed(void* ctx, uint32_t) {
+  ((Call*)ctx)->closed = true;
+}
+
+struct Options {
+  int runs = 5;
+  double seconds = 4;
+  uint32_t stableMs = 400;      // SPECULATION_STABLE_MS
+  float minStability = 0.8f;    // SPECULATION_MIN_STABILITY
+};
+
+// Streams one utterance; false if the recognizer could not be reached
+static bool runOnce(const char* host, const char* port, const Options& o, Call& call) {
+  int fd = connectTo(host, port);
+  if (fd < 0) return false;
+  static uint8_t rx[H2Client::RX_BUFFER_BYTES];
+  static uint8_t messages[2048];
+  H2Client h2(rx, sockRead, sockWrite, &fd);
+  SpeechGrpcReader grpcReader(messages, sizeof(messages), onResult, &call);
+  reader = &grpcReader;
+
+  std::string authority = std::string(host) + ":" + port;
+  H2Client::Header headers[] = {
+    { ":method", "POST" },
+    { ":scheme", "http" },
+    { ":path", SpeechGrpc::path() },
+    { ":authority", authority.c_str() },
+    { "content-type", "application/grpc" },
+    { "te", "trailers" },
+    { "x-goog-api-key", "stand-in" },
+  };
+  H2Client::Handler handler = { onHeader, onData, onClosed, &call };
+  uint32_t id = h2.start() ? h2.request(headers, sizeof(headers) / sizeof(headers[0]), false, handler) : 0;
+  if (!id) {
+    close(fd);
+    return false;
+  }
+
+  // resetSpeculation() at the start of a recording
+  speculative::StableInterim interim(o.minStability, o.stableMs);
+  cancelSpeculation();
+
+  const size_t total = (size_t)(RATE * o.seconds);
+  const uint32_t chunkSamples = RATE * CHUNK_MS / 1000;
+  std::vector<uint8_t> chunk(SpeechGrpc::AUDIO_PREFIX_MAX + chunkSamples * 2);
+  std::vector<int16_t> pcm(chunkSamples);
+  size_t chunkLen = SpeechGrpc::configRequest(chunk.data(), RATE, "en-US", false, true);
+  size_t chunkPos = 0;
+  size_t sample = 0;
+  bool audioDone = false;
+  double start = nowMs();
+  runStart = start;
+  double polledAt = 0;
+  while (!call.closed) {
+    if (chunkPos == chunkLen && !audioDone) {
+      if (start + (sample + chunkSamples) * 1000.0 / RATE > nowMs() && sample < total) {
+        if (!h2.poll()) break;
+        usleep(1000);
+      } else {
+        size_t n = total - sample < chunkSamples ? total - sample : chunkSamples;
+        for (size_t i = 0; i < n; i++) pcm[i] = (int16_t)(8000 * sin(2 * M_PI * 440 * (sample + i) / RATE));
+        size_t prefix = SpeechGrpc::audioPrefix(chunk.data(), n * 2);
+        memcpy(chunk.data() + prefix, pcm.data(), n * 2);
+        chunkLen = prefix + n * 2;
+        chunkPos = 0;
+        sample += n;
+      }
+    }
+    bool last = sample == total;
+    if (chunkPos < chunkLen || (last && !audioDone)) {
+      int32_t n = h2.send(id, chunk.data() + chunkPos, chunkLen - chunkPos, last);
+      if (n < 0) break;
+      chunkPos += n;
+      if (last && chunkPos == chunkLen) audioDone = true;
+    }
+    if (!h2.poll()) break;
+
+    // pollStreamInterim(): fresh results at once, unchanged ones every chunk
+    if (!call.interim.empty() && call.finalAt == 0 && (call.fresh || nowMs() - polledAt >= CHUNK_MS)) {
+      polledAt = nowMs();
+      call.fresh = false;
+      onInterimTranscript(interim, call.interim, call.stability);
+    }
+    if (audioDone || h2.sendable(id) == 0) usleep(1000);
+  }
+  h2.close();
+  close(fd);
+  return call.finalAt > 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 5) {
+    fprintf(stderr,
+            "usage: %s <stt-host> <stt-port> <gemini-host> <gemini-port> [--runs N] [--seconds S]"
+            " [--stable-ms MS] [--min-stability X]\n",
+            argv[0]);
+    return 2;
+  }
+  geminiHost = argv[3];
+  geminiPort = argv[4];
+  Options o;
+  for (int i = 5; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--runs") == 0) o.runs = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--seconds") == 0) o.seconds = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--stable-ms") == 0) o.stableMs = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--min-stability") == 0) o.minStability = atof(argv[i + 1]);
+  }
+
+  std::vector<double> withSpeculation;
+  std::vector<double> without;
+  for (int run = 1; run <= o.runs; run++) {
+    printf("run %d\n", run);
+    Call call;
+    if (!runOnce(argv[1], argv[2], o, call)) {
+      fprintf(stderr, "no final transcript from %s:%s\n", argv[1], argv[2]);
+      return 1;
+    }
+    double waitMs = 0;
+    const char* outcome = takeAnswer(call.transcript, call.finalAt, waitMs);
+    for (std::thread& t : spec.workers) t.join();
+    spec.workers.clear();
+    spec.state = SPEC_IDLE;
+    spec.cancelled = false;
+
+    double start = nowMs();
+    bool ok = askGemini(call.transcript);
+    double plainMs = nowMs() - start;
+    if (!ok) {
+      fprintf(stderr, "generateContent failed at %s:%s\n", geminiHost, geminiPort);
+      return 1;
+    }
+    withSpeculation.push_back(waitMs);
+    without.push_back(plainMs);
+    printf("          %d interims, final \"%s\": %s, answer %.0f ms after it (%.0f ms without speculation)\n",
+           call.interims, call.transcript.c_str(), outcome, waitMs, plainMs);
+  }
+
+  double meanWith = 0;
+  double meanWithout = 0;
+  for (size_t i = 0; i < without.size(); i++) {
+    meanWith += withSpeculation[i] / without.size();
+    meanWithout += without[i] / without.size();
+  }
+  printf("\n%d runs, %.1f s of audio, stable after %u ms or at stability %.2f\n", o.runs, o.seconds, o.stableMs,
+         o.minStability);
+  printf("speculation      %d attempts, %d hits, %d misses, %.0f ms saved (%.0f per hit)\n", totals.attempts,
+         totals.hits, totals.misses, totals.savedMs, totals.hits ? totals.savedMs / totals.hits : 0);
+  printf("answer wait      %.0f ms after the final transcript, %.0f ms without speculation\n", meanWith, meanWithout);
+  return 0;
+}
@@ -0,0 +1,201 @@
+// Runs answers through speech_text.h the way spokenText() does and checks
+// the result: a table of rewrites the voice depends on (ranges, phone
+// numbers, dates, abbreviations, markup), identical output whatever size
+// of pieces the text arrives in, and no markup left in the output. Then
+// reports bytes in and out and normalizer speed over the corpus.
+//
+// The built-in corpus is a handful of answers in the shape Gemini gives
+// them. Files named on the command line, one answer each, replace it.
+//
+//   g++ -O2 -std=c++17 -I.. -o speech_text_check speech_text_check.cpp
+//   ./speech_text_check                    # built-in corpus
+//   ./speech_text_check answers/*.md       # recorded answers
+#include "speech_text.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+static double cpuMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+struct Output {
+  std::string text;
+  int sentences = 0;
+};
+
+static void collect(void* ctx, const char* text, size_t len, bool sentenceEnd) {
+  Output* out = (Output*)ctx;
+  out->text.append(text, len);
+  if (sentenceEnd) out->sentences++;
+}
+
+// Feeds text in pieces of chunk bytes
+static std::string normalize(const std::string& text, size_t chunk) {
+  Output out;
+  SpeechText normalizer(collect, &out);
+  for (size_t i = 0; i < text.size(); i += chunk) {
+    normalizer.write(text.data() + i, text.size() - i < chunk ? text.size() - i : chunk);
+  }
+  normalizer.finish();
+  return out.text;
+}
+
+static int failures = 0;
+
+//----------------------------------------------------------------------
+// Rewrites
+//----------------------------------------------------------------------
+
+struct Case {
+  const char* in;
+  const char* out;
+};
+
+static const Case cases[] = {
+  // Ranges: short numbers, one hyphen, low to high
+  { "Steep it for 3-5 minutes.", "Steep it for 3 to 5 minutes." },
+  { "Use 10-20% less.", "Use 10 to 20 percent less." },
+  { "It ran from 1990-2000.", "It ran from 1990 to 2000." },
+  { "Pages (12-14) cover it.", "Pages (12 to 14) cover it." },
+  // Left alone: phone numbers, dates, codes, backwards or zero-padded pairs
+  { "Call 555-1234 today.", "Call 555-1234 today." },
+  { "Call 1-800-555-1234 today.", "Call 1-800-555-1234 today." },
+  { "It opened 2024-05-01.", "It opened 2024-05-01." },
+  { "Since 2024-05 it is open.", "Since 2024-05 it is open." },
+  { "The score was 5-3.", "The score was 5-3." },
+  { "Room 07-12 is free.", "Room 07-12 is free." },
+  { "It is COVID-19 related.", "It is COVID-19 related." },
+  { "Try the A4-5 route.", "Try the A4-5 route." },
+  // Symbols and abbreviations
+  { "Salt & pepper, e.g. to taste.", "Salt and pepper, for example to taste." },
+  { "Heat to 180°C.", "Heat to 180 degrees C." },
+  { "Apples, pears, etc.", "Apples, pears, et cetera." },
+  // Markup
+  { "## Steps\n1. Boil **water**\n2. Add `tea`", "Steps. Boil water. Add tea." },
+  { "See [the guide](https://example.com/x) or www.example.com.", "See the guide or link." },
+  { "```\ncode();\n```\nDone", "Done." },
+};
+
+static void checkCases() {
+  for (const Case& c : cases) {
+    std::string got = normalize(c.in, 1000);
+    if (got != c.out) {
+      failures++;
+      printf("FAIL \"%s\"\n  want \"%s\"\n  got  \"%s\"\n", c.in, c.out, got.c_str());
+    }
+  }
+  printf("rewrites:  %zu cases\n", sizeof(cases) / sizeof(cases[0]));
+}
+
+//----------------------------------------------------------------------
+// Corpus
+//----------------------------------------------------------------------
+
+static const char* const builtin[] = {
+  "Here's how to make a great cup of tea:\n\n"
+  "## What you need\n"
+  "* Fresh, cold water\n"
+  "* 1 tea bag (or 1-2 tsp loose leaf)\n"
+  "* A mug, e.g. a ceramic one\n\n"
+  "## Steps\n"
+  "1. **Boil** the water. For black tea aim for 95-100°C; green tea prefers 70-80°C.\n"
+  "2. Steep for *3-5 minutes*. Longer than that and it turns bitter.\n"
+  "3. Remove the bag & add milk if you like.\n\n"
+  "> Tip: warming the mug first keeps the tea hot about 20% longer.\n",
+
+  "The **Eiffel Tower** was built between 1887-1889 for the World's Fair. "
+  "It is 330 m tall (about 1,083 ft) and was the tallest structure in the world until 1930.\n\n"
+  "| Fact | Value |\n|---|---|\n| Height | 330 m |\n| Visitors per year | ~7 million |\n\n"
+  "You can read more on [the official site](https://www.toureiffel.paris/en). "
+  "Tickets sell out, so book 2-3 weeks ahead, i.e. before you travel.\n",
+
+  "To reverse a string in Python you can use slicing:\n\n"
+  "```python\ns = \"hello\"\nprint(s[::-1])\n```\n\n"
+  "This works because `[::-1]` steps backwards through the string. "
+  "For very long strings (10-100 MB) it still runs in linear time.\n",
+
+  "Sure! Our support line is 555-0142 and the office opened on 2021-09-13. "
+  "Hours are 9-5 on weekdays. Dr. Smith vs. Mr. Jones: both are in St. Paul.\n\n"
+  "- Call before 10 am\n- Have your order No. ready\n- Expect a reply in 1-2 days\n",
+};
+
+static bool readFile(const char* path, std::string& out) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+static void checkCorpus(const std::vector<std::string>& corpus) {
+  static const size_t chunks[] = { 1, 3, 7, 64, 1000 };
+  size_t bytesIn = 0;
+  size_t bytesOut = 0;
+  for (size_t i = 0; i < corpus.size(); i++) {
+    const std::string& answer = corpus[i];
+    std::string whole = normalize(answer, answer.size() + 1);
+    for (size_t chunk : chunks) {
+      if (normalize(answer, chunk) != whole) {
+        failures++;
+        printf("FAIL answer %zu: output differs when fed %zu bytes at a time\n", i, chunk);
+      }
+    }
+    if (whole.find_first_of("*`#|") != std::string::npos || whole.find("http") != std::string::npos) {
+      failures++;
+      printf("FAIL answer %zu: markup left in \"%s\"\n", i, whole.c_str());
+    }
+    bytesIn += answer.size();
+    bytesOut += whole.size();
+  }
+
+  // Time repeated passes over the whole corpus
+  int passes = 0;
+  double start = cpuMicros();
+  double elapsed = 0;
+  Output sink;
+  while (elapsed < 500000) {
+    for (const std::string& answer : corpus) {
+      sink.text.clear();
+      SpeechText normalizer(collect, &sink);
+      normalizer.write(answer.data(), answer.size());
+      normalizer.finish();
+    }
+    passes++;
+    elapsed = cpuMicros() - start;
+  }
+  printf("corpus:    %zu answers, %zu bytes in, %zu out (%.0f%%), same output in pieces of 1-1000 bytes\n",
+         corpus.size(), bytesIn, bytesOut, 100.0 * bytesOut / bytesIn);
+  printf("speed:     %.1f MB/s, %.1f us per answer\n", bytesIn * (double)passes / elapsed,
+         elapsed / passes / corpus.size());
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> corpus;
+  for (int i = 1; i < argc; i++) {
+    std::string text;
+    if (!readFile(argv[i], text)) {
+      perror(argv[i]);
+      return 1;
+    }
+    corpus.push_back(text);
+  }
+  if (corpus.empty()) corpus.assign(builtin, builtin + sizeof(builtin) / sizeof(builtin[0]));
+
+  checkCases();
+  checkCorpus(corpus);
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,233 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Speech-to-Text StreamingRecognize endpoint.
+
+Speaks HTTP/2 over plain TCP (prior knowledge, no TLS) so h2_client.h and
+speech_grpc.h can be exercised on a Linux host. For every half second of
+audio received it answers with a scripted interim result of growing length;
+once the client ends its side of the stream it waits --final-delay-ms, as
+the real service does while it finishes recognition, then sends the final
+result and the grpc-status trailers. A small --window forces the client
+through flow control.
+
+    pip install h2
+    ./stt_standin.py --port 50051 --window 8192
+"""
+import argparse
+import socket
+import struct
+import threading
+import time
+
+import h2.config
+import h2.connection
+import h2.events
+import h2.settings
+
+PATH = "/google.cloud.speech.v1.Speech/StreamingRecognize"
+SCRIPT = "what is the weather like in Lisbon tomorrow morning"
+
+
+def varint(v):
+    out = bytearray()
+    while v >= 0x80:
+        out.append((v & 0x7F) | 0x80)
+        v >>= 7
+    out.append(v)
+    return bytes(out)
+
+
+def field_bytes(number, data):
+    return varint(number << 3 | 2) + varint(len(data)) + data
+
+
+def field_varint(number, v):
+    return varint(number << 3) + varint(v)
+
+
+def field_float(number, f):
+    return varint(number << 3 | 5) + struct.pack("<f", f)
+
+
+def read_varint(data, pos):
+    v = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7F) << shift
+        if not b & 0x80:
+            return v, pos
+        shift += 7
+
+
+def fields(data):
+    pos = 0
+    while pos < len(data):
+        key, pos = read_varint(data, pos)
+        number, wire = key >> 3, key & 7
+        if wire == 0:
+            value, pos = read_varint(data, pos)
+        elif wire == 2:
+            n, pos = read_varint(data, pos)
+            value, pos = data[pos:pos + n], pos + n
+        elif wire == 5:
+            value, pos = data[pos:pos + 4], pos + 4
+        elif wire == 1:
+            value, pos = data[pos:pos + 8], pos + 8
+        else:
+            raise ValueError("wire type %d" % wire)
+        yield number, wire, value
+
+
+def response(transcript, is_final, stability=0.0, confidence=0.0):
+    alternative = field_bytes(1, transcript.encode())
+    if is_final:
+        alternative += field_float(2, confidence)
+    result = field_bytes(1, alternative)
+    if is_final:
+        result += field_varint(2, 1)
+    else:
+        result += field_float(3, stability)
+    message = field_bytes(2, result)
+    return b"\0" + struct.pack(">I", len(message)) + message
+
+
+class Call:
+    def __init__(self, stream_id, headers):
+        self.stream_id = stream_id
+        self.headers = headers
+        self.buffer = b""
+        self.config = None
+        self.audio_bytes = 0
+        self.messages = 0
+        self.interims = 0
+        self.ended_at = None
+        self.done = False
+
+    def messages_in(self, data):
+        self.buffer += data
+        while len(self.buffer) >= 5:
+            flag, length = self.buffer[0], struct.unpack(">I", self.buffer[1:5])[0]
+            if len(self.buffer) < 5 + length:
+                return
+            message, self.buffer = self.buffer[5:5 + length], self.buffer[5 + length:]
+            if flag:
+                raise ValueError("compressed message")
+            self.messages += 1
+            yield message
+
+
+def parse_config(message):
+    config = {}
+    for number, _, value in fields(message):
+        if number != 1:
+            raise ValueError("first message has no streaming_config")
+        for n, _, v in fields(value):
+            if n == 1:
+                for k, _, x in fields(v):
+                    config[{1: "encoding", 2: "sample_rate_hertz", 3: "language_code"}.get(k, k)] = x
+            elif n == 2:
+                config["single_utterance"] = v
+            elif n == 3:
+                config["interim_results"] = v
+    return config
+
+
+def serve(sock, args):
+    settings = {h2.settings.SettingCodes.INITIAL_WINDOW_SIZE: args.window}
+    conn = h2.connection.H2Connection(h2.config.H2Configuration(client_side=False, header_encoding="utf-8"))
+    conn.initiate_connection()
+    conn.update_settings(settings)
+    sock.sendall(conn.data_to_send())
+    calls = {}
+    sock.settimeout(0.02)
+    words = SCRIPT.split()
+
+    while True:
+        try:
+            data = sock.recv(65536)
+            if not data:
+                return
+        except socket.timeout:
+            data = None
+        events = conn.receive_data(data) if data else []
+        for event in events:
+            if isinstance(event, h2.events.RequestReceived):
+                headers = dict(event.headers)
+                call = Call(event.stream_id, headers)
+                calls[event.stream_id] = call
+                problem = None
+                if headers.get(":path") != PATH:
+                    problem = 12  # UNIMPLEMENTED
+                elif headers.get("content-type") != "application/grpc" or headers.get("te") != "trailers":
+                    problem = 3  # INVALID_ARGUMENT
+                elif not headers.get("x-goog-api-key"):
+                    problem = 16  # UNAUTHENTICATED
+                conn.send_headers(event.stream_id, [(":status", "200"), ("content-type", "application/grpc")])
+                if problem:
+                    conn.send_headers(event.stream_id, [("grpc-status", str(problem))], end_stream=True)
+                    call.done = True
+                print("stream %d %s key=%s" % (event.stream_id, headers.get(":path"), bool(headers.get("x-goog-api-key"))))
+            elif isinstance(event, h2.events.DataReceived):
+                conn.acknowledge_received_data(event.flow_controlled_length, event.stream_id)
+                call = calls.get(event.stream_id)
+                if not call or call.done:
+                    continue
+                for message in call.messages_in(event.data):
+                    if call.config is None:
+                        call.config = parse_config(message)
+                        print("stream %d config %s" % (call.stream_id, call.config))
+                        continue
+                    for number, _, value in fields(message):
+                        if number == 2:
+                            call.audio_bytes += len(value)
+                rate = call.config.get("sample_rate_hertz", 16000) if call.config else 16000
+                due = call.audio_bytes // rate  # One interim per half second of 16-bit audio
+                while call.config and call.config.get("interim_results") and call.interims < due:
+                    call.interims += 1
+                    text = " ".join(words[:min(len(words), call.interims * 2)])
+                    conn.send_data(call.stream_id, response(text, False, min(0.9, 0.1 * call.interims)))
+            elif isinstance(event, h2.events.StreamEnded):
+                call = calls.get(event.stream_id)
+                if call and not call.done:
+                    call.ended_at = time.monotonic()
+            elif isinstance(event, h2.events.StreamReset):
+                calls.pop(event.stream_id, None)
+                print("stream %d reset by client" % event.stream_id)
+            elif isinstance(event, h2.events.ConnectionTerminated):
+                sock.sendall(conn.data_to_send())
+                return
+
+        now = time.monotonic()
+        for call in list(calls.values()):
+            if call.ended_at and not call.done and now - call.ended_at >= args.final_delay_ms / 1000.0:
+                call.done = True
+                seconds = call.audio_bytes / 2.0 / call.config.get("sample_rate_hertz", 16000)
+                conn.send_data(call.stream_id, response(SCRIPT, True, confidence=0.93))
+                conn.send_headers(call.stream_id, [("grpc-status", "0")], end_stream=True)
+                print("stream %d final after %.1f s of audio, %d messages, %d interims"
+                      % (call.stream_id, seconds, call.messages, call.interims))
+        out = conn.data_to_send()
+        if out:
+            sock.sendall(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=50051)
+    parser.add_argument("--window", type=int, default=65535, help="INITIAL_WINDOW_SIZE offered to the client")
+    parser.add_argument("--final-delay-ms", type=int, default=150)
+    args = parser.parse_args()
+
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listener.bind(("127.0.0.1", args.port))
+    listener.listen(4)
+    print("listening on 127.0.0.1:%d" % args.port)
+    while True:
+        sock, _ = listener.accept()
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        threading.Thread(target=serve, args=(sock, args), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
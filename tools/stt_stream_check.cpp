@@ -0,0 +1,222 @@
+// Streams audio through h2_client.h and speech_grpc.h the way the firmware
+// does, against tools/stt_standin.py or any plaintext HTTP/2 gRPC server,
+// and reports the interim results and the time from the end of audio to
+// the final transcript.
+//
+//   g++ -O2 -std=c++17 -I.. -o stt_stream_check stt_stream_check.cpp
+//   ./stt_stream_check 127.0.0.1 50051                  # 3 s generated tone
+//   ./stt_stream_check 127.0.0.1 50051 speech.wav       # 16-bit mono WAV
+//   ./stt_stream_check 127.0.0.1 50051 speech.wav --fast  # Not paced
+#include "h2_client.h"
+#include "speech_grpc.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+static const uint32_t CHUNK_MS = 100;
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int32_t sockWrite(void* io, const uint8_t* data, uint32_t len) {
+  int fd = *(int*)io;
+  uint32_t sent = 0;
+  while (sent < len) {
+    ssize_t n = ::send(fd, data + sent, len - sent, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    sent += n;
+  }
+  return len;
+}
+
+static int32_t sockRead(void* io, uint8_t* buf, uint32_t len) {
+  ssize_t n = ::recv(*(int*)io, buf, len, MSG_DONTWAIT);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+  return n == 0 ? -1 : n;
+}
+
+struct Call {
+  double start = 0;
+  double endOfAudio = 0;
+  double firstInterim = 0;
+  double finalAt = 0;
+  int interims = 0;
+  std::string transcript;
+  std::string grpcStatus;
+  bool closed = false;
+  uint32_t closeCode = 0;
+};
+
+static void onResult(void* ctx, const SpeechGrpcReader::Result& r) {
+  Call* c = (Call*)ctx;
+  double t = nowMs() - c->start;
+  std::string text(r.transcript, r.transcriptLen);
+  if (r.isFinal) {
+    c->transcript += text;
+    c->finalAt = nowMs();
+    printf("%8.0f ms  final    \"%s\" (confidence %.2f)\n", t, text.c_str(), r.confidence);
+  } else {
+    if (c->interims++ == 0) c->firstInterim = t;
+    printf("%8.0f ms  interim  \"%s\" (stability %.2f)\n", t, text.c_str(), r.stability);
+  }
+}
+
+static SpeechGrpcReader* reader;
+
+static void onHeader(void* ctx, const char* name, size_t nameLen, const char* value, size_t valueLen) {
+  if (nameLen == 11 && memcmp(name, "grpc-status", 11) == 0) ((Call*)ctx)->grpcStatus.assign(value, valueLen);
+}
+
+static void onData(void*, const uint8_t* data, size_t len) {
+  reader->feed(data, len);
+}
+
+static void onClosed(void* ctx, uint32_t code) {
+  Call* c = (Call*)ctx;
+  c->closed = true;
+  c->closeCode = code;
+}
+
+static bool loadWav(const char* path, std::vector<int16_t>& pcm, uint32_t& rate) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t h[44];
+  bool ok = fread(h, 1, 44, f) == 44 && memcmp(h, "RIFF", 4) == 0 && h[20] == 1 && h[22] == 1 && h[34] == 16;
+  if (ok) {
+    rate = h[24] | h[25] << 8 | h[26] << 16 | (uint32_t)h[27] << 24;
+    int16_t s[1024];
+    size_t n;
+    while ((n = fread(s, 2, 1024, f)) > 0) pcm.insert(pcm.end(), s, s + n);
+  }
+  fclose(f);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <host> <port> [file.wav] [--fast]\n", argv[0]);
+    return 2;
+  }
+  bool fast = false;
+  const char* wav = nullptr;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "--fast") == 0) {
+      fast = true;
+    } else {
+      wav = argv[i];
+    }
+  }
+
+  std::vector<int16_t> pcm;
+  uint32_t rate = 16000;
+  if (wav) {
+    if (!loadWav(wav, pcm, rate)) {
+      fprintf(stderr, "%s: not a 16-bit mono PCM WAV\n", wav);
+      return 1;
+    }
+  } else {
+    for (uint32_t i = 0; i < rate * 3; i++) pcm.push_back((int16_t)(8000 * sin(2 * M_PI * 440 * i / rate)));
+  }
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(argv[2]));
+  inet_pton(AF_INET, argv[1], &addr.sin_addr);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  double connectStart = nowMs();
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    return 1;
+  }
+
+  static uint8_t rx[H2Client::RX_BUFFER_BYTES];
+  static uint8_t messages[2048];
+  H2Client h2(rx, sockRead, sockWrite, &fd);
+  Call call;
+  SpeechGrpcReader grpcReader(messages, sizeof(messages), onResult, &call);
+  reader = &grpcReader;
+
+  std::string authority = std::string(argv[1]) + ":" + argv[2];
+  H2Client::Header headers[] = {
+    { ":method", "POST" },
+    { ":scheme", "http" },
+    { ":path", SpeechGrpc::path() },
+    { ":authority", authority.c_str() },
+    { "content-type", "application/grpc" },
+    { "te", "trailers" },
+    { "x-goog-api-key", "stand-in" },
+  };
+  H2Client::Handler handler = { onHeader, onData, onClosed, &call };
+  if (!h2.start()) return 1;
+  uint32_t id = h2.request(headers, sizeof(headers) / sizeof(headers[0]), false, handler);
+  if (!id) return 1;
+  call.start = nowMs();
+  printf("connected in %.1f ms, stream %u, %.1f s of audio at %u Hz\n", call.start - connectStart, id,
+         pcm.size() / (double)rate, rate);
+
+  // The config, then one message per chunk: prefix and audio in one buffer
+  uint32_t chunkSamples = rate * CHUNK_MS / 1000;
+  std::vector<uint8_t> chunk(SpeechGrpc::AUDIO_PREFIX_MAX + chunkSamples * 2);
+  size_t chunkLen = SpeechGrpc::configRequest(chunk.data(), rate, "en-US", false, true);
+  size_t sample = 0;
+  size_t chunkPos = 0;
+  bool audioDone = false;
+  while (!call.closed) {
+    if (chunkPos == chunkLen && !audioDone) {
+      // Pace like a microphone: the next chunk exists once it has been spoken
+      if (!fast && call.start + (sample + chunkSamples) * 1000.0 / rate > nowMs() && sample < pcm.size()) {
+        if (!h2.poll()) break;
+        usleep(1000);
+        continue;
+      }
+      size_t n = pcm.size() - sample < chunkSamples ? pcm.size() - sample : chunkSamples;
+      size_t prefix = SpeechGrpc::audioPrefix(chunk.data(), n * 2);
+      memcpy(chunk.data() + prefix, pcm.data() + sample, n * 2);
+      chunkLen = prefix + n * 2;
+      chunkPos = 0;
+      sample += n;
+    }
+    bool last = sample == pcm.size();
+    if (chunkPos < chunkLen || (last && !audioDone)) {
+      int32_t n = h2.send(id, chunk.data() + chunkPos, chunkLen - chunkPos, last);
+      if (n < 0) break;
+      chunkPos += n;
+      if (last && chunkPos == chunkLen && !audioDone) {
+        audioDone = true;
+        call.endOfAudio = nowMs();
+      }
+    }
+    if (!h2.poll()) break;
+    if (audioDone || h2.sendable(id) == 0) usleep(1000);
+  }
+  h2.close();
+  close(fd);
+
+  bool ok = call.closed && call.closeCode == 0 && call.grpcStatus == "0" && call.finalAt > 0;
+  printf("\n%s: grpc-status %s, stream closed with %u, connection error %u\n", ok ? "ok" : "FAILED",
+         call.grpcStatus.empty() ? "-" : call.grpcStatus.c_str(), call.closeCode, h2.lastError());
+  printf("transcript       \"%s\"\n", call.transcript.c_str());
+  printf("interims         %d, first %.0f ms after the start\n", call.interims, call.firstInterim);
+  if (call.finalAt > 0) printf("time to final    %.1f ms after the end of audio\n", call.finalAt - call.endOfAudio);
+  printf("bytes            %u sent, %u received, %u send stalls on flow control\n", h2.bytesSent(),
+         h2.bytesReceived(), h2.windowStalls());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,385 @@
+// Builds the recognize request body for one clip every way the firmware
+// can (base64 in JSON for Google, a multipart file part or the file alone
+// for Whisper-style servers), in each upload encoding, sends each to
+// tools/upload_standin.py and reports body bytes and the CPU time spent
+// producing the body. The body code is the firmware's: json_body.h,
+// upload_body.h and flac_encoder.h, fed the way transcribeRecording() and
+// transcribeBinary() feed them.
+//
+//   g++ -O2 -std=c++17 -I.. -o upload_check upload_check.cpp
+//   ./upload_check 127.0.0.1 8080                # 5 s generated speech-like tone
+//   ./upload_check 127.0.0.1 8080 speech.wav     # 16-bit mono 16 kHz WAV
+#include "flac_encoder.h"
+#include "json_body.h"
+#include "upload_body.h"
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+static const size_t SOCKET_READ = 1460;  // HTTPClient pulls bodies in reads of its buffer size
+static const size_t SPAN = 512;          // RecordingReader span
+
+enum Profile { LINEAR16, FLAC, MULAW, PROFILE_COUNT };
+static const char* const profileNames[PROFILE_COUNT] = { "LINEAR16_16K", "FLAC_16K", "MULAW_8K" };
+static const uint32_t profileRates[PROFILE_COUNT] = { 16000, 16000, 8000 };
+
+enum Kind { JSON_BASE64, MULTIPART, FILE_BODY, KIND_COUNT };
+static const char* const kindNames[KIND_COUNT] = { "json base64", "multipart", "file" };
+
+static double cpuMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint8_t linearToMulaw(int16_t sample) {
+  const int bias = 0x84;
+  const int clip = 32635;
+  int sign = sample < 0 ? 0x80 : 0;
+  int magnitude = sign ? -(int)sample : sample;
+  if (magnitude > clip) magnitude = clip;
+  magnitude += bias;
+  int exponent = 7;
+  for (int mask = 0x4000; (magnitude & mask) == 0 && exponent > 0; mask >>= 1) exponent--;
+  int mantissa = (magnitude >> (exponent + 3)) & 0x0f;
+  return ~(sign | (exponent << 4) | mantissa);
+}
+
+static void buildWavHeader(uint8_t* h, uint32_t dataLength, uint32_t rate, uint16_t format, uint16_t bits) {
+  uint32_t byteRate = rate * bits / 8;
+  memcpy(h, "RIFF", 4);
+  uint32_t chunk = 36 + dataLength;
+  memcpy(h + 4, &chunk, 4);
+  memcpy(h + 8, "WAVEfmt ", 8);
+  uint32_t fmtSize = 16;
+  uint16_t channels = 1;
+  uint16_t blockAlign = bits / 8;
+  memcpy(h + 16, &fmtSize, 4);
+  memcpy(h + 20, &format, 2);
+  memcpy(h + 22, &channels, 2);
+  memcpy(h + 24, &rate, 4);
+  memcpy(h + 28, &byteRate, 4);
+  memcpy(h + 32, &blockAlign, 2);
+  memcpy(h + 34, &bits, 2);
+  memcpy(h + 36, "data", 4);
+  memcpy(h + 40, &dataLength, 4);
+}
+
+// The recording store: spans of at most SPAN bytes, whole samples
+struct Reader {
+  const std::vector<int16_t>* pcm;
+  size_t pos = 0;  // Bytes
+
+  size_t length() const { return pcm->size() * 2; }
+  size_t next(const uint8_t*& data, size_t max) {
+    size_t n = std::min(std::min(max, SPAN), length() - pos) & ~(size_t)1;
+    data = (const uint8_t*)pcm->data() + pos;
+    pos += n;
+    return n;
+  }
+};
+
+// Encoder output, base64-encoded as it comes (Base64Writer)
+struct Base64Sink {
+  std::string out;
+  uint8_t carry[3];
+  size_t carryLen = 0;
+
+  void put(const uint8_t* in, size_t len) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < len; i++) {
+      carry[carryLen++] = in[i];
+      if (carryLen < 3) continue;
+      uint32_t v = carry[0] << 16 | carry[1] << 8 | carry[2];
+      char q[4] = { alphabet[v >> 18], alphabet[v >> 12 & 63], alphabet[v >> 6 & 63], alphabet[v & 63] };
+      out.append(q, 4);
+      carryLen = 0;
+    }
+  }
+  void finish() {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    if (carryLen == 0) return;
+    uint32_t v = carry[0] << 16 | (carryLen > 1 ? carry[1] << 8 : 0);
+    char q[4] = { alphabet[v >> 18], alphabet[v >> 12 & 63], carryLen > 1 ? alphabet[v >> 6 & 63] : '=', '=' };
+    out.append(q, 4);
+    carryLen = 0;
+  }
+  static void write(void* ctx, const uint8_t* data, size_t len) { ((Base64Sink*)ctx)->put(data, len); }
+};
+
+struct ByteSink {
+  std::vector<uint8_t> out;
+  static void write(void* ctx, const uint8_t* data, size_t len) {
+    ByteSink* s = (ByteSink*)ctx;
+    s->out.insert(s->out.end(), data, data + len);
+  }
+};
+
+// encodeUploadAudio()
+static void encode(Reader& reader, Profile profile, FlacEncoder::WriteFn write, void* ctx) {
+  const uint8_t* data;
+  uint8_t encoded[128];
+  size_t bytes;
+  FlacEncoder* flac = nullptr;
+  if (profile == FLAC) {
+    flac = new FlacEncoder(16000, write, ctx);
+    flac->begin();
+  }
+  while ((bytes = reader.next(data, sizeof(encoded) * 4)) > 0) {
+    const int16_t* samples = (const int16_t*)data;
+    size_t count = bytes / 2;
+    if (profile == FLAC) {
+      flac->addSamples(samples, count);
+    } else if (profile == MULAW) {
+      for (size_t i = 0; i + 1 < count; i += 2) encoded[i / 2] = linearToMulaw((samples[i] + samples[i + 1]) / 2);
+      write(ctx, encoded, count / 2);
+    } else {
+      write(ctx, data, bytes);
+    }
+  }
+  if (flac) {
+    flac->finish();
+    delete flac;
+  }
+}
+
+// readUploadSource()
+struct Source {
+  Reader* reader;
+  Profile profile;
+  const uint8_t* encoded = nullptr;
+  size_t encodedLen = 0;
+  size_t encodedPos = 0;
+  uint8_t spare = 0;
+  bool hasSpare = false;
+};
+
+static size_t readSource(void* ctx, uint8_t* out, size_t max) {
+  Source* src = (Source*)ctx;
+  size_t n = 0;
+  if (src->encoded) {
+    n = std::min(max, src->encodedLen - src->encodedPos);
+    memcpy(out, src->encoded + src->encodedPos, n);
+    src->encodedPos += n;
+    return n;
+  }
+  const uint8_t* data;
+  while (n < max) {
+    if (src->profile == MULAW) {
+      size_t bytes = src->reader->next(data, std::min((max - n) * 4, (size_t)512));
+      if (bytes < 4) break;
+      const int16_t* samples = (const int16_t*)data;
+      for (size_t i = 0; i + 1 < bytes / 2; i += 2) out[n++] = linearToMulaw((samples[i] + samples[i + 1]) / 2);
+    } else if (src->hasSpare) {
+      out[n++] = src->spare;
+      src->hasSpare = false;
+    } else {
+      size_t bytes = src->reader->next(data, (max - n + 1) & ~(size_t)1);
+      if (bytes == 0) break;
+      size_t k = std::min(bytes, max - n);
+      memcpy(out + n, data, k);
+      n += k;
+      if (k < bytes) {
+        src->spare = data[k];
+        src->hasSpare = true;
+      }
+    }
+  }
+  return n;
+}
+
+struct Built {
+  std::string contentType;
+  std::string path;
+  std::string body;
+  size_t audioBytes;  // Encoded audio, before any base64
+};
+
+// Produces the whole body through its read() in socket-sized pieces, as
+// HTTPClient would pull it
+template <typename Body>
+static void drain(Body& body, std::string& out) {
+  uint8_t chunk[SOCKET_READ];
+  size_t n;
+  while ((n = body.read(chunk, sizeof(chunk))) > 0) out.append((const char*)chunk, n);
+}
+
+static bool build(const std::vector<int16_t>& pcm, Profile profile, Kind kind, Built& b) {
+  Reader reader;
+  reader.pcm = &pcm;
+  if (kind == JSON_BASE64) {
+    Base64Sink base64;
+    base64.out.reserve(reader.length() * 4 / 3 + 16);
+    encode(reader, profile, Base64Sink::write, &base64);
+    base64.finish();
+    char rate[12];
+    snprintf(rate, sizeof(rate), "%u", profileRates[profile]);
+    JsonBody body;
+    body.raw("{\"config\":{\"encoding\":")
+      .string(profile == FLAC ? "FLAC" : profile == MULAW ? "MULAW" : "LINEAR16")
+      .raw(",\"sampleRateHertz\":")
+      .raw(rate)
+      .raw(",\"languageCode\":\"en-US\"},\"audio\":{\"content\":\"")
+      .raw(base64.out.data(), base64.out.size())
+      .raw("\"}}");
+    if (!body.ok()) return false;
+    b.body.reserve(body.size());
+    drain(body, b.body);
+    b.contentType = "application/json";
+    b.path = "/v1/speech:recognize";
+    b.audioBytes = base64.out.size() / 4 * 3;
+    return b.body.size() == body.size();
+  }
+
+  Source src;
+  src.reader = &reader;
+  src.profile = profile;
+  ByteSink flac;
+  uint8_t head[44];
+  size_t headLen = 0;
+  size_t length;
+  if (profile == FLAC) {
+    encode(reader, profile, ByteSink::write, &flac);
+    src.encoded = flac.out.data();
+    src.encodedLen = flac.out.size();
+    length = flac.out.size();
+  } else if (profile == MULAW) {
+    length = reader.length() / 4;
+    buildWavHeader(head, length, 8000, 7, 8);
+    headLen = sizeof(head);
+  } else {
+    length = reader.length();
+    buildWavHeader(head, length, 16000, 1, 16);
+    headLen = sizeof(head);
+  }
+  UploadBody body(kind == MULTIPART ? "voiceai-audio-boundary" : nullptr);
+  if (kind == MULTIPART) body.field("model", "whisper-1").field("language", "en").field("response_format", "json");
+  body.file("file", profile == FLAC ? "speech.flac" : "speech.wav", profile == FLAC ? "audio/flac" : "audio/wav", head,
+            headLen, readSource, &src, length);
+  if (!body.ok()) return false;
+  b.body.reserve(body.size());
+  drain(body, b.body);
+  b.contentType = body.contentType();
+  b.path = kind == MULTIPART ? "/v1/audio/transcriptions" : "/transcribe";
+  b.audioBytes = headLen + length;
+  return !body.truncated() && b.body.size() == body.size();
+}
+
+static bool post(const char* host, int port, const Built& b, std::string& response) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, host, &addr.sin_addr);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    close(fd);
+    return false;
+  }
+  char head[256];
+  int n = snprintf(head, sizeof(head), "POST %s HTTP/1.0\r\nHost: %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                   b.path.c_str(), host, b.contentType.c_str(), b.body.size());
+  std::string request(head, n);
+  request += b.body;
+  for (size_t sent = 0; sent < request.size();) {
+    ssize_t k = send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+    if (k <= 0) break;
+    sent += k;
+  }
+  char buf[4096];
+  ssize_t k;
+  while ((k = recv(fd, buf, sizeof(buf), 0)) > 0) response.append(buf, k);
+  close(fd);
+  return response.compare(0, 12, "HTTP/1.0 200") == 0;
+}
+
+static bool loadWav(const char* path, std::vector<int16_t>& pcm) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t h[44];
+  bool ok = fread(h, 1, 44, f) == 44 && memcmp(h, "RIFF", 4) == 0 && h[20] == 1 && h[22] == 1 && h[34] == 16
+            && (h[24] | h[25] << 8 | h[26] << 16) == 16000;
+  if (ok) {
+    int16_t s[1024];
+    size_t n;
+    while ((n = fread(s, 2, 1024, f)) > 0) pcm.insert(pcm.end(), s, s + n);
+  }
+  fclose(f);
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <host> <port> [file.wav]\n", argv[0]);
+    return 2;
+  }
+  std::vector<int16_t> pcm;
+  if (argc > 3) {
+    if (!loadWav(argv[3], pcm)) {
+      fprintf(stderr, "%s: not a 16-bit mono 16 kHz PCM WAV\n", argv[3]);
+      return 1;
+    }
+  } else {
+    // Voiced syllables over a little noise, so FLAC sees something speech-like
+    srand(1);
+    for (uint32_t i = 0; i < 16000 * 5; i++) {
+      double t = i / 16000.0;
+      double envelope = 0.5 + 0.5 * sin(2 * M_PI * 4 * t);
+      double voice = sin(2 * M_PI * 140 * t) + 0.5 * sin(2 * M_PI * 280 * t) + 0.25 * sin(2 * M_PI * 420 * t);
+      pcm.push_back((int16_t)(4000 * envelope * voice + (rand() % 200 - 100)));
+    }
+  }
+  printf("%.2f s of audio, %zu bytes of PCM\n\n", pcm.size() / 16000.0, pcm.size() * 2);
+  printf("%-13s %-12s %10s %9s %12s\n", "encoding", "body", "bytes", "vs json", "cpu us");
+
+  bool ok = true;
+  for (int p = 0; p < PROFILE_COUNT; p++) {
+    size_t jsonBytes = 0;
+    double jsonMicros = 0;
+    for (int k = 0; k < KIND_COUNT; k++) {
+      // Best of a few runs: the body is what is measured, not the scheduler
+      Built b;
+      double best = 1e18;
+      for (int run = 0; run < 5; run++) {
+        Built attempt;
+        double start = cpuMicros();
+        bool built = build(pcm, (Profile)p, (Kind)k, attempt);
+        double micros = cpuMicros() - start;
+        if (!built) {
+          printf("%-13s %-12s build FAILED\n", profileNames[p], kindNames[k]);
+          ok = false;
+          break;
+        }
+        if (micros < best) best = micros;
+        b = attempt;
+      }
+      if (b.body.empty()) continue;
+      std::string response;
+      bool accepted = post(argv[1], atoi(argv[2]), b, response);
+      bool transcript = response.find("Lisbon") != std::string::npos;
+      if (k == JSON_BASE64) {
+        jsonBytes = b.body.size();
+        jsonMicros = best;
+      }
+      printf("%-13s %-12s %10zu %8.1f%% %12.0f%s\n", profileNames[p], kindNames[k], b.body.size(),
+             100.0 * b.body.size() / jsonBytes, best, accepted && transcript ? "" : "  REJECTED");
+      ok &= accepted && transcript;
+      if (k != JSON_BASE64) {
+        printf("%27s saved %zu bytes (%.1f%%), %.0f us of CPU\n", "", jsonBytes - b.body.size(),
+               100.0 * (jsonBytes - b.body.size()) / jsonBytes, jsonMicros - best);
+      }
+    }
+  }
+  printf("\n%s\n", ok ? "ok" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Local stand-in for the speech backends the recognize request can use.
+
+Plain HTTP on one port, with one endpoint per body kind:
+
+    POST /v1/speech:recognize       Google Speech-to-Text: JSON with the
+                                    audio base64-encoded in audio.content
+    POST /v1/audio/transcriptions   Whisper-style: multipart/form-data with
+                                    the audio as the "file" part
+    POST /transcribe                The audio file as the whole body
+
+Every request is checked: the audio must decode (WAV, FLAC or raw PCM, as
+its encoding says) and its length is reported next to the bytes the body
+took on the wire and the time spent decoding it, so tools/upload_check can
+compare the paths. Responses follow each API's shape.
+
+    ./upload_standin.py --port 8080
+"""
+import argparse
+import base64
+import json
+import struct
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+TRANSCRIPT = "what is the weather like in Lisbon tomorrow morning"
+
+
+def audio_seconds(data, encoding=None, rate=16000):
+    """Length of an audio file or raw buffer; raises if it does not parse."""
+    if data[:4] == b"RIFF":
+        if data[8:12] != b"WAVE" or data[36:40] != b"data":
+            raise ValueError("not a canonical WAV")
+        fmt, channels, wav_rate = struct.unpack("<HHI", data[20:28])
+        bits = struct.unpack("<H", data[34:36])[0]
+        size = struct.unpack("<I", data[40:44])[0]
+        if fmt not in (1, 7) or channels != 1 or size != len(data) - 44:
+            raise ValueError("unexpected WAV format %d, %d channels, %d of %d bytes" % (fmt, channels, size, len(data) - 44))
+        return size / (wav_rate * bits // 8)
+    if data[:4] == b"fLaC":
+        if data[4] & 0x7F != 0:
+            raise ValueError("FLAC without STREAMINFO")
+        return None  # The encoder leaves the total sample count out
+    if encoding == "LINEAR16":
+        return len(data) / (rate * 2)
+    if encoding == "MULAW":
+        return len(data) / rate
+    raise ValueError("unknown audio")
+
+
+def multipart_file(body, content_type):
+    boundary = content_type.split("boundary=", 1)[1].encode()
+    fields = {}
+    audio = None
+    for part in body.split(b"--" + boundary)[1:]:
+        if part.startswith(b"--"):
+            break
+        head, _, value = part[2:].partition(b"\r\n\r\n")
+        value = value[:-2]  # CRLF before the next boundary
+        name = head.split(b'name="', 1)[1].split(b'"', 1)[0].decode()
+        if b"filename=" in head:
+            audio = value
+        else:
+            fields[name] = value.decode()
+    if audio is None:
+        raise ValueError("no file part")
+    return audio, fields
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.0"
+
+    def do_POST(self):
+        length = int(self.headers["Content-Length"])
+        start = time.monotonic()
+        body = self.rfile.read(length)
+        received = time.monotonic()
+        path = self.path.split("?", 1)[0]
+        try:
+            if path == "/v1/speech:recognize":
+                request = json.loads(body)
+                config = request["config"]
+                audio = base64.b64decode(request["audio"]["content"])
+                seconds = audio_seconds(audio, config["encoding"], config["sampleRateHertz"])
+                reply = {"results": [{"alternatives": [{"transcript": TRANSCRIPT, "confidence": 0.9}]}]}
+                kind = "json"
+            elif path == "/v1/audio/transcriptions":
+                audio, fields = multipart_file(body, self.headers["Content-Type"])
+                seconds = audio_seconds(audio)
+                reply = {"text": " " + TRANSCRIPT}
+                kind = "multipart model=%s" % fields.get("model")
+            elif path == "/transcribe":
+                audio = body
+                seconds = audio_seconds(audio)
+                reply = {"text": " " + TRANSCRIPT}
+                kind = "file %s" % self.headers["Content-Type"]
+            else:
+                self.send_error(404)
+                return
+        except (ValueError, KeyError, IndexError) as e:
+            self.send_error(400, str(e))
+            return
+        decoded = time.monotonic()
+        print("%-28s %7d body bytes, %7d audio bytes (%s s), read %.1f ms, decode %.2f ms"
+              % (kind, length, len(audio), "-" if seconds is None else "%.2f" % seconds,
+                 (received - start) * 1000, (decoded - received) * 1000))
+        data = json.dumps(reply).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--port", type=int, default=8080)
+    args = parser.parse_args()
+    server = ThreadingHTTPServer(("127.0.0.1", args.port), Handler)
+    print("listening on 127.0.0.1:%d" % args.port)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,1347 @@
+// Voice gateway for the devices of a site (gateway_protocol.h). Each device
+// keeps one plain TCP connection and streams the microphone as PCM or IMA
+// ADPCM while the user speaks; the gateway runs Speech-to-Text
+// (StreamingRecognize over gRPC), Gemini and Text-to-Speech on its behalf
+// and streams the answer back as audio, so the device does no TLS, JSON or
+// base64 work. Upstream calls from every device share a small pool of
+// HTTP/2 connections per API host (h2_client.h; TLS with ALPN h2, or plain
+// h2c to a local stand-in), so a turn costs no handshake. One thread runs
+// one epoll loop over non-blocking sockets; a device costs a few KB of
+// state between turns.
+//
+// A turn: audio frames become audio_content messages on the device's
+// recognition stream as they arrive. After TURN_END the final transcript
+// goes to Gemini, the answer is rewritten for speech (speech_text.h) and
+// split into sentences, and the sentences are synthesized concurrently on
+// the pool. Their audio goes back in order, the first sentence as soon as
+// it is ready, throttled by the device's TCP window.
+//
+//   g++ -O2 -std=c++17 -I.. -o voice_gateway voice_gateway.cpp -lssl -lcrypto
+//   ./voice_gateway --key $GOOGLE_API_KEY                # Google APIs
+//   ./voice_gateway --upstream http://127.0.0.1:8443     # tools/gateway_standin.py
+#include "gateway_protocol.h"
+#include "h2_client.h"
+#include "ima_adpcm.h"
+#include "json_body.h"
+#include "speech_grpc.h"
+#include "speech_text.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+static const int STREAMS_PER_CONNECTION = 100;  // Google's SETTINGS_MAX_CONCURRENT_STREAMS
+static const uint32_t STREAM_WINDOW = 1 << 20;    // A TTS response in one round trip
+static const uint32_t CONNECTION_WINDOW = 16 << 20;
+static const size_t DEVICE_OUT_HIGH = 64 * 1024;  // Answer audio queued ahead of the device's socket
+static const size_t TTS_IN_FLIGHT = 3;            // Sentences synthesized ahead, per device
+static const size_t TTS_GROUP_BYTES = 300;        // Later sentences are batched up to this
+static const size_t TTS_MAX_BYTES = 5000;         // Google TTS input limit
+static const double LISTEN_TIMEOUT_MS = 60000;    // TURN_START to TURN_END
+static const double TURN_TIMEOUT_MS = 20000;      // TURN_END to the end of the answer
+static const double RECONNECT_DELAY_MS = 1000;    // After a failed connect
+static const double HELLO_TIMEOUT_MS = 5000;
+static const uint32_t TTS_RATE = 24000;
+
+typedef BasicH2Client<STREAMS_PER_CONNECTION> H2;
+
+static double nowMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+struct Config {
+  int port = gateway::DEFAULT_PORT;
+  std::string key;
+  std::string speechUrl = "https://speech.googleapis.com";
+  std::string geminiUrl = "https://generativelanguage.googleapis.com";
+  std::string ttsUrl = "https://texttospeech.googleapis.com";
+  std::string model = "gemini-pro";
+  std::string voice = "en-US-Wavenet-D";
+  std::string language = "en-US";
+  size_t pool = 2;  // Connections per API host
+  bool verbose = false;
+};
+static Config config;
+
+static int epfd = -1;
+static volatile sig_atomic_t stopping = 0;
+
+// epoll data: the handler of whatever owns the descriptor
+struct Watch {
+  void (*fn)(void* ctx, uint32_t events);
+  void* ctx;
+};
+
+static void watch(int fd, Watch* w, uint32_t events, bool add) {
+  epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = w;
+  epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void setNonBlocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+//----------------------------------------
+// Upstream pool
+//----------------------------------------
+
+struct Device;
+struct Connection;
+struct Upstream;
+
+// One request stream. The body may keep growing while the call is open
+// (recognition audio) until bodyEnded; the response is collected whole
+// unless onData takes it.
+struct UpstreamCall {
+  Upstream* up = nullptr;
+  Connection* conn = nullptr;
+  uint32_t stream = 0;
+  std::string path;
+  bool grpc = false;
+  std::string body;
+  size_t bodyPos = 0;
+  bool bodyEnded = false;
+  bool endSent = false;
+  int status = 0;
+  std::string grpcStatus;
+  std::string response;
+  void (*onData)(void* ctx, const uint8_t* data, size_t len) = nullptr;
+  Device* owner = nullptr;
+  bool done = false;
+  uint32_t error = 0;
+  double startedAt = 0;
+
+  bool ok() const { return done && error == H2::NO_ERROR && status == 200 && (!grpc || grpcStatus == "0"); }
+};
+
+struct Connection {
+  Upstream* up;
+  int fd = -1;
+  SSL* ssl = nullptr;
+  enum State { CONNECTING, HANDSHAKE, OPEN, CLOSED } state = CONNECTING;
+  bool started = false;  // HTTP/2 preface sent
+  Watch w;
+  std::string in;  // Received, not yet taken by the HTTP/2 client
+  size_t inPos = 0;
+  bool eof = false;
+  std::string out;  // Written by the HTTP/2 client, not yet on the socket
+  size_t outPos = 0;
+  bool wantWrite = false;
+  uint8_t rx[H2::RX_BUFFER_BYTES];
+  H2 h2;
+  std::vector<UpstreamCall*> calls;
+
+  Connection(Upstream* u);
+};
+
+struct Upstream {
+  explicit Upstream(const char* n) : name(n) {}
+  const char* name;
+  std::string host;
+  int port = 443;
+  bool tls = true;
+  std::vector<Connection*> conns;
+  std::deque<UpstreamCall*> waiting;  // No stream free yet
+  double retryAt = 0;                 // No new connection before this
+  uint64_t requests = 0;
+  uint64_t connects = 0;
+  uint64_t failures = 0;
+  uint64_t queued = 0;  // Requests that had to wait for a stream
+};
+
+static Upstream speech("speech");
+static Upstream gemini("gemini");
+static Upstream tts("tts");
+static SSL_CTX* sslCtx = nullptr;
+
+static void wake(Device* d);
+static void connectionEvents(void* ctx, uint32_t events);
+static void closeConnection(Connection* c);
+static void connectFailed(Upstream& up);
+
+static void removeCall(Connection* c, UpstreamCall* call) {
+  std::vector<UpstreamCall*>::iterator it = std::find(c->calls.begin(), c->calls.end(), call);
+  if (it != c->calls.end()) c->calls.erase(it);
+}
+
+static int32_t connRead(void* io, uint8_t* buf, uint32_t len) {
+  Connection* c = (Connection*)io;
+  size_t n = std::min((size_t)len, c->in.size() - c->inPos);
+  if (n == 0) return c->eof ? -1 : 0;
+  memcpy(buf, c->in.data() + c->inPos, n);
+  c->inPos += n;
+  if (c->inPos == c->in.size()) {
+    c->in.clear();
+    c->inPos = 0;
+  }
+  return n;
+}
+
+static int32_t connWrite(void* io, const uint8_t* data, uint32_t len) {
+  Connection* c = (Connection*)io;
+  if (c->state == Connection::CLOSED) return -1;
+  c->out.append((const char*)data, len);
+  return len;
+}
+
+Connection::Connection(Upstream* u) : up(u), h2(rx, connRead, connWrite, this) {
+  w = { connectionEvents, this };
+}
+
+static bool parseUrl(const std::string& url, Upstream& up) {
+  size_t start;
+  if (url.compare(0, 8, "https://") == 0) {
+    up.tls = true;
+    up.port = 443;
+    start = 8;
+  } else if (url.compare(0, 7, "http://") == 0) {
+    up.tls = false;
+    up.port = 80;
+    start = 7;
+  } else {
+    return false;
+  }
+  std::string hostPort = url.substr(start, url.find('/', start) - start);
+  size_t colon = hostPort.find(':');
+  up.host = hostPort.substr(0, colon);
+  if (colon != std::string::npos) up.port = atoi(hostPort.c_str() + colon + 1);
+  return !up.host.empty() && up.port > 0;
+}
+
+static std::string authority(const Upstream& up) {
+  return up.port == (up.tls ? 443 : 80) ? up.host : up.host + ":" + std::to_string(up.port);
+}
+
+// Starts a connection; DNS is resolved here, blocking, but only when a
+// pool grows
+static Connection* openConnection(Upstream& up) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(up.host.c_str(), std::to_string(up.port).c_str(), &hints, &res) != 0 || !res) {
+    fprintf(stderr, "[%s] cannot resolve %s\n", up.name, up.host.c_str());
+    connectFailed(up);
+    return nullptr;
+  }
+  int fd = socket(res->ai_family, SOCK_STREAM, 0);
+  setNonBlocking(fd);
+  int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+  freeaddrinfo(res);
+  if (rc < 0 && errno != EINPROGRESS) {
+    close(fd);
+    connectFailed(up);
+    return nullptr;
+  }
+  Connection* c = new Connection(&up);
+  c->fd = fd;
+  if (up.tls) {
+    c->ssl = SSL_new(sslCtx);
+    SSL_set_fd(c->ssl, fd);
+    SSL_set_tlsext_host_name(c->ssl, up.host.c_str());
+    SSL_set1_host(c->ssl, up.host.c_str());
+    SSL_set_connect_state(c->ssl);
+  }
+  up.conns.push_back(c);
+  up.connects++;
+  watch(fd, &c->w, EPOLLIN | EPOLLOUT, true);
+  return c;
+}
+
+// Puts out what the HTTP/2 client has written, as far as the socket takes it
+static void flushConnection(Connection* c) {
+  while (c->outPos < c->out.size() && c->state == Connection::OPEN) {
+    const char* p = c->out.data() + c->outPos;
+    size_t len = c->out.size() - c->outPos;
+    ssize_t n;
+    if (c->ssl) {
+      n = SSL_write(c->ssl, p, len);
+      if (n <= 0) {
+        int e = SSL_get_error(c->ssl, n);
+        if (e == SSL_ERROR_WANT_WRITE || e == SSL_ERROR_WANT_READ) break;
+        c->state = Connection::CLOSED;
+        return;
+      }
+    } else {
+      n = send(c->fd, p, len, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        c->state = Connection::CLOSED;
+        return;
+      }
+    }
+    c->outPos += n;
+  }
+  if (c->outPos == c->out.size()) {
+    c->out.clear();
+    c->outPos = 0;
+  }
+  bool want = c->outPos < c->out.size();
+  if (want != c->wantWrite) {
+    c->wantWrite = want;
+    watch(c->fd, &c->w, EPOLLIN | (want ? (uint32_t)EPOLLOUT : 0), false);
+  }
+}
+
+// Request headers go out from inside request(); the strings only have to
+// live until it returns
+static bool issue(Connection* c, UpstreamCall* call) {
+  std::string auth = authority(*call->up);
+  std::string length = std::to_string(call->body.size());
+  H2::Header headers[8];
+  int n = 0;
+  headers[n++] = { ":method", "POST" };
+  headers[n++] = { ":scheme", call->up->tls ? "https" : "http" };
+  headers[n++] = { ":path", call->path.c_str() };
+  headers[n++] = { ":authority", auth.c_str() };
+  headers[n++] = { "x-goog-api-key", config.key.c_str() };
+  if (call->grpc) {
+    headers[n++] = { "content-type", "application/grpc" };
+    headers[n++] = { "te", "trailers" };
+  } else {
+    headers[n++] = { "content-type", "application/json" };
+    headers[n++] = { "content-length", length.c_str() };
+  }
+  H2::Handler handler = {
+    [](void* ctx, const char* name, size_t nameLen, const char* value, size_t valueLen) {
+      UpstreamCall* call = (UpstreamCall*)ctx;
+      if (nameLen == 7 && memcmp(name, ":status", 7) == 0) call->status = atoi(std::string(value, valueLen).c_str());
+      if (nameLen == 11 && memcmp(name, "grpc-status", 11) == 0) call->grpcStatus.assign(value, valueLen);
+    },
+    [](void* ctx, const uint8_t* data, size_t len) {
+      UpstreamCall* call = (UpstreamCall*)ctx;
+      if (call->onData) {
+        call->onData(call->owner, data, len);
+      } else {
+        call->response.append((const char*)data, len);
+      }
+    },
+    [](void* ctx, uint32_t code) {
+      UpstreamCall* call = (UpstreamCall*)ctx;
+      call->done = true;
+      call->error = code;
+      removeCall(call->conn, call);
+      wake(call->owner);
+    },
+    call,
+  };
+  uint32_t id = c->h2.request(headers, n, false, handler);
+  if (!id) return false;
+  call->conn = c;
+  call->stream = id;
+  c->calls.push_back(call);
+  return true;
+}
+
+// Sends as much of the body as flow control allows
+static void pump(UpstreamCall* call) {
+  if (!call->conn || call->endSent || call->done) return;
+  H2& h2 = call->conn->h2;
+  while (call->bodyPos < call->body.size() || (call->bodyEnded && !call->endSent)) {
+    size_t left = call->body.size() - call->bodyPos;
+    int32_t n = h2.send(call->stream, (const uint8_t*)call->body.data() + call->bodyPos, left, call->bodyEnded);
+    if (n < 0) return;
+    call->bodyPos += n;
+    if (call->bodyEnded && call->bodyPos == call->body.size() && (uint32_t)n == left) call->endSent = true;
+    if (n == 0) break;
+  }
+  if (call->bodyPos > 65536 || call->bodyPos == call->body.size()) {
+    call->body.erase(0, call->bodyPos);
+    call->bodyPos = 0;
+  }
+}
+
+// The open connection with the most free streams, growing the pool while
+// every connection is busy
+static void startWaiting(Upstream& up) {
+  while (!up.waiting.empty()) {
+    Connection* best = nullptr;
+    int opening = 0;
+    for (Connection* c : up.conns) {
+      if (c->state != Connection::OPEN) {
+        opening += c->state != Connection::CLOSED;
+        continue;
+      }
+      if (c->h2.goingAway() || c->h2.openStreams() >= c->h2.streamLimit()) continue;
+      if (!best || c->h2.openStreams() < best->h2.openStreams()) best = c;
+    }
+    bool grow = opening == 0 && up.conns.size() < config.pool && nowMs() >= up.retryAt;
+    if (!best) {
+      if (grow) openConnection(up);
+      return;
+    }
+    if (grow && best->h2.openStreams() > 0) openConnection(up);
+    UpstreamCall* call = up.waiting.front();
+    if (!issue(best, call)) return;
+    up.waiting.pop_front();
+    pump(call);
+    flushConnection(best);
+  }
+}
+
+static void startCall(UpstreamCall* call) {
+  call->startedAt = nowMs();
+  call->up->requests++;
+  call->up->waiting.push_back(call);
+  if (call->up->waiting.size() > 1) call->up->queued++;
+  startWaiting(*call->up);
+}
+
+// More body for an open call
+static void sendMore(UpstreamCall* call) {
+  if (!call->conn || call->done) return;
+  pump(call);
+  flushConnection(call->conn);
+}
+
+// Abandons a call; no callback follows
+static void dropCall(UpstreamCall* call) {
+  if (!call) return;
+  if (call->conn && !call->done) {
+    call->conn->h2.cancel(call->stream);
+    removeCall(call->conn, call);
+    flushConnection(call->conn);
+  } else if (!call->conn) {
+    std::deque<UpstreamCall*>& w = call->up->waiting;
+    w.erase(std::remove(w.begin(), w.end(), call), w.end());
+  }
+  delete call;
+}
+
+// Calls still waiting when a connection could not be set up fail at once
+// rather than at the turn's deadline; the next connect waits a while
+static void connectFailed(Upstream& up) {
+  up.failures++;
+  up.retryAt = nowMs() + RECONNECT_DELAY_MS;
+  for (UpstreamCall* call : up.waiting) {
+    call->done = true;
+    call->error = H2::ERROR_TRANSPORT;
+    wake(call->owner);
+  }
+  up.waiting.clear();
+}
+
+static void closeConnection(Connection* c) {
+  Upstream& up = *c->up;
+  c->state = Connection::CLOSED;
+  std::vector<UpstreamCall*> orphans = c->calls;  // close() takes them off c->calls
+  if (c->h2.isOpen()) c->h2.close();  // Open calls hear CANCEL
+  for (UpstreamCall* call : orphans) {
+    call->conn = nullptr;  // c is deleted below
+    if (call->done) continue;
+    // Closed without the client noticing (connect or TLS failure)
+    call->done = true;
+    call->error = H2::ERROR_TRANSPORT;
+    wake(call->owner);
+  }
+  c->calls.clear();
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+  if (c->ssl) SSL_free(c->ssl);
+  close(c->fd);
+  up.conns.erase(std::find(up.conns.begin(), up.conns.end(), c));
+  delete c;
+  startWaiting(up);
+}
+
+static bool readConnection(Connection* c) {
+  char buf[16384];
+  for (;;) {
+    ssize_t n;
+    if (c->ssl) {
+      n = SSL_read(c->ssl, buf, sizeof(buf));
+      if (n <= 0) {
+        int e = SSL_get_error(c->ssl, n);
+        if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) return true;
+        c->eof = true;
+        return false;
+      }
+    } else {
+      n = recv(c->fd, buf, sizeof(buf), 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+      if (n <= 0) {
+        c->eof = true;
+        return false;
+      }
+    }
+    c->in.append(buf, n);
+  }
+}
+
+static void connectionEvents(void* ctx, uint32_t events) {
+  Connection* c = (Connection*)ctx;
+  Upstream& up = *c->up;
+  if (c->state == Connection::CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err || (events & (EPOLLERR | EPOLLHUP))) {
+      fprintf(stderr, "[%s] connect to %s:%d failed: %s\n", up.name, up.host.c_str(), up.port, strerror(err));
+      connectFailed(up);
+      closeConnection(c);
+      return;
+    }
+    if (!(events & EPOLLOUT)) return;
+    c->state = c->ssl ? Connection::HANDSHAKE : Connection::OPEN;
+    if (c->ssl) {
+      static const unsigned char alpn[] = { 2, 'h', '2' };
+      SSL_set_alpn_protos(c->ssl, alpn, sizeof(alpn));
+    }
+  }
+  if (c->state == Connection::HANDSHAKE) {
+    int rc = SSL_do_handshake(c->ssl);
+    if (rc != 1) {
+      int e = SSL_get_error(c->ssl, rc);
+      if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) {
+        watch(c->fd, &c->w, e == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT, false);
+        return;
+      }
+      char reason[128];
+      ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+      fprintf(stderr, "[%s] TLS with %s failed: %s\n", up.name, up.host.c_str(), reason);
+      connectFailed(up);
+      closeConnection(c);
+      return;
+    }
+    const unsigned char* proto = nullptr;
+    unsigned int protoLen = 0;
+    SSL_get0_alpn_selected(c->ssl, &proto, &protoLen);
+    if (protoLen != 2 || memcmp(proto, "h2", 2) != 0) {
+      fprintf(stderr, "[%s] %s did not negotiate h2\n", up.name, up.host.c_str());
+      connectFailed(up);
+      closeConnection(c);
+      return;
+    }
+    c->state = Connection::OPEN;
+  }
+  if (!c->started) {
+    c->started = true;
+    c->wantWrite = true;  // Forces the interest update in flushConnection
+    if (config.verbose) printf("[%s] connected to %s:%d\n", up.name, up.host.c_str(), up.port);
+    if (!c->h2.start(STREAM_WINDOW, CONNECTION_WINDOW)) {
+      closeConnection(c);
+      return;
+    }
+  }
+
+  bool alive = readConnection(c);
+  if (!c->h2.poll() || !alive) {
+    if (config.verbose || c->h2.lastError() != H2::NO_ERROR) {
+      printf("[%s] connection closed, error %u\n", up.name, (unsigned)c->h2.lastError());
+    }
+    closeConnection(c);
+    return;
+  }
+  // WINDOW_UPDATEs may have arrived: bodies waiting on flow control go on
+  std::vector<UpstreamCall*> calls = c->calls;
+  for (UpstreamCall* call : calls) pump(call);
+  flushConnection(c);
+  if (c->state == Connection::CLOSED) {
+    closeConnection(c);
+    return;
+  }
+  if (c->h2.goingAway() && c->calls.empty()) {
+    closeConnection(c);
+    return;
+  }
+  startWaiting(up);
+}
+
+//----------------------------------------
+// JSON and base64
+//----------------------------------------
+
+// The string value of the first "key" in json; enough for the few fields
+// read here, which come first in their responses
+static bool jsonString(const std::string& json, const char* key, std::string& out) {
+  std::string quoted = std::string("\"") + key + "\"";
+  size_t p = json.find(quoted);
+  if (p == std::string::npos) return false;
+  p += quoted.size();
+  while (p < json.size() && (json[p] == ' ' || json[p] == '\n' || json[p] == '\r' || json[p] == '\t' || json[p] == ':')) p++;
+  if (p >= json.size() || json[p] != '"') return false;
+  out.clear();
+  for (p++; p < json.size(); p++) {
+    char c = json[p];
+    if (c == '"') return true;
+    if (c != '\\') {
+      out += c;
+      continue;
+    }
+    if (++p >= json.size()) return false;
+    switch (json[p]) {
+      case 'n': out += '\n'; break;
+      case 't': out += '\t'; break;
+      case 'r': out += '\r'; break;
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'u':
+        {
+          if (p + 4 >= json.size()) return false;
+          uint32_t cp = strtoul(json.substr(p + 1, 4).c_str(), nullptr, 16);
+          p += 4;
+          if (cp >= 0xd800 && cp < 0xdc00 && json.compare(p + 1, 2, "\\u") == 0) {
+            uint32_t low = strtoul(json.substr(p + 3, 4).c_str(), nullptr, 16);
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            p += 6;
+          }
+          if (cp < 0x80) {
+            out += (char)cp;
+          } else if (cp < 0x800) {
+            out += (char)(0xc0 | cp >> 6);
+            out += (char)(0x80 | (cp & 0x3f));
+          } else if (cp < 0x10000) {
+            out += (char)(0xe0 | cp >> 12);
+            out += (char)(0x80 | (cp >> 6 & 0x3f));
+            out += (char)(0x80 | (cp & 0x3f));
+          } else {
+            out += (char)(0xf0 | cp >> 18);
+            out += (char)(0x80 | (cp >> 12 & 0x3f));
+            out += (char)(0x80 | (cp >> 6 & 0x3f));
+            out += (char)(0x80 | (cp & 0x3f));
+          }
+          break;
+        }
+      default: out += json[p]; break;  // \" \\ \/
+    }
+  }
+  return false;
+}
+
+static size_t base64Decode(const std::string& in, std::string& out) {
+  static int8_t table[256];
+  static bool built = false;
+  if (!built) {
+    memset(table, -1, sizeof(table));
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (int i = 0; i < 64; i++) table[(uint8_t)alphabet[i]] = i;
+    built = true;
+  }
+  out.clear();
+  out.reserve(in.size() / 4 * 3);
+  uint32_t quad = 0;
+  int bits = 0;
+  for (char ch : in) {
+    int v = table[(uint8_t)ch];
+    if (v < 0) continue;
+    quad = quad << 6 | v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out += (char)(quad >> bits);
+    }
+  }
+  return out.size();
+}
+
+static std::string drain(JsonBody& body) {
+  std::string out(body.size(), '\0');
+  body.read((uint8_t*)&out[0], out.size());
+  return out;
+}
+
+//----------------------------------------
+// Devices
+//----------------------------------------
+
+enum TurnState { TURN_IDLE, TURN_LISTENING, TURN_RECOGNIZING, TURN_THINKING, TURN_SPEAKING };
+
+struct Device {
+  int fd = -1;
+  Watch w;
+  uint32_t id = 0;
+  std::string name;
+  std::string in;
+  std::string out;
+  size_t outPos = 0;
+  bool wantWrite = false;
+  bool helloed = false;
+  gateway::Hello hello = {};
+  double connectedAt = 0;
+  bool closing = false;  // Close once out is written
+  bool dead = false;
+  bool dirty = false;
+
+  // The turn
+  TurnState state = TURN_IDLE;
+  double deadline = 0;
+  UpstreamCall* stt = nullptr;
+  SpeechGrpcReader* reader = nullptr;
+  uint8_t messages[2048];
+  std::string transcript;
+  ImaAdpcmDecoder upDecoder;
+  UpstreamCall* llm = nullptr;
+  std::vector<std::string> sentences;
+  std::vector<UpstreamCall*> synth;  // By sentence; null once delivered
+  size_t delivered = 0;              // Sentences whose audio is queued
+  std::string pcm;                   // Answer audio not yet framed
+  size_t pcmPos = 0;
+  uint32_t answerRate = TTS_RATE;
+  bool answerStarted = false;
+  ImaAdpcmEncoder downEncoder;
+  uint64_t samplesSent = 0;
+  double turnEndAt = 0;
+  double transcriptAt = 0;
+  double answerAt = 0;
+  double firstAudioAt = 0;
+};
+
+static std::vector<Device*> devices;
+static std::vector<Device*> dirty;
+static uint32_t nextDeviceId = 1;
+
+struct Stats {
+  uint64_t connections = 0;
+  uint64_t turns = 0;
+  uint64_t byStatus[6] = {};
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+  std::vector<double> latencies;  // TURN_END to first answer audio, this period
+  std::vector<double> stt, llm, tts;
+} stats;
+
+static void wake(Device* d) {
+  if (!d || d->dirty) return;
+  d->dirty = true;
+  dirty.push_back(d);
+}
+
+static void flushDevice(Device* d) {
+  while (d->outPos < d->out.size()) {
+    ssize_t n = send(d->fd, d->out.data() + d->outPos, d->out.size() - d->outPos, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      d->dead = true;
+      return;
+    }
+    d->outPos += n;
+    stats.bytesOut += n;
+  }
+  if (d->outPos == d->out.size() || d->outPos > 1 << 20) {
+    d->out.erase(0, d->outPos);
+    d->outPos = 0;
+  }
+  bool want = d->outPos < d->out.size();
+  if (want != d->wantWrite) {
+    d->wantWrite = want;
+    watch(d->fd, &d->w, EPOLLIN | (want ? (uint32_t)EPOLLOUT : 0), false);
+  }
+  if (!want && d->closing) d->dead = true;
+}
+
+static void queueFrame(Device* d, uint8_t type, const void* payload, size_t len) {
+  if (len > gateway::PAYLOAD_MAX) len = gateway::PAYLOAD_MAX;  // Texts are cut; audio is framed to fit
+  uint8_t header[gateway::HEADER_BYTES];
+  gateway::putHeader(header, type, len);
+  d->out.append((const char*)header, sizeof(header));
+  d->out.append((const char*)payload, len);
+}
+
+static void fail(Device* d, const char* message) {
+  fprintf(stderr, "[device %u %s] %s\n", (unsigned)d->id, d->name.c_str(), message);
+  queueFrame(d, gateway::FRAME_ERROR, message, strlen(message));
+  d->closing = true;
+  flushDevice(d);
+}
+
+static void clearTurn(Device* d) {
+  dropCall(d->stt);
+  d->stt = nullptr;
+  delete d->reader;
+  d->reader = nullptr;
+  dropCall(d->llm);
+  d->llm = nullptr;
+  for (UpstreamCall* call : d->synth) dropCall(call);
+  d->synth.clear();
+  d->sentences.clear();
+  d->delivered = 0;
+  d->pcm.clear();
+  d->pcmPos = 0;
+  d->state = TURN_IDLE;
+}
+
+static uint16_t spanMs(double from, double to) {
+  if (!from || !to || to < from) return 0;
+  return std::min(to - from, 65535.0);
+}
+
+static void endTurn(Device* d, gateway::Status status) {
+  gateway::TurnDone done = {};
+  done.status = status;
+  done.sttMs = spanMs(d->turnEndAt, d->transcriptAt);
+  done.llmMs = spanMs(d->transcriptAt, d->answerAt);
+  done.ttsMs = spanMs(d->answerAt, d->firstAudioAt);
+  done.audioMs = d->samplesSent * 1000 / d->answerRate;
+  queueFrame(d, gateway::FRAME_TURN_DONE, &done, sizeof(done));
+  stats.turns++;
+  stats.byStatus[status]++;
+  if (status == gateway::STATUS_OK && d->firstAudioAt) {
+    stats.latencies.push_back(d->firstAudioAt - d->turnEndAt);
+    stats.stt.push_back(done.sttMs);
+    stats.llm.push_back(done.llmMs);
+    stats.tts.push_back(done.ttsMs);
+  }
+  if (config.verbose || status != gateway::STATUS_OK) {
+    printf("[device %u %s] turn %s: stt %u ms, llm %u ms, tts %u ms, %u ms of audio\n", (unsigned)d->id,
+           d->name.c_str(), gateway::statusNames[status], done.sttMs, done.llmMs, done.ttsMs, (unsigned)done.audioMs);
+  }
+  clearTurn(d);
+  flushDevice(d);
+}
+
+static void onRecognized(void* ctx, const SpeechGrpcReader::Result& r) {
+  Device* d = (Device*)ctx;
+  if (r.isFinal) d->transcript.append(r.transcript, r.transcriptLen);
+}
+
+static void onSttData(void* ctx, const uint8_t* data, size_t len) {
+  Device* d = (Device*)ctx;
+  if (d->reader) d->reader->feed(data, len);
+}
+
+static void startTurn(Device* d) {
+  clearTurn(d);
+  d->transcript.clear();
+  d->answerStarted = false;
+  d->samplesSent = 0;
+  d->turnEndAt = d->transcriptAt = d->answerAt = d->firstAudioAt = 0;
+  d->upDecoder.begin(gateway::ADPCM_BLOCK_ALIGN);
+  d->reader = new SpeechGrpcReader(d->messages, sizeof(d->messages), onRecognized, d);
+
+  UpstreamCall* call = new UpstreamCall();
+  call->up = &speech;
+  call->path = SpeechGrpc::path();
+  call->grpc = true;
+  call->onData = onSttData;
+  call->owner = d;
+  uint8_t first[SpeechGrpc::CONFIG_MAX];
+  size_t n = SpeechGrpc::configRequest(first, d->hello.sampleRate, config.language.c_str(), false, false);
+  call->body.assign((const char*)first, n);
+  d->stt = call;
+  d->state = TURN_LISTENING;
+  d->deadline = nowMs() + LISTEN_TIMEOUT_MS;
+  startCall(call);
+}
+
+static void audioUp(Device* d, const uint8_t* p, size_t len) {
+  if (d->state != TURN_LISTENING || !d->stt || d->stt->done) return;
+  int16_t pcm[2 * gateway::PAYLOAD_MAX];
+  size_t count;
+  if (d->hello.uplinkCodec == gateway::CODEC_IMA_ADPCM) {
+    count = d->upDecoder.decode(p, len, pcm);
+  } else {
+    count = len / 2;
+    memcpy(pcm, p, count * 2);
+  }
+  uint8_t prefix[SpeechGrpc::AUDIO_PREFIX_MAX];
+  size_t n = SpeechGrpc::audioPrefix(prefix, count * 2);
+  d->stt->body.append((const char*)prefix, n);
+  d->stt->body.append((const char*)pcm, count * 2);
+  sendMore(d->stt);
+}
+
+static void endAudio(Device* d) {
+  if (d->state != TURN_LISTENING) return;
+  d->turnEndAt = nowMs();
+  d->deadline = d->turnEndAt + TURN_TIMEOUT_MS;
+  d->state = TURN_RECOGNIZING;
+  if (d->stt) {
+    d->stt->bodyEnded = true;
+    sendMore(d->stt);
+  }
+  wake(d);
+}
+
+static void askGemini(Device* d) {
+  JsonBody body;
+  body.raw("{\"contents\":[{\"parts\":[{\"text\":").string(d->transcript.c_str(), d->transcript.size()).raw("}]}]}");
+  UpstreamCall* call = new UpstreamCall();
+  call->up = &gemini;
+  call->path = "/v1beta/models/" + config.model + ":generateContent";
+  call->body = drain(body);
+  call->bodyEnded = true;
+  call->owner = d;
+  d->llm = call;
+  d->state = TURN_THINKING;
+  startCall(call);
+}
+
+// Collects SpeechText output into sentences: the first alone, so its audio
+// comes back soonest, then the rest in batches of TTS_GROUP_BYTES
+struct SentenceSink {
+  std::vector<std::string>* sentences;
+  std::string current;
+  size_t total = 0;
+};
+
+static void collectSentence(void* ctx, const char* text, size_t len, bool sentenceEnd) {
+  SentenceSink& s = *(SentenceSink*)ctx;
+  if (s.total + len > TTS_MAX_BYTES) return;
+  s.total += len;
+  s.current.append(text, len);
+  if (!sentenceEnd) return;
+  std::vector<std::string>& out = *s.sentences;
+  if (out.size() >= 2 && out.back().size() + s.current.size() <= TTS_GROUP_BYTES) {
+    out.back() += s.current;
+  } else {
+    out.push_back(s.current);
+  }
+  s.current.clear();
+}
+
+static void synthesizeNext(Device* d) {
+  size_t inFlight = 0;
+  for (size_t i = d->delivered; i < d->synth.size(); i++) inFlight += d->synth[i] != nullptr;
+  while (d->synth.size() < d->sentences.size() && inFlight < TTS_IN_FLIGHT) {
+    const std::string& text = d->sentences[d->synth.size()];
+    JsonBody body;
+    body.raw("{\"input\":{\"text\":")
+      .string(text.c_str(), text.size())
+      .raw("},\"voice\":{\"languageCode\":")
+      .string(config.language.c_str())
+      .raw(",\"name\":")
+      .string(config.voice.c_str())
+      .raw("},\"audioConfig\":{\"audioEncoding\":\"LINEAR16\",\"sampleRateHertz\":")
+      .number(TTS_RATE)
+      .raw("}}");
+    UpstreamCall* call = new UpstreamCall();
+    call->up = &tts;
+    call->path = "/v1/text:synthesize";
+    call->body = drain(body);
+    call->bodyEnded = true;
+    call->owner = d;
+    d->synth.push_back(call);
+    inFlight++;
+    startCall(call);
+  }
+}
+
+static void speak(Device* d, const std::string& answer) {
+  SentenceSink sink;
+  sink.sentences = &d->sentences;
+  SpeechText normalizer(collectSentence, &sink);
+  normalizer.write(answer.data(), answer.size());
+  normalizer.finish();
+  if (!sink.current.empty()) d->sentences.push_back(sink.current);
+  std::string spoken;
+  for (const std::string& s : d->sentences) spoken += s;
+  queueFrame(d, gateway::FRAME_ANSWER_TEXT, spoken.data(), spoken.size());
+  d->state = TURN_SPEAKING;
+  synthesizeNext(d);
+}
+
+// Frames queued answer audio while the device's socket keeps up, and
+// returns whether any was. A partial ADPCM block goes out only at the end
+// of the answer.
+static bool pumpAudio(Device* d) {
+  bool last = d->state == TURN_SPEAKING && d->delivered == d->sentences.size();
+  size_t start = d->samplesSent;
+  while (d->out.size() - d->outPos < DEVICE_OUT_HIGH && d->pcmPos < d->pcm.size()) {
+    const int16_t* samples = (const int16_t*)(d->pcm.data() + d->pcmPos);
+    size_t available = (d->pcm.size() - d->pcmPos) / 2;
+    size_t count;
+    if (d->hello.downlinkCodec == gateway::CODEC_IMA_ADPCM) {
+      const size_t perBlock = ImaAdpcm::samplesPerBlock(gateway::ADPCM_BLOCK_ALIGN);
+      const size_t blocks = gateway::PAYLOAD_MAX / gateway::ADPCM_BLOCK_ALIGN;
+      count = std::min(available, perBlock * blocks);
+      if (count < perBlock * blocks && !last) count -= count % perBlock;
+      if (count == 0) break;
+      uint8_t frame[gateway::PAYLOAD_MAX];
+      size_t len = 0;
+      for (size_t i = 0; i < count; i += perBlock) {
+        len += d->downEncoder.encodeBlock(samples + i, std::min(perBlock, count - i), frame + len);
+      }
+      queueFrame(d, gateway::FRAME_AUDIO_DOWN, frame, len);
+    } else {
+      count = std::min(available, gateway::PAYLOAD_MAX / 2);
+      queueFrame(d, gateway::FRAME_AUDIO_DOWN, samples, count * 2);
+    }
+    d->pcmPos += count * 2;
+    d->samplesSent += count;
+  }
+  if (d->pcmPos == d->pcm.size() || d->pcmPos > 1 << 20) {
+    d->pcm.erase(0, d->pcmPos);
+    d->pcmPos = 0;
+  }
+  return d->samplesSent != start;
+}
+
+// Pumps and sends until the socket pushes back; EPOLLOUT brings the rest
+static void sendAnswer(Device* d) {
+  while (pumpAudio(d)) {
+    flushDevice(d);
+    if (d->dead || d->wantWrite) return;
+  }
+  flushDevice(d);
+}
+
+// Moves the turn on after an upstream call finished
+static void advance(Device* d) {
+  if (d->state == TURN_LISTENING && d->stt && d->stt->done && !d->stt->ok()) {
+    // The device stops streaming on TURN_DONE; a TURN_END already on its way is ignored
+    fprintf(stderr, "[device %u] recognition failed while listening: error %u\n", (unsigned)d->id,
+            (unsigned)d->stt->error);
+    endTurn(d, gateway::STATUS_STT_FAILED);
+    return;
+  }
+  if (d->state == TURN_RECOGNIZING && d->stt && d->stt->done) {
+    UpstreamCall* call = d->stt;
+    if (!call->ok()) {
+      fprintf(stderr, "[device %u] recognition failed: status %d, grpc-status %s, error %u\n", (unsigned)d->id,
+              call->status, call->grpcStatus.c_str(), (unsigned)call->error);
+      endTurn(d, gateway::STATUS_STT_FAILED);
+      return;
+    }
+    d->transcriptAt = nowMs();
+    dropCall(d->stt);
+    d->stt = nullptr;
+    if (d->transcript.empty()) {
+      endTurn(d, gateway::STATUS_NO_SPEECH);
+      return;
+    }
+    queueFrame(d, gateway::FRAME_TRANSCRIPT, d->transcript.data(), d->transcript.size());
+    askGemini(d);
+  }
+  if (d->state == TURN_THINKING && d->llm && d->llm->done) {
+    std::string answer;
+    if (!d->llm->ok() || !jsonString(d->llm->response, "text", answer)) {
+      std::string message;
+      jsonString(d->llm->response, "message", message);
+      fprintf(stderr, "[device %u] gemini failed: status %d, error %u %s\n", (unsigned)d->id, d->llm->status,
+              (unsigned)d->llm->error, message.c_str());
+      endTurn(d, gateway::STATUS_LLM_FAILED);
+      return;
+    }
+    d->answerAt = nowMs();
+    dropCall(d->llm);
+    d->llm = nullptr;
+    speak(d, answer);
+  }
+  if (d->state == TURN_SPEAKING) {
+    // Sentences are played in order, however they complete
+    while (d->delivered < d->synth.size() && d->synth[d->delivered]->done) {
+      UpstreamCall* call = d->synth[d->delivered];
+      std::string audio64;
+      std::string audio;
+      if (!call->ok() || !jsonString(call->response, "audioContent", audio64)) {
+        fprintf(stderr, "[device %u] tts failed: status %d, error %u\n", (unsigned)d->id, call->status,
+                (unsigned)call->error);
+        endTurn(d, gateway::STATUS_TTS_FAILED);
+        return;
+      }
+      base64Decode(audio64, audio);
+      size_t skip = 0;
+      if (audio.size() >= 44 && audio.compare(0, 4, "RIFF") == 0) {
+        memcpy(&d->answerRate, &audio[24], 4);
+        skip = 44;
+      }
+      if (!d->answerStarted) {
+        gateway::AnswerStart start = {};
+        start.sampleRate = d->answerRate;
+        start.codec = d->hello.downlinkCodec;
+        queueFrame(d, gateway::FRAME_ANSWER_START, &start, sizeof(start));
+        d->downEncoder.reset();
+        d->answerStarted = true;
+        d->firstAudioAt = nowMs();
+      }
+      d->pcm.append(audio, skip, (audio.size() - skip) & ~(size_t)1);
+      dropCall(call);
+      d->synth[d->delivered++] = nullptr;
+    }
+    synthesizeNext(d);
+    sendAnswer(d);
+    if (d->delivered == d->sentences.size() && d->pcmPos == d->pcm.size()) {
+      endTurn(d, gateway::STATUS_OK);
+      return;
+    }
+  }
+  flushDevice(d);
+}
+
+static void handleFrame(Device* d, uint8_t type, const uint8_t* p, size_t len) {
+  if (!d->helloed) {
+    if (type != gateway::FRAME_HELLO || len < sizeof(gateway::Hello)) return fail(d, "expected HELLO");
+    memcpy(&d->hello, p, sizeof(d->hello));
+    d->hello.deviceId[sizeof(d->hello.deviceId) - 1] = '\0';
+    if (d->hello.version != gateway::VERSION) return fail(d, "unsupported protocol version");
+    if (d->hello.uplinkCodec > gateway::CODEC_IMA_ADPCM || d->hello.downlinkCodec > gateway::CODEC_IMA_ADPCM) {
+      return fail(d, "unsupported codec");
+    }
+    if (d->hello.sampleRate < 8000 || d->hello.sampleRate > 48000) return fail(d, "unsupported sample rate");
+    d->helloed = true;
+    d->name = d->hello.deviceId;
+    gateway::Ready ready = {};
+    ready.version = gateway::VERSION;
+    ready.sessionId = d->id;
+    queueFrame(d, gateway::FRAME_READY, &ready, sizeof(ready));
+    if (config.verbose) printf("[device %u %s] ready\n", (unsigned)d->id, d->name.c_str());
+    return;
+  }
+  switch (type) {
+    case gateway::FRAME_TURN_START:
+      if (d->state != TURN_IDLE) return fail(d, "TURN_START inside a turn");
+      startTurn(d);
+      break;
+    case gateway::FRAME_AUDIO_UP:
+      audioUp(d, p, len);
+      break;
+    case gateway::FRAME_TURN_END:
+      endAudio(d);
+      break;
+    case gateway::FRAME_CANCEL:
+      if (d->state != TURN_IDLE) endTurn(d, gateway::STATUS_CANCELLED);
+      break;
+    default:
+      break;
+  }
+}
+
+static void closeDevice(Device* d) {
+  if (config.verbose) printf("[device %u %s] disconnected\n", (unsigned)d->id, d->name.c_str());
+  clearTurn(d);
+  epoll_ctl(epfd, EPOLL_CTL_DEL, d->fd, nullptr);
+  close(d->fd);
+  devices.erase(std::find(devices.begin(), devices.end(), d));
+  delete d;
+}
+
+static void deviceEvents(void* ctx, uint32_t events) {
+  Device* d = (Device*)ctx;
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    char buf[16384];
+    for (;;) {
+      ssize_t n = recv(d->fd, buf, sizeof(buf), 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+      if (n <= 0) {
+        d->dead = true;
+        break;
+      }
+      stats.bytesIn += n;
+      d->in.append(buf, n);
+    }
+    size_t pos = 0;
+    while (!d->closing && d->in.size() - pos >= gateway::HEADER_BYTES) {
+      const uint8_t* h = (const uint8_t*)d->in.data() + pos;
+      size_t len = gateway::payloadLength(h);
+      if (len > gateway::PAYLOAD_MAX) {
+        fail(d, "frame too large");
+        break;
+      }
+      if (d->in.size() - pos < gateway::HEADER_BYTES + len) break;
+      handleFrame(d, h[0], h + gateway::HEADER_BYTES, len);
+      pos += gateway::HEADER_BYTES + len;
+    }
+    d->in.erase(0, pos);
+  }
+  if (!d->dead) {
+    sendAnswer(d);
+    if (d->state == TURN_SPEAKING) wake(d);  // The socket drained: the answer may be complete
+  }
+  if (d->dead) wake(d);
+}
+
+static int listener = -1;
+static Watch listenWatch;
+
+static void acceptDevices(void*, uint32_t) {
+  for (;;) {
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) return;
+    setNonBlocking(fd);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    Device* d = new Device();
+    d->fd = fd;
+    d->id = nextDeviceId++;
+    d->connectedAt = nowMs();
+    d->w = { deviceEvents, d };
+    devices.push_back(d);
+    stats.connections++;
+    watch(fd, &d->w, EPOLLIN, true);
+  }
+}
+
+static void checkTimeouts(double now) {
+  for (Device* d : devices) {
+    if (!d->helloed && !d->closing && now - d->connectedAt > HELLO_TIMEOUT_MS) {
+      fail(d, "no HELLO");
+    } else if (d->state != TURN_IDLE && now > d->deadline) {
+      endTurn(d, d->state <= TURN_RECOGNIZING ? gateway::STATUS_STT_FAILED
+                 : d->state == TURN_THINKING ? gateway::STATUS_LLM_FAILED
+                                             : gateway::STATUS_TTS_FAILED);
+    }
+    if (d->dead) wake(d);
+  }
+}
+
+static double percentile(std::vector<double>& v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, (size_t)(p * v.size()))];
+}
+
+static void report(double seconds) {
+  size_t busy = 0;
+  for (Device* d : devices) busy += d->state != TURN_IDLE;
+  printf("[gateway] %zu devices (%zu in a turn), %llu turns, %llu failed | first audio p50 %.0f p99 %.0f ms"
+         " (stt p50 %.0f, llm p50 %.0f, tts p50 %.0f) over %zu turns in %.0f s\n",
+         devices.size(), busy, (unsigned long long)stats.turns,
+         (unsigned long long)(stats.turns - stats.byStatus[gateway::STATUS_OK] - stats.byStatus[gateway::STATUS_NO_SPEECH]
+                              - stats.byStatus[gateway::STATUS_CANCELLED]),
+         percentile(stats.latencies, 0.5), percentile(stats.latencies, 0.99), percentile(stats.stt, 0.5),
+         percentile(stats.llm, 0.5), percentile(stats.tts, 0.5), stats.latencies.size(), seconds);
+  for (Upstream* up : { &speech, &gemini, &tts }) {
+    int streams = 0;
+    for (Connection* c : up->conns) streams += c->h2.openStreams();
+    printf("[gateway]   %-6s %zu connections, %d streams open, %zu waiting | %llu requests, %llu queued,"
+           " %llu connects, %llu failures\n",
+           up->name, up->conns.size(), streams, up->waiting.size(), (unsigned long long)up->requests,
+           (unsigned long long)up->queued, (unsigned long long)up->connects, (unsigned long long)up->failures);
+  }
+  stats.latencies.clear();
+  stats.stt.clear();
+  stats.llm.clear();
+  stats.tts.clear();
+}
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--port N] [--key KEY] [--upstream URL | --speech URL --gemini URL --tts URL]\n"
+          "          [--model NAME] [--voice NAME] [--language CODE] [--pool N] [--verbose]\n"
+          "  The key may also come from GOOGLE_API_KEY. --upstream points all three APIs at one\n"
+          "  server, such as http://127.0.0.1:8443 for tools/gateway_standin.py.\n",
+          argv0);
+}
+
+int main(int argc, char** argv) {
+  if (getenv("GOOGLE_API_KEY")) config.key = getenv("GOOGLE_API_KEY");
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (a == "--verbose") {
+      config.verbose = true;
+      continue;
+    }
+    if (!v) {
+      usage(argv[0]);
+      return 2;
+    }
+    i++;
+    if (a == "--port") config.port = atoi(v);
+    else if (a == "--key") config.key = v;
+    else if (a == "--upstream") config.speechUrl = config.geminiUrl = config.ttsUrl = v;
+    else if (a == "--speech") config.speechUrl = v;
+    else if (a == "--gemini") config.geminiUrl = v;
+    else if (a == "--tts") config.ttsUrl = v;
+    else if (a == "--model") config.model = v;
+    else if (a == "--voice") config.voice = v;
+    else if (a == "--language") config.language = v;
+    else if (a == "--pool") config.pool = std::max(1, atoi(v));
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (!parseUrl(config.speechUrl, speech) || !parseUrl(config.geminiUrl, gemini) || !parseUrl(config.ttsUrl, tts)) {
+    fprintf(stderr, "upstream URLs are http:// or https://host[:port]\n");
+    return 2;
+  }
+  if (config.key.empty()) fprintf(stderr, "no API key: set GOOGLE_API_KEY or pass --key\n");
+
+  // Hundreds of devices plus the pools
+  rlimit files;
+  if (getrlimit(RLIMIT_NOFILE, &files) == 0) {
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, [](int) { stopping = 1; });
+  signal(SIGTERM, [](int) { stopping = 1; });
+
+  sslCtx = SSL_CTX_new(TLS_client_method());
+  SSL_CTX_set_default_verify_paths(sslCtx);
+  SSL_CTX_set_verify(sslCtx, SSL_VERIFY_PEER, nullptr);
+  SSL_CTX_set_min_proto_version(sslCtx, TLS1_2_VERSION);
+  SSL_CTX_set_mode(sslCtx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  epfd = epoll_create1(0);
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config.port);
+  addr.sin_addr.s_addr = INADDR_ANY;
+  if (bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 512) < 0) {
+    perror("listen");
+    return 1;
+  }
+  fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+  listenWatch = { acceptDevices, nullptr };
+  watch(listener, &listenWatch, EPOLLIN, true);
+  printf("[gateway] listening on port %d; speech %s:%d, gemini %s:%d, tts %s:%d, %zu connections per host\n",
+         config.port, speech.host.c_str(), speech.port, gemini.host.c_str(), gemini.port, tts.host.c_str(), tts.port,
+         config.pool);
+
+  double lastTimeouts = nowMs();
+  double lastReport = lastTimeouts;
+  epoll_event events[256];
+  while (!stopping) {
+    int n = epoll_wait(epfd, events, 256, 100);
+    for (int i = 0; i < n; i++) {
+      Watch* w = (Watch*)events[i].data.ptr;
+      w->fn(w->ctx, events[i].events);
+    }
+    double now = nowMs();
+    if (now - lastTimeouts >= 250) {
+      checkTimeouts(now);
+      for (Upstream* up : { &speech, &gemini, &tts }) startWaiting(*up);  // After a reconnect delay
+      lastTimeouts = now;
+    }
+    // Turns whose calls moved, and devices to let go; advancing one may
+    // wake another (a connection failure ends several calls)
+    while (!dirty.empty()) {
+      std::vector<Device*> batch;
+      batch.swap(dirty);
+      for (Device* d : batch) d->dirty = false;
+      for (Device* d : batch) {
+        if (d->dead) {
+          closeDevice(d);
+        } else {
+          advance(d);
+          if (d->dead) wake(d);
+        }
+      }
+    }
+    if (now - lastReport >= 10000) {
+      report((now - lastReport) / 1000);
+      lastReport = now;
+    }
+  }
+  report((nowMs() - lastReport) / 1000);
+  return 0;
+}
@@ -0,0 +1,231 @@
+// Drives volume_limiter.h the way the playback task does (the mixer's
+// unsaturated 32-bit sum in 256-sample blocks at 44.1 kHz) and checks it:
+// loud input never clips at any volume step, input below the threshold
+// passes through untouched apart from the look-ahead delay, the steps are
+// DB_PER_STEP apart with step 0 muting, and a volume change ramps over
+// RAMP_MS without steps. Then reports the cost per block with quiet input,
+// while limiting, and while the volume ramps.
+//
+// The loud inputs are up to four full-scale sources summed, which is the
+// most the mixer can hand over: sines, square waves, isolated clicks
+// and noise.
+//
+//   g++ -O2 -std=c++17 -I.. -o volume_check volume_check.cpp
+//   ./volume_check
+#include "volume_limiter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+static const uint32_t SAMPLE_RATE = 44100;  // SAMPLE_RATE in main.cpp
+static const int BLOCK = 256;               // PLAYBACK_BLOCK_SAMPLES
+static const int32_t MIX_MAX = 4 * 32767;   // Mixer::MAX_SLOTS sources at full scale
+
+static double cpuMicros() {
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Runs in through a limiter in blocks and returns the output
+static std::vector<int16_t> run(VolumeLimiter& limiter, const std::vector<int32_t>& in) {
+  std::vector<int16_t> out(in.size());
+  for (size_t i = 0; i < in.size(); i += BLOCK) {
+    int n = in.size() - i < (size_t)BLOCK ? (int)(in.size() - i) : BLOCK;
+    limiter.process(&in[i], &out[i], n);
+  }
+  return out;
+}
+
+//----------------------------------------------------------------------
+// Signals, one second each
+//----------------------------------------------------------------------
+
+static std::vector<int32_t> sine(double hz, int32_t peak) {
+  std::vector<int32_t> s(SAMPLE_RATE);
+  for (size_t i = 0; i < s.size(); i++) s[i] = (int32_t)lrint(peak * sin(2 * M_PI * hz * i / SAMPLE_RATE));
+  return s;
+}
+
+static std::vector<int32_t> square(double hz, int32_t peak) {
+  std::vector<int32_t> s(SAMPLE_RATE);
+  for (size_t i = 0; i < s.size(); i++) s[i] = fmod(hz * i / SAMPLE_RATE, 1.0) < 0.5 ? peak : -peak;
+  return s;
+}
+
+// Single-sample clicks on quiet audio, the worst case for the attack
+static std::vector<int32_t> clicks(int32_t peak) {
+  std::vector<int32_t> s = sine(300, 4000);
+  for (size_t i = 1000; i < s.size(); i += 997) s[i] = (i / 997) & 1 ? peak : -peak;
+  return s;
+}
+
+static std::vector<int32_t> noise(int32_t peak) {
+  std::vector<int32_t> s(SAMPLE_RATE);
+  srand(3);
+  for (int32_t& v : s) v = (int32_t)(((double)rand() / RAND_MAX * 2 - 1) * peak);
+  return s;
+}
+
+static std::vector<int32_t> constant(int32_t value, size_t samples) { return std::vector<int32_t>(samples, value); }
+
+//----------------------------------------------------------------------
+// Checks
+//----------------------------------------------------------------------
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+  if (!ok) {
+    failures++;
+    printf("FAIL %s\n", what);
+  }
+}
+
+static void noClipping() {
+  struct Signal {
+    const char* name;
+    std::vector<int32_t> samples;
+  };
+  const Signal signals[] = {
+    { "sine 200 Hz", sine(200, MIX_MAX) },    { "sine 3 kHz", sine(3000, MIX_MAX) },
+    { "square 100 Hz", square(100, MIX_MAX) }, { "clicks", clicks(MIX_MAX) },
+    { "noise", noise(MIX_MAX) },              { "sine at 0 dBFS", sine(440, 32767) },
+  };
+  int32_t worst = 0;
+  for (const Signal& sig : signals) {
+    for (int step = 0; step <= VolumeLimiter::STEPS; step++) {
+      VolumeLimiter limiter(SAMPLE_RATE);
+      limiter.setVolume(step);
+      std::vector<int16_t> out = run(limiter, sig.samples);
+      int32_t peak = 0;
+      for (int16_t v : out) peak = abs(v) > peak ? abs(v) : peak;
+      if (peak > worst) worst = peak;
+      if (limiter.clippedSamples() > 0 || peak > VolumeLimiter::THRESHOLD) {
+        failures++;
+        printf("FAIL %s at step %d: peak %d, %u samples clipped\n", sig.name, step, peak, limiter.clippedSamples());
+      }
+    }
+  }
+  printf("clipping:  %zu loud signals at %d steps, highest output peak %d (threshold %d)\n",
+         sizeof(signals) / sizeof(signals[0]), VolumeLimiter::STEPS + 1, worst, VolumeLimiter::THRESHOLD);
+}
+
+static void transparency() {
+  VolumeLimiter limiter(SAMPLE_RATE);
+  std::vector<int32_t> in = sine(440, VolumeLimiter::THRESHOLD);
+  std::vector<int16_t> out = run(limiter, in);
+  bool same = true;
+  for (size_t i = VolumeLimiter::LOOKAHEAD; i < in.size(); i++) same &= out[i] == in[i - VolumeLimiter::LOOKAHEAD];
+  check(same, "input at the threshold is not passed through at full volume");
+  check(limiter.limitedSamples() == 0, "input at the threshold is limited");
+}
+
+static void steps() {
+  const int32_t level = 20000;
+  double prevDb = 0;
+  bool spaced = true;
+  for (int step = VolumeLimiter::STEPS; step >= 0; step--) {
+    VolumeLimiter limiter(SAMPLE_RATE);
+    limiter.setVolume(step);
+    std::vector<int16_t> out = run(limiter, constant(level, BLOCK * 8));
+    int16_t v = out.back();
+    if (step == 0) {
+      check(v == 0, "step 0 does not mute");
+      break;
+    }
+    double db = 20 * log10((double)v / level);
+    if (step < VolumeLimiter::STEPS && fabs(prevDb - db - VolumeLimiter::DB_PER_STEP) > 0.05) spaced = false;
+    prevDb = db;
+  }
+  check(spaced, "volume steps are not DB_PER_STEP apart");
+}
+
+static void ramping() {
+  const int32_t level = 20000;
+  VolumeLimiter limiter(SAMPLE_RATE);
+  run(limiter, constant(level, BLOCK));
+  limiter.setVolume(VolumeLimiter::STEPS / 2);
+  std::vector<int16_t> out = run(limiter, constant(level, SAMPLE_RATE / 10));
+
+  // The delay line still holds samples at the old volume
+  const size_t from = VolumeLimiter::LOOKAHEAD;
+  const size_t rampSamples = SAMPLE_RATE * VolumeLimiter::RAMP_MS / 1000;
+  int32_t largestStep = 0;
+  bool monotonic = true;
+  for (size_t i = from + 1; i < out.size(); i++) {
+    int32_t d = out[i - 1] - out[i];
+    monotonic &= d >= 0;
+    if (d > largestStep) largestStep = d;
+  }
+  int16_t settled = out[from + rampSamples];
+  check(monotonic, "a volume change is not monotonic");
+  check(settled == out.back() && settled < level / 2, "a volume change does not finish within RAMP_MS");
+  // Spread over rampSamples, each step is well under 1/100 of the change
+  check(largestStep * 100 < level - settled, "a volume change steps instead of ramping");
+  printf("ramping:   0 dB to -%d dB in %zu samples, largest step %d\n",
+         VolumeLimiter::STEPS / 2 * VolumeLimiter::DB_PER_STEP, rampSamples, largestStep);
+}
+
+//----------------------------------------------------------------------
+// Cost per block
+//----------------------------------------------------------------------
+
+static double blockCost(const std::vector<int32_t>& in, bool ramp) {
+  VolumeLimiter limiter(SAMPLE_RATE);
+  int16_t out[BLOCK];
+  long blocks = 0;
+  int32_t sink = 0;
+  double start = cpuMicros();
+  double elapsed = 0;
+  while (elapsed < 200000) {
+    for (int b = 0; b < 64; b++) {
+      // Changing the volume every block keeps the ramp running
+      if (ramp) limiter.setVolume((blocks + b) & 1 ? VolumeLimiter::STEPS : 1);
+      limiter.process(&in[(size_t)b * BLOCK], out, BLOCK);
+      sink += out[b];
+    }
+    blocks += 64;
+    elapsed = cpuMicros() - start;
+  }
+  if (sink == 0x7fffffff) printf(" ");  // Keeps the output live
+  return elapsed / blocks;
+}
+
+static void bench() {
+  const double budgetUs = BLOCK * 1e6 / SAMPLE_RATE;
+  struct Case {
+    const char* name;
+    std::vector<int32_t> in;
+    bool ramp;
+  };
+  const Case cases[] = {
+    { "quiet", sine(440, 8000), false },
+    { "limiting", noise(MIX_MAX), false },
+    { "ramping", sine(440, 8000), true },
+  };
+  printf("cost per %d-sample block (budget %.0f us at %u Hz):\n", BLOCK, budgetUs, SAMPLE_RATE);
+  for (const Case& c : cases) {
+    double us = blockCost(c.in, c.ramp);
+    printf("  %-9s %6.2f us, %5.2f ns per sample\n", c.name, us, us * 1000 / BLOCK);
+  }
+}
+
+int main() {
+  noClipping();
+  transparency();
+  steps();
+  ramping();
+  bench();
+
+  if (failures) {
+    printf("%d failures\n", failures);
+    return 1;
+  }
+  printf("ok\n");
+  return 0;
+}
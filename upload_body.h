@@ -0,0 +1,135 @@
+// Binary request body for an audio upload: multipart/form-data with a few
+// text fields and one file part, or the file alone as the whole body
+// (application/octet-stream style). The file is a short head from the
+// caller, such as a WAV header, followed by content pulled from a source
+// while the body is read, so audio goes from the recording store to the
+// socket with no payload buffer and no base64. size() is the exact byte
+// count, for Content-Length. Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+class UploadBody {
+ public:
+  static const size_t FRAMING_MAX = 512;  // Fields and the file part's headers
+  static const size_t HEAD_MAX = 64;
+
+  // Copies up to max bytes of file content into out and returns the
+  // count; less than asked only at the end of the content
+  typedef size_t (*SourceFn)(void* ctx, uint8_t* out, size_t max);
+
+  // With a boundary the body is multipart; without one it is the file alone
+  explicit UploadBody(const char* boundary = nullptr) : boundary_(boundary) {
+    if (boundary_) snprintf(contentType_, sizeof(contentType_), "multipart/form-data; boundary=%s", boundary_);
+  }
+
+  // A text field; all fields come before the file
+  UploadBody& field(const char* name, const char* value) {
+    if (!boundary_ || hasFile_) return fail();
+    return advance(snprintf(framing_ + framingLen_, FRAMING_MAX - framingLen_,
+                            "--%s\r\nContent-Disposition: form-data; name=\"%s\"\r\n\r\n%s\r\n", boundary_, name, value));
+  }
+
+  // The file: head, then length bytes from source
+  UploadBody& file(const char* name, const char* filename, const char* contentType, const uint8_t* head,
+                   size_t headLen, SourceFn source, void* ctx, size_t length) {
+    if (hasFile_ || headLen > HEAD_MAX) return fail();
+    hasFile_ = true;
+    memcpy(head_, head, headLen);
+    headLen_ = headLen;
+    source_ = source;
+    ctx_ = ctx;
+    length_ = length;
+    if (!boundary_) {
+      snprintf(contentType_, sizeof(contentType_), "%s", contentType);
+      return *this;
+    }
+    advance(snprintf(framing_ + framingLen_, FRAMING_MAX - framingLen_,
+                     "--%s\r\nContent-Disposition: form-data; name=\"%s\"; filename=\"%s\"\r\nContent-Type: %s\r\n\r\n",
+                     boundary_, name, filename, contentType));
+    int n = snprintf(closing_, sizeof(closing_), "\r\n--%s--\r\n", boundary_);
+    if (n < 0 || n >= (int)sizeof(closing_)) return fail();
+    closingLen_ = n;
+    return *this;
+  }
+
+  // False if the framing did not fit or the parts came out of order
+  bool ok() const { return ok_ && hasFile_; }
+  // True once the source ran dry before length; the body is then short
+  bool truncated() const { return truncated_; }
+  size_t size() const { return framingLen_ + headLen_ + length_ + closingLen_; }
+  size_t remaining() const { return size() - sent_; }
+  const char* contentType() const { return contentType_; }
+  // Bytes the framing adds to the file
+  size_t overhead() const { return framingLen_ + closingLen_; }
+
+  // Copies up to len bytes of the body and returns the count, 0 at the end
+  size_t read(uint8_t* out, size_t len) {
+    size_t contentStart = framingLen_ + headLen_;
+    size_t contentEnd = contentStart + length_;
+    size_t n = 0;
+    while (n < len) {
+      size_t pos = sent_ + n;
+      size_t k;
+      if (pos < framingLen_) {
+        k = take(out + n, len - n, (const uint8_t*)framing_ + pos, framingLen_ - pos);
+      } else if (pos < contentStart) {
+        k = take(out + n, len - n, head_ + pos - framingLen_, contentStart - pos);
+      } else if (pos < contentEnd) {
+        if (truncated_) break;
+        size_t want = len - n < contentEnd - pos ? len - n : contentEnd - pos;
+        k = source_(ctx_, out + n, want);
+        if (k < want) truncated_ = true;
+        if (k == 0) break;
+      } else if (pos < contentEnd + closingLen_) {
+        k = take(out + n, len - n, (const uint8_t*)closing_ + pos - contentEnd, contentEnd + closingLen_ - pos);
+      } else {
+        break;
+      }
+      n += k;
+    }
+    sent_ += n;
+    return n;
+  }
+
+ private:
+  const char* boundary_;
+  char contentType_[96] = "application/octet-stream";
+  char framing_[FRAMING_MAX];
+  size_t framingLen_ = 0;
+  uint8_t head_[HEAD_MAX];
+  size_t headLen_ = 0;
+  SourceFn source_ = nullptr;
+  void* ctx_ = nullptr;
+  size_t length_ = 0;
+  char closing_[80];
+  size_t closingLen_ = 0;
+  bool hasFile_ = false;
+  bool ok_ = true;
+  bool truncated_ = false;
+  size_t sent_ = 0;
+
+  UploadBody& fail() {
+    ok_ = false;
+    return *this;
+  }
+
+  // Keeps what snprintf appended to the framing, if it all fit
+  UploadBody& advance(int n) {
+    if (n < 0 || (size_t)n >= FRAMING_MAX - framingLen_) {
+      framing_[framingLen_] = '\0';
+      return fail();
+    }
+    framingLen_ += n;
+    return *this;
+  }
+
+  static size_t take(uint8_t* out, size_t room, const uint8_t* data, size_t len) {
+    size_t k = len < room ? len : room;
+    memcpy(out, data, k);
+    return k;
+  }
+};
@@ -0,0 +1,112 @@
+// Output gain stage for the playback path: a dB-stepped volume that ramps
+// between steps, followed by a look-ahead peak limiter. Both run in one
+// fixed-point pass that also narrows the mixer's 32-bit sum to 16-bit
+// samples, so loud TTS or overlapping sources are turned down ahead of the
+// peak instead of clipping. Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+class VolumeLimiter {
+ public:
+  static const int STEPS = 20;             // STEPS is 0 dB, 0 mutes
+  static const int DB_PER_STEP = 2;
+  static const int LOOKAHEAD = 64;         // Samples of delay, power of two
+  static const int32_t UNITY = 1 << 15;    // Q15 gain of 1.0
+  static const int32_t THRESHOLD = 29204;  // -1 dBFS
+  static const int RELEASE_SHIFT = 11;     // ~45 ms time constant at 44.1 kHz
+  static const uint32_t RAMP_MS = 30;      // Volume step transition
+
+  explicit VolumeLimiter(uint32_t sampleRate) {
+    table_[0] = 0;
+    for (int s = 1; s <= STEPS; s++) {
+      table_[s] = (int32_t)(UNITY * powf(10.0f, (s - STEPS) * DB_PER_STEP / 20.0f) + 0.5f);
+    }
+    rampSamples_ = sampleRate * RAMP_MS / 1000;
+    setVolume(STEPS);
+    volume_ = target_;
+  }
+
+  void setVolume(int step) {
+    step_ = step < 0 ? 0 : step > STEPS ? STEPS : step;
+    target_ = table_[step_];
+    int32_t distance = target_ > volume_ ? target_ - volume_ : volume_ - target_;
+    volumeStep_ = (distance + rampSamples_ - 1) / rampSamples_;
+    if (volumeStep_ == 0) volumeStep_ = 1;
+  }
+
+  int volume() const { return step_; }
+  uint32_t limitedSamples() const { return limited_; }
+  uint32_t clippedSamples() const { return clipped_; }
+
+  void process(const int32_t* in, int16_t* out, int count) {
+    for (int i = 0; i < count; i++) {
+      if (volume_ < target_) {
+        volume_ = target_ - volume_ > volumeStep_ ? volume_ + volumeStep_ : target_;
+      } else if (volume_ > target_) {
+        volume_ = volume_ - target_ > volumeStep_ ? volume_ - volumeStep_ : target_;
+      }
+      int32_t x = (int32_t)(((int64_t)in[i] * volume_) >> 15);
+
+      // The gain a sample needs is held for as long as it sits in the
+      // delay line, and the attack is fast enough to get there before
+      // the sample comes out.
+      int32_t magnitude = x < 0 ? -x : x;
+      if (magnitude > THRESHOLD) {
+        int32_t need = (int32_t)(((int64_t)THRESHOLD << 15) / magnitude);
+        if (need < hold_) {
+          hold_ = need;
+          int32_t attack = (gain_ - need + LOOKAHEAD - 1) / LOOKAHEAD;
+          if (attack > attack_) attack_ = attack;
+        }
+        holdLeft_ = LOOKAHEAD + 1;  // Released only after the sample is out
+      } else if (holdLeft_ > 0 && --holdLeft_ == 0) {
+        hold_ = UNITY;
+      }
+
+      if (gain_ > hold_) {
+        gain_ -= attack_;
+        if (gain_ <= hold_) {
+          gain_ = hold_;
+          attack_ = 0;
+        }
+      } else if (gain_ < hold_) {
+        gain_ += ((hold_ - gain_) >> RELEASE_SHIFT) + 1;
+        if (gain_ > hold_) gain_ = hold_;
+      }
+
+      int32_t delayed = delay_[pos_];
+      delay_[pos_] = x;
+      pos_ = (pos_ + 1) & (LOOKAHEAD - 1);
+
+      int32_t y = (int32_t)(((int64_t)delayed * gain_) >> 15);
+      if (gain_ < UNITY) limited_++;
+      if (y > 32767) {
+        y = 32767;
+        clipped_++;
+      } else if (y < -32768) {
+        y = -32768;
+        clipped_++;
+      }
+      out[i] = (int16_t)y;
+    }
+  }
+
+ private:
+  int32_t table_[STEPS + 1];
+  int32_t rampSamples_;
+  int step_ = STEPS;
+  int32_t volume_ = UNITY;  // Q15, ramps towards target_
+  int32_t target_ = UNITY;
+  int32_t volumeStep_ = 1;
+
+  int32_t delay_[LOOKAHEAD] = {};
+  int pos_ = 0;
+  int32_t gain_ = UNITY;  // Limiter gain, Q15
+  int32_t hold_ = UNITY;  // Lowest gain needed by a sample still in the delay line
+  int32_t attack_ = 0;    // Per-sample decrease while gain_ > hold_
+  int holdLeft_ = 0;
+  uint32_t limited_ = 0;
+  uint32_t clipped_ = 0;
+};
@@ -0,0 +1,469 @@
+// WebSocket client (RFC 6455) for one long-lived connection. Payload is
+// handed over in pieces as it arrives, so a message of any size passes
+// through the RX_BUFFER_BYTES buffer without being collected; outgoing
+// messages can likewise be written in pieces once their length is known.
+// Pings are answered, the close handshake is honoured, and server frames
+// that break the protocol close the connection with 1002.
+//
+// The transport (TLS, or plain TCP to a local test server) is reached
+// through ReadFn and WriteFn, as in h2_client.h. poll() is non-blocking
+// and delivers every event. Single-threaded: one task owns the client.
+// Plain C++, no Arduino dependencies.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class WsClient {
+ public:
+  // Writes all of data; returns len, or < 0 on error
+  typedef int32_t (*WriteFn)(void* io, const uint8_t* data, uint32_t len);
+  // Reads what is available, up to len; 0 if nothing yet, < 0 once closed
+  typedef int32_t (*ReadFn)(void* io, uint8_t* buf, uint32_t len);
+  // Masking keys and the handshake nonce; must not be predictable
+  typedef uint32_t (*RandomFn)();
+
+  struct Handler {
+    // A piece of a text or binary message; end marks its last piece
+    void (*message)(void* ctx, bool binary, const uint8_t* data, size_t len, bool end);
+    // The connection is gone: the peer's close code, or one of ours
+    void (*closed)(void* ctx, uint16_t code);
+    void* ctx;
+  };
+
+  static const uint32_t RX_BUFFER_BYTES = 1024;  // Also bounds the request and the handshake response
+  static const uint16_t CLOSE_NORMAL = 1000;
+  static const uint16_t CLOSE_PROTOCOL_ERROR = 1002;
+  static const uint16_t CLOSE_NO_STATUS = 1005;
+  static const uint16_t CLOSE_ABNORMAL = 1006;  // Not sent: the transport dropped
+  static const uint16_t CLOSE_HANDSHAKE_FAILED = 4000;  // Not sent (private range): no 101 with the right accept key
+
+  enum State : uint8_t { STATE_IDLE, STATE_CONNECTING, STATE_OPEN, STATE_CLOSING, STATE_CLOSED };
+
+  // rxBuffer holds RX_BUFFER_BYTES and must outlive the client
+  WsClient(uint8_t* rxBuffer, ReadFn read, WriteFn write, RandomFn random, void* io)
+    : rx_(rxBuffer), read_(read), write_(write), random_(random), io_(io) {}
+
+  void setHandler(const Handler& handler) { handler_ = handler; }
+
+  // Sends the upgrade request. extraHeaders are complete lines, each ending
+  // in \r\n. The connection is open once state() is STATE_OPEN.
+  bool start(const char* host, const char* path, const char* extraHeaders = "") {
+    uint8_t nonce[16];
+    for (int i = 0; i < 16; i += 4) {
+      uint32_t r = random_();
+      memcpy(nonce + i, &r, 4);
+    }
+    char key[25];
+    base64(nonce, 16, key);
+    acceptKey(key, expectedAccept_);
+
+    char* req = (char*)rx_;
+    size_t n = 0;
+    const char* parts[] = {
+      "GET ", path, " HTTP/1.1\r\nHost: ", host,
+      "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\nSec-WebSocket-Key: ", key,
+      "\r\n", extraHeaders, "\r\n",
+    };
+    for (const char* part : parts) {
+      size_t len = strlen(part);
+      if (n + len > RX_BUFFER_BYTES) return false;
+      memcpy(req + n, part, len);
+      n += len;
+    }
+    if (write_(io_, rx_, n) < 0) return false;
+    rxLen_ = 0;
+    state_ = STATE_CONNECTING;
+    return true;
+  }
+
+  // Reads and handles whatever has arrived. False once the connection is
+  // closed; handler.closed has been called by then.
+  bool poll() {
+    while (state_ == STATE_CONNECTING || state_ == STATE_OPEN || state_ == STATE_CLOSING) {
+      if (state_ == STATE_CONNECTING) {
+        int32_t n = read_(io_, rx_ + rxLen_, RX_BUFFER_BYTES - rxLen_);
+        if (n < 0) return drop(CLOSE_ABNORMAL);
+        if (n == 0) return true;
+        bytesReceived_ += n;
+        rxLen_ += n;
+        if (!handshakeResponse()) return drop(CLOSE_HANDSHAKE_FAILED);
+        continue;
+      }
+      int32_t n = read_(io_, rx_, RX_BUFFER_BYTES);
+      if (n < 0) return drop(CLOSE_ABNORMAL);
+      if (n == 0) return true;
+      bytesReceived_ += n;
+      consume(rx_, n);
+    }
+    return false;
+  }
+
+  // A whole message in one frame
+  bool send(bool binary, const uint8_t* data, size_t len) {
+    return beginMessage(binary, len) && write(data, len);
+  }
+
+  // Starts a message of exactly len bytes, to be passed to write() in
+  // pieces; nothing else is sent until the last of them
+  bool beginMessage(bool binary, uint64_t len) {
+    if (state_ != STATE_OPEN || txRemaining_ > 0) return false;
+    if (!writeHeader(binary ? OP_BINARY : OP_TEXT, len)) return false;
+    txRemaining_ = len;
+    return true;
+  }
+
+  bool write(const uint8_t* data, size_t len) {
+    if (len > txRemaining_ || !writeMasked(data, len)) return false;
+    txRemaining_ -= len;
+    if (txRemaining_ == 0) messagesSent_++;
+    if (txRemaining_ == 0 && pongPending_) {
+      pongPending_ = false;
+      return sendControl(OP_PONG, pong_, pongLen_);
+    }
+    return true;
+  }
+
+  // Starts the close handshake; poll() until the peer answers
+  bool close(uint16_t code = CLOSE_NORMAL) {
+    if (state_ != STATE_OPEN || txRemaining_ > 0) return drop(code);
+    uint8_t payload[2] = { (uint8_t)(code >> 8), (uint8_t)code };
+    state_ = STATE_CLOSING;
+    return sendControl(OP_CLOSE, payload, 2);
+  }
+
+  State state() const { return state_; }
+  uint16_t closeCode() const { return closeCode_; }
+  uint32_t bytesSent() const { return bytesSent_; }
+  uint32_t bytesReceived() const { return bytesReceived_; }
+  uint32_t messagesSent() const { return messagesSent_; }
+  uint32_t messagesReceived() const { return messagesReceived_; }
+
+ private:
+  enum Opcode : uint8_t {
+    OP_CONTINUATION = 0x0,
+    OP_TEXT = 0x1,
+    OP_BINARY = 0x2,
+    OP_CLOSE = 0x8,
+    OP_PING = 0x9,
+    OP_PONG = 0xa,
+  };
+
+  uint8_t* rx_;
+  ReadFn read_;
+  WriteFn write_;
+  RandomFn random_;
+  void* io_;
+  Handler handler_ = {};
+  State state_ = STATE_IDLE;
+  uint16_t closeCode_ = 0;
+  uint32_t rxLen_ = 0;  // Handshake response bytes so far
+  char expectedAccept_[29];
+
+  // Incoming frame
+  uint8_t header_[10];
+  uint8_t headerLen_ = 0;
+  uint8_t headerNeed_ = 2;
+  uint8_t opcode_ = 0;
+  bool fin_ = false;
+  uint64_t remaining_ = 0;
+  bool inMessage_ = false;  // Between a data frame without FIN and its last continuation
+  bool binary_ = false;
+  uint8_t control_[125];
+  uint8_t controlLen_ = 0;
+
+  // Outgoing
+  uint64_t txRemaining_ = 0;
+  uint8_t mask_[4];
+  uint8_t maskPos_ = 0;
+  bool pongPending_ = false;  // A ping came in while a message was being written
+  uint8_t pong_[125];
+  uint8_t pongLen_ = 0;
+
+  uint32_t bytesSent_ = 0;
+  uint32_t bytesReceived_ = 0;
+  uint32_t messagesSent_ = 0;
+  uint32_t messagesReceived_ = 0;
+
+  bool drop(uint16_t code) {
+    bool wasOpen = state_ != STATE_CLOSED && state_ != STATE_IDLE;
+    state_ = STATE_CLOSED;
+    closeCode_ = code;
+    if (wasOpen && handler_.closed) handler_.closed(handler_.ctx, code);
+    return false;
+  }
+
+  bool fail(uint16_t code) {
+    if (state_ == STATE_OPEN && txRemaining_ == 0) {
+      uint8_t payload[2] = { (uint8_t)(code >> 8), (uint8_t)code };
+      sendControl(OP_CLOSE, payload, 2);
+    }
+    return drop(code);
+  }
+
+  // Checks the 101 response once all of it is in, and hands any frame
+  // bytes that came with it to the frame parser
+  bool handshakeResponse() {
+    char* text = (char*)rx_;
+    uint32_t end = 0;
+    for (uint32_t i = 3; i < rxLen_; i++) {
+      if (memcmp(text + i - 3, "\r\n\r\n", 4) == 0) {
+        end = i + 1;
+        break;
+      }
+    }
+    if (!end) return rxLen_ < RX_BUFFER_BYTES;
+    if (rxLen_ < 12 || memcmp(text, "HTTP/1.1 101", 12) != 0) return false;
+
+    bool accepted = false;
+    for (uint32_t line = 0; line < end;) {
+      uint32_t eol = line;
+      while (eol + 1 < end && !(text[eol] == '\r' && text[eol + 1] == '\n')) eol++;
+      static const char name[] = "sec-websocket-accept:";
+      const size_t nameLen = sizeof(name) - 1;
+      if (eol - line > nameLen && equalsIgnoreCase(text + line, name, nameLen)) {
+        uint32_t v = line + nameLen;
+        while (v < eol && text[v] == ' ') v++;
+        uint32_t vEnd = eol;
+        while (vEnd > v && text[vEnd - 1] == ' ') vEnd--;
+        accepted = vEnd - v == 28 && memcmp(text + v, expectedAccept_, 28) == 0;
+      }
+      line = eol + 2;
+    }
+    if (!accepted) return false;
+
+    state_ = STATE_OPEN;
+    uint32_t extra = rxLen_ - end;
+    rxLen_ = 0;
+    if (extra) {
+      memmove(rx_, rx_ + end, extra);
+      consume(rx_, extra);
+    }
+    return true;
+  }
+
+  static bool equalsIgnoreCase(const char* s, const char* lower, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      char c = s[i] >= 'A' && s[i] <= 'Z' ? s[i] + 32 : s[i];
+      if (c != lower[i]) return false;
+    }
+    return true;
+  }
+
+  // Frame parser: any split of the byte stream gives the same events
+  void consume(const uint8_t* p, size_t n) {
+    size_t i = 0;
+    while (i < n && (state_ == STATE_OPEN || state_ == STATE_CLOSING)) {
+      if (headerLen_ < headerNeed_) {
+        header_[headerLen_++] = p[i++];
+        if (headerLen_ == 2) {
+          uint8_t len7 = header_[1] & 0x7f;
+          headerNeed_ = 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0);
+          if (header_[1] & 0x80) {
+            fail(CLOSE_PROTOCOL_ERROR);  // Servers must not mask
+            return;
+          }
+        }
+        if (headerLen_ == headerNeed_ && !startFrame()) return;
+        continue;
+      }
+      size_t k = n - i < remaining_ ? n - i : (size_t)remaining_;
+      payload(p + i, k);
+      i += k;
+      remaining_ -= k;
+      if (remaining_ == 0) endFrame();
+    }
+  }
+
+  bool startFrame() {
+    fin_ = header_[0] & 0x80;
+    opcode_ = header_[0] & 0x0f;
+    uint8_t len7 = header_[1] & 0x7f;
+    remaining_ = len7;
+    if (len7 >= 126) {
+      remaining_ = 0;
+      for (uint8_t i = 2; i < headerNeed_; i++) remaining_ = remaining_ << 8 | header_[i];
+    }
+    bool control = opcode_ & 0x8;
+    bool ok = !(header_[0] & 0x70);  // No extensions were negotiated
+    if (control) {
+      ok = ok && fin_ && remaining_ <= sizeof(control_) && opcode_ <= OP_PONG;
+    } else if (opcode_ == OP_CONTINUATION) {
+      ok = ok && inMessage_;
+    } else {
+      ok = ok && !inMessage_ && (opcode_ == OP_TEXT || opcode_ == OP_BINARY);
+      binary_ = opcode_ == OP_BINARY;
+    }
+    if (!ok) {
+      fail(CLOSE_PROTOCOL_ERROR);
+      return false;
+    }
+    if (!control) inMessage_ = !fin_;
+    controlLen_ = 0;
+    if (remaining_ == 0) endFrame();
+    return true;
+  }
+
+  void payload(const uint8_t* data, size_t len) {
+    if (opcode_ & 0x8) {
+      memcpy(control_ + controlLen_, data, len);
+      controlLen_ += len;
+    } else if (handler_.message && len > 0) {
+      handler_.message(handler_.ctx, binary_, data, len, fin_ && remaining_ == len);
+    }
+  }
+
+  void endFrame() {
+    headerLen_ = 0;
+    headerNeed_ = 2;
+    switch (opcode_) {
+      case OP_PING:
+        if (txRemaining_ > 0) {
+          memcpy(pong_, control_, controlLen_);
+          pongLen_ = controlLen_;
+          pongPending_ = true;
+        } else {
+          sendControl(OP_PONG, control_, controlLen_);
+        }
+        return;
+      case OP_PONG:
+        return;
+      case OP_CLOSE:
+        {
+          uint16_t code = controlLen_ >= 2 ? control_[0] << 8 | control_[1] : CLOSE_NO_STATUS;
+          if (state_ == STATE_OPEN && txRemaining_ == 0) sendControl(OP_CLOSE, control_, controlLen_ >= 2 ? 2 : 0);
+          drop(code);
+          return;
+        }
+      default:
+        if (!fin_) return;
+        messagesReceived_++;
+        // An empty last frame still ends the message for the handler
+        if (handler_.message && (header_[1] & 0x7f) == 0) handler_.message(handler_.ctx, binary_, nullptr, 0, true);
+        return;
+    }
+  }
+
+  bool writeHeader(uint8_t opcode, uint64_t len) {
+    uint8_t h[14];
+    size_t n = 0;
+    h[n++] = 0x80 | opcode;
+    if (len < 126) {
+      h[n++] = 0x80 | len;
+    } else if (len <= 0xffff) {
+      h[n++] = 0x80 | 126;
+      h[n++] = len >> 8;
+      h[n++] = len;
+    } else {
+      h[n++] = 0x80 | 127;
+      for (int shift = 56; shift >= 0; shift -= 8) h[n++] = len >> shift;
+    }
+    uint32_t key = random_();
+    memcpy(mask_, &key, 4);
+    memcpy(h + n, mask_, 4);
+    n += 4;
+    maskPos_ = 0;
+    return transmit(h, n);
+  }
+
+  bool writeMasked(const uint8_t* data, size_t len) {
+    uint8_t buf[128];
+    while (len > 0) {
+      size_t k = len < sizeof(buf) ? len : sizeof(buf);
+      for (size_t i = 0; i < k; i++) buf[i] = data[i] ^ mask_[maskPos_++ & 3];
+      if (!transmit(buf, k)) return false;
+      data += k;
+      len -= k;
+    }
+    return true;
+  }
+
+  bool sendControl(uint8_t opcode, const uint8_t* data, size_t len) {
+    return writeHeader(opcode, len) && writeMasked(data, len);
+  }
+
+  bool transmit(const uint8_t* data, size_t len) {
+    if (write_(io_, data, len) < 0) return drop(CLOSE_ABNORMAL);
+    bytesSent_ += len;
+    return true;
+  }
+
+  //----------------------------------------
+  // Handshake key: base64(SHA-1(key + GUID))
+  //----------------------------------------
+
+  static void base64(const uint8_t* in, size_t len, char* out) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += 3) {
+      uint32_t v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0) | (i + 2 < len ? in[i + 2] : 0);
+      out[n++] = alphabet[v >> 18 & 63];
+      out[n++] = alphabet[v >> 12 & 63];
+      out[n++] = i + 1 < len ? alphabet[v >> 6 & 63] : '=';
+      out[n++] = i + 2 < len ? alphabet[v & 63] : '=';
+    }
+    out[n] = '\0';
+  }
+
+  static void acceptKey(const char* key, char* out) {
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t message[60];
+    memcpy(message, key, 24);
+    memcpy(message + 24, guid, 36);
+    uint8_t digest[20];
+    sha1Block(message, 60, digest);
+    base64(digest, 20, out);
+  }
+
+  static uint32_t rol(uint32_t x, int n) { return x << n | x >> (32 - n); }
+
+  // SHA-1 of a message of up to 119 bytes (two blocks); the handshake needs 60
+  static void sha1Block(const uint8_t* block, size_t len, uint8_t* digest) {
+    uint8_t padded[128] = {};
+    memcpy(padded, block, len);
+    padded[len] = 0x80;
+    size_t blocks = len < 56 ? 1 : 2;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) padded[blocks * 64 - 1 - i] = bits >> (8 * i);
+
+    uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    for (size_t b = 0; b < blocks; b++) {
+      uint32_t w[80];
+      for (int i = 0; i < 16; i++) {
+        const uint8_t* q = padded + b * 64 + i * 4;
+        w[i] = (uint32_t)q[0] << 24 | (uint32_t)q[1] << 16 | q[2] << 8 | q[3];
+      }
+      for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+      uint32_t a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4];
+      for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+          f = (bb & c) | (~bb & d);
+          k = 0x5a827999;
+        } else if (i < 40) {
+          f = bb ^ c ^ d;
+          k = 0x6ed9eba1;
+        } else if (i < 60) {
+          f = (bb & c) | (bb & d) | (c & d);
+          k = 0x8f1bbcdc;
+        } else {
+          f = bb ^ c ^ d;
+          k = 0xca62c1d6;
+        }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(bb, 30);
+        bb = a;
+        a = t;
+      }
+      h[0] += a;
+      h[1] += bb;
+      h[2] += c;
+      h[3] += d;
+      h[4] += e;
+    }
+    for (int i = 0; i < 20; i++) digest[i] = h[i / 4] >> (24 - 8 * (i % 4));
+  }
+};